@@ -0,0 +1,1093 @@
+#include "assembler.h"
+#include "opcodes.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+namespace {
+
+struct Instruction {
+    char name[5];
+    uint8_t opcode;  // With its register, pair or RST fields zero
+    OperandForm form;
+};
+
+constexpr int compareNames(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return static_cast<unsigned char>(*a) - static_cast<unsigned char>(*b);
+}
+
+// A mnemonic's base opcode is the lowest one with that mnemonic
+constexpr bool isBaseOpcode(int opcode) {
+    if (!kOpcodes[opcode].documented) return false;
+    for (int lower = 0; lower < opcode; lower++) {
+        if (kOpcodes[lower].documented && compareNames(kOpcodes[lower].mnemonic, kOpcodes[opcode].mnemonic) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+constexpr size_t countMnemonics() {
+    size_t count = 0;
+    for (int opcode = 0; opcode < 256; opcode++) count += isBaseOpcode(opcode);
+    return count;
+}
+
+constexpr size_t kInstructionCount = countMnemonics();
+
+// Every mnemonic in kOpcodes, sorted by name for the binary search
+struct InstructionTable {
+    Instruction entries[kInstructionCount];
+
+    constexpr const Instruction* begin() const { return entries; }
+    constexpr const Instruction* end() const { return entries + kInstructionCount; }
+};
+
+constexpr InstructionTable makeInstructionTable() {
+    InstructionTable t{};
+    size_t count = 0;
+    for (int opcode = 0; opcode < 256; opcode++) {
+        if (!isBaseOpcode(opcode)) continue;
+        Instruction in{};
+        for (size_t i = 0; kOpcodes[opcode].mnemonic[i]; i++) in.name[i] = kOpcodes[opcode].mnemonic[i];
+        in.opcode = static_cast<uint8_t>(opcode);
+        in.form = kOpcodes[opcode].form;
+        size_t at = count++;
+        for (; at > 0 && compareNames(t.entries[at - 1].name, in.name) > 0; at--) t.entries[at] = t.entries[at - 1];
+        t.entries[at] = in;
+    }
+    return t;
+}
+
+constexpr InstructionTable kInstructions = makeInstructionTable();
+static_assert(kInstructionCount == 80, "the 8085 has 80 mnemonics");
+
+enum class Directive : uint8_t { None, Org, Db, Dw, Ds, Equ, Set, End, Macro, Endm };
+
+bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+bool isNameStart(char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_' || c == '.' || c == '?' || c == '@';
+}
+
+bool isNameChar(char c) {
+    return isNameStart(c) || isDigit(c);
+}
+
+char upper(char c) {
+    return c >= 'a' && c <= 'z' ? static_cast<char>(c - 'a' + 'A') : c;
+}
+
+// Case-insensitive comparison with an upper-case keyword
+bool is(std::string_view word, const char* keyword) {
+    size_t i = 0;
+    for (; i < word.size(); i++) {
+        if (!keyword[i] || upper(word[i]) != keyword[i]) return false;
+    }
+    return keyword[i] == '\0';
+}
+
+const Instruction* findInstruction(std::string_view word) {
+    char name[5];
+    if (word.empty() || word.size() > 4) return nullptr;
+    for (size_t i = 0; i < word.size(); i++) name[i] = upper(word[i]);
+    name[word.size()] = '\0';
+    const Instruction* end = kInstructions.end();
+    const Instruction* found = std::lower_bound(kInstructions.begin(), end, name, [](const Instruction& in, const char* key) {
+        return compareNames(in.name, key) < 0;
+    });
+    return found != end && compareNames(found->name, name) == 0 ? found : nullptr;
+}
+
+// Directives may be written with a leading dot: .ORG, .DB
+Directive findDirective(std::string_view word) {
+    if (!word.empty() && word[0] == '.') word.remove_prefix(1);
+    static const std::pair<const char*, Directive> directives[] = {
+        {"ORG", Directive::Org}, {"DB", Directive::Db},   {"DW", Directive::Dw},
+        {"DS", Directive::Ds},   {"EQU", Directive::Equ}, {"SET", Directive::Set},
+        {"END", Directive::End}, {"MACRO", Directive::Macro}, {"ENDM", Directive::Endm}};
+    for (const auto& directive : directives) {
+        if (is(word, directive.first)) return directive.second;
+    }
+    return Directive::None;
+}
+
+// B C D E H L M A, as encoded in opcodes; -1 for anything else
+int registerCode(std::string_view word) {
+    if (word.size() != 1) return -1;
+    const char* found = std::strchr("BCDEHLMA", upper(word[0]));
+    return found && *found ? static_cast<int>(found - "BCDEHLMA") : -1;
+}
+
+// B D H and SP (or PSW), also as BC DE HL
+int pairCode(std::string_view word, bool psw) {
+    if (is(word, "B") || is(word, "BC")) return 0;
+    if (is(word, "D") || is(word, "DE")) return 1;
+    if (is(word, "H") || is(word, "HL")) return 2;
+    return is(word, psw ? "PSW" : "SP") ? 3 : -1;
+}
+
+// End of the statement on a line: the first ';' outside quotes
+const char* codeEnd(const char* p, const char* end) {
+    char quote = 0;
+    for (; p < end; p++) {
+        if (quote) {
+            if (*p == quote) quote = 0;
+        } else if (*p == '\'' || *p == '"') {
+            quote = *p;
+        } else if (*p == ';') {
+            break;
+        }
+    }
+    return p;
+}
+
+// Wraps like the 32-bit arithmetic the syntax promises, without overflow
+int32_t wrap(int64_t value) {
+    return static_cast<int32_t>(static_cast<uint32_t>(value));
+}
+
+bool hasHexExtension(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) return false;
+    std::string_view ext(path.c_str() + dot + 1);
+    return is(ext, "HEX") || is(ext, "IHX") || is(ext, "IHEX");
+}
+
+} // namespace
+
+struct Assembler::Cursor {
+    const char* p;
+    const char* end;
+
+    void skipSpace() {
+        while (p < end && isBlank(*p)) p++;
+    }
+    bool atEnd() {
+        skipSpace();
+        return p >= end;
+    }
+    bool accept(char c) {
+        skipSpace();
+        if (p >= end || *p != c) return false;
+        p++;
+        return true;
+    }
+    bool accept(char first, char second) {
+        skipSpace();
+        if (end - p < 2 || p[0] != first || p[1] != second) return false;
+        p += 2;
+        return true;
+    }
+    // The name at p, or an empty one
+    std::string_view word() {
+        skipSpace();
+        const char* start = p;
+        if (p < end && isNameStart(*p)) {
+            while (p < end && isNameChar(*p)) p++;
+        }
+        return std::string_view(start, static_cast<size_t>(p - start));
+    }
+    std::string_view peekWord() const {
+        Cursor copy = *this;
+        return copy.word();
+    }
+    std::string rest() {
+        skipSpace();
+        const char* last = end;
+        while (last > p && isBlank(last[-1])) last--;
+        return std::string(p, last);
+    }
+};
+
+size_t Assembler::NameHash::operator()(std::string_view name) const {
+    uint64_t hash = 14695981039346656037ULL;  // FNV-1a
+    for (char c : name) {
+        hash ^= static_cast<unsigned char>(upper(c));
+        hash *= 1099511628211ULL;
+    }
+    return static_cast<size_t>(hash);
+}
+
+bool Assembler::NameEqual::operator()(std::string_view a, std::string_view b) const {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (upper(a[i]) != upper(b[i])) return false;
+    }
+    return true;
+}
+
+bool Assembler::assemble(const char* source, size_t length, AssembledProgram& result) {
+    result.bytes.clear();
+    result.segments.clear();
+    result.errors.clear();
+    result.hasStart = false;
+    result.start = 0;
+    result.lines = 0;
+    symbols.clear();
+    macros.clear();
+    fixups.clear();
+    expansions.clear();
+    listed.clear();
+    listingBuffer.clear();
+    out = &result;
+    pc = origin;
+    statementPc = origin;
+    line = 0;
+    macroDepth = 0;
+    expressionDepth = 0;
+    expansionCount = 0;
+    ended = false;
+    resolving = false;
+    defining = nullptr;
+    expanding = std::string_view();
+
+    assembleText(source, source + length, false);
+    if (defining) {
+        line = definingLine;
+        lineFailed = false;
+        error("MACRO without ENDM");
+        defining = nullptr;
+    }
+    finish();
+    std::stable_sort(result.errors.begin(), result.errors.end(),
+                     [](const AssemblyError& a, const AssemblyError& b) { return a.line < b.line; });
+    if (listing) writeListing();
+    out = nullptr;
+    return result.ok();
+}
+
+bool Assembler::assembleFile(const std::string& path, AssembledProgram& result) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        assemble("", 0, result);
+        result.errors.push_back({0, "cannot open " + path});
+        return false;
+    }
+    fileBuffer.clear();
+    char chunk[16384];
+    size_t count;
+    while ((count = std::fread(chunk, 1, sizeof(chunk), file)) > 0) fileBuffer.append(chunk, count);
+    bool readError = std::ferror(file) != 0;
+    std::fclose(file);
+    if (readError) {
+        assemble("", 0, result);
+        result.errors.push_back({0, "cannot read " + path});
+        return false;
+    }
+    return assemble(fileBuffer.data(), fileBuffer.size(), result);
+}
+
+void Assembler::assembleText(const char* begin, const char* end, bool expansion) {
+    for (const char* p = begin; p < end && !ended;) {
+        const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+        if (!lineEnd) lineEnd = end;
+        if (!expansion) {
+            line++;
+            out->lines++;
+        }
+        lineFailed = false;
+        statementPc = static_cast<uint16_t>(pc);
+        const char* textEnd = lineEnd;
+        while (textEnd > p && textEnd[-1] == '\r') textEnd--;
+        std::string_view text(p, static_cast<size_t>(textEnd - p));
+        Cursor c = {p, codeEnd(p, textEnd)};
+        if (defining) {
+            collectMacroLine(c, text, p);
+        } else {
+            statement(c, text, expansion);
+        }
+        p = lineEnd < end ? lineEnd + 1 : end;
+    }
+}
+
+void Assembler::collectMacroLine(Cursor& c, std::string_view text, const char* lineStart) {
+    if (!defining->body) defining->body = lineStart;
+    std::string_view word = c.word();
+    if (c.accept(':')) word = c.word();
+    if (findDirective(word) == Directive::Endm) {
+        defining->bodyEnd = lineStart;
+        defining = nullptr;
+    }
+    if (listing) listed.push_back({line, statementPc, static_cast<uint32_t>(out->bytes.size()), 0, text, false, false});
+}
+
+void Assembler::statement(Cursor& c, std::string_view text, bool expansion) {
+    size_t entry = listed.size();
+    uint32_t firstByte = static_cast<uint32_t>(out->bytes.size());
+    if (listing) listed.push_back({line, statementPc, firstByte, 0, text, expansion, false});
+    bool invoked = false;
+
+    // A label ends in ':', starts the line, or names an EQU, SET or MACRO
+    const char* lineStart = c.p;
+    std::string_view label, operation;
+    std::string_view first = c.word();
+    if (first.empty()) {
+        if (!c.atEnd()) error("unexpected '" + c.rest() + "'");
+    } else {
+        if (c.accept(':')) {
+            label = first;
+            operation = c.word();
+        } else {
+            Directive next = findDirective(c.peekWord());
+            bool column0 = first.data() == lineStart;
+            bool keyword = findInstruction(first) || findDirective(first) != Directive::None || macros.count(first);
+            if (next == Directive::Equ || next == Directive::Set || next == Directive::Macro || (column0 && !keyword)) {
+                label = first;
+                operation = c.word();
+            } else {
+                operation = first;
+            }
+        }
+
+        if (operation.empty()) {
+            if (!label.empty()) defineSymbol(label, statementPc, false);
+        } else if (!directive(c, operation, label)) {
+            if (!label.empty()) defineSymbol(label, statementPc, false);
+            if (!instruction(c, operation)) {
+                auto macro = macros.find(operation);
+                if (macro != macros.end() && macro->second.bodyEnd) {
+                    expandMacro(c, macro->first, macro->second);
+                    invoked = true;
+                } else {
+                    error("unknown instruction '" + std::string(operation) + "'");
+                }
+            }
+        }
+        if (!lineFailed && !c.atEnd()) error("unexpected '" + c.rest() + "'");
+    }
+
+    // An invocation's bytes are listed under its expansion's lines
+    if (listing && !invoked) listed[entry].length = static_cast<uint32_t>(out->bytes.size()) - firstByte;
+}
+
+bool Assembler::instruction(Cursor& c, std::string_view mnemonic) {
+    const Instruction* in = findInstruction(mnemonic);
+    if (!in) return false;
+    auto reg = [&](int& code) {
+        code = registerCode(c.word());
+        return code >= 0 || error("expected a register: B, C, D, E, H, L, M or A");
+    };
+    auto pair = [&](int& code, bool psw) {
+        code = pairCode(c.word(), psw);
+        return code >= 0 || error(psw ? "expected B, D, H or PSW" : "expected B, D, H or SP");
+    };
+    auto comma = [&]() { return c.accept(',') || error("expected ','"); };
+    int r = 0, s = 0;
+    switch (in->form) {
+        case OperandForm::None:
+            emitByte(in->opcode);
+            break;
+        case OperandForm::Reg:
+            if (reg(r)) emitByte(static_cast<uint8_t>(in->opcode | r));
+            break;
+        case OperandForm::RegHigh:
+            if (reg(r)) emitByte(static_cast<uint8_t>(in->opcode | r << 3));
+            break;
+        case OperandForm::RegReg:
+            if (!reg(r) || !comma() || !reg(s)) break;
+            if (r == 6 && s == 6) {
+                error("MOV M,M is not an instruction (its opcode is HLT)");
+                break;
+            }
+            emitByte(static_cast<uint8_t>(in->opcode | r << 3 | s));
+            break;
+        case OperandForm::RegImm8:
+            if (!reg(r) || !comma()) break;
+            emitByte(static_cast<uint8_t>(in->opcode | r << 3));
+            emitValue(c, Width::Byte);
+            break;
+        case OperandForm::Imm8:
+            emitByte(in->opcode);
+            emitValue(c, Width::Byte);
+            break;
+        case OperandForm::Imm16:
+            emitByte(in->opcode);
+            emitValue(c, Width::Word);
+            break;
+        case OperandForm::Pair:
+            if (pair(r, false)) emitByte(static_cast<uint8_t>(in->opcode | r << 4));
+            break;
+        case OperandForm::PairImm16:
+            if (!pair(r, false) || !comma()) break;
+            emitByte(static_cast<uint8_t>(in->opcode | r << 4));
+            emitValue(c, Width::Word);
+            break;
+        case OperandForm::PairPsw:
+            if (pair(r, true)) emitByte(static_cast<uint8_t>(in->opcode | r << 4));
+            break;
+        case OperandForm::PairBD:
+            r = pairCode(c.word(), false);
+            if (r == 0 || r == 1) {
+                emitByte(static_cast<uint8_t>(in->opcode | r << 4));
+            } else {
+                error("expected B or D");
+            }
+            break;
+        case OperandForm::Rst: {
+            Value v = expression(c);
+            if (lineFailed) break;
+            if (!v.known) {
+                error("RST needs a number defined above it");
+            } else if (v.value < 0 || v.value > 7) {
+                error("RST number must be 0 to 7");
+            } else {
+                emitByte(static_cast<uint8_t>(in->opcode | v.value << 3));
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+bool Assembler::directive(Cursor& c, std::string_view word, std::string_view label) {
+    Directive d = findDirective(word);
+    if (d == Directive::None) return false;
+    std::string name(word);
+    // ORG's label is the new address; EQU, SET and MACRO define the label
+    if (!label.empty() && d != Directive::Org && d != Directive::Equ && d != Directive::Set &&
+        d != Directive::Macro) {
+        defineSymbol(label, statementPc, false);
+    }
+    // Operands these directives must know now
+    auto known = [&](Value v) { return lineFailed ? false : v.known || error(name + " needs values defined above it"); };
+
+    switch (d) {
+        case Directive::None:
+            break;
+        case Directive::Org: {
+            Value v = expression(c);
+            if (!known(v)) break;
+            if (v.value < 0 || v.value > 0xFFFF) {
+                error("ORG address must be 0 to FFFFh");
+                break;
+            }
+            pc = static_cast<uint32_t>(v.value);
+            statementPc = static_cast<uint16_t>(pc);
+            if (listing) listed.back().address = statementPc;
+            if (!label.empty()) defineSymbol(label, v.value, false);
+            break;
+        }
+        case Directive::Db:
+            do {
+                c.skipSpace();
+                if (c.p < c.end && (*c.p == '\'' || *c.p == '"')) {
+                    // A string, unless it is a character in an expression
+                    const char* close = static_cast<const char*>(
+                        std::memchr(c.p + 1, *c.p, static_cast<size_t>(c.end - c.p - 1)));
+                    if (!close) {
+                        error("unterminated string");
+                        break;
+                    }
+                    Cursor after = {close + 1, c.end};
+                    if (after.atEnd() || *after.p == ',') {
+                        for (const char* p = c.p + 1; p < close; p++) emitByte(static_cast<uint8_t>(*p));
+                        c.p = close + 1;
+                        continue;
+                    }
+                }
+                emitValue(c, Width::Byte);
+            } while (!lineFailed && c.accept(','));
+            break;
+        case Directive::Dw:
+            do {
+                emitValue(c, Width::Word);
+            } while (!lineFailed && c.accept(','));
+            break;
+        case Directive::Ds: {
+            Value v = expression(c);
+            if (!known(v)) break;
+            if (v.value < 0 || pc + static_cast<uint32_t>(v.value) > 0x10000) {
+                error("DS runs past FFFFh");
+                break;
+            }
+            pc += static_cast<uint32_t>(v.value);
+            break;
+        }
+        case Directive::Equ:
+        case Directive::Set: {
+            if (label.empty()) {
+                error(name + " needs a name");
+                break;
+            }
+            Value v = expression(c);
+            if (!known(v)) break;
+            defineSymbol(label, v.value, d == Directive::Set);
+            if (listing) {
+                listed.back().address = static_cast<uint16_t>(v.value);
+                listed.back().equate = true;
+            }
+            break;
+        }
+        case Directive::End:
+            ended = true;
+            if (!c.atEnd()) emitValue(c, Width::Start);
+            break;
+        case Directive::Macro: {
+            if (label.empty()) {
+                error("MACRO needs a name");
+                break;
+            }
+            if (macroDepth > 0) {
+                error("macros cannot be defined inside macros");
+                break;
+            }
+            if (findInstruction(label) || findDirective(label) != Directive::None) {
+                error("'" + std::string(label) + "' is reserved and cannot name a macro");
+                break;
+            }
+            Macro macro = {{}, nullptr, nullptr};
+            while (!c.atEnd()) {
+                std::string_view parameter = c.word();
+                if (parameter.empty()) {
+                    error("expected a parameter name");
+                    break;
+                }
+                macro.parameters.push_back(parameter);
+                if (!c.accept(',')) break;
+            }
+            auto inserted = macros.emplace(label, macro);
+            if (!inserted.second) {
+                error("macro '" + std::string(label) + "' is already defined");
+                inserted.first->second = macro;  // Still collect the body
+            }
+            defining = &inserted.first->second;
+            definingLine = line;
+            break;
+        }
+        case Directive::Endm:
+            error("ENDM without MACRO");
+            break;
+    }
+    return true;
+}
+
+void Assembler::expandMacro(Cursor& c, std::string_view name, const Macro& macro) {
+    if (macroDepth >= kMaxMacroDepth) {
+        error("macros nested too deeply");
+        return;
+    }
+    // Arguments split at commas outside quotes and parentheses
+    std::vector<std::string_view> arguments;
+    while (!c.atEnd()) {
+        const char* start = c.p;
+        char quote = 0;
+        int depth = 0;
+        for (; c.p < c.end; c.p++) {
+            char ch = *c.p;
+            if (quote) {
+                if (ch == quote) quote = 0;
+            } else if (ch == '\'' || ch == '"') {
+                quote = ch;
+            } else if (ch == '(') {
+                depth++;
+            } else if (ch == ')') {
+                depth--;
+            } else if (ch == ',' && depth <= 0) {
+                break;
+            }
+        }
+        const char* last = c.p;
+        while (last > start && isBlank(last[-1])) last--;
+        arguments.push_back(std::string_view(start, static_cast<size_t>(last - start)));
+        if (!c.accept(',')) break;
+    }
+    if (arguments.size() > macro.parameters.size()) {
+        error("macro '" + std::string(name) + "' takes " + std::to_string(macro.parameters.size()) + " arguments");
+        return;
+    }
+
+    // Substitutes parameters and \@ outside strings and comments
+    expansions.emplace_back();
+    std::string& text = expansions.back();
+    text.reserve(static_cast<size_t>(macro.bodyEnd - macro.body) + 16);
+    std::string unique = std::to_string(++expansionCount);
+    char quote = 0;
+    for (const char* p = macro.body; p < macro.bodyEnd;) {
+        char ch = *p;
+        if (quote || ch == '\'' || ch == '"') {
+            quote = quote == ch || ch == '\n' ? 0 : quote ? quote : ch;
+            text += *p++;
+        } else if (ch == ';') {
+            while (p < macro.bodyEnd && *p != '\n') text += *p++;
+        } else if (ch == '\\' && p + 1 < macro.bodyEnd && p[1] == '@') {
+            text += unique;
+            p += 2;
+        } else if (isNameChar(ch)) {
+            // Whole names and numbers, so 1BH never matches a parameter B
+            const char* start = p;
+            while (p < macro.bodyEnd && isNameChar(*p)) p++;
+            std::string_view word(start, static_cast<size_t>(p - start));
+            size_t i = 0;
+            while (i < macro.parameters.size() && !(isNameStart(ch) && NameEqual()(word, macro.parameters[i]))) i++;
+            if (i < macro.parameters.size()) {
+                if (i < arguments.size()) text.append(arguments[i].data(), arguments[i].size());
+            } else {
+                text.append(word.data(), word.size());
+            }
+        } else {
+            text += *p++;
+        }
+    }
+
+    std::string_view outer = expanding;
+    if (macroDepth == 0) expanding = name;
+    macroDepth++;
+    assembleText(text.data(), text.data() + text.size(), true);
+    macroDepth--;
+    expanding = outer;
+}
+
+void Assembler::defineSymbol(std::string_view name, int32_t value, bool redefinable) {
+    auto inserted = symbols.emplace(name, Symbol{value, redefinable});
+    if (inserted.second) return;
+    Symbol& symbol = inserted.first->second;
+    if (symbol.redefinable && redefinable) {
+        symbol.value = value;
+    } else {
+        error("'" + std::string(name) + "' is already defined");
+    }
+}
+
+void Assembler::finish() {
+    resolving = true;
+    for (const Fixup& fixup : fixups) {
+        line = fixup.line;
+        statementPc = fixup.pc;
+        lineFailed = false;
+        Cursor c = {fixup.begin, fixup.end};
+        Value v = expression(c);
+        if (!lineFailed) store(fixup.offset, v.value, fixup.width);
+    }
+    resolving = false;
+}
+
+void Assembler::emitByte(uint8_t byte) {
+    if (pc > 0xFFFF) {
+        error("code runs past FFFFh");
+        return;
+    }
+    std::vector<AssembledProgram::Segment>& segments = out->segments;
+    if (segments.empty() || segments.back().address + segments.back().length != pc) {
+        segments.push_back({static_cast<uint16_t>(pc), static_cast<uint32_t>(out->bytes.size()), 0});
+    }
+    segments.back().length++;
+    out->bytes.push_back(byte);
+    pc++;
+}
+
+void Assembler::emitValue(Cursor& c, Width width) {
+    c.skipSpace();
+    const char* begin = c.p;
+    uint32_t offset = static_cast<uint32_t>(out->bytes.size());
+    Value v = expression(c);
+    if (lineFailed) return;
+    if (width != Width::Start) {
+        emitByte(0);
+        if (width == Width::Word) emitByte(0);
+    }
+    if (v.known) {
+        store(offset, v.value, width);
+    } else {
+        fixups.push_back({begin, c.p, offset, statementPc, line, width});
+    }
+}
+
+void Assembler::store(uint32_t offset, int32_t value, Width width) {
+    bool fits = width == Width::Byte ? value >= -128 && value <= 0xFF : value >= -32768 && value <= 0xFFFF;
+    if (!fits) {
+        error("value " + std::to_string(value) + " does not fit in a " + (width == Width::Byte ? "byte" : "word"));
+        return;
+    }
+    if (width == Width::Start) {
+        out->hasStart = true;
+        out->start = static_cast<uint16_t>(value);
+        return;
+    }
+    size_t size = width == Width::Byte ? 1 : 2;
+    if (offset + size > out->bytes.size()) return;  // Past FFFFh, already reported
+    out->bytes[offset] = static_cast<uint8_t>(value);
+    if (size == 2) out->bytes[offset + 1] = static_cast<uint8_t>(value >> 8);
+}
+
+bool Assembler::error(const std::string& message) {
+    if (lineFailed) return false;
+    lineFailed = true;
+    if (out->errors.size() >= kMaxErrors) return false;
+    std::string text = message;
+    if (!expanding.empty() && !resolving) text += " (in macro " + std::string(expanding) + ")";
+    out->errors.push_back({line, text});
+    if (out->errors.size() == kMaxErrors) {
+        out->errors.push_back({line, "too many errors, giving up"});
+        ended = true;
+    }
+    return false;
+}
+
+// Recursive descent, one function per precedence level, lowest first. Unknown
+// values propagate through every operator.
+Assembler::Value Assembler::expression(Cursor& c) {
+    return bitOr(c);
+}
+
+Assembler::Value Assembler::bitOr(Cursor& c) {
+    Value a = bitXor(c);
+    while (c.accept('|')) {
+        Value b = bitXor(c);
+        a = {a.value | b.value, a.known && b.known};
+    }
+    return a;
+}
+
+Assembler::Value Assembler::bitXor(Cursor& c) {
+    Value a = bitAnd(c);
+    while (c.accept('^')) {
+        Value b = bitAnd(c);
+        a = {a.value ^ b.value, a.known && b.known};
+    }
+    return a;
+}
+
+Assembler::Value Assembler::bitAnd(Cursor& c) {
+    Value a = shift(c);
+    while (c.accept('&')) {
+        Value b = shift(c);
+        a = {a.value & b.value, a.known && b.known};
+    }
+    return a;
+}
+
+Assembler::Value Assembler::shift(Cursor& c) {
+    Value a = sum(c);
+    for (;;) {
+        bool left = c.accept('<', '<');
+        if (!left && !c.accept('>', '>')) return a;
+        Value b = sum(c);
+        int32_t result = 0;
+        if (b.value >= 0 && b.value < 32) {
+            result = left ? wrap(static_cast<int64_t>(static_cast<uint32_t>(a.value) << b.value)) : a.value >> b.value;
+        } else if (!left) {
+            result = a.value < 0 ? -1 : 0;
+        }
+        a = {result, a.known && b.known};
+    }
+}
+
+Assembler::Value Assembler::sum(Cursor& c) {
+    Value a = product(c);
+    for (;;) {
+        bool add = c.accept('+');
+        if (!add && !c.accept('-')) return a;
+        Value b = product(c);
+        a = {wrap(add ? int64_t(a.value) + b.value : int64_t(a.value) - b.value), a.known && b.known};
+    }
+}
+
+Assembler::Value Assembler::product(Cursor& c) {
+    Value a = unary(c);
+    for (;;) {
+        c.skipSpace();
+        if (c.p >= c.end || (*c.p != '*' && *c.p != '/' && *c.p != '%')) return a;
+        char op = *c.p++;
+        Value b = unary(c);
+        bool known = a.known && b.known;
+        if (op == '*') {
+            a = {wrap(int64_t(a.value) * b.value), known};
+        } else if (known && b.value == 0) {
+            error("division by zero");
+            return {0, false};
+        } else if (!known || b.value == 0) {
+            a = {0, false};
+        } else {
+            int64_t x = a.value, y = b.value;
+            a = {wrap(op == '/' ? x / y : x % y), true};
+        }
+    }
+}
+
+Assembler::Value Assembler::unary(Cursor& c) {
+    if (c.accept('-')) {
+        Value v = nested(c, &Assembler::unary);
+        return {wrap(-int64_t(v.value)), v.known};
+    }
+    if (c.accept('+')) return nested(c, &Assembler::unary);
+    if (c.accept('~')) {
+        Value v = nested(c, &Assembler::unary);
+        return {~v.value, v.known};
+    }
+    std::string_view name = c.peekWord();
+    if (is(name, "HIGH") || is(name, "LOW")) {
+        c.word();
+        Value v = nested(c, &Assembler::unary);
+        return {is(name, "HIGH") ? (v.value >> 8) & 0xFF : v.value & 0xFF, v.known};
+    }
+    return primary(c);
+}
+
+// Parentheses and unary operators recurse, so a hostile line could
+// otherwise run the stack out
+Assembler::Value Assembler::nested(Cursor& c, Value (Assembler::*parse)(Cursor&)) {
+    if (expressionDepth >= kMaxExpressionDepth) {
+        error("expression too deep");
+        return {0, false};
+    }
+    expressionDepth++;
+    Value v = (this->*parse)(c);
+    expressionDepth--;
+    return v;
+}
+
+Assembler::Value Assembler::primary(Cursor& c) {
+    if (c.atEnd()) {
+        error("expected a value");
+        return {0, false};
+    }
+    char ch = *c.p;
+    if (c.accept('(')) {
+        Value v = nested(c, &Assembler::expression);
+        if (!c.accept(')')) error("expected ')'");
+        return v;
+    }
+    if (isDigit(ch)) return number(c);
+    if (ch == '\'' || ch == '"') {
+        if (c.end - c.p < 3 || c.p[2] != ch) {
+            error("expected a one-character constant");
+            return {0, false};
+        }
+        int32_t value = static_cast<unsigned char>(c.p[1]);
+        c.p += 3;
+        return {value, true};
+    }
+    if (ch == '$' && !(c.p + 1 < c.end && isNameChar(c.p[1]))) {
+        c.p++;
+        return {statementPc, true};
+    }
+    std::string_view name = c.word();
+    if (name.empty()) {
+        error("unexpected '" + c.rest() + "'");
+        return {0, false};
+    }
+    auto found = symbols.find(name);
+    if (found != symbols.end()) return {found->second.value, true};
+    if (resolving) error("undefined symbol '" + std::string(name) + "'");
+    return {0, false};
+}
+
+Assembler::Value Assembler::number(Cursor& c) {
+    const char* start = c.p;
+    while (c.p < c.end && isNameChar(*c.p)) c.p++;
+    const char* first = start;
+    const char* last = c.p;
+    int base = 10;
+    if (last - first > 2 && first[0] == '0' && (first[1] == 'x' || first[1] == 'X')) {
+        base = 16;
+        first += 2;
+    } else {
+        switch (upper(last[-1])) {
+            case 'H': base = 16; last--; break;
+            case 'B': base = 2; last--; break;
+            case 'O': case 'Q': base = 8; last--; break;
+            case 'D': base = 10; last--; break;
+        }
+    }
+    uint64_t value = 0;
+    for (const char* p = first; p < last; p++) {
+        char d = upper(*p);
+        int digit = isDigit(d) ? d - '0' : d >= 'A' && d <= 'F' ? d - 'A' + 10 : 99;
+        if (digit >= base) {
+            error("bad number '" + std::string(start, c.p) + "'");
+            return {0, false};
+        }
+        value = value * base + digit;
+        if (value > 0xFFFFFFFFULL) {
+            error("number '" + std::string(start, c.p) + "' is too large");
+            return {0, false};
+        }
+    }
+    if (first == last) {
+        error("bad number '" + std::string(start, c.p) + "'");
+        return {0, false};
+    }
+    return {static_cast<int32_t>(static_cast<uint32_t>(value)), true};
+}
+
+void Assembler::writeListing() {
+    static const char digits[] = "0123456789ABCDEF";
+    char row[48];
+    for (const ListedLine& entry : listed) {
+        // Four bytes to a row; longer DBs continue on rows of their own
+        uint32_t done = 0;
+        do {
+            char bytes[13] = "";
+            uint32_t count = std::min<uint32_t>(4, entry.length - done);
+            for (uint32_t i = 0; i < count; i++) {
+                uint8_t b = out->bytes[entry.offset + done + i];
+                bytes[i * 3] = digits[b >> 4];
+                bytes[i * 3 + 1] = digits[b & 0xF];
+                bytes[i * 3 + 2] = i + 1 < count ? ' ' : '\0';
+            }
+            if (done == 0) {
+                // EQU and SET show their value, marked with '=', where others show $
+                std::snprintf(row, sizeof(row), "%5u%c %04X %c%-12s  ", static_cast<unsigned>(entry.line),
+                              entry.expansion ? '+' : ' ', entry.address, entry.equate ? '=' : ' ', bytes);
+                listingBuffer += row;
+                listingBuffer.append(entry.text.data(), entry.text.size());
+            } else {
+                std::snprintf(row, sizeof(row), "       %04X  %s", (entry.address + done) & 0xFFFF, bytes);
+                listingBuffer += row;
+            }
+            listingBuffer += '\n';
+            done += count;
+        } while (done < entry.length);
+    }
+
+    std::vector<std::pair<std::string_view, int32_t>> sorted;
+    for (const auto& symbol : symbols) sorted.push_back({symbol.first, symbol.second.value});
+    std::sort(sorted.begin(), sorted.end());
+    listingBuffer += "\nSymbols:\n";
+    for (const auto& symbol : sorted) {
+        std::snprintf(row, sizeof(row), "  %04X  ", static_cast<unsigned>(symbol.second & 0xFFFF));
+        listingBuffer += row;
+        listingBuffer.append(symbol.first.data(), symbol.first.size());
+        listingBuffer += '\n';
+    }
+}
+
+uint16_t AssembledProgram::lowAddress() const {
+    uint16_t low = 0xFFFF;
+    bool any = false;
+    for (const Segment& segment : segments) {
+        if (!segment.length) continue;
+        low = std::min(low, segment.address);
+        any = true;
+    }
+    return any ? low : 0;
+}
+
+uint16_t AssembledProgram::highAddress() const {
+    uint32_t high = 0;
+    for (const Segment& segment : segments) {
+        if (segment.length) high = std::max(high, segment.address + segment.length - 1);
+    }
+    return static_cast<uint16_t>(high);
+}
+
+std::vector<uint8_t> AssembledProgram::flatImage() const {
+    if (bytes.empty()) return {};
+    uint16_t low = lowAddress();
+    std::vector<uint8_t> image(highAddress() - low + 1u, 0);
+    for (const Segment& segment : segments) {
+        std::copy_n(bytes.begin() + segment.offset, segment.length, image.begin() + (segment.address - low));
+    }
+    return image;
+}
+
+std::string AssembledProgram::errorText(const std::string& name) const {
+    std::string text;
+    for (const AssemblyError& e : errors) {
+        text += name;
+        if (e.line) text += ":" + std::to_string(e.line);
+        text += ": " + e.message + "\n";
+    }
+    return text;
+}
+
+void writeIntelHex(std::ostream& out, const AssembledProgram& program) {
+    static const char digits[] = "0123456789ABCDEF";
+    auto record = [&](uint16_t address, uint8_t type, const uint8_t* data, size_t count) {
+        char text[48];
+        char* p = text;
+        uint8_t sum = 0;
+        auto hex = [&](uint8_t b) {
+            *p++ = digits[b >> 4];
+            *p++ = digits[b & 0xF];
+            sum = static_cast<uint8_t>(sum + b);
+        };
+        *p++ = ':';
+        hex(static_cast<uint8_t>(count));
+        hex(static_cast<uint8_t>(address >> 8));
+        hex(static_cast<uint8_t>(address));
+        hex(type);
+        for (size_t i = 0; i < count; i++) hex(data[i]);
+        hex(static_cast<uint8_t>(-sum));
+        *p++ = '\n';
+        out.write(text, p - text);
+    };
+    for (const AssembledProgram::Segment& segment : program.segments) {
+        for (uint32_t i = 0; i < segment.length; i += 16) {
+            record(static_cast<uint16_t>(segment.address + i), 0x00, &program.bytes[segment.offset + i],
+                   std::min<uint32_t>(16, segment.length - i));
+        }
+    }
+    if (program.hasStart) {
+        // Start segment address, CS:IP = 0000:start
+        const uint8_t start[4] = {0, 0, static_cast<uint8_t>(program.start >> 8), static_cast<uint8_t>(program.start)};
+        record(0, 0x03, start, 4);
+    }
+    record(0, 0x01, nullptr, 0);
+}
+
+void writeBinary(std::ostream& out, const AssembledProgram& program) {
+    std::vector<uint8_t> image = program.flatImage();
+    out.write(reinterpret_cast<const char*>(image.data()), static_cast<std::streamsize>(image.size()));
+}
+
+bool writeProgramFile(const std::string& path, const AssembledProgram& program, std::string& error) {
+    bool hex = hasHexExtension(path);
+    std::ofstream out(path, hex ? std::ios::out : std::ios::out | std::ios::binary);
+    if (out) {
+        if (hex) {
+            writeIntelHex(out, program);
+        } else {
+            writeBinary(out, program);
+        }
+        out.flush();
+    }
+    if (!out) error = "cannot write " + path;
+    return static_cast<bool>(out);
+}
+
+std::vector<AssemblyJobResult> assembleFiles(const std::vector<AssemblyJob>& jobs, unsigned threads) {
+    std::vector<AssemblyJobResult> results(jobs.size());
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, jobs.size())));
+
+    // Sources are small and similar, so a shared counter spreads them well
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        Assembler assembler;
+        AssembledProgram program;
+        for (size_t i; (i = next.fetch_add(1)) < jobs.size();) {
+            const AssemblyJob& job = jobs[i];
+            AssemblyJobResult& result = results[i];
+            result.ok = assembler.assembleFile(job.source, program);
+            result.bytes = program.bytes.size();
+            result.lines = program.lines;
+            std::string error;
+            if (!result.ok) {
+                result.errors = program.errorText(job.source);
+            } else if (!job.output.empty() && !writeProgramFile(job.output, program, error)) {
+                result.ok = false;
+                result.errors = error + "\n";
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++) pool.emplace_back(work);
+    work();
+    for (std::thread& thread : pool) thread.join();
+    return results;
+}
@@ -0,0 +1,205 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct AssemblyError {
+    uint32_t line;  // 1-based; 0 for errors about the file itself
+    std::string message;
+};
+
+// Machine code from the assembler: bytes in the order they were emitted, and
+// the addresses each run of them (segment) goes to
+struct AssembledProgram {
+    struct Segment {
+        uint16_t address;
+        uint32_t offset;  // Into bytes
+        uint32_t length;
+    };
+
+    std::vector<uint8_t> bytes;
+    std::vector<Segment> segments;
+    bool hasStart = false;  // END had an operand
+    uint16_t start = 0;
+    uint32_t lines = 0;  // Source lines read, not counting macro expansions
+    std::vector<AssemblyError> errors;
+
+    bool ok() const { return errors.empty(); }
+    uint16_t lowAddress() const;
+    uint16_t highAddress() const;
+    // Every byte from lowAddress() to highAddress(), gaps zero-filled
+    std::vector<uint8_t> flatImage() const;
+    // END's operand, else the lowest address
+    uint16_t entryPoint() const { return hasStart ? start : lowAddress(); }
+    // Every error as "name:line: message", one per line
+    std::string errorText(const std::string& name) const;
+
+    template <class Cpu> void loadInto(Cpu& cpu) const {
+        for (const Segment& segment : segments) {
+            for (uint32_t i = 0; i < segment.length; i++) {
+                cpu.setMemory(static_cast<uint16_t>(segment.address + i), bytes[segment.offset + i]);
+            }
+        }
+    }
+};
+
+// Intel HEX: 16-byte data records, a start record if END had an operand, EOF
+void writeIntelHex(std::ostream& out, const AssembledProgram& program);
+// flatImage()
+void writeBinary(std::ostream& out, const AssembledProgram& program);
+// Intel HEX for .hex/.ihx/.ihex, else binary
+bool writeProgramFile(const std::string& path, const AssembledProgram& program, std::string& error);
+
+// 8085 assembler covering every documented instruction, in one pass over the
+// source. Symbols are defined as they are met; an operand naming one defined
+// further down is emitted as zeros and recorded as a fixup, which keeps a
+// pointer to the expression's text and is evaluated again once the whole
+// source has been read. Tokens are pointers into the source, never copies,
+// so the only allocations are symbol table nodes, fixups, macro expansions
+// and the output, and an Assembler reused for many sources keeps its tables'
+// capacity from one to the next.
+//
+// Syntax, one statement per line, ';' starts a comment:
+//   [label[:]] MNEMONIC operands     a label without ':' must start the line
+//   name EQU expr                    constant; SET makes a redefinable one
+//   ORG expr / DS count / DB bytes, 'text' / DW words / END [start]
+//   name MACRO [param, ...]          body lines, then ENDM; \@ in the body
+//                                    becomes a number unique to the expansion
+// Mnemonics, registers, directives, symbols and macro names are not case
+// sensitive. Expressions are C-like on 32-bit integers: + - * / % & | ^ ~
+// << >> ( ), HIGH x and LOW x, $ for the address of the current statement,
+// 'c' for a character, and numbers as 10, 0x1F, 1Fh, 101b or 17o.
+// ORG, DS, EQU, SET and RST need values defined above them.
+class Assembler {
+public:
+    uint16_t origin = 0;   // Address before the first ORG
+    bool listing = false;  // Build listingText() too
+
+    // Returns out.ok(); out is cleared first
+    bool assemble(const char* source, size_t length, AssembledProgram& out);
+    bool assemble(const std::string& source, AssembledProgram& out) {
+        return assemble(source.data(), source.size(), out);
+    }
+    bool assembleFile(const std::string& path, AssembledProgram& out);
+    // Of the last assemble(): line number, address, bytes and source for each
+    // line, then the symbols
+    const std::string& listingText() const { return listingBuffer; }
+
+private:
+    struct Cursor;
+    struct Value {
+        int32_t value;
+        bool known;  // false while it names a symbol not defined yet
+    };
+    enum class Width : uint8_t { Byte, Word, Start };
+    struct Symbol {
+        int32_t value;
+        bool redefinable;  // SET
+    };
+    struct Fixup {
+        const char* begin;
+        const char* end;
+        uint32_t offset;  // Into the output bytes
+        uint16_t pc;      // $ of the statement
+        uint32_t line;
+        Width width;
+    };
+    struct Macro {
+        std::vector<std::string_view> parameters;
+        const char* body;
+        const char* bodyEnd;
+    };
+    struct ListedLine {
+        uint32_t line;
+        uint16_t address;         // The value instead for EQU and SET
+        uint32_t offset, length;  // Output bytes of the line
+        std::string_view text;
+        bool expansion;
+        bool equate;
+    };
+    // Symbol and macro names compare without case
+    struct NameHash {
+        size_t operator()(std::string_view name) const;
+    };
+    struct NameEqual {
+        bool operator()(std::string_view a, std::string_view b) const;
+    };
+    static const int kMaxMacroDepth = 16;
+    static const int kMaxExpressionDepth = 64;  // Parentheses and unary operators
+    static const size_t kMaxErrors = 100;
+
+    std::unordered_map<std::string_view, Symbol, NameHash, NameEqual> symbols;
+    std::unordered_map<std::string_view, Macro, NameHash, NameEqual> macros;
+    std::vector<Fixup> fixups;
+    std::deque<std::string> expansions;  // Fixups and listed lines point into them
+    std::vector<ListedLine> listed;
+    std::string fileBuffer, listingBuffer;
+
+    // State of the assemble() in progress
+    AssembledProgram* out = nullptr;
+    uint32_t pc = 0;            // Past FFFFh once the code has run off the end
+    uint16_t statementPc = 0;   // $
+    uint32_t line = 0;          // Of the source line being assembled
+    int macroDepth = 0;
+    int expressionDepth = 0;
+    uint32_t expansionCount = 0;
+    bool ended = false;         // END seen
+    bool resolving = false;     // Evaluating fixups: undefined symbols are errors
+    bool lineFailed = false;    // Only the first error of a line is reported
+    Macro* defining = nullptr;  // MACRO seen, collecting its body
+    uint32_t definingLine = 0;
+    std::string_view expanding;  // Outermost macro being expanded, for errors
+
+    void assembleText(const char* begin, const char* end, bool expansion);
+    void statement(Cursor& c, std::string_view text, bool expansion);
+    void collectMacroLine(Cursor& c, std::string_view text, const char* lineStart);
+    bool instruction(Cursor& c, std::string_view mnemonic);
+    bool directive(Cursor& c, std::string_view word, std::string_view label);
+    void expandMacro(Cursor& c, std::string_view name, const Macro& macro);
+    void defineSymbol(std::string_view name, int32_t value, bool redefinable);
+    void finish();
+    void writeListing();
+
+    void emitByte(uint8_t byte);
+    void emitValue(Cursor& c, Width width);  // Parses an expression
+    void store(uint32_t offset, int32_t value, Width width);
+    bool error(const std::string& message);
+
+    Value expression(Cursor& c);
+    Value bitOr(Cursor& c);
+    Value bitXor(Cursor& c);
+    Value bitAnd(Cursor& c);
+    Value shift(Cursor& c);
+    Value sum(Cursor& c);
+    Value product(Cursor& c);
+    Value unary(Cursor& c);
+    Value primary(Cursor& c);
+    Value nested(Cursor& c, Value (Assembler::*parse)(Cursor&));
+    Value number(Cursor& c);
+};
+
+// One source to assemble, and where its output goes ("" to only check it)
+struct AssemblyJob {
+    std::string source;
+    std::string output;
+};
+
+struct AssemblyJobResult {
+    bool ok = false;
+    size_t bytes = 0;
+    uint32_t lines = 0;
+    std::string errors;  // As AssembledProgram::errorText(), plus write errors
+};
+
+// Assembles every job on threads workers (0 = one per core), each with its
+// own Assembler, and writes each output with writeProgramFile()
+std::vector<AssemblyJobResult> assembleFiles(const std::vector<AssemblyJob>& jobs, unsigned threads = 0);
+
+#endif // ASSEMBLER_H
@@ -0,0 +1,242 @@
+#include "batch.h"
+#include "loader.h"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// T-states between wall-clock checks for jobs with a time limit
+const uint64_t kSliceCycles = 1000000;
+// Jobs are dealt out in about this many chunks per worker; idle workers
+// steal whole chunks from the others
+const size_t kChunksPerWorker = 8;
+
+static_assert(sizeof(BatchResult) == 32, "BatchResult should stay compact");
+
+struct Range {
+    size_t first;
+    size_t last;  // Exclusive
+};
+
+} // namespace
+
+// One worker's chunks. The owner takes from the back, thieves from the front.
+struct BatchRunner::Queue {
+    std::mutex lock;
+    std::deque<Range> ranges;
+
+    bool pop(Range& range) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (ranges.empty()) return false;
+        range = ranges.back();
+        ranges.pop_back();
+        return true;
+    }
+
+    bool steal(Range& range) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (ranges.empty()) return false;
+        range = ranges.front();
+        ranges.pop_front();
+        return true;
+    }
+};
+
+const char* batchExitName(BatchExit exit) {
+    switch (exit) {
+        case BatchExit::Halted: return "halted";
+        case BatchExit::CycleLimit: return "cycle-limit";
+        case BatchExit::TimeLimit: return "time-limit";
+    }
+    return "unknown";
+}
+
+bool loadBatchImage(const std::string& path, uint16_t origin, BatchImage& image, std::string& error) {
+    std::unique_ptr<CPU8085> scratch(new CPU8085(CPU8085::Engine::Switch));
+    LoadResult loaded = loadImageFile(*scratch, path, origin);
+    if (!loaded.ok) {
+        error = loaded.error;
+        return false;
+    }
+
+    std::vector<uint8_t> contents(0x10000);
+    scratch->memory.read(0x0000, contents.data(), contents.size());
+    image.name = path;
+    image.memory = std::make_shared<MemoryImage>(contents.data(), contents.size(), 0x0000);
+    image.start = loaded.hasStartAddress ? loaded.startAddress
+                : loaded.bytesLoaded ? loaded.lowAddress : origin;
+    return true;
+}
+
+BatchRunner::BatchRunner(const BatchOptions& options) : options(options) {
+    threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    if (this->options.lanes == 0) this->options.lanes = 1;
+    for (unsigned i = 0; i < threads; i++) {
+        if (options.lockstep) {
+            lockstepCpus.emplace_back(new LockstepCPU8085());
+            continue;
+        }
+        cpus.emplace_back(new CPU8085(options.engine));
+        cpus.back()->setLoopSkipping(options.skipLoops);
+        // The JIT engine switches back to flat memory on its first run
+        cpus.back()->memory.setMode(GuestMemory::Mode::Paged);
+    }
+}
+
+BatchRunner::~BatchRunner() = default;
+
+uint64_t BatchRunner::totalCycles() const {
+    uint64_t total = 0;
+    for (const BatchResult& result : resultBuffer) total += result.cycles;
+    return total;
+}
+
+void BatchRunner::run(const std::vector<BatchJob>& jobs) {
+    resultBuffer.assign(jobs.size(), BatchResult());
+    outputBuffer.assign(jobs.size() * options.outputLength, 0);
+
+    std::vector<Queue> queues(threads);
+    size_t owner = 0;
+    if (options.lockstep) {
+        // Runs of jobs that can share a group, split evenly into groups of
+        // at most options.lanes, and into one per worker when that is fewer
+        for (size_t first = 0; first < jobs.size();) {
+            size_t end = first + 1;
+            while (end < jobs.size() && jobs[end].image == jobs[first].image &&
+                   jobs[end].limits.maxSeconds == jobs[first].limits.maxSeconds) {
+                end++;
+            }
+            size_t count = end - first;
+            size_t groups = std::max<size_t>((count + options.lanes - 1) / options.lanes, std::min<size_t>(threads, count));
+            for (size_t g = 0; g < groups; g++) {
+                queues[owner].ranges.push_back({first + count * g / groups, first + count * (g + 1) / groups});
+                owner = (owner + 1) % threads;
+            }
+            first = end;
+        }
+    } else {
+        size_t chunk = std::max<size_t>(1, jobs.size() / (threads * kChunksPerWorker));
+        for (size_t first = 0; first < jobs.size(); first += chunk) {
+            queues[owner].ranges.push_back({first, std::min(first + chunk, jobs.size())});
+            owner = (owner + 1) % threads;
+        }
+    }
+
+    auto start = Clock::now();
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++) {
+        pool.emplace_back(&BatchRunner::worker, this, i, std::ref(queues), std::cref(jobs));
+    }
+    worker(0, queues, jobs);
+    for (std::thread& thread : pool) thread.join();
+    elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void BatchRunner::worker(unsigned index, std::vector<Queue>& queues, const std::vector<BatchJob>& jobs) {
+    size_t count = queues.size();
+    Range range;
+    for (;;) {
+        bool found = queues[index].pop(range);
+        for (size_t k = 1; k < count && !found; k++) {
+            found = queues[(index + k) % count].steal(range);
+        }
+        // Nothing is queued after run() starts, so empty queues mean done
+        if (!found) return;
+        if (options.lockstep) {
+            runGroup(*lockstepCpus[index], jobs, range.first, range.last);
+            continue;
+        }
+        for (size_t i = range.first; i < range.last; i++) {
+            runJob(*cpus[index], jobs[i], i);
+        }
+    }
+}
+
+void BatchRunner::runJob(CPU8085& cpu, const BatchJob& job, size_t index) {
+    // Consecutive jobs on the same image only undo the pages the last one wrote
+    std::shared_ptr<const MemoryImage> image = job.image ? job.image->memory : nullptr;
+    if (cpu.memory.getImage() != image) cpu.setMemoryImage(image);
+    cpu.reset();
+    if (job.image) cpu.PC = job.image->start;
+    for (const BatchInput& input : job.inputs) {
+        for (size_t i = 0; i < input.bytes.size(); i++) {
+            cpu.setMemory(static_cast<uint16_t>(input.address + i), input.bytes[i]);
+        }
+    }
+
+    // Without a time limit the whole cycle budget goes to one run() call
+    const BatchLimits& limits = job.limits;
+    bool timed = limits.maxSeconds > 0.0;
+    auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                       std::chrono::duration<double>(limits.maxSeconds));
+    BatchExit exit = BatchExit::CycleLimit;
+    while (!cpu.halted && cpu.cycles < limits.maxCycles) {
+        uint64_t budget = limits.maxCycles - cpu.cycles;
+        if (timed) budget = std::min(budget, kSliceCycles);
+        cpu.run(budget);
+        if (timed && !cpu.halted && Clock::now() >= deadline) {
+            exit = BatchExit::TimeLimit;
+            break;
+        }
+    }
+    if (cpu.halted) exit = BatchExit::Halted;
+
+    BatchResult& result = resultBuffer[index];
+    result.cycles = cpu.cycles;
+    result.outputOffset = static_cast<uint32_t>(index * options.outputLength);
+    result.SP = cpu.SP;
+    result.PC = cpu.PC;
+    result.A = cpu.A;
+    result.B = cpu.B;
+    result.C = cpu.C;
+    result.D = cpu.D;
+    result.E = cpu.E;
+    result.H = cpu.H;
+    result.L = cpu.L;
+    result.psw = cpu.flags.psw;
+    result.exit = exit;
+
+    cpu.memory.read(options.outputAddress, outputBuffer.data() + result.outputOffset, options.outputLength);
+}
+
+void BatchRunner::runGroup(LockstepCPU8085& cpu, const std::vector<BatchJob>& jobs, size_t first, size_t last) {
+    const BatchImage* image = jobs[first].image;
+    if (cpu.lanes() != last - first) cpu.setLanes(last - first);
+    cpu.setImage(image ? image->memory : nullptr, image ? image->start : 0x0000);
+    for (size_t i = first; i < last; i++) {
+        for (const BatchInput& input : jobs[i].inputs) {
+            for (size_t b = 0; b < input.bytes.size(); b++) {
+                cpu.setMemory(i - first, static_cast<uint16_t>(input.address + b), input.bytes[b]);
+            }
+        }
+        cpu.setCycleLimit(i - first, jobs[i].limits.maxCycles);
+    }
+    cpu.run(jobs[first].limits.maxSeconds);
+
+    for (size_t i = first; i < last; i++) {
+        LockstepCPU8085::Lane lane = cpu.lane(i - first);
+        BatchResult& result = resultBuffer[i];
+        result.cycles = lane.cycles;
+        result.outputOffset = static_cast<uint32_t>(i * options.outputLength);
+        result.SP = lane.SP;
+        result.PC = lane.PC;
+        result.A = lane.A;
+        result.B = lane.B;
+        result.C = lane.C;
+        result.D = lane.D;
+        result.E = lane.E;
+        result.H = lane.H;
+        result.L = lane.L;
+        result.psw = lane.psw;
+        result.exit = lane.exit == LockstepCPU8085::Exit::Halted ? BatchExit::Halted
+                    : lane.exit == LockstepCPU8085::Exit::TimeLimit ? BatchExit::TimeLimit
+                    : BatchExit::CycleLimit;
+        cpu.readMemory(i - first, options.outputAddress, outputBuffer.data() + result.outputOffset, options.outputLength);
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cpu8085.h"
+#include "lockstep.h"
+
+// Guest program shared read-only by every job that runs it. Workers map its
+// pages copy-on-write, so a job only allocates the pages it writes.
+struct BatchImage {
+    std::string name;
+    std::shared_ptr<const MemoryImage> memory;
+    uint16_t start = 0x0000;  // Initial PC
+};
+
+// Loads a binary or Intel HEX file (see loader.h) as a batch image
+bool loadBatchImage(const std::string& path, uint16_t origin, BatchImage& image, std::string& error);
+
+// Bytes written over the image before the job starts
+struct BatchInput {
+    uint16_t address = 0x0000;
+    std::vector<uint8_t> bytes;
+};
+
+struct BatchLimits {
+    uint64_t maxCycles = 1000000000ULL;
+    double maxSeconds = 0.0;  // Wall-clock limit, 0 = none
+};
+
+struct BatchJob {
+    const BatchImage* image = nullptr;
+    std::vector<BatchInput> inputs;
+    BatchLimits limits;
+};
+
+enum class BatchExit : uint8_t {
+    Halted,
+    CycleLimit,
+    TimeLimit,
+};
+
+const char* batchExitName(BatchExit exit);
+
+// Final state of one job, 32 bytes
+struct BatchResult {
+    uint64_t cycles;
+    uint32_t outputOffset;  // Start of this job's bytes in BatchRunner::output()
+    uint16_t SP, PC;
+    uint8_t A, B, C, D, E, H, L;
+    uint8_t psw;
+    BatchExit exit;
+};
+
+struct BatchOptions {
+    unsigned threads = 0;  // 0 = one per hardware thread
+    CPU8085::Engine engine = CPU8085::defaultEngine;
+    bool skipLoops = false;  // CPU8085::setLoopSkipping()
+    // Memory window copied into the output buffer after every job
+    uint16_t outputAddress = 0x0000;
+    uint16_t outputLength = 0;
+    // Run jobs on the lockstep core (lockstep.h) in groups of up to lanes
+    // consecutive jobs with the same image and time limit. engine and
+    // skipLoops are unused then, and a time limit applies to a whole group.
+    bool lockstep = false;
+    size_t lanes = 1024;
+};
+
+// Runs independent jobs on a work-stealing thread pool. Each worker owns one
+// CPU8085 with paged memory that is reset and reused for every job it takes,
+// and writes results straight into its job's slot, so workers share nothing
+// but the queues and the read-only images. With options.lockstep each worker
+// owns a LockstepCPU8085 instead and takes a group of jobs at a time.
+class BatchRunner {
+public:
+    explicit BatchRunner(const BatchOptions& options = BatchOptions());
+    ~BatchRunner();
+
+    // Blocks until every job has finished; results()[i] belongs to jobs[i]
+    void run(const std::vector<BatchJob>& jobs);
+
+    const std::vector<BatchResult>& results() const { return resultBuffer; }
+    const std::vector<uint8_t>& output() const { return outputBuffer; }
+    const uint8_t* outputOf(size_t job) const { return outputBuffer.data() + resultBuffer[job].outputOffset; }
+
+    unsigned threadCount() const { return threads; }
+    double seconds() const { return elapsed; }  // Wall-clock time of the last run()
+    uint64_t totalCycles() const;
+
+private:
+    struct Queue;
+
+    BatchOptions options;
+    unsigned threads;
+    std::vector<std::unique_ptr<CPU8085>> cpus;
+    std::vector<std::unique_ptr<LockstepCPU8085>> lockstepCpus;
+    std::vector<BatchResult> resultBuffer;
+    std::vector<uint8_t> outputBuffer;
+    double elapsed = 0.0;
+
+    void worker(unsigned index, std::vector<Queue>& queues, const std::vector<BatchJob>& jobs);
+    void runJob(CPU8085& cpu, const BatchJob& job, size_t index);
+    // Jobs first to last share an image and time limit
+    void runGroup(LockstepCPU8085& cpu, const std::vector<BatchJob>& jobs, size_t first, size_t last);
+};
+
+#endif // BATCH_H
@@ -0,0 +1,573 @@
+#include "benchmark.h"
+#include "lockstep.h"
+#include "multicpu.h"
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+
+namespace {
+
+// Safety net so a broken core cannot hang the benchmark
+const uint64_t kInstructionLimit = 500000000ULL;
+const uint64_t kCycleLimit = kInstructionLimit * 18;  // 18 = slowest instruction
+
+// Nested DCR/JNZ countdown, ~8.4M instructions
+const uint8_t tightLoop[] = {
+    0x1E, 0x40,        // 0000: MVI E, 40h
+    0x06, 0x00,        // 0002: L1: MVI B, 00h
+    0x0E, 0x00,        // 0004: L2: MVI C, 00h
+    0x0D,              // 0006: L3: DCR C
+    0xC2, 0x06, 0x00,  // 0007: JNZ L3
+    0x05,              // 000A: DCR B
+    0xC2, 0x04, 0x00,  // 000B: JNZ L2
+    0x1D,              // 000E: DCR E
+    0xC2, 0x02, 0x00,  // 000F: JNZ L1
+    0x76               // 0012: HLT
+};
+
+// Copies 4KB from 1000h to 2000h, 64 passes, ~2.1M instructions
+const uint8_t memoryCopy[] = {
+    0x3E, 0x40,        // 0000: MVI A, 40h
+    0x32, 0x00, 0x30,  // 0002: STA 3000h      ; pass counter
+    0x21, 0x00, 0x10,  // 0005: OUTER: LXI H, 1000h
+    0x11, 0x00, 0x20,  // 0008: LXI D, 2000h
+    0x01, 0x00, 0x10,  // 000B: LXI B, 1000h
+    0x7E,              // 000E: LOOP: MOV A, M
+    0x12,              // 000F: STAX D
+    0x23,              // 0010: INX H
+    0x13,              // 0011: INX D
+    0x0B,              // 0012: DCX B
+    0x78,              // 0013: MOV A, B
+    0xB1,              // 0014: ORA C
+    0xC2, 0x0E, 0x00,  // 0015: JNZ LOOP
+    0x3A, 0x00, 0x30,  // 0018: LDA 3000h
+    0x3D,              // 001B: DCR A
+    0x32, 0x00, 0x30,  // 001C: STA 3000h
+    0xC2, 0x05, 0x00,  // 001F: JNZ OUTER
+    0x76               // 0022: HLT
+};
+
+// Two-digit BCD counter in memory incremented with ADI/ACI + DAA, ~6.3M instructions
+const uint8_t bcdArithmetic[] = {
+    0x1E, 0x08,        // 0000: MVI E, 08h
+    0x01, 0x00, 0x00,  // 0002: OUTER: LXI B, 0000h
+    0x3A, 0x00, 0x30,  // 0005: LOOP: LDA 3000h
+    0xC6, 0x01,        // 0008: ADI 01h
+    0x27,              // 000A: DAA
+    0x32, 0x00, 0x30,  // 000B: STA 3000h
+    0x3A, 0x01, 0x30,  // 000E: LDA 3001h
+    0xCE, 0x00,        // 0011: ACI 00h
+    0x27,              // 0013: DAA
+    0x32, 0x01, 0x30,  // 0014: STA 3001h
+    0x0B,              // 0017: DCX B
+    0x78,              // 0018: MOV A, B
+    0xB1,              // 0019: ORA C
+    0xC2, 0x05, 0x00,  // 001A: JNZ LOOP
+    0x1D,              // 001D: DCR E
+    0xC2, 0x02, 0x00,  // 001E: JNZ OUTER
+    0x76               // 0021: HLT
+};
+
+// Two CALLs per iteration into a PUSH/POP/RET routine, ~3.1M instructions
+const uint8_t callReturn[] = {
+    0x1E, 0x04,        // 0000: MVI E, 04h
+    0x01, 0x00, 0x00,  // 0002: OUTER: LXI B, 0000h
+    0xCD, 0x16, 0x00,  // 0005: LOOP: CALL SUB
+    0xCD, 0x16, 0x00,  // 0008: CALL SUB
+    0x0B,              // 000B: DCX B
+    0x78,              // 000C: MOV A, B
+    0xB1,              // 000D: ORA C
+    0xC2, 0x05, 0x00,  // 000E: JNZ LOOP
+    0x1D,              // 0011: DCR E
+    0xC2, 0x02, 0x00,  // 0012: JNZ OUTER
+    0x76,              // 0015: HLT
+    0xC5,              // 0016: SUB: PUSH B
+    0xC1,              // 0017: POP B
+    0xC9               // 0018: RET
+};
+
+// Bubble sort of the 16 bytes at 1000h; the swaps depend on the data
+const uint8_t sort16[] = {
+    0x0E, 0x0F,        // 0000: MVI C, 0Fh      ; passes
+    0x21, 0x00, 0x10,  // 0002: PASS: LXI H, 1000h
+    0x06, 0x0F,        // 0005: MVI B, 0Fh      ; compares per pass
+    0x7E,              // 0007: NEXT: MOV A, M
+    0x23,              // 0008: INX H
+    0xBE,              // 0009: CMP M
+    0xDA, 0x15, 0x00,  // 000A: JC KEEP
+    0xCA, 0x15, 0x00,  // 000D: JZ KEEP
+    0x56,              // 0010: MOV D, M        ; swap [HL-1] and [HL]
+    0x77,              // 0011: MOV M, A
+    0x2B,              // 0012: DCX H
+    0x72,              // 0013: MOV M, D
+    0x23,              // 0014: INX H
+    0x05,              // 0015: KEEP: DCR B
+    0xC2, 0x07, 0x00,  // 0016: JNZ NEXT
+    0x0D,              // 0019: DCR C
+    0xC2, 0x02, 0x00,  // 001A: JNZ PASS
+    0x76               // 001D: HLT
+};
+
+// Shift-and-add products of the 16 byte pairs at 1000h, each written over
+// its pair as a 16-bit word; the additions depend on the multiplier bits
+const uint8_t multiply[] = {
+    0x21, 0x00, 0x10,  // 0000: LXI H, 1000h
+    0x22, 0xFE, 0x10,  // 0003: SHLD 10FEh      ; pair pointer
+    0x06, 0x10,        // 0006: MVI B, 10h      ; pairs
+    0x2A, 0xFE, 0x10,  // 0008: PAIR: LHLD 10FEh
+    0x5E,              // 000B: MOV E, M        ; DE = multiplicand
+    0x16, 0x00,        // 000C: MVI D, 00h
+    0x23,              // 000E: INX H
+    0x7E,              // 000F: MOV A, M        ; multiplier
+    0x21, 0x00, 0x00,  // 0010: LXI H, 0000h    ; product
+    0x0E, 0x08,        // 0013: MVI C, 08h
+    0x29,              // 0015: BIT: DAD H
+    0x17,              // 0016: RAL
+    0xD2, 0x1B, 0x00,  // 0017: JNC SKIP
+    0x19,              // 001A: DAD D
+    0x0D,              // 001B: SKIP: DCR C
+    0xC2, 0x15, 0x00,  // 001C: JNZ BIT
+    0xEB,              // 001F: XCHG
+    0x2A, 0xFE, 0x10,  // 0020: LHLD 10FEh
+    0x73,              // 0023: MOV M, E
+    0x23,              // 0024: INX H
+    0x72,              // 0025: MOV M, D
+    0x23,              // 0026: INX H
+    0x22, 0xFE, 0x10,  // 0027: SHLD 10FEh
+    0x05,              // 002A: DCR B
+    0xC2, 0x08, 0x00,  // 002B: JNZ PAIR
+    0x76               // 002E: HLT
+};
+
+// Fletcher-style sums of the 256 bytes at 1000h, stored at 1100h; the same
+// path for every input
+const uint8_t checksum[] = {
+    0x21, 0x00, 0x10,  // 0000: LXI H, 1000h
+    0x01, 0x00, 0x00,  // 0003: LXI B, 0000h
+    0x16, 0x00,        // 0006: MVI D, 00h      ; 256 bytes
+    0x78,              // 0008: LOOP: MOV A, B
+    0x86,              // 0009: ADD M
+    0x47,              // 000A: MOV B, A
+    0x81,              // 000B: ADD C
+    0x4F,              // 000C: MOV C, A
+    0x23,              // 000D: INX H
+    0x15,              // 000E: DCR D
+    0xC2, 0x08, 0x00,  // 000F: JNZ LOOP
+    0x78,              // 0012: MOV A, B
+    0x32, 0x00, 0x11,  // 0013: STA 1100h
+    0x79,              // 0016: MOV A, C
+    0x32, 0x01, 0x11,  // 0017: STA 1101h
+    0x76               // 001A: HLT
+};
+
+// One CPU of the board benchmark's ring, its number at 0FFFh. Each round it
+// sends the round number to the next CPU, computes, then adds what the
+// previous one sent to E and posts E to the shared window at 8000h + number.
+const uint8_t ringNode[] = {
+    0x31, 0x00, 0x0F,  // 0000: LXI SP, 0F00h
+    0x0E, 0xC8,        // 0003: MVI C, 200      ; rounds
+    0x1E, 0x00,        // 0005: MVI E, 00h
+    0x79,              // 0007: ROUND: MOV A, C
+    0xD3, 0x10,        // 0008: OUT 10h         ; to the next CPU
+    0x16, 0x03,        // 000A: MVI D, 03h
+    0x06, 0x00,        // 000C: OUTER: MVI B, 00h
+    0x80,              // 000E: INNER: ADD B
+    0x07,              // 000F: RLC
+    0x05,              // 0010: DCR B
+    0xC2, 0x0E, 0x00,  // 0011: JNZ INNER
+    0x15,              // 0014: DCR D
+    0xC2, 0x0C, 0x00,  // 0015: JNZ OUTER
+    0x32, 0x80, 0x0F,  // 0018: STA 0F80h
+    0xDB, 0x21,        // 001B: WAIT: IN 21h    ; from the previous CPU
+    0xE6, 0x01,        // 001D: ANI 01h
+    0xCA, 0x1B, 0x00,  // 001F: JZ WAIT
+    0xDB, 0x20,        // 0022: IN 20h
+    0x83,              // 0024: ADD E
+    0x5F,              // 0025: MOV E, A
+    0x3A, 0xFF, 0x0F,  // 0026: LDA 0FFFh
+    0x6F,              // 0029: MOV L, A
+    0x26, 0x80,        // 002A: MVI H, 80h
+    0x73,              // 002C: MOV M, E
+    0x0D,              // 002D: DCR C
+    0xC2, 0x07, 0x00,  // 002E: JNZ ROUND
+    0x76               // 0031: HLT
+};
+
+} // namespace
+
+const std::vector<Workload>& builtinWorkloads() {
+    static const std::vector<Workload> workloads = {
+        {"tight_loop", "nested DCR/JNZ delay loop", tightLoop, sizeof(tightLoop)},
+        {"memory_copy", "4KB block copy via MOV A,M / STAX D", memoryCopy, sizeof(memoryCopy)},
+        {"bcd_arithmetic", "BCD counter with ADI/ACI/DAA", bcdArithmetic, sizeof(bcdArithmetic)},
+        {"call_ret", "CALL/PUSH/POP/RET heavy loop", callReturn, sizeof(callReturn)},
+    };
+    return workloads;
+}
+
+const std::vector<LaneWorkload>& laneWorkloads() {
+    static const std::vector<LaneWorkload> workloads = {
+        {"sort16", "bubble sort of 16 bytes", sort16, sizeof(sort16), 0x1000, 16, 0x1000, 16},
+        {"multiply", "16 shift-and-add 8x8 multiplies", multiply, sizeof(multiply), 0x1000, 32, 0x1000, 32},
+        {"checksum", "Fletcher sums of 256 bytes", checksum, sizeof(checksum), 0x1000, 256, 0x1100, 2},
+    };
+    return workloads;
+}
+
+const std::vector<CPU8085::Engine>& allEngines() {
+    static const std::vector<CPU8085::Engine> engines = {
+        CPU8085::Engine::Switch,
+        CPU8085::Engine::Threaded,
+        CPU8085::Engine::FunctionTable,
+        CPU8085::Engine::Predecoded,
+        CPU8085::Engine::Jit,
+    };
+    return engines;
+}
+
+const std::vector<std::string>& benchmarkCores() {
+    static const std::vector<std::string> cores = {"plain", "counting", "tracing", "debug"};
+    return cores;
+}
+
+namespace {
+
+template <class Cpu>
+void runCore(int repeat, const std::string& filter, const std::vector<CPU8085::Engine>& engines,
+             const std::string& core, std::vector<BenchmarkResult>& results) {
+    Cpu cpu;
+
+    for (const Workload& workload : builtinWorkloads()) {
+        if (!filter.empty() && filter != workload.name) continue;
+
+        // Count instructions once with step() so the timed runs can use run()
+        // without per-instruction bookkeeping
+        cpu.reset();
+        cpu.loadProgram(workload.program, workload.size, 0x0000);
+        uint64_t instructions = 0;
+        while (!cpu.halted && instructions < kInstructionLimit) {
+            cpu.step();
+            instructions++;
+        }
+
+        for (CPU8085::Engine engine : engines) {
+            cpu.setEngine(engine);
+            BenchmarkResult result;
+            result.workload = workload.name;
+            result.engine = CPU8085::engineName(engine);
+            result.core = core;
+            result.instructions = instructions;
+            for (int run = 0; run < repeat; run++) {
+                cpu.reset();
+                cpu.loadProgram(workload.program, workload.size, 0x0000);
+
+                auto start = std::chrono::steady_clock::now();
+                cpu.run(kCycleLimit);
+                auto end = std::chrono::steady_clock::now();
+
+                double seconds = std::chrono::duration<double>(end - start).count();
+                if (run == 0 || seconds < result.seconds) result.seconds = seconds;
+                result.cycles = cpu.cycles;
+                result.halted = cpu.halted;
+            }
+            results.push_back(result);
+        }
+    }
+}
+
+} // namespace
+
+std::vector<BenchmarkResult> runBenchmarks(int repeat, const std::string& filter,
+                                           const std::vector<CPU8085::Engine>& engines,
+                                           const std::string& core) {
+    // Policies are left idle (no trace file, no breakpoints), so the other
+    // cores measure what merely compiling their hooks in costs
+    std::vector<BenchmarkResult> results;
+    if (core == "plain") {
+        runCore<CPU8085>(repeat, filter, engines, core, results);
+    } else if (core == "counting") {
+        runCore<CountingCPU8085>(repeat, filter, engines, core, results);
+    } else if (core == "tracing") {
+        runCore<TracingCPU8085>(repeat, filter, engines, core, results);
+    } else if (core == "debug") {
+        runCore<DebugCPU8085>(repeat, filter, engines, core, results);
+    }
+    return results;
+}
+
+namespace {
+
+// The input bytes of every lane, from a xorshift generator seeded per lane
+std::vector<uint8_t> laneInputs(const LaneWorkload& workload, size_t lanes) {
+    std::vector<uint8_t> inputs(lanes * workload.inputLength);
+    for (size_t lane = 0; lane < lanes; lane++) {
+        uint32_t state = static_cast<uint32_t>(lane) * 2654435761u + 1;
+        for (uint16_t i = 0; i < workload.inputLength; i++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            inputs[lane * workload.inputLength + i] = static_cast<uint8_t>(state >> 24);
+        }
+    }
+    return inputs;
+}
+
+// What the comparison looks at after a lane's run
+struct LaneOutcome {
+    uint8_t A, B, C, D, E, H, L, psw;
+    uint16_t SP, PC;
+    uint64_t cycles;
+    bool halted;
+
+    bool operator==(const LaneOutcome& o) const {
+        return A == o.A && B == o.B && C == o.C && D == o.D && E == o.E && H == o.H && L == o.L &&
+               psw == o.psw && SP == o.SP && PC == o.PC && cycles == o.cycles && halted == o.halted;
+    }
+};
+
+} // namespace
+
+std::vector<LockstepBenchmarkResult> runLockstepBenchmarks(int repeat, const std::string& filter, size_t lanes) {
+    std::vector<LockstepBenchmarkResult> results;
+    std::unique_ptr<CPU8085> cpu(new CPU8085());
+    LockstepCPU8085 lockstep(lanes);
+
+    for (const LaneWorkload& workload : laneWorkloads()) {
+        if (!filter.empty() && filter != workload.name) continue;
+        std::vector<uint8_t> program(workload.program, workload.program + workload.size);
+        auto image = std::make_shared<const MemoryImage>(program.data(), program.size(), 0x0000);
+        std::vector<uint8_t> inputs = laneInputs(workload, lanes);
+        cpu->setMemoryImage(image);
+        lockstep.setImage(image, 0x0000);
+
+        LockstepBenchmarkResult result;
+        result.workload = workload.name;
+        result.kernel = LockstepCPU8085::kernelName();
+        result.lanes = lanes;
+        std::vector<LaneOutcome> scalar(lanes);
+        std::vector<uint8_t> scalarOutput(lanes * workload.outputLength);
+        for (int run = 0; run < repeat; run++) {
+            // Lane after lane, the way BatchRunner reuses a worker's CPU
+            auto start = std::chrono::steady_clock::now();
+            for (size_t lane = 0; lane < lanes; lane++) {
+                cpu->reset();
+                for (uint16_t i = 0; i < workload.inputLength; i++) {
+                    cpu->setMemory(static_cast<uint16_t>(workload.inputAddress + i), inputs[lane * workload.inputLength + i]);
+                }
+                cpu->run(kCycleLimit);
+                scalar[lane] = {cpu->A, cpu->B, cpu->C, cpu->D, cpu->E, cpu->H, cpu->L, cpu->flags.psw,
+                                cpu->SP, cpu->PC, cpu->cycles, cpu->halted};
+                cpu->memory.read(workload.outputAddress, scalarOutput.data() + lane * workload.outputLength,
+                                 workload.outputLength);
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (run == 0 || seconds < result.scalarSeconds) result.scalarSeconds = seconds;
+
+            start = std::chrono::steady_clock::now();
+            lockstep.reset();
+            for (size_t lane = 0; lane < lanes; lane++) {
+                for (uint16_t i = 0; i < workload.inputLength; i++) {
+                    lockstep.setMemory(lane, static_cast<uint16_t>(workload.inputAddress + i),
+                                       inputs[lane * workload.inputLength + i]);
+                }
+                lockstep.setCycleLimit(lane, kCycleLimit);
+            }
+            lockstep.run();
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (run == 0 || seconds < result.lockstepSeconds) result.lockstepSeconds = seconds;
+        }
+
+        result.instructions = lockstep.stats().laneInstructions;
+        result.lanesPerStep = lockstep.stats().lanesPerStep();
+        result.matched = true;
+        std::vector<uint8_t> output(workload.outputLength);
+        for (size_t lane = 0; lane < lanes && result.matched; lane++) {
+            LockstepCPU8085::Lane l = lockstep.lane(lane);
+            LaneOutcome outcome = {l.A, l.B, l.C, l.D, l.E, l.H, l.L, l.psw, l.SP, l.PC, l.cycles,
+                                   l.exit == LockstepCPU8085::Exit::Halted};
+            lockstep.readMemory(lane, workload.outputAddress, output.data(), output.size());
+            result.matched = outcome == scalar[lane] &&
+                             std::memcmp(output.data(), scalarOutput.data() + lane * workload.outputLength,
+                                         output.size()) == 0;
+        }
+        results.push_back(result);
+    }
+    return results;
+}
+
+void printBenchmarkTable(std::ostream& out, const std::vector<BenchmarkResult>& results) {
+    out << std::left << std::setw(16) << "workload"
+        << std::setw(16) << "engine"
+        << std::setw(10) << "core"
+        << std::right << std::setw(14) << "instructions"
+        << std::setw(12) << "seconds"
+        << std::setw(10) << "MIPS" << "\n";
+    for (const BenchmarkResult& r : results) {
+        out << std::left << std::setw(16) << r.workload
+            << std::setw(16) << r.engine
+            << std::setw(10) << r.core
+            << std::right << std::setw(14) << r.instructions
+            << std::setw(12) << std::fixed << std::setprecision(4) << r.seconds
+            << std::setw(10) << std::setprecision(2) << r.mips()
+            << (r.halted ? "" : "  (did not halt)") << "\n";
+    }
+}
+
+void writeBenchmarkJson(std::ostream& out, const std::vector<BenchmarkResult>& results) {
+    out << "{\n  \"benchmark\": \"cpu8085\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& r = results[i];
+        out << "    {\"workload\": \"" << r.workload << "\""
+            << ", \"engine\": \"" << r.engine << "\""
+            << ", \"core\": \"" << r.core << "\""
+            << ", \"instructions\": " << r.instructions
+            << ", \"cycles\": " << r.cycles
+            << ", \"seconds\": " << std::setprecision(6) << std::fixed << r.seconds
+            << ", \"mips\": " << std::setprecision(3) << r.mips()
+            << ", \"halted\": " << (r.halted ? "true" : "false") << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+void printLockstepTable(std::ostream& out, const std::vector<LockstepBenchmarkResult>& results) {
+    out << std::left << std::setw(12) << "workload"
+        << std::setw(8) << "kernel"
+        << std::right << std::setw(8) << "lanes"
+        << std::setw(14) << "instructions"
+        << std::setw(16) << "scalar lanes/s"
+        << std::setw(18) << "lockstep lanes/s"
+        << std::setw(9) << "speedup"
+        << std::setw(12) << "lanes/step" << "\n";
+    for (const LockstepBenchmarkResult& r : results) {
+        out << std::left << std::setw(12) << r.workload
+            << std::setw(8) << r.kernel
+            << std::right << std::setw(8) << r.lanes
+            << std::setw(14) << r.instructions
+            << std::setw(16) << std::fixed << std::setprecision(0) << r.scalarLanesPerSecond()
+            << std::setw(18) << r.lockstepLanesPerSecond()
+            << std::setw(8) << std::setprecision(2) << r.speedup() << "x"
+            << std::setw(12) << std::setprecision(1) << r.lanesPerStep
+            << (r.matched ? "" : "  (lanes differ from CPU8085)") << "\n";
+    }
+}
+
+void writeLockstepJson(std::ostream& out, const std::vector<LockstepBenchmarkResult>& results) {
+    out << "{\n  \"benchmark\": \"lockstep\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const LockstepBenchmarkResult& r = results[i];
+        out << "    {\"workload\": \"" << r.workload << "\""
+            << ", \"kernel\": \"" << r.kernel << "\""
+            << ", \"lanes\": " << r.lanes
+            << ", \"instructions\": " << r.instructions
+            << ", \"scalar_seconds\": " << std::setprecision(6) << std::fixed << r.scalarSeconds
+            << ", \"lockstep_seconds\": " << r.lockstepSeconds
+            << ", \"speedup\": " << std::setprecision(3) << r.speedup()
+            << ", \"lanes_per_step\": " << r.lanesPerStep
+            << ", \"matched\": " << (r.matched ? "true" : "false") << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+namespace {
+
+std::unique_ptr<MultiCpuSystem> makeRing(size_t cpus, uint64_t quantum) {
+    std::unique_ptr<MultiCpuSystem> board(new MultiCpuSystem(cpus));
+    std::vector<uint8_t> contents(0x1000, 0);
+    std::memcpy(contents.data(), ringNode, sizeof(ringNode));
+    std::string error;
+    for (size_t i = 0; i < cpus; i++) {
+        contents[0xFFF] = static_cast<uint8_t>(i);
+        board->cpu(i).setMemoryImage(std::make_shared<const MemoryImage>(contents.data(), contents.size(), 0x0000));
+        board->addMailbox(i, 0x10, (i + 1) % cpus, 0x20, error);
+    }
+    board->addSharedWindow(0x80, 1, error);
+    board->setQuantum(quantum);
+    board->reset();
+    return board;
+}
+
+// Registers and cycles of every CPU, and the shared window
+std::string boardState(const MultiCpuSystem& board) {
+    std::string state;
+    for (size_t i = 0; i < board.cpuCount(); i++) {
+        const CPU8085& cpu = board.cpu(i);
+        state += cpu.getRegisterState() + " " + cpu.getFlagsState() + " T:" + std::to_string(cpu.cycles) + "\n";
+    }
+    for (uint16_t address = 0x8000; address < 0x8100; address++) state += static_cast<char>(board.getShared(address));
+    return state;
+}
+
+// Best time of repeat runs from reset to all CPUs halted
+double timeBoard(MultiCpuSystem& board, int repeat) {
+    double best = 0.0;
+    for (int run = 0; run < repeat; run++) {
+        board.reset();
+        auto start = std::chrono::steady_clock::now();
+        board.run(UINT64_MAX);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (run == 0 || seconds < best) best = seconds;
+    }
+    return best;
+}
+
+} // namespace
+
+BoardBenchmarkResult runBoardBenchmark(int repeat, size_t cpus, uint64_t quantum, unsigned threads) {
+    BoardBenchmarkResult result;
+    result.cpus = cpus;
+    result.quantum = quantum;
+
+    std::unique_ptr<MultiCpuSystem> single = makeRing(1, quantum);
+    result.singleSeconds = timeBoard(*single, repeat);
+
+    std::unique_ptr<MultiCpuSystem> board = makeRing(cpus, quantum);
+    board->setThreads(1);
+    result.serialSeconds = timeBoard(*board, repeat);
+    std::string serial = boardState(*board);
+    result.cycles = board->cycles();
+    result.quanta = board->quanta();
+
+    board->setThreads(threads);
+    result.threads = board->threadCount();
+    result.parallelSeconds = timeBoard(*board, repeat);
+    result.matched = boardState(*board) == serial && board->quanta() == result.quanta;
+    return result;
+}
+
+void printBoardTable(std::ostream& out, const BoardBenchmarkResult& r) {
+    out << std::right << std::setw(6) << "cpus"
+        << std::setw(9) << "threads"
+        << std::setw(9) << "quantum"
+        << std::setw(12) << "T-states"
+        << std::setw(12) << "1 cpu s"
+        << std::setw(12) << "serial s"
+        << std::setw(12) << "parallel s"
+        << std::setw(10) << "speedup" << "\n";
+    out << std::setw(6) << r.cpus
+        << std::setw(9) << r.threads
+        << std::setw(9) << r.quantum
+        << std::setw(12) << r.cycles
+        << std::setw(12) << std::fixed << std::setprecision(4) << r.singleSeconds
+        << std::setw(12) << r.serialSeconds
+        << std::setw(12) << r.parallelSeconds
+        << std::setw(9) << std::setprecision(2) << r.speedup() << "x"
+        << (r.matched ? "" : "  (parallel run differs from serial)") << "\n";
+}
+
+void writeBoardJson(std::ostream& out, const BoardBenchmarkResult& r) {
+    out << "{\n  \"benchmark\": \"board\",\n"
+        << "  \"cpus\": " << r.cpus << ",\n"
+        << "  \"threads\": " << r.threads << ",\n"
+        << "  \"quantum\": " << r.quantum << ",\n"
+        << "  \"cycles\": " << r.cycles << ",\n"
+        << "  \"quanta\": " << r.quanta << ",\n"
+        << std::setprecision(6) << std::fixed
+        << "  \"single_seconds\": " << r.singleSeconds << ",\n"
+        << "  \"serial_seconds\": " << r.serialSeconds << ",\n"
+        << "  \"parallel_seconds\": " << r.parallelSeconds << ",\n"
+        << "  \"speedup\": " << std::setprecision(3) << r.speedup() << ",\n"
+        << "  \"matched\": " << (r.matched ? "true" : "false") << "\n}\n";
+}
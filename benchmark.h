@@ -0,0 +1,107 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <ostream>
+#include "cpu8085.h"
+
+// Built-in guest program used to measure interpreter throughput
+struct Workload {
+    const char* name;
+    const char* description;
+    const uint8_t* program;
+    size_t size;
+};
+
+struct BenchmarkResult {
+    std::string workload;
+    std::string engine;
+    std::string core;        // CPU8085 specialization, see benchmarkCores()
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;     // Guest T-states per run
+    double seconds = 0.0;    // Best of all repetitions
+    bool halted = false;     // Guest reached HLT within the limit
+    double mips() const { return seconds > 0.0 ? instructions / seconds / 1e6 : 0.0; }
+};
+
+// Short program for the lockstep benchmark, run once per lane on input
+// bytes of the lane's own
+struct LaneWorkload {
+    const char* name;
+    const char* description;
+    const uint8_t* program;
+    size_t size;
+    uint16_t inputAddress;
+    uint16_t inputLength;
+    uint16_t outputAddress;  // Compared between the two runs
+    uint16_t outputLength;
+};
+
+struct LockstepBenchmarkResult {
+    std::string workload;
+    std::string kernel;           // LockstepCPU8085::kernelName()
+    size_t lanes = 0;
+    uint64_t instructions = 0;    // Executed by all lanes together
+    double scalarSeconds = 0.0;   // CPU8085 running the lanes one after another
+    double lockstepSeconds = 0.0; // Both best of all repetitions
+    double lanesPerStep = 0.0;    // Average lanes executing each instruction
+    bool matched = false;         // Every lane ended as it did on CPU8085
+    double scalarLanesPerSecond() const { return scalarSeconds > 0.0 ? lanes / scalarSeconds : 0.0; }
+    double lockstepLanesPerSecond() const { return lockstepSeconds > 0.0 ? lanes / lockstepSeconds : 0.0; }
+    double speedup() const { return lockstepSeconds > 0.0 ? scalarSeconds / lockstepSeconds : 0.0; }
+};
+
+struct BoardBenchmarkResult {
+    size_t cpus = 0;
+    unsigned threads = 0;           // Of the parallel run
+    uint64_t quantum = 0;
+    uint64_t cycles = 0;            // Board time of a run
+    uint64_t quanta = 0;
+    double singleSeconds = 0.0;     // A board of one CPU running the same program
+    double serialSeconds = 0.0;     // This board on one thread
+    double parallelSeconds = 0.0;   // All best of all repetitions
+    bool matched = false;           // The parallel runs ended exactly as the serial one
+    double speedup() const { return parallelSeconds > 0.0 ? serialSeconds / parallelSeconds : 0.0; }
+};
+
+const std::vector<Workload>& builtinWorkloads();
+const std::vector<LaneWorkload>& laneWorkloads();
+
+// Every dispatch engine, in the order the benchmark reports them
+const std::vector<CPU8085::Engine>& allEngines();
+
+// Names of the core specializations runBenchmarks() can measure: plain
+// (CPU8085), counting, tracing and debug (the policy aliases in cpu8085.h)
+const std::vector<std::string>& benchmarkCores();
+
+// Runs every workload (or only those whose name matches filter) repeat times
+// on each of the given engines, using the named core. Returns nothing for an
+// unknown core or filter.
+std::vector<BenchmarkResult> runBenchmarks(int repeat, const std::string& filter,
+                                           const std::vector<CPU8085::Engine>& engines,
+                                           const std::string& core = "plain");
+
+void printBenchmarkTable(std::ostream& out, const std::vector<BenchmarkResult>& results);
+void writeBenchmarkJson(std::ostream& out, const std::vector<BenchmarkResult>& results);
+
+// Runs every lane workload (or the one named filter) for the given number
+// of lanes, each with its own pseudo-random input, on LockstepCPU8085 and on
+// one CPU8085 lane after lane, and checks that both end the same
+std::vector<LockstepBenchmarkResult> runLockstepBenchmarks(int repeat, const std::string& filter, size_t lanes);
+
+void printLockstepTable(std::ostream& out, const std::vector<LockstepBenchmarkResult>& results);
+void writeLockstepJson(std::ostream& out, const std::vector<LockstepBenchmarkResult>& results);
+
+// Runs a ring of cpus CPUs (MultiCpuSystem) that compute, pass a token to
+// the next CPU over a mailbox and post their sums to a shared window, every
+// round: as a board of one CPU, on one thread and on the given threads
+// (0 = one per CPU), and checks that the runs end alike
+BoardBenchmarkResult runBoardBenchmark(int repeat, size_t cpus, uint64_t quantum, unsigned threads);
+
+void printBoardTable(std::ostream& out, const BoardBenchmarkResult& result);
+void writeBoardJson(std::ostream& out, const BoardBenchmarkResult& result);
+
+#endif // BENCHMARK_H
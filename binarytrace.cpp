@@ -0,0 +1,244 @@
+#include "binarytrace.h"
+#include "cpu8085.h"
+#include "opcodes.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/types.h>
+#define TRACE_SEEK(file, offset, whence) fseeko(file, static_cast<off_t>(offset), whence)
+#define TRACE_TELL(file) static_cast<uint64_t>(ftello(file))
+#else
+// Only 2GB traces where long is 32 bits
+#define TRACE_SEEK(file, offset, whence) std::fseek(file, static_cast<long>(offset), whence)
+#define TRACE_TELL(file) static_cast<uint64_t>(std::ftell(file))
+#endif
+
+namespace {
+
+const char kMagic[8] = {'8', '0', '8', '5', 'T', 'R', 'C', '\0'};
+const uint32_t kByteOrder = 0x01020304;
+const size_t kHeaderSize = 32;
+
+} // namespace
+
+TraceWriter::~TraceWriter() {
+    std::string error;
+    close(error);
+}
+
+bool TraceWriter::open(const std::string& filePath, std::string& error) {
+    if (!close(error)) return false;
+    file = std::fopen(filePath.c_str(), "wb");
+    if (!file) {
+        error = "cannot write " + filePath;
+        return false;
+    }
+    path = filePath;
+    uint8_t header[kHeaderSize] = {};
+    const uint32_t fields[] = {kVersion, static_cast<uint32_t>(sizeof(TraceRecord)), kByteOrder};
+    std::memcpy(header, kMagic, sizeof(kMagic));
+    std::memcpy(header + 8, fields, sizeof(fields));
+    failed = std::fwrite(header, 1, kHeaderSize, file) != kHeaderSize;
+    records = 0;
+    closing = false;
+    thread = std::thread(&TraceWriter::writeLoop, this);
+    return true;
+}
+
+bool TraceWriter::close(std::string& error) {
+    if (!file) return true;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        closing = true;
+    }
+    queued.notify_all();
+    thread.join();
+    bool ok = std::fclose(file) == 0 && !failed;
+    file = nullptr;
+    spare.clear();
+    if (!ok) error = "error writing " + path;
+    return ok;
+}
+
+void TraceWriter::exchange(std::vector<TraceRecord>& buffer) {
+    std::unique_lock<std::mutex> guard(mutex);
+    if (!buffer.empty()) {
+        // Only a disk this far behind holds the producer up
+        written.wait(guard, [&] { return queue.size() < kMaxQueued; });
+        queue.push_back(std::move(buffer));
+        queued.notify_one();
+    }
+    if (!spare.empty()) {
+        buffer = std::move(spare.back());
+        spare.pop_back();
+    } else {
+        buffer = std::vector<TraceRecord>();
+    }
+    buffer.clear();
+    buffer.reserve(kBufferRecords);
+}
+
+uint64_t TraceWriter::recordsWritten() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return records;
+}
+
+void TraceWriter::writeLoop() {
+    std::unique_lock<std::mutex> guard(mutex);
+    for (;;) {
+        queued.wait(guard, [&] { return closing || !queue.empty(); });
+        if (queue.empty()) return;  // Closing with nothing left
+        std::vector<TraceRecord> buffer = std::move(queue.front());
+        queue.pop_front();
+        guard.unlock();
+        bool ok = std::fwrite(buffer.data(), sizeof(TraceRecord), buffer.size(), file) == buffer.size();
+        guard.lock();
+        failed = failed || !ok;
+        records += buffer.size();
+        buffer.clear();
+        spare.push_back(std::move(buffer));
+        written.notify_all();
+    }
+}
+
+void BinaryTracer::flushTrace() {
+    if (traceWriter && !traceBuffer.empty()) traceWriter->exchange(traceBuffer);
+}
+
+TraceReader::~TraceReader() {
+    if (file) std::fclose(file);
+}
+
+bool TraceReader::open(const std::string& path, std::string& error) {
+    if (file) std::fclose(file);
+    count = 0;
+    file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        error = "cannot read " + path;
+        return false;
+    }
+    uint8_t header[kHeaderSize];
+    uint32_t fields[3];
+    if (std::fread(header, 1, kHeaderSize, file) != kHeaderSize || std::memcmp(header, kMagic, sizeof(kMagic)) != 0) {
+        error = path + " is not a trace";
+        return false;
+    }
+    std::memcpy(fields, header + 8, sizeof(fields));
+    if (fields[2] != kByteOrder) {
+        error = path + " was recorded on a host with another byte order";
+        return false;
+    }
+    if (fields[0] != TraceWriter::kVersion || fields[1] != sizeof(TraceRecord)) {
+        error = path + " is trace version " + std::to_string(fields[0]) + ", expected " +
+                std::to_string(TraceWriter::kVersion);
+        return false;
+    }
+    if (TRACE_SEEK(file, 0, SEEK_END) != 0) {
+        error = "cannot seek in " + path;
+        return false;
+    }
+    uint64_t size = TRACE_TELL(file);
+    count = size > kHeaderSize ? (size - kHeaderSize) / sizeof(TraceRecord) : 0;
+    seek(0);
+    return true;
+}
+
+bool TraceReader::seek(uint64_t index) {
+    if (!file || index > count) return false;
+    return TRACE_SEEK(file, kHeaderSize + index * sizeof(TraceRecord), SEEK_SET) == 0;
+}
+
+size_t TraceReader::read(TraceRecord* out, size_t max) {
+    return file ? std::fread(out, sizeof(TraceRecord), max, file) : 0;
+}
+
+void formatTraceRecord(const TraceRecord& r, uint64_t index, char* out) {
+    uint8_t code[3] = {r.opcode, r.operands[0], r.operands[1]};
+    char text[kDisassemblySize];
+    int length = disassemble(code, text);
+    char bytes[12];
+    std::snprintf(bytes, sizeof(bytes), "%02X %02X %02X", r.opcode, r.operands[0], r.operands[1]);
+    bytes[length * 3 - 1] = '\0';
+    int used = std::snprintf(out, kTraceLineSize,
+                             "%10llu  %04X  %-8s  %-14s  A=%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%04X F=%02X "
+                             "T=%llu",
+                             static_cast<unsigned long long>(index), r.PC, bytes, text, r.A, r.B, r.C, r.D, r.E,
+                             r.H, r.L, r.SP, r.psw, static_cast<unsigned long long>(r.cycles));
+    for (int i = 0; i < r.writeCount && i < 2 && used < static_cast<int>(kTraceLineSize); i++) {
+        used += std::snprintf(out + used, kTraceLineSize - used, " [%04X]=%02X", r.writeAddress[i], r.writeValue[i]);
+    }
+    if (r.writeCount > 2 && used < static_cast<int>(kTraceLineSize)) {
+        std::snprintf(out + used, kTraceLineSize - used, " +%d", r.writeCount - 2);
+    }
+}
+
+namespace {
+
+// The recorder keeps both bytes after the opcode, but past the instruction's
+// length they are whatever memory followed it and mean nothing
+TraceRecord withUnusedBytesCleared(TraceRecord r) {
+    int length = kOpcodes[r.opcode].length;
+    if (length < 3) r.operands[1] = 0;
+    if (length < 2) r.operands[0] = 0;
+    return r;
+}
+
+bool sameRecord(const TraceRecord& a, const TraceRecord& b) {
+    TraceRecord left = withUnusedBytesCleared(a), right = withUnusedBytesCleared(b);
+    return std::memcmp(&left, &right, sizeof(TraceRecord)) == 0;
+}
+
+} // namespace
+
+std::string traceDifferences(const TraceRecord& a, const TraceRecord& b) {
+    std::string fields;
+    auto check = [&](bool same, const char* name) {
+        if (same) return;
+        if (!fields.empty()) fields += ", ";
+        fields += name;
+    };
+    check(a.PC == b.PC, "PC");
+    TraceRecord left = withUnusedBytesCleared(a), right = withUnusedBytesCleared(b);
+    check(left.opcode == right.opcode && left.operands[0] == right.operands[0] &&
+          left.operands[1] == right.operands[1], "bytes");
+    check(a.A == b.A, "A");
+    check(a.B == b.B && a.C == b.C, "BC");
+    check(a.D == b.D && a.E == b.E, "DE");
+    check(a.H == b.H && a.L == b.L, "HL");
+    check(a.SP == b.SP, "SP");
+    check(a.psw == b.psw, "flags");
+    check(a.cycles == b.cycles, "T-states");
+    check(a.writeCount == b.writeCount && std::memcmp(a.writeAddress, b.writeAddress, sizeof(a.writeAddress)) == 0 &&
+          std::memcmp(a.writeValue, b.writeValue, sizeof(a.writeValue)) == 0, "stores");
+    return fields;
+}
+
+TraceDivergence findTraceDivergence(TraceReader& a, TraceReader& b) {
+    const size_t kChunk = 4096;
+    std::vector<TraceRecord> left(kChunk), right(kChunk);
+    TraceDivergence result;
+    a.seek(0);
+    b.seek(0);
+    for (uint64_t index = 0;;) {
+        size_t leftCount = a.read(left.data(), kChunk);
+        size_t rightCount = b.read(right.data(), kChunk);
+        size_t common = std::min(leftCount, rightCount);
+        if (std::memcmp(left.data(), right.data(), common * sizeof(TraceRecord)) != 0) {
+            for (size_t i = 0; i < common; i++) {
+                if (sameRecord(left[i], right[i])) continue;
+                result.diverged = true;
+                result.index = index + i;
+                return result;
+            }
+        }
+        index += common;
+        if (leftCount != rightCount) {
+            result.diverged = true;
+            result.lengthOnly = true;
+            result.index = index;
+            return result;
+        }
+        if (common == 0) return result;
+    }
+}
@@ -0,0 +1,170 @@
+#ifndef BINARYTRACE_H
+#define BINARYTRACE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cpupolicy.h"
+
+// One executed instruction, 32 bytes: registers and T-states after it, and
+// the first two bytes it stored (PUSH, CALL, SHLD and XTHL store two).
+// Stores made while taking an interrupt are counted with the next instruction.
+struct TraceRecord {
+    uint64_t cycles;
+    uint16_t PC, SP;  // PC is the instruction's address, SP is after it
+    uint8_t opcode;
+    uint8_t operands[2];  // The two bytes after the opcode, whether used or not
+    uint8_t psw;
+    uint8_t A, B, C, D, E, H, L;
+    uint8_t writeCount;  // All stores, up to 255; only the first two are kept
+    uint16_t writeAddress[2];
+    uint8_t writeValue[2];
+    uint8_t reserved[2];
+};
+static_assert(sizeof(TraceRecord) == 32, "trace records are 32 bytes");
+
+// Writes trace files on a background thread. Producers fill whole buffers of
+// records without locking and swap them for empty ones with exchange(); only
+// that swap takes the lock, and it only waits when kMaxQueued buffers are
+// already waiting for the disk.
+//
+// File format, version 1: a 32-byte header (magic "8085TRC\0", version,
+// record size and a byte order tag, 32 bits each, in host order), then the
+// records in host order.
+class TraceWriter {
+public:
+    static const uint32_t kVersion = 1;
+    static const size_t kBufferRecords = 1 << 16;  // 2MB buffers
+    static const size_t kMaxQueued = 64;
+
+    TraceWriter() = default;
+    ~TraceWriter();
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    bool open(const std::string& path, std::string& error);
+    // Writes what was queued and closes the file; false if any write failed
+    bool close(std::string& error);
+
+    // Queues buffer's records (if any) and hands back an empty buffer with
+    // room for kBufferRecords
+    void exchange(std::vector<TraceRecord>& buffer);
+
+    uint64_t recordsWritten() const;
+
+private:
+    std::string path;
+    std::FILE* file = nullptr;
+    mutable std::mutex mutex;
+    std::condition_variable queued;   // A buffer was queued, or closing
+    std::condition_variable written;  // A buffer was written
+    std::deque<std::vector<TraceRecord>> queue;
+    std::vector<std::vector<TraceRecord>> spare;
+    uint64_t records = 0;
+    bool closing = false;
+    bool failed = false;
+    std::thread thread;
+
+    void writeLoop();
+};
+
+// Core policy recording every instruction into a TraceWriter. The records go
+// into a buffer owned by the CPU, so each thread running a CPU fills its own;
+// give each tracing CPU its own writer. Copies (fork()) start without one.
+// Call flushTrace() before closing the writer.
+struct BinaryTracer : CpuPolicy {
+    static constexpr bool kInstructionHooks = true;
+    static constexpr bool kStoreHooks = true;
+
+    TraceWriter* traceWriter = nullptr;
+
+    BinaryTracer() = default;
+    BinaryTracer(const BinaryTracer&) {}
+    BinaryTracer& operator=(const BinaryTracer&) { return *this; }
+
+    // Hands the records buffered so far to the writer
+    void flushTrace();
+
+    template <class Cpu> void onStore(Cpu&, uint16_t address, uint8_t value) {
+        if (pendingWrites < 2) {
+            pendingAddress[pendingWrites] = address;
+            pendingValue[pendingWrites] = value;
+        }
+        if (pendingWrites < 255) pendingWrites++;
+    }
+
+    template <class Cpu> void afterInstruction(Cpu& cpu, uint16_t pc, uint8_t opcode, int) {
+        if (traceWriter) {
+            if (traceBuffer.size() == traceBuffer.capacity()) traceWriter->exchange(traceBuffer);
+            traceBuffer.emplace_back();
+            TraceRecord& r = traceBuffer.back();
+            r.cycles = cpu.cycles;
+            r.PC = pc;
+            r.SP = cpu.SP;
+            r.opcode = opcode;
+            r.operands[0] = cpu.memory.peek(static_cast<uint16_t>(pc + 1));
+            r.operands[1] = cpu.memory.peek(static_cast<uint16_t>(pc + 2));
+            r.psw = cpu.flags.psw;
+            r.A = cpu.A; r.B = cpu.B; r.C = cpu.C; r.D = cpu.D;
+            r.E = cpu.E; r.H = cpu.H; r.L = cpu.L;
+            r.writeCount = pendingWrites;
+            r.writeAddress[0] = pendingWrites > 0 ? pendingAddress[0] : 0;
+            r.writeAddress[1] = pendingWrites > 1 ? pendingAddress[1] : 0;
+            r.writeValue[0] = pendingWrites > 0 ? pendingValue[0] : 0;
+            r.writeValue[1] = pendingWrites > 1 ? pendingValue[1] : 0;
+            r.reserved[0] = r.reserved[1] = 0;
+        }
+        pendingWrites = 0;
+    }
+
+private:
+    std::vector<TraceRecord> traceBuffer;
+    uint8_t pendingWrites = 0;
+    uint16_t pendingAddress[2] = {};
+    uint8_t pendingValue[2] = {};
+};
+
+// Streams records from a trace file, from any index, without holding more
+// than the caller's buffer in memory
+class TraceReader {
+public:
+    TraceReader() = default;
+    ~TraceReader();
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    bool open(const std::string& path, std::string& error);
+    uint64_t size() const { return count; }  // Records in the file
+    bool seek(uint64_t index);
+    // Reads up to max records from the current position; 0 at the end
+    size_t read(TraceRecord* out, size_t max);
+
+private:
+    std::FILE* file = nullptr;
+    uint64_t count = 0;
+};
+
+// Formats a record as one line: index, address, instruction bytes and text,
+// registers, flags, T-states and stores. out should hold at least kTraceLineSize bytes.
+const size_t kTraceLineSize = 160;
+void formatTraceRecord(const TraceRecord& record, uint64_t index, char* out);
+
+// Names of the fields two records differ in, comma separated
+std::string traceDifferences(const TraceRecord& a, const TraceRecord& b);
+
+struct TraceDivergence {
+    bool diverged = false;
+    uint64_t index = 0;  // First record that differs, or the shorter length
+    bool lengthOnly = false;  // One trace is a prefix of the other
+};
+
+// Streams both traces and finds the first record where they differ
+TraceDivergence findTraceDivergence(TraceReader& a, TraceReader& b);
+
+#endif // BINARYTRACE_H
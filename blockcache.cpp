@@ -0,0 +1,139 @@
+#include "blockcache.h"
+#include <algorithm>
+
+template <class Cpu>
+BasicBlockCache<Cpu>::BasicBlockCache() : blockAt(65536, -1) {
+}
+
+template <class Cpu>
+void BasicBlockCache<Cpu>::flush() {
+    ops.clear();
+    blocks.clear();
+    std::fill(blockAt.begin(), blockAt.end(), -1);
+    for (auto& list : pageBlocks) list.clear();
+}
+
+template <class Cpu>
+void BasicBlockCache<Cpu>::invalidatePage(uint8_t page) {
+    for (int32_t index : pageBlocks[page]) {
+        Block& block = blocks[index];
+        if (block.valid) {
+            block.valid = false;
+            blockAt[block.start] = -1;
+        }
+    }
+    pageBlocks[page].clear();
+}
+
+template <class Cpu>
+int32_t BasicBlockCache<Cpu>::decode(Cpu& cpu, uint16_t address) {
+    if (blocks.size() >= kMaxBlocks) {
+        flush();
+        cpu.codePages.fill(0);
+    }
+
+    Block block;
+    block.start = address;
+    block.last = address;
+    block.firstOp = static_cast<uint32_t>(ops.size());
+    block.count = 0;
+    block.maxCycles = 0;
+    block.valid = true;
+    int32_t index = static_cast<int32_t>(blocks.size());
+
+    uint16_t pc = address;
+    int lastPage = -1;
+    while (block.count < kMaxBlockOps) {
+        // Code in device pages is fetched through the device every time
+        if (cpu.memory.pageKind(pc >> 8) == GuestMemory::PageKind::Device) break;
+        uint8_t opcode = cpu.memory[pc];
+        int length = Cpu::instructionLength(opcode);
+        uint16_t last = static_cast<uint16_t>(pc + length - 1);
+        if (cpu.memory.pageKind(last >> 8) == GuestMemory::PageKind::Device) break;
+
+        MicroOp op;
+        op.fn = Cpu::microOpTable[opcode];
+        op.opcode = opcode;
+        op.operand = 0;
+        if (length == 2) {
+            op.operand = cpu.memory[static_cast<uint16_t>(pc + 1)];
+        } else if (length == 3) {
+            op.operand = cpu.memory[static_cast<uint16_t>(pc + 1)] |
+                         (cpu.memory[static_cast<uint16_t>(pc + 2)] << 8);
+        }
+        op.nextPC = static_cast<uint16_t>(pc + length);
+        ops.push_back(op);
+        block.last = pc;
+
+        // Register every page holding a byte of this instruction
+        for (int i = 0; i < length; i++) {
+            int page = static_cast<uint16_t>(pc + i) >> 8;
+            if (page != lastPage) {
+                if (pageBlocks[page].empty() || pageBlocks[page].back() != index) {
+                    pageBlocks[page].push_back(index);
+                }
+                cpu.codePages[page] = 1;
+                lastPage = page;
+            }
+        }
+
+        block.count++;
+        block.maxCycles += Cpu::baseCycles(opcode) + Cpu::takenExtraCycles(opcode);
+        pc = op.nextPC;
+        if (Cpu::endsBlock(opcode)) break;
+    }
+
+    blocks.push_back(block);
+    blockAt[address] = index;
+    return index;
+}
+
+template <class Cpu>
+uint64_t BasicBlockCache<Cpu>::run(Cpu& cpu, uint64_t cycleBudget) {
+    uint64_t start = cpu.cycles;
+    uint64_t target = start + cycleBudget;
+    while (!cpu.exitRun && cpu.cycles < target) {
+        int32_t index = blockAt[cpu.PC];
+        if (index < 0) index = decode(cpu, cpu.PC);
+        const Block& block = blocks[index];
+
+        // Near the end of the budget, step so run() stops on exactly the same
+        // instruction as the other engines. Empty blocks start at code that
+        // has to be fetched through a device.
+        if (target - cpu.cycles < block.maxCycles || block.count == 0) {
+            if constexpr (Cpu::kInstructionHooks) {
+                if (!cpu.beforeInstruction() && cpu.cycles != cpu.runStart) break;
+            }
+            cpu.executeNext();
+            continue;
+        }
+
+        cpu.leaveBlock = false;
+        const MicroOp* op = &ops[block.firstOp];
+        const MicroOp* end = op + block.count;
+        bool hooked = Cpu::kInstructionHooks;
+        if constexpr (Cpu::kSparseHooks) hooked = cpu.wantsInstructions(block.start, block.last);
+        if (hooked) {
+            for (; op != end; ++op) {
+                if (!cpu.beforeInstruction() && cpu.cycles != cpu.runStart) return cpu.cycles - start;
+                uint16_t pc = cpu.PC;
+                cpu.PC = op->nextPC;
+                int states = op->fn(cpu, op->operand);
+                cpu.cycles += states;
+                cpu.afterInstruction(pc, op->opcode, states);
+                if (cpu.leaveBlock) break;
+            }
+        } else {
+            for (; op != end; ++op) {
+                cpu.PC = op->nextPC;
+                cpu.cycles += op->fn(cpu, op->operand);
+                if (cpu.leaveBlock) break;
+            }
+        }
+    }
+    return cpu.cycles - start;
+}
+
+#define BLOCKCACHE_INSTANTIATE(...) template class BasicBlockCache<BasicCPU8085<__VA_ARGS__>>;
+CPU8085_SPECIALIZATIONS(BLOCKCACHE_INSTANTIATE)
+#undef BLOCKCACHE_INSTANTIATE
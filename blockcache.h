@@ -0,0 +1,72 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include "cpu8085.h"
+
+// Predecoded engine: straight-line runs of guest code ("blocks") are decoded
+// once into arrays of micro-ops (handler pointer + operand + next PC) and then
+// executed without fetching or decoding. A block ends after any instruction
+// that can change PC (jumps, calls, returns, RST, PCHL) or halt, or after
+// kMaxBlockOps instructions, and before any instruction with a byte in a
+// device page (those are stepped, fetching through the device).
+//
+// Self-modifying code: every page a block covers is marked in
+// CPU8085::codePages. A store to a marked page drops all blocks on it and
+// stops the running block after the current instruction, so the next fetch
+// sees the new bytes.
+//
+// Specializations with instruction hooks run each micro-op through them, and
+// blocks are cut short when a hook stops the run. Sparse hooks (breakpoints)
+// are only run for blocks some policy wants, so the other blocks run as
+// fast as on the plain core.
+template <class Cpu>
+class BasicBlockCache {
+public:
+    BasicBlockCache();
+
+    // Same contract as Cpu::run()
+    uint64_t run(Cpu& cpu, uint64_t cycleBudget);
+
+    void invalidatePage(uint8_t page);
+    void flush();
+
+    size_t blockCount() const { return blocks.size(); }
+
+private:
+    static const int kMaxBlockOps = 32;
+    static const size_t kMaxBlocks = 8192;  // Flush everything past this
+
+    struct MicroOp {
+        typename Cpu::MicroOpFn fn;
+        uint16_t operand;
+        uint16_t nextPC;  // PC after this instruction's bytes
+        uint8_t opcode;   // For the instruction hooks
+    };
+
+    struct Block {
+        uint16_t start;
+        uint16_t last;     // Address of the last instruction
+        uint32_t firstOp;  // Index into ops
+        uint16_t count;
+        uint16_t maxCycles;  // T-states if every conditional is taken
+        bool valid;
+    };
+
+    std::vector<MicroOp> ops;
+    std::vector<Block> blocks;
+    std::vector<int32_t> blockAt;  // Start address -> block index, -1 if none
+    std::array<std::vector<int32_t>, 256> pageBlocks;
+
+    int32_t decode(Cpu& cpu, uint16_t address);
+};
+
+using BlockCache = BasicBlockCache<CPU8085>;
+
+#define BLOCKCACHE_EXTERN_TEMPLATE(...) extern template class BasicBlockCache<BasicCPU8085<__VA_ARGS__>>;
+CPU8085_SPECIALIZATIONS(BLOCKCACHE_EXTERN_TEMPLATE)
+#undef BLOCKCACHE_EXTERN_TEMPLATE
+
+#endif // BLOCKCACHE_H
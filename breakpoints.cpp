@@ -0,0 +1,310 @@
+#include "breakpoints.h"
+#include "cpu8085.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+#include <utility>
+
+void AddressBitmap::setRange(uint16_t first, uint16_t last) {
+    for (uint32_t address = first; address <= last; address++) set(static_cast<uint16_t>(address));
+}
+
+bool AddressBitmap::any(uint16_t first, uint16_t last) const {
+    if (last < first) return any(first, 0xFFFF) || any(0, last);
+    unsigned low = first >> 6, high = last >> 6;
+    uint64_t firstMask = ~uint64_t(0) << (first & 63);
+    uint64_t lastMask = ~uint64_t(0) >> (63 - (last & 63));
+    if (low == high) return (words[low] & firstMask & lastMask) != 0;
+    if (words[low] & firstMask) return true;
+    for (unsigned i = low + 1; i < high; i++) {
+        if (words[i]) return true;
+    }
+    return (words[high] & lastMask) != 0;
+}
+
+// Recursive descent over the token stream, emitting the stack program in
+// postfix order. Each level handles one precedence, lowest first.
+struct DebugCondition::Parser {
+    const std::string& text;
+    size_t pos = 0;
+    std::vector<Step>& code;
+    size_t depth = 0;  // Stack entries after the code emitted so far
+    size_t nesting = 0;  // Recursion below the current level
+    std::string error;
+
+    Parser(const std::string& source, std::vector<Step>& out) : text(source), code(out) {}
+
+    void skipSpace() {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) pos++;
+    }
+    bool accept(const char* symbol) {
+        skipSpace();
+        size_t length = std::char_traits<char>::length(symbol);
+        if (text.compare(pos, length, symbol) != 0) return false;
+        // Keep "<" from matching the start of "<=", "&" of "&&" and so on
+        if (length == 1 && pos + 1 < text.size()) {
+            char next = text[pos + 1];
+            if ((symbol[0] == '<' || symbol[0] == '>' || symbol[0] == '!') && next == '=') return false;
+            if ((symbol[0] == '&' || symbol[0] == '|') && next == symbol[0]) return false;
+        }
+        pos += length;
+        return true;
+    }
+    bool fail(const std::string& what) {
+        if (error.empty()) error = what + " at column " + std::to_string(pos + 1);
+        return false;
+    }
+    bool emit(Op op, uint16_t operand = 0) {
+        code.push_back({op, operand});
+        if (op == Op::Constant || op == Op::Register) {
+            if (++depth > kMaxStack) return fail("expression too deep");
+        } else if (op != Op::Memory && op != Op::Not && op != Op::Negate && op != Op::Complement) {
+            depth--;  // Binary: two in, one out
+        }
+        return true;
+    }
+
+    // The recursing rules go through here, so a pasted or typed condition
+    // cannot run the stack out
+    template <class Inner>
+    bool nested(Inner inner) {
+        if (++nesting > kMaxNesting) return fail("expression too deep");
+        bool ok = inner();
+        nesting--;
+        return ok;
+    }
+
+    // Each level: operand (op operand)*
+    template <class Next>
+    bool binary(Next next, std::initializer_list<std::pair<const char*, Op>> ops) {
+        if (!next()) return false;
+        for (;;) {
+            bool matched = false;
+            for (const auto& candidate : ops) {
+                if (!accept(candidate.first)) continue;
+                if (!next() || !emit(candidate.second)) return false;
+                matched = true;
+                break;
+            }
+            if (!matched) return true;
+        }
+    }
+
+    bool logicalOr() { return binary([&] { return logicalAnd(); }, {{"||", Op::LogicalOr}}); }
+    bool logicalAnd() { return binary([&] { return bitOr(); }, {{"&&", Op::LogicalAnd}}); }
+    bool bitOr() { return binary([&] { return bitXor(); }, {{"|", Op::Or}}); }
+    bool bitXor() { return binary([&] { return bitAnd(); }, {{"^", Op::Xor}}); }
+    bool bitAnd() { return binary([&] { return equality(); }, {{"&", Op::And}}); }
+    bool equality() {
+        return binary([&] { return relation(); }, {{"==", Op::Equal}, {"!=", Op::NotEqual}});
+    }
+    bool relation() {
+        return binary([&] { return sum(); }, {{"<=", Op::LessEqual}, {">=", Op::GreaterEqual},
+                                              {"<", Op::Less}, {">", Op::Greater}});
+    }
+    bool sum() { return binary([&] { return unary(); }, {{"+", Op::Add}, {"-", Op::Subtract}}); }
+
+    bool unary() {
+        if (accept("!")) return nested([&] { return unary(); }) && emit(Op::Not);
+        if (accept("-")) return nested([&] { return unary(); }) && emit(Op::Negate);
+        if (accept("~")) return nested([&] { return unary(); }) && emit(Op::Complement);
+        return primary();
+    }
+
+    bool primary() {
+        skipSpace();
+        if (accept("(")) return nested([&] { return logicalOr(); }) && (accept(")") || fail("expected )"));
+        if (accept("[")) {
+            return nested([&] { return logicalOr(); }) && (accept("]") || fail("expected ]")) && emit(Op::Memory);
+        }
+        if (pos >= text.size()) return fail("expected a value");
+        size_t start = pos;
+        while (pos < text.size() && std::isalnum(static_cast<unsigned char>(text[pos]))) pos++;
+        std::string word = text.substr(start, pos - start);
+        if (word.empty()) return fail("unexpected '" + text.substr(start, 1) + "'");
+        if (std::isdigit(static_cast<unsigned char>(word[0]))) {
+            // Decimal unless 0x or h says hex, as in the assembler: 010 is ten
+            int base = 10;
+            if (word.size() > 2 && word[0] == '0' && (word[1] == 'x' || word[1] == 'X')) {
+                base = 16;
+            } else if (word.back() == 'h' || word.back() == 'H') {
+                word.pop_back();
+                base = 16;
+            }
+            char* end = nullptr;
+            unsigned long value = std::strtoul(word.c_str(), &end, base);
+            if (!end || *end != '\0' || value > 0xFFFF) {
+                pos = start;
+                return fail("bad number");
+            }
+            return emit(Op::Constant, static_cast<uint16_t>(value));
+        }
+        for (char& c : word) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        static const char* const names[] = {"A", "B", "C", "D", "E", "H", "L", "F", "BC", "DE", "HL",
+                                            "SP", "PC", "S", "Z", "AC", "P", "CY", "VALUE"};
+        for (uint16_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            if (word == names[i]) return emit(Op::Register, i);
+        }
+        if (word == "M") return emit(Op::Register, 10) && emit(Op::Memory);  // [HL]
+        pos = start;
+        return fail("unknown name '" + word + "'");
+    }
+};
+
+bool DebugCondition::parse(const std::string& text, std::string& error) {
+    std::vector<Step> parsed;
+    Parser parser(text, parsed);
+    parser.skipSpace();
+    if (parser.pos < text.size()) {
+        if (!parser.logicalOr()) {
+            error = parser.error;
+            return false;
+        }
+        parser.skipSpace();
+        if (parser.pos < text.size()) {
+            parser.fail("unexpected '" + text.substr(parser.pos, 1) + "'");
+            error = parser.error;
+            return false;
+        }
+    }
+    code = std::move(parsed);
+    source = text;
+    return true;
+}
+
+bool DebugCondition::holds(const DebugRegisters& r, uint8_t value, const GuestMemory& memory) const {
+    if (code.empty()) return true;
+    CPU8085Base::Flags flags;
+    flags.psw = r.psw;
+    const int32_t registers[] = {r.A, r.B, r.C, r.D, r.E, r.H, r.L, r.psw,
+                                 (r.B << 8) | r.C, (r.D << 8) | r.E, (r.H << 8) | r.L, r.SP, r.PC,
+                                 flags.S(), flags.Z(), flags.AC(), flags.P(), flags.CY(), value};
+    int32_t stack[kMaxStack];
+    size_t top = 0;  // Entries in use; parse() checked the program never overflows
+    for (const Step& step : code) {
+        switch (step.op) {
+            case Op::Constant: stack[top++] = step.operand; continue;
+            case Op::Register: stack[top++] = registers[step.operand]; continue;
+            case Op::Memory: stack[top - 1] = memory.peek(static_cast<uint16_t>(stack[top - 1])); continue;
+            case Op::Not: stack[top - 1] = !stack[top - 1]; continue;
+            case Op::Negate: stack[top - 1] = -stack[top - 1]; continue;
+            case Op::Complement: stack[top - 1] = ~stack[top - 1]; continue;
+            default: break;
+        }
+        int32_t b = stack[--top];
+        int32_t& a = stack[top - 1];
+        switch (step.op) {
+            case Op::Add: a += b; break;
+            case Op::Subtract: a -= b; break;
+            case Op::And: a &= b; break;
+            case Op::Xor: a ^= b; break;
+            case Op::Or: a |= b; break;
+            case Op::Equal: a = a == b; break;
+            case Op::NotEqual: a = a != b; break;
+            case Op::Less: a = a < b; break;
+            case Op::LessEqual: a = a <= b; break;
+            case Op::Greater: a = a > b; break;
+            case Op::GreaterEqual: a = a >= b; break;
+            case Op::LogicalAnd: a = a && b; break;
+            case Op::LogicalOr: a = a || b; break;
+            default: break;
+        }
+    }
+    return stack[0] != 0;
+}
+
+const char* breakKindName(BreakKind kind) {
+    switch (kind) {
+        case BreakKind::Execute: return "exec";
+        case BreakKind::Read: return "read";
+        case BreakKind::Write: return "write";
+        case BreakKind::Input: return "in";
+        case BreakKind::Output: return "out";
+    }
+    return "?";
+}
+
+std::string formatDebugHit(const DebugHit& h) {
+    const DebugRegisters& r = h.registers;
+    char line[160];
+    std::snprintf(line, sizeof(line),
+                  "#%d %-5s %04X=%02X hit %llu%s  A=%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%04X F=%02X "
+                  "PC=%04X T=%llu",
+                  h.id, breakKindName(h.kind), h.address, h.value, static_cast<unsigned long long>(h.hits),
+                  h.stopped ? " stop" : "", r.A, r.B, r.C, r.D, r.E, r.H, r.L, r.SP, r.psw, r.PC,
+                  static_cast<unsigned long long>(h.cycles));
+    return line;
+}
+
+int Breakpoints::addBreakpoint(Breakpoint breakpoint) {
+    breakpoint.id = nextId++;
+    breakpoint.hits = 0;
+    entries.push_back(std::move(breakpoint));
+    rebuild();
+    return entries.back().id;
+}
+
+int Breakpoints::addBreakpoint(uint16_t address) {
+    Breakpoint breakpoint;
+    breakpoint.first = breakpoint.last = address;
+    return addBreakpoint(std::move(breakpoint));
+}
+
+bool Breakpoints::removeBreakpoint(int id) {
+    auto found = std::find_if(entries.begin(), entries.end(), [&](const Breakpoint& b) { return b.id == id; });
+    if (found == entries.end()) return false;
+    entries.erase(found);
+    rebuild();
+    return true;
+}
+
+void Breakpoints::clearBreakpoints() {
+    entries.clear();
+    rebuild();
+}
+
+bool Breakpoints::breakpointAt(uint16_t address) const {
+    if (!execute[address]) return false;
+    for (const Breakpoint& b : entries) {
+        if (b.kind == BreakKind::Execute && !b.logOnly && address >= b.first && address <= b.last) return true;
+    }
+    return false;
+}
+
+void Breakpoints::rebuild() {
+    execute.reset();
+    reads.reset();
+    writes.reset();
+    inputs.reset();
+    outputs.reset();
+    for (const Breakpoint& b : entries) {
+        switch (b.kind) {
+            case BreakKind::Execute: execute.setRange(b.first, b.last); break;
+            case BreakKind::Read: reads.setRange(b.first, b.last); break;
+            case BreakKind::Write: writes.setRange(b.first, b.last); break;
+            case BreakKind::Input:
+            case BreakKind::Output:
+                for (unsigned port = b.first; port <= std::min<unsigned>(b.last, 0xFF); port++) {
+                    (b.kind == BreakKind::Input ? inputs : outputs).set(port);
+                }
+                break;
+        }
+    }
+}
+
+bool Breakpoints::hit(BreakKind kind, uint16_t address, uint8_t value, const DebugRegisters& registers,
+                      const GuestMemory& memory, uint64_t cycles) {
+    bool stop = false;
+    for (Breakpoint& b : entries) {
+        if (b.kind != kind || address < b.first || address > b.last) continue;
+        if (!b.condition.holds(registers, value, memory)) continue;
+        b.hits++;
+        bool stops = !b.logOnly && b.hits >= b.hitCount;
+        stop = stop || stops;
+        if (hitHandler) hitHandler({b.id, kind, address, value, stops, b.hits, cycles, registers});
+    }
+    breakRequested = breakRequested || stop;
+    return stop;
+}
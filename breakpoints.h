@@ -0,0 +1,183 @@
+#ifndef BREAKPOINTS_H
+#define BREAKPOINTS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <bitset>
+#include <functional>
+#include <string>
+#include <vector>
+#include "cpupolicy.h"
+#include "guestmemory.h"
+
+// One bit per 64K address
+class AddressBitmap {
+public:
+    bool operator[](uint16_t address) const { return (words[address >> 6] >> (address & 63)) & 1; }
+    void set(uint16_t address) { words[address >> 6] |= uint64_t(1) << (address & 63); }
+    void setRange(uint16_t first, uint16_t last);  // first <= last
+    // Any address from first to last set, wrapping past FFFFh when last < first
+    bool any(uint16_t first, uint16_t last) const;
+    void reset() { words.fill(0); }
+
+private:
+    std::array<uint64_t, 1024> words = {};
+};
+
+// Registers as a debug condition or hit report sees them
+struct DebugRegisters {
+    uint8_t A, B, C, D, E, H, L, psw;
+    uint16_t SP, PC;
+};
+
+// A condition on registers, flags and memory, parsed once and evaluated as
+// a small stack program. Syntax is C-like, on 32-bit signed integers:
+//   A B C D E H L  BC DE HL SP PC  F (flag byte)  M (the byte at HL)
+//   S Z AC P CY    flags, 0 or 1
+//   VALUE          the byte read or written, for watchpoints
+//   [expr]         the byte at address expr
+//   ! - ~  + -  &  ^  |  == != < <= > >=  &&  ||  ( )
+// Names are not case sensitive. Numbers start with a digit and are decimal
+// unless written as hex: 10, 010 (ten), 0x1F, 1Fh.
+class DebugCondition {
+public:
+    // An empty text always holds
+    bool parse(const std::string& text, std::string& error);
+    bool empty() const { return code.empty(); }
+    const std::string& text() const { return source; }
+    bool holds(const DebugRegisters& registers, uint8_t value, const GuestMemory& memory) const;
+
+private:
+    struct Parser;
+    enum class Op : uint8_t {
+        Constant, Register, Memory, Not, Negate, Complement,
+        Add, Subtract, And, Xor, Or, Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual,
+        LogicalAnd, LogicalOr
+    };
+    struct Step {
+        Op op;
+        uint16_t operand;  // Constant, or register index for Register
+    };
+    static const size_t kMaxStack = 32;
+    static const size_t kMaxNesting = 64;  // Parentheses, brackets and unary operators
+
+    std::vector<Step> code;
+    std::string source;
+};
+
+// What a breakpoint watches. Read and Write are program data accesses
+// (instruction fetches do not count); Input and Output are IN and OUT.
+enum class BreakKind : uint8_t { Execute, Read, Write, Input, Output };
+const char* breakKindName(BreakKind kind);
+
+struct Breakpoint {
+    BreakKind kind = BreakKind::Execute;
+    uint16_t first = 0, last = 0;  // Address range, or ports 00h-FFh
+    DebugCondition condition;      // Accesses only count as hits while it holds
+    uint64_t hitCount = 1;         // Stop from this hit on
+    bool logOnly = false;          // Tracepoint: report hits but never stop
+    int id = 0;                    // Assigned by addBreakpoint()
+    uint64_t hits = 0;
+};
+
+struct DebugHit {
+    int id;            // Of the breakpoint
+    BreakKind kind;
+    uint16_t address;  // PC for Execute, else the memory address or port
+    uint8_t value;     // Opcode for Execute, else the byte read or written
+    bool stopped;      // false for tracepoints and hits before hitCount
+    uint64_t hits;     // Including this one
+    uint64_t cycles;
+    DebugRegisters registers;  // For accesses PC is already past the instruction
+};
+
+// One line: id, kind, address, value, hit number, registers and T-states
+std::string formatDebugHit(const DebugHit& hit);
+
+// Breakpoints, watchpoints and tracepoints, as a core policy. Every kind has
+// a bitmap of the addresses (or ports) something watches, so an instruction
+// or access nobody watches costs one bit test; only a set bit looks at the
+// breakpoint list, conditions and hit counts.
+//
+// An execution breakpoint stops run() before the instruction, leaving PC on
+// it; a watchpoint stops it after the instruction making the access. A run
+// never stops on its first instruction, so running again after a stop goes
+// on past it, and step() always executes. Hits are passed to hitHandler,
+// on the thread running the CPU; it must not touch the CPU.
+//
+// The hooks are sparse: the predecoded engine runs blocks with no execution
+// breakpoint in them without instruction hooks at all.
+class Breakpoints : public CpuPolicy {
+public:
+    static constexpr bool kInstructionHooks = true;
+    static constexpr bool kLoadHooks = true;
+    static constexpr bool kStoreHooks = true;
+    static constexpr bool kPortHooks = true;
+    static constexpr bool kSparseHooks = true;
+
+    std::function<void(const DebugHit&)> hitHandler;
+    bool breakRequested = false;  // Set by every stopping hit; cleared by the host
+
+    // Returns the breakpoint's id
+    int addBreakpoint(Breakpoint breakpoint);
+    int addBreakpoint(uint16_t address);  // Plain execution breakpoint
+    bool removeBreakpoint(int id);
+    void clearBreakpoints();
+    const std::vector<Breakpoint>& breakpointList() const { return entries; }
+    // Some execution breakpoint other than a tracepoint covers address,
+    // whatever its condition
+    bool breakpointAt(uint16_t address) const;
+
+    template <class Cpu> bool beforeInstruction(Cpu& cpu) {
+        // A run never stops on its first instruction, not even for a
+        // watchpoint hit at the end of the last one
+        bool resuming = cpu.cycles == cpu.runStart;
+        if (pendingStop) {
+            pendingStop = false;
+            if (!resuming) return false;
+        }
+        if (resuming || !execute[cpu.PC]) return true;
+        return !hit(cpu, BreakKind::Execute, cpu.PC, cpu.memory.peek(cpu.PC));
+    }
+    template <class Cpu> bool wantsInstructions(Cpu&, uint16_t first, uint16_t last) const {
+        return pendingStop || execute.any(first, last);
+    }
+    template <class Cpu> void onLoad(Cpu& cpu, uint16_t address, uint8_t value) {
+        if (reads[address]) access(cpu, BreakKind::Read, address, value);
+    }
+    template <class Cpu> void onStore(Cpu& cpu, uint16_t address, uint8_t value) {
+        if (writes[address]) access(cpu, BreakKind::Write, address, value);
+    }
+    template <class Cpu> void onInput(Cpu& cpu, uint8_t port, uint8_t& value) {
+        if (inputs[port]) access(cpu, BreakKind::Input, port, value);
+    }
+    template <class Cpu> void onOutput(Cpu& cpu, uint8_t port, uint8_t value) {
+        if (outputs[port]) access(cpu, BreakKind::Output, port, value);
+    }
+
+private:
+    AddressBitmap execute, reads, writes;
+    std::bitset<256> inputs, outputs;
+    std::vector<Breakpoint> entries;
+    int nextId = 1;
+    bool pendingStop = false;  // A watchpoint hit: stop before the next instruction
+
+    void rebuild();
+    // Counts and reports the hits of every breakpoint of kind covering
+    // address; true if one of them stops
+    bool hit(BreakKind kind, uint16_t address, uint8_t value, const DebugRegisters& registers,
+             const GuestMemory& memory, uint64_t cycles);
+    template <class Cpu> bool hit(Cpu& cpu, BreakKind kind, uint16_t address, uint8_t value) {
+        DebugRegisters registers = {cpu.A, cpu.B, cpu.C, cpu.D, cpu.E, cpu.H, cpu.L,
+                                    cpu.flags.psw, cpu.SP, cpu.PC};
+        return hit(kind, address, value, registers, cpu.memory, cpu.cycles);
+    }
+    template <class Cpu> void access(Cpu& cpu, BreakKind kind, uint16_t address, uint8_t value) {
+        if (!hit(cpu, kind, address, value)) return;
+        pendingStop = true;
+        cpu.requestExit();
+    }
+};
+
+#endif // BREAKPOINTS_H
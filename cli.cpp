@@ -0,0 +1,1066 @@
+// Headless 8085 runner: loads an image, runs it without Qt and reports throughput
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <cstdio>
+#include <type_traits>
+#include "cpu8085.h"
+#include "assembler.h"
+#include "devices.h"
+#include "loader.h"
+#include "batch.h"
+#include "benchmark.h"
+#include "multicpu.h"
+#include "superopt.h"
+#include "pacer.h"
+#include "savestate.h"
+#include "selftest.h"
+
+namespace {
+
+struct MemoryRange {
+    uint16_t start;
+    uint32_t length;
+};
+
+struct Options {
+    std::string image;
+    uint16_t origin = 0x0000;
+    bool hasStart = false;
+    uint16_t start = 0x0000;
+    bool hasMaxInstructions = false;  // Runs the counting core
+    uint64_t maxInstructions = UINT64_MAX;
+    std::string tracePath;  // Runs the tracing core; - for stdout
+    std::string binaryTracePath;  // Runs the binary tracing core
+    std::string profilePath;  // Runs the profiling core; - for stdout
+    std::string foldedPath;
+    uint64_t maxCycles = 1000000000ULL;
+    double clockHz = 0.0;  // 0 = run unpaced
+    bool hasEngine = false;
+    CPU8085::Engine engine = CPU8085::defaultEngine;
+    bool jitVerify = false;
+    bool skipLoops = false;
+    std::vector<MemoryRange> dumps;
+    std::vector<MemoryRange> roms;  // Pages covering these are read-only
+    bool quiet = false;
+    bool hasTimer = false;  // IntervalTimer on RST 7.5
+    uint8_t timerPort = 0;
+    bool hasUart = false;   // Uart to stdout, rx on RST 6.5
+    uint8_t uartPort = 0;
+    uint64_t uartBaud = 9600;
+    std::string uartInputPath;
+    std::string loadStatePath;  // Resume from this instead of loading an image
+    std::string saveStatePath;
+    uint64_t back = 0;  // Instructions to step back after the run
+    bool hasBackTo = false;  // Run back to this address after the run
+    uint16_t backTo = 0;
+    bool hasHistory = false;
+    uint64_t history = 0;
+    std::vector<Breakpoint> breakpoints;  // Runs the debug core
+
+    bool bench = false;
+    std::string core = "plain";
+    int repeat = 3;
+    std::string workload;
+    std::string jsonPath;
+
+    bool selfTest = false;
+    bool conformance = false;
+
+    std::string batchPath;  // Jobs file for --batch
+    unsigned threads = 0;
+    double maxSeconds = 0.0;
+    bool lockstep = false;  // Batch jobs, or the benchmark, on the lockstep core
+    size_t lanes = 1024;
+    size_t cpus = 0;  // Board benchmark with this many CPUs
+    uint64_t quantum = MultiCpuSystem::kDefaultQuantum;
+
+    std::string assemblePath;  // Write the assembled image here instead of running it
+    std::string listingPath;
+    std::string assembleBatchPath;  // Sources file for --assemble-batch
+
+    std::string superoptPath;  // Assembly source of the sequence to improve
+    SuperoptOptions superopt;
+};
+
+void printUsage(const char* argv0) {
+    std::cerr
+        << "Usage: " << argv0 << " [options] IMAGE\n"
+        << "       " << argv0 << " [options] --load-state FILE\n"
+        << "       " << argv0 << " --bench [--repeat N] [--workload NAME] [--core NAME] [--json FILE]\n"
+        << "       " << argv0 << " --bench --lockstep [--lanes N] [--repeat N] [--workload NAME] [--json FILE]\n"
+        << "       " << argv0 << " --bench --cpus N [--quantum T] [--threads N] [--repeat N] [--json FILE]\n"
+        << "       " << argv0 << " --batch JOBS [--threads N] [--max-seconds S] [--dump START:LEN] [--lockstep]\n"
+        << "       " << argv0 << " --assemble OUT [--listing FILE] SOURCE\n"
+        << "       " << argv0 << " --assemble-batch LIST [--threads N]\n"
+        << "       " << argv0 << " --superopt SOURCE [--live LIST] [--max-length N] [--cost bytes|cycles]\n"
+        << "                      [--threads N]\n"
+        << "       " << argv0 << " --conformance [--threads N]\n"
+        << "\n"
+        << "IMAGE is Intel HEX (.hex, .ihx), assembly source (.asm, .s, .a85) or raw binary.\n"
+        << "\n"
+        << "Run options:\n"
+        << "  --org ADDR               load address for raw binary images, and the address\n"
+        << "                           assembly starts at before any ORG (default 0)\n"
+        << "  --start ADDR             initial PC (default: HEX start record or load address)\n"
+        << "  --max-instructions N     stop after N instructions (runs the counting core)\n"
+        << "  --max-cycles N           stop after N T-states (default 1000000000)\n"
+        << "  --clock HZ               pace execution to HZ (e.g. 3.072e6 or 3.072MHz)\n"
+        << "  --dump START:LEN         dump LEN bytes of memory from START after the run\n"
+        << "  --rom START:LEN          make the 256-byte pages covering the range read-only\n"
+        << "  --quiet                  only print the final state\n"
+        << "  --engine NAME            dispatch engine: switch, threaded, function-table,\n"
+        << "                           predecoded or jit\n"
+        << "                           (with --bench: only that engine, default all)\n"
+        << "  --jit-verify             check every JIT block against the interpreter\n"
+        << "  --skip-loops             fast-forward delay and polling loops, with the same\n"
+        << "                           result as running them (plain core and --batch)\n"
+        << "  --trace FILE             log every instruction and port access to FILE\n"
+        << "                           (- for stdout; runs the tracing core)\n"
+        << "  --trace-bin FILE         record every instruction to a binary trace FILE\n"
+        << "                           (read it with 8085_trace)\n"
+        << "  --profile FILE           write opcode, address and routine profiles to FILE\n"
+        << "                           (- for stdout; runs the profiling core)\n"
+        << "  --profile-folded FILE    write the call stacks as flame graph input to FILE\n"
+        << "  --timer PORT             interval timer at PORT..PORT+2, interrupting on RST 7.5\n"
+        << "  --uart PORT[:BAUD]       serial port at PORT/PORT+1 (default 9600 baud) sending\n"
+        << "                           to stdout, receive interrupt on RST 6.5\n"
+        << "  --uart-input FILE        bytes the --uart port receives, one frame apart\n"
+        << "  --save-state FILE        save the machine to FILE after the run\n"
+        << "  --load-state FILE        resume a saved machine instead of loading IMAGE\n"
+        << "  --back N                 step back N instructions after the run\n"
+        << "  --back-to ADDR           after the run, go back to the last time PC was ADDR\n"
+        << "  --history N              instructions kept for stepping back (default 1048576)\n"
+        << "  --break ADDR[:COND]      stop before executing ADDR (while COND holds)\n"
+        << "  --tracepoint ADDR[:COND] print the registers at ADDR and carry on\n"
+        << "  --watch-read RANGE[:COND], --watch-write RANGE[:COND]\n"
+        << "                           stop after a data read or store in RANGE (ADDR or\n"
+        << "                           ADDR-END); VALUE in COND is the byte accessed\n"
+        << "  --watch-in PORT[:COND], --watch-out PORT[:COND]\n"
+        << "                           stop after IN or OUT on PORT (or PORT-END)\n"
+        << "  --hit-count N            the previous breakpoint stops from its Nth hit on\n"
+        << "  --log-only               the previous breakpoint prints its hits and carries on\n"
+        << "                           (COND is C-like over A..L, BC, DE, HL, SP, PC, M,\n"
+        << "                           flags S Z AC P CY and [ADDR], e.g. 'B==0 && CY')\n"
+        << "\n"
+        << "Benchmark options:\n"
+        << "  --bench                  run the built-in guest workloads\n"
+        << "  --repeat N               repetitions per workload, best time wins (default 3)\n"
+        << "  --workload NAME          run a single workload\n"
+        << "  --core NAME              core specialization: plain (default), counting,\n"
+        << "                           tracing or debug, with their policies left idle\n"
+        << "  --json FILE              write results as JSON (use - for stdout)\n"
+        << "  --lockstep               run the lane workloads on the lockstep core and on\n"
+        << "                           CPU8085 one lane after another, and compare\n"
+        << "  --lanes N                lanes per lockstep run (default 1024)\n"
+        << "  --cpus N                 run a board of N CPUs passing tokens round a ring,\n"
+        << "                           on one thread and on --threads (default one per\n"
+        << "                           CPU), against a board of one\n"
+        << "  --quantum T              T-states between the board's CPUs synchronizing\n"
+        << "                           (default 10000)\n"
+        << "\n"
+        << "Batch options:\n"
+        << "  --batch JOBS             run every job in JOBS on a thread pool; each line is\n"
+        << "                           IMAGE [ADDR=HEXBYTES ...], bytes poked before the run\n"
+        << "  --threads N              worker threads (default: one per core)\n"
+        << "  --max-seconds S          wall-clock limit per job\n"
+        << "                           (--max-cycles and --org apply per job; the first\n"
+        << "                           --dump range is captured as each job's output)\n"
+        << "  --lockstep               run consecutive jobs on the same image together on\n"
+        << "                           the lockstep core, --lanes at a time (no devices;\n"
+        << "                           --max-seconds applies per group)\n"
+        << "\n"
+        << "Assembler options:\n"
+        << "  --assemble OUT           assemble SOURCE into OUT (Intel HEX for .hex, else\n"
+        << "                           binary) instead of running it\n"
+        << "  --listing FILE           write the listing and symbols of an assembly IMAGE\n"
+        << "                           to FILE (- for stdout)\n"
+        << "  --assemble-batch LIST    assemble every source in LIST on a thread pool; each\n"
+        << "                           line is SOURCE [OUTPUT], OUTPUT defaulting to SOURCE\n"
+        << "                           with a .hex extension\n"
+        << "\n"
+        << "Superoptimizer options:\n"
+        << "  --superopt SOURCE        search for the cheapest sequence of register\n"
+        << "                           instructions doing what SOURCE does to the live\n"
+        << "                           registers and flags, on --threads\n"
+        << "  --live LIST              live outputs, e.g. A,HL,CY: A B C D E H L, BC DE\n"
+        << "                           HL, S Z AC P CY, F for all flags (default A)\n"
+        << "  --max-length N           instructions in a candidate (default 3)\n"
+        << "  --cost NAME              bytes (default) or cycles, the other breaking ties\n"
+        << "\n"
+        << "  --selftest               check the ALU flag tables and engines, then exit\n"
+        << "  --conformance            run only the exhaustive ALU check and the\n"
+        << "                           instruction exerciser, on --threads, then exit\n"
+        << "\n"
+        << "Numbers accept C syntax (0x1000) or a trailing h (1000h).\n";
+}
+
+bool parseNumber(const std::string& text, uint64_t& value) {
+    if (text.empty()) return false;
+    std::string digits = text;
+    int base = 0;
+    if (digits.back() == 'h' || digits.back() == 'H') {
+        digits.pop_back();
+        base = 16;
+    }
+    char* end = nullptr;
+    value = std::strtoull(digits.c_str(), &end, base);
+    return end && *end == '\0' && !digits.empty();
+}
+
+bool parseAddress(const std::string& text, uint16_t& address) {
+    uint64_t value;
+    if (!parseNumber(text, value) || value > 0xFFFF) return false;
+    address = static_cast<uint16_t>(value);
+    return true;
+}
+
+// START:LEN with 0 < LEN <= 64KB
+bool parseRange(const std::string& text, MemoryRange& range) {
+    size_t colon = text.find(':');
+    uint64_t length = 0;
+    if (colon == std::string::npos || !parseAddress(text.substr(0, colon), range.start) ||
+        !parseNumber(text.substr(colon + 1), length) || length == 0 || length > 0x10000) {
+        return false;
+    }
+    range.length = static_cast<uint32_t>(length);
+    return true;
+}
+
+// ADDR[-END][:CONDITION], with addresses up to limit
+bool parseBreakpoint(const std::string& text, BreakKind kind, uint16_t limit, Breakpoint& breakpoint) {
+    size_t colon = text.find(':');
+    std::string range = text.substr(0, colon);
+    size_t dash = range.find('-');
+    if (!parseAddress(range.substr(0, dash), breakpoint.first)) return false;
+    breakpoint.last = breakpoint.first;
+    if (dash != std::string::npos && !parseAddress(range.substr(dash + 1), breakpoint.last)) return false;
+    if (breakpoint.last < breakpoint.first || breakpoint.last > limit) return false;
+    breakpoint.kind = kind;
+    std::string error;
+    if (colon != std::string::npos && !breakpoint.condition.parse(text.substr(colon + 1), error)) {
+        std::cerr << "error: condition '" << text.substr(colon + 1) << "': " << error << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool parseClock(const std::string& text, double& hz) {
+    std::string digits = text;
+    double scale = 1.0;
+    if (digits.size() > 3 && (digits.compare(digits.size() - 3, 3, "MHz") == 0 ||
+                              digits.compare(digits.size() - 3, 3, "mhz") == 0)) {
+        digits.resize(digits.size() - 3);
+        scale = 1e6;
+    }
+    char* end = nullptr;
+    hz = std::strtod(digits.c_str(), &end) * scale;
+    return end && *end == '\0' && !digits.empty() && hz > 0.0;
+}
+
+bool parseEngine(const std::string& text, CPU8085::Engine& engine) {
+    if (text == "switch") {
+        engine = CPU8085::Engine::Switch;
+    } else if (text == "threaded") {
+        engine = CPU8085::Engine::Threaded;
+    } else if (text == "function-table") {
+        engine = CPU8085::Engine::FunctionTable;
+    } else if (text == "predecoded") {
+        engine = CPU8085::Engine::Predecoded;
+    } else if (text == "jit") {
+        engine = CPU8085::Engine::Jit;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parseArgs(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto next = [&](std::string& out) {
+            if (i + 1 >= argc) return false;
+            out = argv[++i];
+            return true;
+        };
+        auto invalid = [&]() {
+            std::cerr << "error: missing or invalid value for " << arg << "\n";
+            return false;
+        };
+        std::string value;
+        uint64_t number;
+
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            std::exit(0);
+        } else if (arg == "--org") {
+            if (!next(value) || !parseAddress(value, opts.origin)) return invalid();
+        } else if (arg == "--start") {
+            if (!next(value) || !parseAddress(value, opts.start)) return invalid();
+            opts.hasStart = true;
+        } else if (arg == "--max-instructions") {
+            if (!next(value) || !parseNumber(value, opts.maxInstructions)) return invalid();
+            opts.hasMaxInstructions = true;
+        } else if (arg == "--max-cycles") {
+            if (!next(value) || !parseNumber(value, opts.maxCycles)) return invalid();
+        } else if (arg == "--clock") {
+            if (!next(value) || !parseClock(value, opts.clockHz)) return invalid();
+        } else if (arg == "--dump" || arg == "--rom") {
+            if (!next(value)) return invalid();
+            MemoryRange range;
+            if (!parseRange(value, range)) {
+                std::cerr << "error: bad " << arg << " range '" << value << "'\n";
+                return false;
+            }
+            (arg == "--dump" ? opts.dumps : opts.roms).push_back(range);
+        } else if (arg == "--engine") {
+            if (!next(value) || !parseEngine(value, opts.engine)) return invalid();
+            opts.hasEngine = true;
+        } else if (arg == "--jit-verify") {
+            opts.jitVerify = true;
+        } else if (arg == "--skip-loops") {
+            opts.skipLoops = true;
+        } else if (arg == "--trace") {
+            if (!next(opts.tracePath)) return invalid();
+        } else if (arg == "--trace-bin") {
+            if (!next(opts.binaryTracePath)) return invalid();
+        } else if (arg == "--profile") {
+            if (!next(opts.profilePath)) return invalid();
+        } else if (arg == "--profile-folded") {
+            if (!next(opts.foldedPath)) return invalid();
+        } else if (arg == "--timer") {
+            if (!next(value) || !parseNumber(value, number) || number > 0xFF) return invalid();
+            opts.timerPort = static_cast<uint8_t>(number);
+            opts.hasTimer = true;
+        } else if (arg == "--uart") {
+            if (!next(value)) return invalid();
+            size_t colon = value.find(':');
+            if (!parseNumber(value.substr(0, colon), number) || number > 0xFF) return invalid();
+            opts.uartPort = static_cast<uint8_t>(number);
+            if (colon != std::string::npos &&
+                (!parseNumber(value.substr(colon + 1), opts.uartBaud) || opts.uartBaud == 0)) {
+                return invalid();
+            }
+            opts.hasUart = true;
+        } else if (arg == "--uart-input") {
+            if (!next(opts.uartInputPath)) return invalid();
+        } else if (arg == "--load-state") {
+            if (!next(opts.loadStatePath)) return invalid();
+        } else if (arg == "--save-state") {
+            if (!next(opts.saveStatePath)) return invalid();
+        } else if (arg == "--back") {
+            if (!next(value) || !parseNumber(value, opts.back) || opts.back == 0) return invalid();
+        } else if (arg == "--back-to") {
+            if (!next(value) || !parseAddress(value, opts.backTo)) return invalid();
+            opts.hasBackTo = true;
+        } else if (arg == "--history") {
+            if (!next(value) || !parseNumber(value, opts.history) || opts.history == 0 ||
+                opts.history > (1ULL << 30)) {
+                return invalid();
+            }
+            opts.hasHistory = true;
+        } else if (arg == "--break" || arg == "--tracepoint" || arg == "--watch-read" ||
+                   arg == "--watch-write" || arg == "--watch-in" || arg == "--watch-out") {
+            static const std::map<std::string, BreakKind> kinds = {
+                {"--break", BreakKind::Execute}, {"--tracepoint", BreakKind::Execute},
+                {"--watch-read", BreakKind::Read}, {"--watch-write", BreakKind::Write},
+                {"--watch-in", BreakKind::Input}, {"--watch-out", BreakKind::Output}};
+            BreakKind kind = kinds.at(arg);
+            bool port = kind == BreakKind::Input || kind == BreakKind::Output;
+            Breakpoint breakpoint;
+            breakpoint.logOnly = arg == "--tracepoint";
+            if (!next(value) || !parseBreakpoint(value, kind, port ? 0xFF : 0xFFFF, breakpoint)) return invalid();
+            opts.breakpoints.push_back(std::move(breakpoint));
+        } else if (arg == "--hit-count" || arg == "--log-only") {
+            if (opts.breakpoints.empty()) {
+                std::cerr << "error: " << arg << " needs a breakpoint before it\n";
+                return false;
+            }
+            if (arg == "--log-only") {
+                opts.breakpoints.back().logOnly = true;
+            } else if (!next(value) || !parseNumber(value, opts.breakpoints.back().hitCount) ||
+                       opts.breakpoints.back().hitCount == 0) {
+                return invalid();
+            }
+        } else if (arg == "--quiet") {
+            opts.quiet = true;
+        } else if (arg == "--selftest") {
+            opts.selfTest = true;
+        } else if (arg == "--conformance") {
+            opts.conformance = true;
+        } else if (arg == "--bench") {
+            opts.bench = true;
+        } else if (arg == "--repeat") {
+            if (!next(value) || !parseNumber(value, number) || number == 0) return invalid();
+            opts.repeat = static_cast<int>(number);
+        } else if (arg == "--core") {
+            if (!next(opts.core)) return invalid();
+            const std::vector<std::string>& cores = benchmarkCores();
+            if (std::find(cores.begin(), cores.end(), opts.core) == cores.end()) return invalid();
+        } else if (arg == "--workload") {
+            if (!next(opts.workload)) return invalid();
+        } else if (arg == "--json") {
+            if (!next(opts.jsonPath)) return invalid();
+        } else if (arg == "--batch") {
+            if (!next(opts.batchPath)) return invalid();
+        } else if (arg == "--assemble") {
+            if (!next(opts.assemblePath)) return invalid();
+        } else if (arg == "--listing") {
+            if (!next(opts.listingPath)) return invalid();
+        } else if (arg == "--assemble-batch") {
+            if (!next(opts.assembleBatchPath)) return invalid();
+        } else if (arg == "--superopt") {
+            if (!next(opts.superoptPath)) return invalid();
+        } else if (arg == "--live") {
+            std::string error;
+            if (!next(value)) return invalid();
+            if (!parseLiveSet(value, opts.superopt.liveRegisters, opts.superopt.liveFlags, error)) {
+                std::cerr << "error: " << error << "\n";
+                return false;
+            }
+        } else if (arg == "--max-length") {
+            if (!next(value) || !parseNumber(value, number) || number > 8) return invalid();
+            opts.superopt.maxLength = static_cast<int>(number);
+        } else if (arg == "--cost") {
+            if (!next(value)) return invalid();
+            if (value == "bytes") {
+                opts.superopt.cost = SuperoptCost::Bytes;
+            } else if (value == "cycles") {
+                opts.superopt.cost = SuperoptCost::Cycles;
+            } else {
+                return invalid();
+            }
+        } else if (arg == "--threads") {
+            if (!next(value) || !parseNumber(value, number) || number == 0 || number > 1024) return invalid();
+            opts.threads = static_cast<unsigned>(number);
+        } else if (arg == "--lockstep") {
+            opts.lockstep = true;
+        } else if (arg == "--lanes") {
+            if (!next(value) || !parseNumber(value, number) || number == 0 || number > 0x100000) return invalid();
+            opts.lanes = static_cast<size_t>(number);
+        } else if (arg == "--cpus") {
+            if (!next(value) || !parseNumber(value, number) || number == 0 || number > 256) return invalid();
+            opts.cpus = static_cast<size_t>(number);
+        } else if (arg == "--quantum") {
+            if (!next(value) || !parseNumber(value, number) || number == 0) return invalid();
+            opts.quantum = number;
+        } else if (arg == "--max-seconds") {
+            if (!next(value)) return invalid();
+            char* end = nullptr;
+            opts.maxSeconds = std::strtod(value.c_str(), &end);
+            if (!end || *end != '\0' || opts.maxSeconds <= 0.0) return invalid();
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "error: unknown option " << arg << "\n";
+            return false;
+        } else if (opts.image.empty()) {
+            opts.image = arg;
+        } else {
+            std::cerr << "error: more than one image given\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class Cpu>
+void dumpMemory(const Cpu& cpu, const MemoryRange& dump) {
+    std::cout << std::hex << std::uppercase << std::setfill('0');
+    for (uint32_t offset = 0; offset < dump.length; offset += 16) {
+        uint32_t lineAddr = dump.start + offset;
+        std::cout << std::setw(4) << (lineAddr & 0xFFFF) << ":";
+        for (uint32_t i = offset; i < offset + 16 && i < dump.length; i++) {
+            std::cout << " " << std::setw(2) << (int)cpu.getMemory(static_cast<uint16_t>(dump.start + i));
+        }
+        std::cout << "\n";
+    }
+    std::cout << std::dec << std::setfill(' ');
+}
+
+int runLockstepBench(const Options& opts) {
+    std::vector<LockstepBenchmarkResult> results = runLockstepBenchmarks(opts.repeat, opts.workload, opts.lanes);
+    if (results.empty()) {
+        std::cerr << "error: no lane workload named '" << opts.workload << "'\n";
+        return 1;
+    }
+
+    if (opts.jsonPath == "-") {
+        writeLockstepJson(std::cout, results);
+    } else {
+        printLockstepTable(std::cout, results);
+        if (!opts.jsonPath.empty()) {
+            std::ofstream out(opts.jsonPath);
+            if (!out) {
+                std::cerr << "error: cannot write " << opts.jsonPath << "\n";
+                return 1;
+            }
+            writeLockstepJson(out, results);
+        }
+    }
+
+    for (const LockstepBenchmarkResult& r : results) {
+        if (!r.matched) return 2;
+    }
+    return 0;
+}
+
+int runBoardBench(const Options& opts) {
+    BoardBenchmarkResult result = runBoardBenchmark(opts.repeat, opts.cpus, opts.quantum, opts.threads);
+    if (opts.jsonPath == "-") {
+        writeBoardJson(std::cout, result);
+    } else {
+        printBoardTable(std::cout, result);
+        if (!opts.jsonPath.empty()) {
+            std::ofstream out(opts.jsonPath);
+            if (!out) {
+                std::cerr << "error: cannot write " << opts.jsonPath << "\n";
+                return 1;
+            }
+            writeBoardJson(out, result);
+        }
+    }
+    return result.matched ? 0 : 2;
+}
+
+int runBench(const Options& opts) {
+    if (opts.lockstep) return runLockstepBench(opts);
+    if (opts.cpus) return runBoardBench(opts);
+    std::vector<CPU8085::Engine> engines = allEngines();
+    if (opts.hasEngine) engines = {opts.engine};
+    std::vector<BenchmarkResult> results = runBenchmarks(opts.repeat, opts.workload, engines, opts.core);
+    if (results.empty()) {
+        std::cerr << "error: no workload named '" << opts.workload << "'\n";
+        return 1;
+    }
+
+    if (opts.jsonPath == "-") {
+        writeBenchmarkJson(std::cout, results);
+    } else {
+        printBenchmarkTable(std::cout, results);
+        if (!opts.jsonPath.empty()) {
+            std::ofstream out(opts.jsonPath);
+            if (!out) {
+                std::cerr << "error: cannot write " << opts.jsonPath << "\n";
+                return 1;
+            }
+            writeBenchmarkJson(out, results);
+        }
+    }
+
+    for (const BenchmarkResult& r : results) {
+        if (!r.halted) return 2;
+    }
+    return 0;
+}
+
+// Reads a jobs file: one job per line, IMAGE followed by ADDR=HEXBYTES inputs.
+// Each distinct image is loaded once and shared by its jobs.
+bool readJobs(const Options& opts, std::vector<std::unique_ptr<BatchImage>>& images,
+              std::vector<BatchJob>& jobs) {
+    std::ifstream in(opts.batchPath);
+    if (!in) {
+        std::cerr << "error: cannot open " << opts.batchPath << "\n";
+        return false;
+    }
+    std::map<std::string, const BatchImage*> byPath;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        std::istringstream words(line);
+        std::string path;
+        if (!(words >> path) || path[0] == '#') continue;
+
+        auto bad = [&](const std::string& what) {
+            std::cerr << opts.batchPath << ":" << lineNumber << ": " << what << "\n";
+            return false;
+        };
+
+        if (!byPath.count(path)) {
+            std::unique_ptr<BatchImage> image(new BatchImage());
+            std::string error;
+            if (!loadBatchImage(path, opts.origin, *image, error)) return bad(error);
+            byPath[path] = image.get();
+            images.push_back(std::move(image));
+        }
+
+        BatchJob job;
+        job.image = byPath[path];
+        job.limits.maxCycles = opts.maxCycles;
+        job.limits.maxSeconds = opts.maxSeconds;
+        std::string word;
+        while (words >> word) {
+            size_t equals = word.find('=');
+            BatchInput input;
+            std::string hex = equals == std::string::npos ? "" : word.substr(equals + 1);
+            if (equals == std::string::npos || !parseAddress(word.substr(0, equals), input.address) ||
+                hex.empty() || hex.size() % 2 != 0) {
+                return bad("bad input '" + word + "', expected ADDR=HEXBYTES");
+            }
+            for (size_t i = 0; i < hex.size(); i += 2) {
+                char* end = nullptr;
+                std::string digits = hex.substr(i, 2);
+                unsigned long byte = std::strtoul(digits.c_str(), &end, 16);
+                if (!end || *end != '\0') return bad("bad hex bytes in '" + word + "'");
+                input.bytes.push_back(static_cast<uint8_t>(byte));
+            }
+            job.inputs.push_back(input);
+        }
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+int runBatch(const Options& opts) {
+    std::vector<std::unique_ptr<BatchImage>> images;
+    std::vector<BatchJob> jobs;
+    if (!readJobs(opts, images, jobs)) return 1;
+
+    BatchOptions batchOptions;
+    batchOptions.threads = opts.threads;
+    batchOptions.engine = opts.engine;
+    batchOptions.skipLoops = opts.skipLoops;
+    batchOptions.lockstep = opts.lockstep;
+    batchOptions.lanes = opts.lanes;
+    if (!opts.dumps.empty()) {
+        batchOptions.outputAddress = opts.dumps[0].start;
+        batchOptions.outputLength = static_cast<uint16_t>(std::min<uint32_t>(opts.dumps[0].length, 0xFFFF));
+    }
+    BatchRunner runner(batchOptions);
+    runner.run(jobs);
+
+    bool allHalted = true;
+    std::cout << std::hex << std::uppercase << std::setfill('0');
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const BatchResult& r = runner.results()[i];
+        allHalted = allHalted && r.exit == BatchExit::Halted;
+        std::cout << std::dec << i << " " << jobs[i].image->name << " " << batchExitName(r.exit)
+                  << " T:" << r.cycles << std::hex
+                  << " A:" << std::setw(2) << (int)r.A << " B:" << std::setw(2) << (int)r.B
+                  << " C:" << std::setw(2) << (int)r.C << " D:" << std::setw(2) << (int)r.D
+                  << " E:" << std::setw(2) << (int)r.E << " H:" << std::setw(2) << (int)r.H
+                  << " L:" << std::setw(2) << (int)r.L << " PSW:" << std::setw(2) << (int)r.psw
+                  << " SP:" << std::setw(4) << r.SP << " PC:" << std::setw(4) << r.PC;
+        if (batchOptions.outputLength) {
+            std::cout << " OUT:";
+            const uint8_t* out = runner.outputOf(i);
+            for (uint16_t k = 0; k < batchOptions.outputLength; k++) {
+                std::cout << std::setw(2) << (int)out[k];
+            }
+        }
+        std::cout << "\n";
+    }
+    std::cout << std::dec << std::setfill(' ');
+
+    if (!opts.quiet) {
+        double seconds = runner.seconds();
+        std::cout << jobs.size() << " jobs on " << runner.threadCount()
+                  << (runner.threadCount() == 1 ? " thread in " : " threads in ")
+                  << std::fixed << std::setprecision(4) << seconds << " s";
+        if (seconds > 0.0) {
+            std::cout << " (" << std::setprecision(0) << jobs.size() / seconds << " jobs/s, "
+                      << std::setprecision(2) << runner.totalCycles() / seconds / 1e6
+                      << " MHz aggregate)";
+        }
+        std::cout << "\n";
+    }
+    return allHalted ? 0 : 2;
+}
+
+// Calls write on stdout for -, or on the file at path
+bool writeOutput(const std::string& path, const std::function<void(std::ostream&)>& write) {
+    if (path == "-") {
+        write(std::cout);
+        return true;
+    }
+    std::ofstream out(path);
+    if (out) write(out);
+    if (!out) std::cerr << "error: cannot write " << path << "\n";
+    return static_cast<bool>(out);
+}
+
+// Assembles opts.image for --assemble and --listing
+int assembleImage(const Options& opts) {
+    Assembler assembler;
+    assembler.origin = opts.origin;
+    assembler.listing = !opts.listingPath.empty();
+    AssembledProgram program;
+    bool ok = assembler.assembleFile(opts.image, program);
+    if (assembler.listing &&
+        !writeOutput(opts.listingPath, [&](std::ostream& out) { out << assembler.listingText(); })) {
+        return 1;
+    }
+    if (!ok) {
+        std::cerr << program.errorText(opts.image);
+        return 1;
+    }
+    if (!opts.assemblePath.empty()) {
+        std::string error;
+        if (!writeProgramFile(opts.assemblePath, program, error)) {
+            std::cerr << "error: " << error << "\n";
+            return 1;
+        }
+        if (!opts.quiet) {
+            std::cout << "Assembled " << program.lines << " lines into " << program.bytes.size() << " bytes in "
+                      << opts.assemblePath << "\n";
+        }
+    }
+    return 0;
+}
+
+// Assembles the target and prints the cheapest replacement found
+int runSuperopt(const Options& opts) {
+    Assembler assembler;
+    AssembledProgram program;
+    if (!assembler.assembleFile(opts.superoptPath, program)) {
+        std::cerr << program.errorText(opts.superoptPath);
+        return 1;
+    }
+    SuperoptOptions options = opts.superopt;
+    options.threads = opts.threads;
+    SuperoptResult result = superoptimize(program.bytes, options);
+    if (!result.ok) {
+        std::cerr << "error: " << result.error << "\n";
+        return 1;
+    }
+
+    std::cout << "Target: " << result.targetBytes << " bytes, " << result.targetCycles << " T-states\n";
+    if (result.found) {
+        std::cout << "Found:  " << result.bytes << " bytes, " << result.cycles << " T-states, "
+                  << (result.proven ? "checked on every input" : "checked on a random sample of inputs")
+                  << "\n";
+        std::istringstream lines(result.listing);
+        std::string line;
+        while (std::getline(lines, line)) std::cout << "    " << line << "\n";
+        if (result.code.empty()) std::cout << "    (nothing: the target changes nothing live)\n";
+    } else {
+        std::cout << "Nothing cheaper of up to " << options.maxLength << " instructions\n";
+    }
+    if (!opts.quiet) {
+        std::cout << result.candidates << " candidates, " << result.survivors << " passed the filter, "
+                  << result.confirmed << " confirmed in " << std::fixed << std::setprecision(4) << result.seconds
+                  << " s";
+        if (result.seconds > 0.0) {
+            std::cout << " (" << std::setprecision(1) << result.candidates / result.seconds / 1e6
+                      << "M candidates/s)";
+        }
+        std::cout << "\n";
+    }
+    return 0;
+}
+
+// Reads SOURCE [OUTPUT] lines and assembles every source on a thread pool
+int runAssembleBatch(const Options& opts) {
+    std::ifstream in(opts.assembleBatchPath);
+    if (!in) {
+        std::cerr << "error: cannot open " << opts.assembleBatchPath << "\n";
+        return 1;
+    }
+    std::vector<AssemblyJob> jobs;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream words(line);
+        AssemblyJob job;
+        if (!(words >> job.source) || job.source[0] == '#') continue;
+        if (!(words >> job.output)) {
+            size_t dot = job.source.find_last_of('.');
+            size_t slash = job.source.find_last_of("/\\");
+            bool extension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+            job.output = (extension ? job.source.substr(0, dot) : job.source) + ".hex";
+        }
+        jobs.push_back(std::move(job));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<AssemblyJobResult> results = assembleFiles(jobs, opts.threads);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t failed = 0;
+    uint64_t lines = 0;
+    for (const AssemblyJobResult& result : results) {
+        lines += result.lines;
+        if (result.ok) continue;
+        failed++;
+        std::cerr << result.errors;
+    }
+    if (!opts.quiet) {
+        std::cout << jobs.size() << " sources, " << failed << " failed, " << lines << " lines in " << std::fixed
+                  << std::setprecision(4) << seconds << " s";
+        if (seconds > 0.0) std::cout << " (" << std::setprecision(0) << lines / seconds << " lines/s)";
+        std::cout << "\n";
+    }
+    return failed ? 1 : 0;
+}
+
+// Runs opts.image on the given core specialization
+template <class Cpu>
+int runImage(const Options& opts) {
+    constexpr bool counting = std::is_base_of<InstructionCounter, Cpu>::value;
+    constexpr bool reversible = std::is_base_of<UndoLog, Cpu>::value;
+    Cpu cpu(opts.engine);
+    if constexpr (reversible) {
+        if (opts.hasHistory) cpu.undoHistory = static_cast<size_t>(opts.history);
+    }
+    if (opts.jitVerify) cpu.setJitVerify(true);
+    cpu.setLoopSkipping(opts.skipLoops);
+    for (const MemoryRange& rom : opts.roms) {
+        int first = rom.start >> 8;
+        int last = (rom.start + rom.length - 1) >> 8;
+        cpu.memory.mapRom(static_cast<uint8_t>(first), std::min(last, 255) - first + 1);
+    }
+    if (!opts.loadStatePath.empty()) {
+        // The runner's memory has no image, so states are deltas against zeros
+        SaveState state;
+        std::string error;
+        if (!state.load(opts.loadStatePath, nullptr, error)) {
+            std::cerr << "error: " << error << "\n";
+            return 1;
+        }
+        cpu.restoreState(state);
+        if (opts.hasStart) cpu.PC = opts.start;
+        if (!opts.quiet) std::cout << "Restored " << opts.loadStatePath << "\n";
+    } else {
+        LoadResult loaded = loadImageFile(cpu, opts.image, opts.origin);
+        if (!loaded.ok) {
+            std::cerr << "error: " << loaded.error << "\n";
+            return 1;
+        }
+
+        if (opts.hasStart) {
+            cpu.PC = opts.start;
+        } else if (loaded.hasStartAddress) {
+            cpu.PC = loaded.startAddress;
+        } else {
+            cpu.PC = loaded.bytesLoaded ? loaded.lowAddress : opts.origin;
+        }
+
+        if (!opts.quiet) {
+            std::cout << "Loaded " << loaded.bytesLoaded << " bytes from " << opts.image << "\n";
+        }
+    }
+
+    IntervalTimer timer;
+    if (opts.hasTimer) timer.attach(cpu, opts.timerPort);
+    // Bit times follow the emulated clock, paced or not
+    Uart uart(opts.clockHz > 0.0 ? opts.clockHz : ClockPacer::kDefaultClockHz,
+              static_cast<uint32_t>(std::min<uint64_t>(opts.uartBaud, UINT32_MAX)));
+    if (opts.hasUart) {
+        uart.output = [](uint8_t byte) { std::cout.put(static_cast<char>(byte)).flush(); };
+        uart.attach(cpu, opts.uartPort);
+        if (!opts.uartInputPath.empty()) {
+            std::ifstream in(opts.uartInputPath, std::ios::binary);
+            if (!in) {
+                std::cerr << "error: cannot open " << opts.uartInputPath << "\n";
+                return 1;
+            }
+            std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            uart.receive(bytes.data(), bytes.size());
+        }
+    }
+
+    // Unpaced runs use a single batch covering the whole cycle limit
+    ClockPacer pacer(opts.clockHz > 0.0 ? opts.clockHz : ClockPacer::kDefaultClockHz);
+    uint64_t batch = opts.clockHz > 0.0 ? pacer.batchCycles() : UINT64_MAX;
+
+    std::FILE* trace = nullptr;
+    if constexpr (std::is_base_of<InstructionTracer, Cpu>::value) {
+        trace = opts.tracePath == "-" ? stdout : std::fopen(opts.tracePath.c_str(), "w");
+        if (!trace) {
+            std::cerr << "error: cannot write " << opts.tracePath << "\n";
+            return 1;
+        }
+        cpu.traceFile = trace;
+    }
+    TraceWriter traceWriter;
+    if constexpr (std::is_base_of<BinaryTracer, Cpu>::value) {
+        std::string error;
+        if (!traceWriter.open(opts.binaryTracePath, error)) {
+            std::cerr << "error: " << error << "\n";
+            return 1;
+        }
+        cpu.traceWriter = &traceWriter;
+    }
+    if constexpr (std::is_base_of<Profiler, Cpu>::value) {
+        cpu.profiling = !opts.profilePath.empty() || !opts.foldedPath.empty();
+    }
+    if constexpr (std::is_base_of<Breakpoints, Cpu>::value) {
+        for (const Breakpoint& breakpoint : opts.breakpoints) cpu.addBreakpoint(breakpoint);
+        cpu.hitHandler = [](const DebugHit& hit) { std::cout << formatDebugHit(hit) << "\n"; };
+    }
+    if constexpr (counting) cpu.instructionLimit = opts.maxInstructions;
+    auto limitReached = [&]() {
+        if constexpr (counting) return cpu.instructions >= opts.maxInstructions;
+        return false;
+    };
+    auto breakHit = [&]() {
+        if constexpr (std::is_base_of<Breakpoints, Cpu>::value) return cpu.breakRequested;
+        return false;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    pacer.start(cpu.cycles);
+    while (!cpu.stopped() && !limitReached() && !breakHit() && cpu.cycles < opts.maxCycles) {
+        uint64_t batchEnd = cpu.cycles + std::min(batch, opts.maxCycles - cpu.cycles);
+        cpu.run(batchEnd - cpu.cycles);
+        if (!cpu.jitVerifyError().empty()) {
+            std::cerr << "error: " << cpu.jitVerifyError() << "\n";
+            return 1;
+        }
+        if (opts.clockHz > 0.0) pacer.pace(cpu.cycles);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    if (trace && trace != stdout) std::fclose(trace);
+    if constexpr (std::is_base_of<BinaryTracer, Cpu>::value) {
+        cpu.flushTrace();
+        std::string error;
+        if (!traceWriter.close(error)) {
+            std::cerr << "error: " << error << "\n";
+            return 1;
+        }
+    }
+    bool halted = cpu.stopped();
+    bool broken = breakHit();
+    uint64_t cycles = cpu.cycles;  // Before any stepping back
+    bool rewound = false;
+    uint64_t undone = 0;
+
+    if constexpr (reversible) {
+        rewound = opts.back || opts.hasBackTo;
+        if (opts.hasBackTo) {
+            cpu.addBreakpoint(opts.backTo);
+            undone = runBack(cpu);
+            if (cpu.PC != opts.backTo) {
+                std::cerr << "error: PC was not " << std::hex << std::uppercase << opts.backTo << std::dec
+                          << "h in the last " << undone << " instructions\n";
+                return 1;
+            }
+        }
+        if (opts.back) undone += rewind(cpu, opts.back);
+    }
+
+    if (!opts.saveStatePath.empty()) {
+        std::string error;
+        if (!cpu.saveState().save(opts.saveStatePath, error)) {
+            std::cerr << "error: " << error << "\n";
+            return 1;
+        }
+    }
+
+    if constexpr (std::is_base_of<Profiler, Cpu>::value) {
+        bool written = opts.profilePath.empty() ||
+                       writeOutput(opts.profilePath, [&](std::ostream& out) { writeProfileReport(out, cpu); });
+        written = (opts.foldedPath.empty() ||
+                   writeOutput(opts.foldedPath, [&](std::ostream& out) { writeFoldedStacks(out, cpu); })) && written;
+        if (!written) return 1;
+    }
+
+    std::cout << cpu.getRegisterState() << "\n" << cpu.getFlagsState() << "\n";
+    for (const MemoryRange& dump : opts.dumps) {
+        dumpMemory(cpu, dump);
+    }
+
+    if (!opts.quiet && rewound) {
+        // The forward run's totals no longer describe the machine
+        std::cout << "Stepped back " << undone << " instructions to PC " << std::hex << std::uppercase
+                  << std::setfill('0') << std::setw(4) << cpu.PC << "h" << std::dec << std::setfill(' ') << " after "
+                  << cpu.cycles << " T-states\n";
+    } else if (!opts.quiet) {
+        std::cout << (halted ? "Halted" : broken ? "Stopped by a breakpoint" : "Limit reached") << " after ";
+        if constexpr (counting) std::cout << cpu.instructions << " instructions, ";
+        std::cout << cycles << " T-states in "
+                  << std::fixed << std::setprecision(4) << seconds << " s";
+        if (seconds > 0.0) {
+            std::cout << " (" << std::setprecision(2);
+            if constexpr (counting) std::cout << cpu.instructions / seconds / 1e6 << " MIPS, ";
+            std::cout << cycles / seconds / 1e6 << " MHz effective)";
+        }
+        std::cout << "\n";
+        if (cpu.loopSkipping()) std::cout << "Skipped " << cpu.skippedCycles() << " T-states in loops\n";
+    }
+    return halted ? 0 : broken ? 3 : 2;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseArgs(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (opts.selfTest) {
+        bool ok = runAluConformanceCheck(std::cout);
+        ok = runExerciserCheck(std::cout) && ok;
+        ok = runEngineEquivalenceCheck(std::cout) && ok;
+        ok = runJitVerifyCheck(std::cout) && ok;
+        ok = runPagedMemoryCheck(std::cout) && ok;
+        ok = runEmulationThreadCheck(std::cout) && ok;
+        ok = runBatchCheck(std::cout) && ok;
+        ok = runPolicyCheck(std::cout) && ok;
+        ok = runDeviceCheck(std::cout) && ok;
+        ok = runMemoryMapCheck(std::cout) && ok;
+        ok = runSaveStateCheck(std::cout) && ok;
+        ok = runReverseCheck(std::cout) && ok;
+        ok = runBinaryTraceCheck(std::cout) && ok;
+        ok = runProfilerCheck(std::cout) && ok;
+        ok = runBreakpointCheck(std::cout) && ok;
+        ok = runAssemblerCheck(std::cout) && ok;
+        ok = runOpcodeTableCheck(std::cout) && ok;
+        ok = runLoopSkipCheck(std::cout) && ok;
+        ok = runLockstepCheck(std::cout) && ok;
+        ok = runMultiCpuCheck(std::cout) && ok;
+        ok = runSuperoptCheck(std::cout) && ok;
+        return ok ? 0 : 1;
+    }
+    if (opts.conformance) {
+        bool ok = runAluConformanceCheck(std::cout, opts.threads);
+        ok = runExerciserCheck(std::cout, opts.threads) && ok;
+        return ok ? 0 : 1;
+    }
+    if (opts.bench) return runBench(opts);
+    if (!opts.batchPath.empty()) return runBatch(opts);
+    if (!opts.assembleBatchPath.empty()) return runAssembleBatch(opts);
+    if (!opts.superoptPath.empty()) return runSuperopt(opts);
+
+    if (opts.image.empty() && opts.loadStatePath.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (!opts.assemblePath.empty() || !opts.listingPath.empty()) {
+        if (opts.image.empty()) {
+            std::cerr << "error: --assemble and --listing need a source file\n";
+            return 1;
+        }
+        int status = assembleImage(opts);
+        if (status != 0 || !opts.assemblePath.empty()) return status;
+    }
+    bool reversing = opts.back || opts.hasBackTo || opts.hasHistory;
+    bool profiling = !opts.profilePath.empty() || !opts.foldedPath.empty();
+    bool debugging = !opts.breakpoints.empty();
+    // Each of these picks its own core; the reversible one has breakpoints too
+    int cores = !opts.tracePath.empty() + !opts.binaryTracePath.empty() + profiling + (reversing || debugging);
+    if (cores > 1 || ((reversing || debugging) && opts.hasMaxInstructions)) {
+        std::cerr << "error: --trace, --trace-bin, --profile and --back or breakpoints cannot be combined, "
+                  << "and --back and breakpoints cannot be used with --max-instructions\n";
+        return 1;
+    }
+    if (reversing) return runImage<ReversibleCPU8085>(opts);
+    if (debugging) return runImage<DebugCPU8085>(opts);
+    if (!opts.tracePath.empty()) return runImage<TracingCPU8085>(opts);
+    if (!opts.binaryTracePath.empty()) return runImage<BinaryTracingCPU8085>(opts);
+    if (profiling) return runImage<ProfilingCPU8085>(opts);
+    if (opts.hasMaxInstructions) return runImage<CountingCPU8085>(opts);
+    return runImage<CPU8085>(opts);
+}
@@ -1,369 +1,630 @@
 #include "cpu8085.h"
+#include "blockcache.h"
+#include "jit.h"
+#include "loopskip.h"
+#include "opcodes.h"
+#include "savestate.h"
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
 #include <cstring>
 
-CPU8085::CPU8085() {
+namespace {
+
+using Flags = CPU8085Base::Flags;
+
+// Instruction lengths in bytes, from the OP() table
+constexpr uint8_t lengthTable[256] = {
+#define OP(code, length, ...) length,
+#include "cpu8085_ops.inc"
+#undef OP
+};
+
+// Base T-states per opcode from kOpcodes, packed for the dispatch loops.
+// Conditional jumps, calls and returns list the not-taken cost; the OP()
+// statements add the extra states when taken.
+struct CycleTable {
+    uint8_t cycles[256];
+
+    constexpr uint8_t operator[](uint8_t opcode) const { return cycles[opcode]; }
+};
+
+constexpr CycleTable makeCycleTable() {
+    CycleTable t{};
+    for (int opcode = 0; opcode < 256; opcode++) t.cycles[opcode] = kOpcodes[opcode].cycles;
+    return t;
+}
+
+constexpr CycleTable cycleTable = makeCycleTable();
+
+// The OP() table and kOpcodes describe the same instructions
+constexpr bool opcodeTablesAgree() {
+    for (int opcode = 0; opcode < 256; opcode++) {
+        if (lengthTable[opcode] != kOpcodes[opcode].length) return false;
+    }
+    return kOpcodes[0x80].flags == Flags::ALL && kOpcodes[0x04].flags == (Flags::ALL & ~Flags::CARRY) &&
+           kOpcodes[0x37].flags == Flags::CARRY;
+}
+static_assert(opcodeTablesAgree(), "cpu8085_ops.inc lengths or PSW masks differ from kOpcodes");
+
+// Flag lookup tables, generated at compile time. AC follows the documented
+// rule: the carry out of bit 3, where subtraction (SUB, SBB, CMP, DCR) is
+// the addition of the two's complement, so AC is set when no borrow came
+// out of the low nibble. Only CY is turned into a borrow.
+struct FlagTables {
+    // S, Z and P for every 8-bit result (plus the always-one PSW bit)
+    uint8_t szp[256];
+    // S, Z, AC and P after INR and DCR, by result
+    uint8_t inr[256];
+    uint8_t dcr[256];
+    // Complete PSW after ADD/ADC/SUB/SBB/CMP, indexed by
+    // (nibble carry/borrow << 9) | 9-bit result; bit 8 of the result is CY
+    uint8_t arith[1024];
+    // DAA, indexed by (CY << 9) | (AC << 8) | A -> (new A << 8) | new PSW
+    uint16_t daa[1024];
+};
+
+constexpr FlagTables makeFlagTables() {
+    FlagTables t{};
+    for (int value = 0; value < 256; value++) {
+        int bits = 0;
+        for (int i = 0; i < 8; i++) {
+            if (value & (1 << i)) bits++;
+        }
+        uint8_t flags = Flags::ALWAYS_ONE;
+        if (value == 0) flags |= Flags::ZERO;
+        if (value & 0x80) flags |= Flags::SIGN;
+        if (bits % 2 == 0) flags |= Flags::PARITY;
+        t.szp[value] = flags;
+        t.inr[value] = flags | ((value & 0x0F) == 0x00 ? Flags::AUX_CARRY : 0);
+        t.dcr[value] = flags | ((value & 0x0F) != 0x0F ? Flags::AUX_CARRY : 0);
+    }
+    for (int index = 0; index < 1024; index++) {
+        uint8_t flags = t.szp[index & 0xFF];
+        if (index & 0x100) flags |= Flags::CARRY;
+        if (index & 0x200) flags |= Flags::AUX_CARRY;
+        t.arith[index] = flags;
+    }
+    for (int index = 0; index < 1024; index++) {
+        uint8_t a = index & 0xFF;
+        bool ac = (index & 0x100) != 0;
+        bool cy = (index & 0x200) != 0;
+        uint8_t correction = 0;
+        if ((a & 0x0F) > 9 || ac) correction += 0x06;
+        if ((a >> 4) > 9 || cy || ((a >> 4) >= 9 && (a & 0x0F) > 9)) {
+            correction += 0x60;
+            cy = true;
+        }
+        uint8_t result = static_cast<uint8_t>(a + correction);
+        uint8_t flags = t.szp[result];
+        if ((a & 0x0F) + (correction & 0x0F) > 0x0F) flags |= Flags::AUX_CARRY;  // From the low correction
+        if (cy) flags |= Flags::CARRY;
+        t.daa[index] = static_cast<uint16_t>((result << 8) | flags);
+    }
+    return t;
+}
+
+constexpr FlagTables flagTables = makeFlagTables();
+
+} // namespace
+
+template <class... Policies>
+BasicCPU8085<Policies...>::BasicCPU8085(Engine engine)
+    : leaveBlock(false), exitRun(false), enableDelay(false), runStart(0) {
+    events.setClock(&cycles);
+    codePages.fill(0);
+    writtenPages.fill(1);
+    memory.setDeviceHook(memoryDeviceAccessed, this);
+    setEngine(engine);
     reset();
 }
 
-void CPU8085::reset() {
+template <class... Policies>
+BasicCPU8085<Policies...>::~BasicCPU8085() = default;
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::reset() {
+    resetRegisters();
+    resetMemory();
+    io.reset();
+}
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::resetRegisters() {
     A = B = C = D = E = H = L = 0;
     SP = 0xFFFF;
     PC = 0x0000;
-    flags = {false, false, false, false, false};
-    memory.fill(0);
+    flags.psw = Flags::ALWAYS_ONE;
     halted = false;
     interruptEnabled = false;
+    enableDelay = false;
+    cycles = 0;
+    events.clear();
+    interrupts.reset();
+}
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::resetMemory() {
+    if (memory.getMode() == GuestMemory::Mode::Paged) {
+        // Only written pages change back, so code cached elsewhere stays valid
+        for (uint8_t page : memory.dirtyPages()) {
+            if (codePages[page]) invalidateCodePage(page);
+        }
+        memory.reset();
+    } else {
+        memory.reset();
+        invalidateCode();
+    }
+    writtenPages.fill(1);
+}
+
+template <class... Policies>
+SaveState BasicCPU8085<Policies...>::saveState() const {
+    SaveState state;
+    state.A = A; state.B = B; state.C = C; state.D = D;
+    state.E = E; state.H = H; state.L = L;
+    state.psw = flags.psw;
+    state.SP = SP;
+    state.PC = PC;
+    state.halted = halted;
+    state.interruptEnabled = interruptEnabled;
+    state.enableDelay = enableDelay;
+    state.cycles = cycles;
+    state.interrupts = interrupts;
+    state.memory = memory.snapshot();
+    state.base = memory.getImage();
+    return state;
+}
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::restoreState(const SaveState& state) {
+    A = state.A; B = state.B; C = state.C; D = state.D;
+    E = state.E; H = state.H; L = state.L;
+    flags.psw = state.psw;
+    SP = state.SP;
+    PC = state.PC;
+    halted = state.halted;
+    interruptEnabled = state.interruptEnabled;
+    enableDelay = state.enableDelay;
+    cycles = state.cycles;
+    interrupts = state.interrupts;
+    // Restoring the same state again is a reset of the pages written since
+    if (memory.getImage() == state.memory) {
+        resetMemory();
+    } else {
+        setMemoryImage(state.memory);
+    }
+}
+
+template <class... Policies>
+std::unique_ptr<BasicCPU8085<Policies...>> BasicCPU8085<Policies...>::fork() const {
+    std::unique_ptr<BasicCPU8085> child(new BasicCPU8085(engine));
+    ((static_cast<Policies&>(*child) = static_cast<const Policies&>(*this)), ...);
+    child->setLoopSkipping(loopSkipping());
+    child->memory.setMode(GuestMemory::Mode::Paged);
+    child->restoreState(saveState());
+    return child;
 }
 
-uint8_t CPU8085::fetchByte() {
-    return memory[PC++];
+template <class... Policies>
+uint8_t BasicCPU8085<Policies...>::fetchByte() {
+    return memory.read(PC++);
 }
 
-uint16_t CPU8085::fetchWord() {
+template <class... Policies>
+uint16_t BasicCPU8085<Policies...>::fetchWord() {
     uint8_t low = fetchByte();
     uint8_t high = fetchByte();
     return (high << 8) | low;
 }
 
-void CPU8085::step() {
-    if (halted) return;
-    
-    uint8_t opcode = fetchByte();
-    executeInstruction(opcode);
+template <class... Policies>
+int BasicCPU8085<Policies...>::step() {
+    if (stopped()) return 0;
+    // A halted CPU waits for its next event
+    uint64_t budget = halted ? std::max(events.nextDue(), cycles) - cycles + 1 : 1;
+    return static_cast<int>(run(budget));
 }
 
-void CPU8085::executeInstruction(uint8_t opcode) {
-    uint16_t addr, temp16;
-    uint8_t temp8;
-    
-    switch (opcode) {
-        // NOP and HLT
-        case 0x00: break; // NOP
-        case 0x76: halted = true; break; // HLT
-        
-        // Data Transfer Group - MOV r1, r2 (all 49 combinations)
-        case 0x40: B = B; break; case 0x41: B = C; break; case 0x42: B = D; break; case 0x43: B = E; break;
-        case 0x44: B = H; break; case 0x45: B = L; break; case 0x46: B = memory[getHL()]; break; case 0x47: B = A; break;
-        case 0x48: C = B; break; case 0x49: C = C; break; case 0x4A: C = D; break; case 0x4B: C = E; break;
-        case 0x4C: C = H; break; case 0x4D: C = L; break; case 0x4E: C = memory[getHL()]; break; case 0x4F: C = A; break;
-        case 0x50: D = B; break; case 0x51: D = C; break; case 0x52: D = D; break; case 0x53: D = E; break;
-        case 0x54: D = H; break; case 0x55: D = L; break; case 0x56: D = memory[getHL()]; break; case 0x57: D = A; break;
-        case 0x58: E = B; break; case 0x59: E = C; break; case 0x5A: E = D; break; case 0x5B: E = E; break;
-        case 0x5C: E = H; break; case 0x5D: E = L; break; case 0x5E: E = memory[getHL()]; break; case 0x5F: E = A; break;
-        case 0x60: H = B; break; case 0x61: H = C; break; case 0x62: H = D; break; case 0x63: H = E; break;
-        case 0x64: H = H; break; case 0x65: H = L; break; case 0x66: H = memory[getHL()]; break; case 0x67: H = A; break;
-        case 0x68: L = B; break; case 0x69: L = C; break; case 0x6A: L = D; break; case 0x6B: L = E; break;
-        case 0x6C: L = H; break; case 0x6D: L = L; break; case 0x6E: L = memory[getHL()]; break; case 0x6F: L = A; break;
-        case 0x70: memory[getHL()] = B; break; case 0x71: memory[getHL()] = C; break;
-        case 0x72: memory[getHL()] = D; break; case 0x73: memory[getHL()] = E; break;
-        case 0x74: memory[getHL()] = H; break; case 0x75: memory[getHL()] = L; break;
-        case 0x77: memory[getHL()] = A; break;
-        case 0x78: A = B; break; case 0x79: A = C; break; case 0x7A: A = D; break; case 0x7B: A = E; break;
-        case 0x7C: A = H; break; case 0x7D: A = L; break; case 0x7E: A = memory[getHL()]; break; case 0x7F: A = A; break;
-        
-        // MVI r, data
-        case 0x06: B = fetchByte(); break; case 0x0E: C = fetchByte(); break;
-        case 0x16: D = fetchByte(); break; case 0x1E: E = fetchByte(); break;
-        case 0x26: H = fetchByte(); break; case 0x2E: L = fetchByte(); break;
-        case 0x36: memory[getHL()] = fetchByte(); break; case 0x3E: A = fetchByte(); break;
-        
-        // LXI rp, data16
-        case 0x01: setBC(fetchWord()); break; // LXI B
-        case 0x11: setDE(fetchWord()); break; // LXI D
-        case 0x21: setHL(fetchWord()); break; // LXI H
-        case 0x31: SP = fetchWord(); break;    // LXI SP
-        
-        // LDA/STA addr
-        case 0x3A: addr = fetchWord(); A = memory[addr]; break; // LDA
-        case 0x32: addr = fetchWord(); memory[addr] = A; break; // STA
-        
-        // LHLD/SHLD addr
-        case 0x2A: addr = fetchWord(); L = memory[addr]; H = memory[addr + 1]; break; // LHLD
-        case 0x22: addr = fetchWord(); memory[addr] = L; memory[addr + 1] = H; break; // SHLD
-        
-        // LDAX/STAX
-        case 0x0A: A = memory[getBC()]; break; // LDAX B
-        case 0x1A: A = memory[getDE()]; break; // LDAX D
-        case 0x02: memory[getBC()] = A; break; // STAX B
-        case 0x12: memory[getDE()] = A; break; // STAX D
-        
-        // XCHG
-        case 0xEB: temp8 = D; D = H; H = temp8; temp8 = E; E = L; L = temp8; break;
-        
-        // Arithmetic Group - ADD
-        case 0x80: A = add(B); break; case 0x81: A = add(C); break; case 0x82: A = add(D); break;
-        case 0x83: A = add(E); break; case 0x84: A = add(H); break; case 0x85: A = add(L); break;
-        case 0x86: A = add(memory[getHL()]); break; case 0x87: A = add(A); break;
-        case 0xC6: A = add(fetchByte()); break; // ADI
-        
-        // ADC (Add with Carry)
-        case 0x88: A = add(B, true); break; case 0x89: A = add(C, true); break; case 0x8A: A = add(D, true); break;
-        case 0x8B: A = add(E, true); break; case 0x8C: A = add(H, true); break; case 0x8D: A = add(L, true); break;
-        case 0x8E: A = add(memory[getHL()], true); break; case 0x8F: A = add(A, true); break;
-        case 0xCE: A = add(fetchByte(), true); break; // ACI
-        
-        // SUB
-        case 0x90: A = sub(B); break; case 0x91: A = sub(C); break; case 0x92: A = sub(D); break;
-        case 0x93: A = sub(E); break; case 0x94: A = sub(H); break; case 0x95: A = sub(L); break;
-        case 0x96: A = sub(memory[getHL()]); break; case 0x97: A = sub(A); break;
-        case 0xD6: A = sub(fetchByte()); break; // SUI
-        
-        // SBB (Subtract with Borrow)
-        case 0x98: A = sub(B, true); break; case 0x99: A = sub(C, true); break; case 0x9A: A = sub(D, true); break;
-        case 0x9B: A = sub(E, true); break; case 0x9C: A = sub(H, true); break; case 0x9D: A = sub(L, true); break;
-        case 0x9E: A = sub(memory[getHL()], true); break; case 0x9F: A = sub(A, true); break;
-        case 0xDE: A = sub(fetchByte(), true); break; // SBI
-        
-        // INR (Increment)
-        case 0x04: B++; updateFlags(B); break; case 0x0C: C++; updateFlags(C); break;
-        case 0x14: D++; updateFlags(D); break; case 0x1C: E++; updateFlags(E); break;
-        case 0x24: H++; updateFlags(H); break; case 0x2C: L++; updateFlags(L); break;
-        case 0x34: temp8 = memory[getHL()] + 1; memory[getHL()] = temp8; updateFlags(temp8); break;
-        case 0x3C: A++; updateFlags(A); break;
-        
-        // DCR (Decrement)
-        case 0x05: B--; updateFlags(B); break; case 0x0D: C--; updateFlags(C); break;
-        case 0x15: D--; updateFlags(D); break; case 0x1D: E--; updateFlags(E); break;
-        case 0x25: H--; updateFlags(H); break; case 0x2D: L--; updateFlags(L); break;
-        case 0x35: temp8 = memory[getHL()] - 1; memory[getHL()] = temp8; updateFlags(temp8); break;
-        case 0x3D: A--; updateFlags(A); break;
-        
-        // INX (Increment Register Pair)
-        case 0x03: setBC(getBC() + 1); break; case 0x13: setDE(getDE() + 1); break;
-        case 0x23: setHL(getHL() + 1); break; case 0x33: SP++; break;
-        
-        // DCX (Decrement Register Pair)
-        case 0x0B: setBC(getBC() - 1); break; case 0x1B: setDE(getDE() - 1); break;
-        case 0x2B: setHL(getHL() - 1); break; case 0x3B: SP--; break;
-        
-        // DAD (Add register pair to HL)
-        case 0x09: temp16 = getHL() + getBC(); flags.CY = (temp16 < getHL()); setHL(temp16); break;
-        case 0x19: temp16 = getHL() + getDE(); flags.CY = (temp16 < getHL()); setHL(temp16); break;
-        case 0x29: temp16 = getHL() + getHL(); flags.CY = (temp16 < getHL()); setHL(temp16); break;
-        case 0x39: temp16 = getHL() + SP; flags.CY = (temp16 < getHL()); setHL(temp16); break;
+template <class... Policies>
+uint64_t BasicCPU8085<Policies...>::run(uint64_t cycleBudget) {
+    runStart = cycles;
+    // Engines compute cycles + cycleBudget, which must not wrap
+    uint64_t target = runStart + std::min(cycleBudget, UINT64_MAX - runStart);
+    while (cycles < target) {
+        events.fireDue(cycles);
+        interrupts.changed = false;
+        events.changed = false;
+        if (!enableDelay && interrupts.requested(interruptEnabled)) {
+            acceptInterrupt();
+            continue;
+        }
+        if (halted) {
+            uint64_t due = events.nextDue();
+            if (due == UINT64_MAX) break;  // Nothing left to wake it
+            cycles = std::min(due, target);
+            continue;
+        }
         
-        // DAA (Decimal Adjust Accumulator)
-        case 0x27: {
-            uint8_t correction = 0;
-            if ((A & 0x0F) > 9 || flags.AC) correction += 0x06;
-            if ((A >> 4) > 9 || flags.CY || ((A >> 4) >= 9 && (A & 0x0F) > 9)) {
-                correction += 0x60;
-                flags.CY = true;
+        // Run up to the next event; EI delays a pending request by one instruction
+        uint64_t sliceEnd = enableDelay ? cycles + 1 : std::min(events.nextDue(), target);
+        bool delayed = enableDelay;
+        enableDelay = false;
+        exitRun = false;
+        if constexpr (kLoopSkipping) {
+            if (loopSkipper && !delayed && memory.allRam()) {
+                uint64_t interval = loopSkipper->skip(*this, sliceEnd);
+                if (exitRun || cycles >= sliceEnd) continue;
+                // Back here before long, in case the engine enters a loop
+                sliceEnd = std::min(sliceEnd, cycles + interval);
             }
-            A += correction;
-            updateFlags(A);
-            break;
         }
-        
-        // Logical Group - ANA (AND)
-        case 0xA0: A &= B; updateFlagsLogical(A); break; case 0xA1: A &= C; updateFlagsLogical(A); break;
-        case 0xA2: A &= D; updateFlagsLogical(A); break; case 0xA3: A &= E; updateFlagsLogical(A); break;
-        case 0xA4: A &= H; updateFlagsLogical(A); break; case 0xA5: A &= L; updateFlagsLogical(A); break;
-        case 0xA6: A &= memory[getHL()]; updateFlagsLogical(A); break; case 0xA7: A &= A; updateFlagsLogical(A); break;
-        case 0xE6: A &= fetchByte(); updateFlagsLogical(A); break; // ANI
-        
-        // XRA (XOR)
-        case 0xA8: A ^= B; updateFlagsLogical(A); break; case 0xA9: A ^= C; updateFlagsLogical(A); break;
-        case 0xAA: A ^= D; updateFlagsLogical(A); break; case 0xAB: A ^= E; updateFlagsLogical(A); break;
-        case 0xAC: A ^= H; updateFlagsLogical(A); break; case 0xAD: A ^= L; updateFlagsLogical(A); break;
-        case 0xAE: A ^= memory[getHL()]; updateFlagsLogical(A); break; case 0xAF: A ^= A; updateFlagsLogical(A); break;
-        case 0xEE: A ^= fetchByte(); updateFlagsLogical(A); break; // XRI
-        
-        // ORA (OR)
-        case 0xB0: A |= B; updateFlagsLogical(A); break; case 0xB1: A |= C; updateFlagsLogical(A); break;
-        case 0xB2: A |= D; updateFlagsLogical(A); break; case 0xB3: A |= E; updateFlagsLogical(A); break;
-        case 0xB4: A |= H; updateFlagsLogical(A); break; case 0xB5: A |= L; updateFlagsLogical(A); break;
-        case 0xB6: A |= memory[getHL()]; updateFlagsLogical(A); break; case 0xB7: A |= A; updateFlagsLogical(A); break;
-        case 0xF6: A |= fetchByte(); updateFlagsLogical(A); break; // ORI
-        
-        // CMP (Compare)
-        case 0xB8: sub(B); break; case 0xB9: sub(C); break; case 0xBA: sub(D); break; case 0xBB: sub(E); break;
-        case 0xBC: sub(H); break; case 0xBD: sub(L); break; case 0xBE: sub(memory[getHL()]); break; case 0xBF: sub(A); break;
-        case 0xFE: sub(fetchByte()); break; // CPI
-        
-        // RLC (Rotate Left)
-        case 0x07: flags.CY = (A & 0x80) != 0; A = (A << 1) | (flags.CY ? 1 : 0); break;
-        
-        // RRC (Rotate Right)
-        case 0x0F: flags.CY = (A & 0x01) != 0; A = (A >> 1) | (flags.CY ? 0x80 : 0); break;
-        
-        // RAL (Rotate Left through Carry)
-        case 0x17: temp8 = flags.CY ? 1 : 0; flags.CY = (A & 0x80) != 0; A = (A << 1) | temp8; break;
-        
-        // RAR (Rotate Right through Carry)
-        case 0x1F: temp8 = flags.CY ? 0x80 : 0; flags.CY = (A & 0x01) != 0; A = (A >> 1) | temp8; break;
-        
-        // CMA (Complement Accumulator)
-        case 0x2F: A = ~A; break;
-        
-        // CMC (Complement Carry)
-        case 0x3F: flags.CY = !flags.CY; break;
-        
-        // STC (Set Carry)
-        case 0x37: flags.CY = true; break;
-        
-        // Branch Group - JMP
-        case 0xC3: PC = fetchWord(); break; // JMP
-        case 0xC2: addr = fetchWord(); if (!flags.Z) PC = addr; break; // JNZ
-        case 0xCA: addr = fetchWord(); if (flags.Z) PC = addr; break;  // JZ
-        case 0xD2: addr = fetchWord(); if (!flags.CY) PC = addr; break; // JNC
-        case 0xDA: addr = fetchWord(); if (flags.CY) PC = addr; break;  // JC
-        case 0xE2: addr = fetchWord(); if (!flags.P) PC = addr; break;  // JPO
-        case 0xEA: addr = fetchWord(); if (flags.P) PC = addr; break;   // JPE
-        case 0xF2: addr = fetchWord(); if (!flags.S) PC = addr; break;  // JP
-        case 0xFA: addr = fetchWord(); if (flags.S) PC = addr; break;   // JM
-        
-        // CALL
-        case 0xCD: addr = fetchWord(); push(PC); PC = addr; break; // CALL
-        case 0xC4: addr = fetchWord(); if (!flags.Z) { push(PC); PC = addr; } break; // CNZ
-        case 0xCC: addr = fetchWord(); if (flags.Z) { push(PC); PC = addr; } break;  // CZ
-        case 0xD4: addr = fetchWord(); if (!flags.CY) { push(PC); PC = addr; } break; // CNC
-        case 0xDC: addr = fetchWord(); if (flags.CY) { push(PC); PC = addr; } break;  // CC
-        case 0xE4: addr = fetchWord(); if (!flags.P) { push(PC); PC = addr; } break;  // CPO
-        case 0xEC: addr = fetchWord(); if (flags.P) { push(PC); PC = addr; } break;   // CPE
-        case 0xF4: addr = fetchWord(); if (!flags.S) { push(PC); PC = addr; } break;  // CP
-        case 0xFC: addr = fetchWord(); if (flags.S) { push(PC); PC = addr; } break;   // CM
-        
-        // RET
-        case 0xC9: PC = pop(); break; // RET
-        case 0xC0: if (!flags.Z) PC = pop(); break; // RNZ
-        case 0xC8: if (flags.Z) PC = pop(); break;  // RZ
-        case 0xD0: if (!flags.CY) PC = pop(); break; // RNC
-        case 0xD8: if (flags.CY) PC = pop(); break;  // RC
-        case 0xE0: if (!flags.P) PC = pop(); break;  // RPO
-        case 0xE8: if (flags.P) PC = pop(); break;   // RPE
-        case 0xF0: if (!flags.S) PC = pop(); break;  // RP
-        case 0xF8: if (flags.S) PC = pop(); break;   // RM
-        
-        // RST (Restart)
-        case 0xC7: push(PC); PC = 0x00; break; case 0xCF: push(PC); PC = 0x08; break;
-        case 0xD7: push(PC); PC = 0x10; break; case 0xDF: push(PC); PC = 0x18; break;
-        case 0xE7: push(PC); PC = 0x20; break; case 0xEF: push(PC); PC = 0x28; break;
-        case 0xF7: push(PC); PC = 0x30; break; case 0xFF: push(PC); PC = 0x38; break;
-        
-        // PCHL (Move HL to PC)
-        case 0xE9: PC = getHL(); break;
-        
-        // Stack Group - PUSH
-        case 0xC5: push(getBC()); break; // PUSH B
-        case 0xD5: push(getDE()); break; // PUSH D
-        case 0xE5: push(getHL()); break; // PUSH H
-        case 0xF5: push((A << 8) | (flags.S ? 0x80 : 0) | (flags.Z ? 0x40 : 0) | (flags.AC ? 0x10 : 0) | (flags.P ? 0x04 : 0) | 0x02 | (flags.CY ? 0x01 : 0)); break; // PUSH PSW
-        
-        // POP
-        case 0xC1: setBC(pop()); break; // POP B
-        case 0xD1: setDE(pop()); break; // POP D
-        case 0xE1: setHL(pop()); break; // POP H
-        case 0xF1: { // POP PSW
-            temp16 = pop();
-            A = (temp16 >> 8) & 0xFF;
-            flags.S = (temp16 & 0x80) != 0;
-            flags.Z = (temp16 & 0x40) != 0;
-            flags.AC = (temp16 & 0x10) != 0;
-            flags.P = (temp16 & 0x04) != 0;
-            flags.CY = (temp16 & 0x01) != 0;
+        (this->*runEngine)(sliceEnd - cycles);
+        // Stopped early by a policy hook or JIT verification
+        if (!exitRun && cycles < sliceEnd) break;
+    }
+    return cycles - runStart;
+}
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::acceptInterrupt() {
+    InterruptUnit::Request request = interrupts.next(interruptEnabled);
+    interrupts.acknowledge(request.line, interruptEnabled);
+    interruptEnabled = false;
+    halted = false;
+    push(PC);
+    PC = request.vector;
+    cycles += 12;  // Same as RST
+}
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::setEngine(Engine newEngine) {
+    engine = newEngine;
+    switch (engine) {
+        case Engine::Switch: runEngine = &BasicCPU8085::runSwitch; break;
+        case Engine::Threaded: runEngine = &BasicCPU8085::runThreaded; break;
+        case Engine::FunctionTable: runEngine = &BasicCPU8085::runFunctionTable; break;
+        case Engine::Predecoded: runEngine = &BasicCPU8085::runPredecoded; break;
+        case Engine::Jit:
+            runEngine = hasJit() && kNativeJit ? &BasicCPU8085::runJit : &BasicCPU8085::runPredecoded;
             break;
+    }
+    // Caches are only kept up to date by the engine using them
+    invalidateCode();
+}
+
+const char* CPU8085Base::engineName(Engine engine) {
+    switch (engine) {
+        case Engine::Switch: return "switch";
+        case Engine::Threaded: return hasComputedGoto() ? "threaded" : "threaded (function table)";
+        case Engine::FunctionTable: return "function-table";
+        case Engine::Predecoded: return "predecoded";
+        case Engine::Jit: return "jit";
+    }
+    return "unknown";
+}
+
+bool CPU8085Base::hasComputedGoto() {
+    return CPU8085_COMPUTED_GOTO != 0;
+}
+
+bool CPU8085Base::hasJit() {
+    return CPU8085_JIT != 0;
+}
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::setJitVerify(bool enabled) {
+    if constexpr (kNativeJit) {
+        if (!jit) jit.reset(new JitCompiler(*this));
+        jit->setVerify(enabled);
+    }
+}
+
+template <class... Policies>
+std::string BasicCPU8085<Policies...>::jitVerifyError() const {
+    return jit ? jit->verifyError() : std::string();
+}
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::setLoopSkipping(bool enabled) {
+    if constexpr (kLoopSkipping) {
+        if (!enabled) {
+            loopSkipper.reset();
+        } else if (!loopSkipper) {
+            loopSkipper.reset(new LoopSkipper());
         }
-        
-        // XTHL (Exchange HL with top of stack)
-        case 0xE3:
-            temp8 = memory[SP];
-            memory[SP] = L;
-            L = temp8;
-            temp8 = memory[SP + 1];
-            memory[SP + 1] = H;
-            H = temp8;
-            break;
-        
-        // SPHL (Move HL to SP)
-        case 0xF9: SP = getHL(); break;
-        
-        // IN/OUT (I/O instructions - simplified)
-        case 0xDB: fetchByte(); break; // IN port (not implemented)
-        case 0xD3: fetchByte(); break; // OUT port (not implemented)
-        
-        // EI/DI (Enable/Disable Interrupts)
-        case 0xFB: interruptEnabled = true; break;  // EI
-        case 0xF3: interruptEnabled = false; break; // DI
-        
-        // RIM/SIM (8085 specific - Read/Set Interrupt Mask)
-        case 0x20: A = 0; break; // RIM (simplified)
-        case 0x30: break;         // SIM (simplified)
-        
-        // Undefined/Illegal opcodes in 8085 - treat as NOP
-        case 0x08: break; // *NOP (undefined)
-        case 0x10: break; // *NOP (undefined)
-        case 0x18: break; // *NOP (undefined)
-        case 0x28: break; // *NOP (undefined)
-        case 0x38: break; // *NOP (undefined)
-        case 0xCB: break; // *NOP (undefined)
-        case 0xD9: break; // *NOP (undefined - RET in 8080, but NOP in 8085)
-        case 0xDD: break; // *NOP (undefined)
-        case 0xED: break; // *NOP (undefined)
-        case 0xFD: break; // *NOP (undefined)
-        
-        default:
-            // Unknown opcode - should never reach here if all 256 are covered
-            break;
     }
 }
 
-uint8_t CPU8085::add(uint8_t value, bool withCarry) {
-    uint16_t result = A + value + (withCarry && flags.CY ? 1 : 0);
-    flags.CY = (result > 0xFF);
-    flags.AC = ((A & 0x0F) + (value & 0x0F) + (withCarry && flags.CY ? 1 : 0)) > 0x0F;
-    updateFlags(result & 0xFF);
-    return result & 0xFF;
+template <class... Policies>
+uint64_t BasicCPU8085<Policies...>::skippedCycles() const {
+    return loopSkipper ? loopSkipper->skippedCycles : 0;
 }
 
-uint8_t CPU8085::sub(uint8_t value, bool withBorrow) {
-    uint16_t result = A - value - (withBorrow && flags.CY ? 1 : 0);
-    flags.CY = (result > 0xFF);
-    flags.AC = ((A & 0x0F) < ((value & 0x0F) + (withBorrow && flags.CY ? 1 : 0)));
-    updateFlags(result & 0xFF);
-    return result & 0xFF;
+int CPU8085Base::instructionLength(uint8_t opcode) {
+    return lengthTable[opcode];
+}
+
+int CPU8085Base::baseCycles(uint8_t opcode) {
+    return cycleTable[opcode];
 }
 
-void CPU8085::updateFlags(uint8_t result) {
-    flags.Z = (result == 0);
-    flags.S = (result & 0x80) != 0;
+int CPU8085Base::takenExtraCycles(uint8_t opcode) {
+    return kOpcodes[opcode].takenCycles;
+}
+
+bool CPU8085Base::endsBlock(uint8_t opcode) {
+    return kOpcodes[opcode].flow != ControlFlow::Next;
+}
+
+// Operand fetch emitted in front of the OP() statements, by instruction length
+#define FETCH_OPERAND_1
+#define FETCH_OPERAND_2 operand = fetchByte();
+#define FETCH_OPERAND_3 operand = fetchWord();
+
+// Locals the OP() statements may use
+#define OP_LOCALS \
+    [[maybe_unused]] uint16_t operand; \
+    [[maybe_unused]] uint16_t temp16; \
+    [[maybe_unused]] uint8_t temp8
+
+// Switch engine: one indirect branch shared by every opcode
+
+template <class... Policies>
+int BasicCPU8085<Policies...>::executeInstruction(uint8_t opcode) {
+    OP_LOCALS;
+    int states = cycleTable[opcode];
     
-    // Calculate parity
-    int bits = 0;
-    for (int i = 0; i < 8; i++) {
-        if (result & (1 << i)) bits++;
+    switch (opcode) {
+#define OP(code, length, ...) case code: FETCH_OPERAND_##length __VA_ARGS__ break;
+#include "cpu8085_ops.inc"
+#undef OP
+    }
+    return states;
+}
+
+template <class... Policies>
+uint64_t BasicCPU8085<Policies...>::runSwitch(uint64_t cycleBudget) {
+    uint64_t start = cycles;
+    uint64_t target = start + cycleBudget;
+    while (!exitRun && cycles < target) {
+        if constexpr (kInstructionHooks) {
+            if (!beforeInstruction() && cycles != runStart) break;
+        }
+        executeNext();
     }
-    flags.P = (bits % 2 == 0);
+    return cycles - start;
+}
+
+template <class... Policies>
+uint64_t BasicCPU8085<Policies...>::executeCount(int count) {
+    uint64_t start = cycles;
+    for (int i = 0; i < count && !halted; i++) executeNext();
+    return cycles - start;
+}
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::executeNext() {
+    [[maybe_unused]] uint16_t pc = PC;
+    uint8_t opcode = fetchByte();
+    int states = executeInstruction(opcode);
+    cycles += states;
+    if constexpr (kInstructionHooks) afterInstruction(pc, opcode, states);
 }
 
-void CPU8085::updateFlagsLogical(uint8_t result) {
-    flags.Z = (result == 0);
-    flags.S = (result & 0x80) != 0;
-    flags.CY = false;  // Logical operations clear carry
-    flags.AC = false;  // Auxiliary carry is reset
+// Threaded engine: every handler ends with its own indirect jump, so the
+// branch predictor sees one branch site per opcode instead of one in total
+
+template <class... Policies>
+uint64_t BasicCPU8085<Policies...>::runThreaded(uint64_t cycleBudget) {
+#if CPU8085_COMPUTED_GOTO
+    static void* const labels[256] = {
+#define OP(code, length, ...) &&op_##code,
+#include "cpu8085_ops.inc"
+#undef OP
+    };
+    
+    OP_LOCALS;
+    uint64_t start = cycles;
+    uint64_t target = start + cycleBudget;
+    [[maybe_unused]] uint16_t pc;
+    uint8_t opcode;
+    int states;
+    
+#define DISPATCH() \
+    if (exitRun || cycles >= target) return cycles - start; \
+    if constexpr (kInstructionHooks) { \
+        if (!beforeInstruction() && cycles != runStart) return cycles - start; \
+        pc = PC; \
+    } \
+    opcode = fetchByte(); \
+    states = cycleTable[opcode]; \
+    goto *labels[opcode]
+#define RETIRE() \
+    cycles += states; \
+    if constexpr (kInstructionHooks) afterInstruction(pc, opcode, states)
     
-    // Calculate parity
-    int bits = 0;
-    for (int i = 0; i < 8; i++) {
-        if (result & (1 << i)) bits++;
+    DISPATCH();
+#define OP(code, length, ...) op_##code: FETCH_OPERAND_##length __VA_ARGS__ RETIRE(); DISPATCH();
+#include "cpu8085_ops.inc"
+#undef OP
+#undef RETIRE
+#undef DISPATCH
+#else
+    // No computed goto on this compiler - use the portable table instead
+    return runFunctionTable(cycleBudget);
+#endif
+}
+
+// Per-opcode functions used by the function-table and predecoded engines
+
+// Only the branch for OPCODE is instantiated
+template <class... Policies>
+template <uint8_t OPCODE>
+int BasicCPU8085<Policies...>::execute([[maybe_unused]] uint16_t operand) {
+    [[maybe_unused]] uint16_t temp16;
+    [[maybe_unused]] uint8_t temp8;
+    int states = cycleTable[OPCODE];
+#define OP(code, length, ...) if constexpr (OPCODE == code) { __VA_ARGS__ } else
+#include "cpu8085_ops.inc"
+#undef OP
+    {}
+    return states;
+}
+
+template <class... Policies>
+template <uint8_t OPCODE>
+int BasicCPU8085<Policies...>::handler() {
+    uint16_t operand = 0;
+    if (lengthTable[OPCODE] == 2) {
+        operand = fetchByte();
+    } else if (lengthTable[OPCODE] == 3) {
+        operand = fetchWord();
+    }
+    return execute<OPCODE>(operand);
+}
+
+template <class... Policies>
+template <uint8_t OPCODE>
+int BasicCPU8085<Policies...>::microOp(BasicCPU8085& cpu, uint16_t operand) {
+    return cpu.template execute<OPCODE>(operand);
+}
+
+template <class... Policies>
+const typename BasicCPU8085<Policies...>::Handler BasicCPU8085<Policies...>::handlerTable[256] = {
+#define OP(code, length, ...) &BasicCPU8085::handler<code>,
+#include "cpu8085_ops.inc"
+#undef OP
+};
+
+template <class... Policies>
+const typename BasicCPU8085<Policies...>::MicroOpFn BasicCPU8085<Policies...>::microOpTable[256] = {
+#define OP(code, length, ...) &BasicCPU8085::microOp<code>,
+#include "cpu8085_ops.inc"
+#undef OP
+};
+
+// Function-table engine: portable per-opcode handlers
+
+template <class... Policies>
+uint64_t BasicCPU8085<Policies...>::runFunctionTable(uint64_t cycleBudget) {
+    uint64_t start = cycles;
+    uint64_t target = start + cycleBudget;
+    while (!exitRun && cycles < target) {
+        if constexpr (kInstructionHooks) {
+            if (!beforeInstruction() && cycles != runStart) break;
+        }
+        [[maybe_unused]] uint16_t pc = PC;
+        uint8_t opcode = fetchByte();
+        int states = (this->*handlerTable[opcode])();
+        cycles += states;
+        if constexpr (kInstructionHooks) afterInstruction(pc, opcode, states);
     }
-    flags.P = (bits % 2 == 0);
+    return cycles - start;
+}
+
+// Predecoded engine: see blockcache.h
+
+template <class... Policies>
+uint64_t BasicCPU8085<Policies...>::runPredecoded(uint64_t cycleBudget) {
+    if (!blockCache) blockCache.reset(new BasicBlockCache<BasicCPU8085>());
+    return blockCache->run(*this, cycleBudget);
+}
+
+// JIT engine: see jit.h
+
+template <class... Policies>
+uint64_t BasicCPU8085<Policies...>::runJit(uint64_t cycleBudget) {
+    if constexpr (kNativeJit) {
+        if (!jit) jit.reset(new JitCompiler(*this));
+        // No executable memory, or ROM and device pages that compiled loads
+        // and stores cannot route - interpret instead
+        if (!jit->available() || !memory.allRam()) return runPredecoded(cycleBudget);
+        // Compiled code indexes guest memory directly
+        memory.setMode(GuestMemory::Mode::Flat);
+        return jit->run(*this, cycleBudget);
+    } else {
+        return runPredecoded(cycleBudget);
+    }
+}
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::invalidateCodePage(uint8_t page) {
+    if (blockCache) blockCache->invalidatePage(page);
+    if (jit) jit->invalidatePage(page);
+    codePages[page] = 0;
+    leaveBlock = true;
+}
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::invalidateCode() {
+    if (blockCache) blockCache->flush();
+    if (jit) jit->flush();
+    codePages.fill(0);
+}
+
+#undef OP_LOCALS
+#undef FETCH_OPERAND_1
+#undef FETCH_OPERAND_2
+#undef FETCH_OPERAND_3
+
+// The carry in (ADC) or borrow in (SBB) counts towards AC as well as CY
+template <class... Policies>
+uint8_t BasicCPU8085<Policies...>::add(uint8_t value, bool withCarry) {
+    unsigned carry = withCarry && flags.CY() ? 1 : 0;
+    unsigned result = A + value + carry;
+    unsigned half = ((A & 0x0F) + (value & 0x0F) + carry) & 0x10;
+    flags.psw = flagTables.arith[(half << 5) | result];
+    return result & 0xFF;
+}
+
+template <class... Policies>
+uint8_t BasicCPU8085<Policies...>::sub(uint8_t value, bool withBorrow) {
+    unsigned borrow = withBorrow && flags.CY() ? 1 : 0;
+    unsigned result = (A - value - borrow) & 0x1FF;
+    unsigned half = ((A & 0x0F) + (~value & 0x0F) + (borrow ^ 1)) & 0x10;
+    flags.psw = flagTables.arith[(half << 5) | result];
+    return result & 0xFF;
+}
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::incrementFlags(uint8_t result) {
+    // S, Z, AC and P from the table; CY is preserved
+    flags.psw = (flags.psw & Flags::CARRY) | flagTables.inr[result];
+}
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::decrementFlags(uint8_t result) {
+    flags.psw = (flags.psw & Flags::CARRY) | flagTables.dcr[result];
+}
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::updateFlagsLogical(uint8_t result) {
+    // XRA and ORA clear CY and AC
+    flags.psw = flagTables.szp[result];
 }
 
-void CPU8085::push(uint16_t value) {
-    memory[--SP] = (value >> 8) & 0xFF;
-    memory[--SP] = value & 0xFF;
+template <class... Policies>
+void BasicCPU8085<Policies...>::updateFlagsAnd(uint8_t result) {
+    // ANA clears CY and, on the 8085 unlike the 8080, sets AC
+    flags.psw = flagTables.szp[result] | Flags::AUX_CARRY;
 }
 
-uint16_t CPU8085::pop() {
-    uint8_t low = memory[SP++];
-    uint8_t high = memory[SP++];
+template <class... Policies>
+void BasicCPU8085<Policies...>::push(uint16_t value) {
+    writeByte(--SP, (value >> 8) & 0xFF);
+    writeByte(--SP, value & 0xFF);
+}
+
+template <class... Policies>
+uint16_t BasicCPU8085<Policies...>::pop() {
+    uint8_t low = readByte(SP++);
+    uint8_t high = readByte(SP++);
     return (high << 8) | low;
 }
 
-std::string CPU8085::getRegisterState() const {
+template <class... Policies>
+std::string BasicCPU8085<Policies...>::getRegisterState() const {
     std::ostringstream oss;
     oss << std::hex << std::uppercase << std::setfill('0');
     oss << "A:" << std::setw(2) << (int)A << " "
@@ -378,25 +639,54 @@ std::string CPU8085::getRegisterState() const {
     return oss.str();
 }
 
-std::string CPU8085::getFlagsState() const {
+template <class... Policies>
+std::string BasicCPU8085<Policies...>::getFlagsState() const {
     std::ostringstream oss;
-    oss << "S:" << flags.S << " "
-        << "Z:" << flags.Z << " "
-        << "AC:" << flags.AC << " "
-        << "P:" << flags.P << " "
-        << "CY:" << flags.CY;
+    oss << "S:" << flags.S() << " "
+        << "Z:" << flags.Z() << " "
+        << "AC:" << flags.AC() << " "
+        << "P:" << flags.P() << " "
+        << "CY:" << flags.CY();
     return oss.str();
 }
 
-uint8_t CPU8085::getMemory(uint16_t address) const {
-    return memory[address];
+template <class... Policies>
+uint8_t BasicCPU8085<Policies...>::getMemory(uint16_t address) const {
+    return memory.peek(address);
 }
 
-void CPU8085::setMemory(uint16_t address, uint8_t value) {
-    memory[address] = value;
+template <class... Policies>
+void BasicCPU8085<Policies...>::setMemory(uint16_t address, uint8_t value) {
+    memory.poke(address, value);
+    writtenPages[address >> 8] = 1;
+    if (codePages[address >> 8]) invalidateCodePage(address >> 8);
 }
 
-void CPU8085::loadProgram(const uint8_t* program, size_t size, uint16_t startAddress) {
-    std::memcpy(&memory[startAddress], program, size);
+template <class... Policies>
+void BasicCPU8085<Policies...>::loadProgram(const uint8_t* program, size_t size, uint16_t startAddress) {
+    memory.write(startAddress, program, size);
+    invalidateCode();
+    writtenPages.fill(1);
     PC = startAddress;
 }
+
+template <class... Policies>
+void BasicCPU8085<Policies...>::setMemoryImage(std::shared_ptr<const MemoryImage> image) {
+    memory.setImage(std::move(image));
+    invalidateCode();
+    writtenPages.fill(1);
+}
+
+template <class... Policies>
+std::bitset<256> BasicCPU8085<Policies...>::takeWrittenPages() {
+    std::bitset<256> pages;
+    for (int page = 0; page < 256; page++) {
+        if (writtenPages[page]) pages.set(page);
+    }
+    writtenPages.fill(0);
+    return pages;
+}
+
+#define CPU8085_INSTANTIATE(...) template class BasicCPU8085<__VA_ARGS__>;
+CPU8085_SPECIALIZATIONS(CPU8085_INSTANTIATE)
+#undef CPU8085_INSTANTIATE
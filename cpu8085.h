@@ -3,10 +3,126 @@
 
 #include <cstdint>
 #include <array>
+#include <bitset>
+#include <memory>
 #include <string>
+#include "binarytrace.h"
+#include "breakpoints.h"
+#include "cpupolicy.h"
+#include "guestmemory.h"
+#include "interrupts.h"
+#include "iobus.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "undolog.h"
 
-class CPU8085 {
+// Computed goto (labels as values) is a GCC/Clang extension
+#ifndef CPU8085_COMPUTED_GOTO
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU8085_COMPUTED_GOTO 1
+#else
+#define CPU8085_COMPUTED_GOTO 0
+#endif
+#endif
+
+// The JIT engine emits x86-64 code and maps it with mmap
+#ifndef CPU8085_JIT
+#if defined(__x86_64__) && defined(__linux__)
+#define CPU8085_JIT 1
+#else
+#define CPU8085_JIT 0
+#endif
+#endif
+
+// Build-time default for the dispatch engine (Switch, Threaded, FunctionTable,
+// Predecoded or Jit)
+#ifndef CPU8085_DEFAULT_ENGINE
+#define CPU8085_DEFAULT_ENGINE Threaded
+#endif
+
+template <class Cpu> class BasicBlockCache;
+class JitCompiler;
+class LoopSkipper;
+class SaveState;
+
+// Parts of the core that do not depend on the policies: engine selection,
+// the PSW layout and static instruction properties
+class CPU8085Base {
 public:
+    // Interpreter cores. All of them expand the same opcode definitions from
+    // cpu8085_ops.inc, so they only differ in how an opcode is dispatched.
+    enum class Engine {
+        Switch,         // One 256-case switch
+        Threaded,       // Computed-goto threaded code (FunctionTable if unsupported)
+        FunctionTable,  // Table of per-opcode member function pointers
+        Predecoded,     // Cached basic blocks of predecoded micro-ops (blockcache.h)
+        Jit,            // Hot blocks compiled to x86-64 code (jit.h; Predecoded if unsupported)
+    };
+    static constexpr Engine defaultEngine = Engine::CPU8085_DEFAULT_ENGINE;
+    
+    // Flags, packed in 8085 PSW layout: S Z 0 AC 0 P 1 CY
+    struct Flags {
+        static constexpr uint8_t SIGN = 0x80;
+        static constexpr uint8_t ZERO = 0x40;
+        static constexpr uint8_t AUX_CARRY = 0x10;
+        static constexpr uint8_t PARITY = 0x04;
+        static constexpr uint8_t ALWAYS_ONE = 0x02;
+        static constexpr uint8_t CARRY = 0x01;
+        static constexpr uint8_t ALL = SIGN | ZERO | AUX_CARRY | PARITY | CARRY;
+        
+        uint8_t psw;
+        
+        bool S() const { return psw & SIGN; }       // Sign
+        bool Z() const { return psw & ZERO; }       // Zero
+        bool AC() const { return psw & AUX_CARRY; } // Auxiliary Carry
+        bool P() const { return psw & PARITY; }     // Parity
+        bool CY() const { return psw & CARRY; }     // Carry
+        
+        void setS(bool on) { set(SIGN, on); }
+        void setZ(bool on) { set(ZERO, on); }
+        void setAC(bool on) { set(AUX_CARRY, on); }
+        void setP(bool on) { set(PARITY, on); }
+        void setCY(bool on) { set(CARRY, on); }
+        
+    private:
+        void set(uint8_t mask, bool on) { psw = on ? (psw | mask) : (psw & ~mask); }
+    };
+    
+    static const char* engineName(Engine engine);
+    static bool hasComputedGoto();
+    static bool hasJit();
+    
+    // Static instruction properties shared with the block decoder and JIT
+    static int instructionLength(uint8_t opcode);
+    static int baseCycles(uint8_t opcode);  // Not-taken cost for conditionals
+    static int takenExtraCycles(uint8_t opcode);  // Added when a conditional is taken
+    static bool endsBlock(uint8_t opcode);  // May transfer control or halt
+};
+
+// The 8085 core, specialized at compile time by policy classes (cpupolicy.h)
+// for tracing, counting, breakpoints and I/O hooks. Hooks of policies that
+// are not in the list are never compiled in, so CPU8085 = BasicCPU8085<>
+// runs exactly the loops it would without any policy support.
+//
+// Member functions live in cpu8085.cpp and are instantiated there for the
+// specializations listed in CPU8085_SPECIALIZATIONS below; add a line there
+// to use a new combination of policies.
+template <class... Policies>
+class BasicCPU8085 : public CPU8085Base, public Policies... {
+public:
+    static constexpr bool kInstructionHooks = (false || ... || Policies::kInstructionHooks);
+    static constexpr bool kLoadHooks = (false || ... || Policies::kLoadHooks);
+    static constexpr bool kStoreHooks = (false || ... || Policies::kStoreHooks);
+    static constexpr bool kPortHooks = (false || ... || Policies::kPortHooks);
+    // The instruction hooks only matter where wantsInstructions() says so
+    static constexpr bool kSparseHooks =
+        kInstructionHooks && (true && ... && (Policies::kSparseHooks || !Policies::kInstructionHooks));
+    // The JIT only compiles the policy-free core; other specializations run
+    // Engine::Jit on the predecoded engine, which calls every hook
+    static constexpr bool kNativeJit = sizeof...(Policies) == 0;
+    // Skipped loops never reach the hooks, so only the policy-free core skips
+    static constexpr bool kLoopSkipping = sizeof...(Policies) == 0;
+    
     // Registers
     uint8_t A;      // Accumulator
     uint8_t B, C;   // BC register pair
@@ -15,41 +131,220 @@ public:
     uint16_t SP;    // Stack Pointer
     uint16_t PC;    // Program Counter
     
-    // Flags
-    struct Flags {
-        bool S;  // Sign
-        bool Z;  // Zero
-        bool AC; // Auxiliary Carry
-        bool P;  // Parity
-        bool CY; // Carry
-    } flags;
+    Flags flags;
     
-    // Memory (64KB)
-    std::array<uint8_t, 65536> memory;
+    // Memory (64KB), flat unless switched to paged copy-on-write or given ROM
+    // and device pages (guestmemory.h)
+    GuestMemory memory;
     
     // State
     bool halted;
     bool interruptEnabled;
+    uint64_t cycles;  // T-states executed since reset
     
-    CPU8085();
+    // Devices: port handlers, interrupt inputs and events timed in T-states.
+    // reset() keeps the port mappings, drops pending events and interrupt
+    // requests, then calls the bus reset hooks.
+    IoBus io;
+    InterruptUnit interrupts;
+    EventScheduler events;
+    
+    explicit BasicCPU8085(Engine engine = defaultEngine);
+    ~BasicCPU8085();
+    BasicCPU8085(const BasicCPU8085&) = delete;
+    BasicCPU8085& operator=(const BasicCPU8085&) = delete;
     void reset();
-    void step();  // Execute one instruction
+    // reset() less its memory and bus parts: registers, flags, clock, events
+    // and interrupt requests only. A few stores, for tools that run many
+    // short programs on one CPU and would spend most of their time in
+    // reset()'s 64KB copy.
+    void resetRegisters();
+    // Executes count instructions from PC, or fewer if one halts, without
+    // looking at events or interrupts and without the engine's caches.
+    // Returns the T-states spent. Allocates nothing, so it suits tight loops
+    // over short straight-line code.
+    uint64_t executeCount(int count);
+    // Execute one instruction or take one interrupt, returns the T-states
+    // spent. A halted CPU instead waits for its next event (0 when stopped()).
+    int step();
+    // Execute instructions until at least cycleBudget T-states have elapsed or
+    // the CPU stops. May overrun the budget by up to one instruction.
+    // Events fire between instructions once their cycle is reached, and
+    // interrupts are taken between instructions. While halted the CPU skips
+    // ahead to the next event, spending the T-states without executing.
+    // Returns the T-states that elapsed.
+    uint64_t run(uint64_t cycleBudget);
+    // Halted with no event scheduled and no interrupt it would take, so
+    // run() cannot make progress
+    bool stopped() const {
+        return halted && events.empty() && !interrupts.requested(interruptEnabled);
+    }
+    
+    // Dispatch engine selection (takes effect on the next step()/run())
+    void setEngine(Engine engine);
+    Engine getEngine() const { return engine; }
+    
+    // JIT lockstep verification: every compiled block is replayed on an
+    // interpreter and the states compared. run() stops at the first mismatch,
+    // which jitVerifyError() then describes.
+    void setJitVerify(bool enabled);
+    std::string jitVerifyError() const;
+    
+    // Loop skipping (loopskip.h): run() fast-forwards delay loops and polling
+    // loops with the same result as executing them. Off by default, and only
+    // the plain core (kLoopSkipping) can switch it on.
+    void setLoopSkipping(bool enabled);
+    bool loopSkipping() const { return loopSkipper != nullptr; }
+    // T-states fast-forwarded since loop skipping was switched on
+    uint64_t skippedCycles() const;
+    
     uint8_t fetchByte();
     uint16_t fetchWord();
     
     // Helper functions
     std::string getRegisterState() const;
     std::string getFlagsState() const;
+    // Host access to the contents, past the memory map: ROM can be patched
+    // and device pages are not touched
     uint8_t getMemory(uint16_t address) const;
     void setMemory(uint16_t address, uint8_t value);
     
     // Load program into memory
     void loadProgram(const uint8_t* program, size_t size, uint16_t startAddress = 0x0000);
+    // Memory contents restored by reset(), shared read-only between CPUs in
+    // paged mode. Replaces the current contents straight away.
+    void setMemoryImage(std::shared_ptr<const MemoryImage> image);
+    
+    // Save states (savestate.h). restoreState() keeps the engine, policies,
+    // memory map and devices.
+    SaveState saveState() const;
+    void restoreState(const SaveState& state);
+    // A new machine starting from this one's state, with the same engine and
+    // policy settings, paged memory and nothing on its I/O bus. Memory is
+    // shared copy-on-write; only pages changed since the image was set are
+    // copied.
+    std::unique_ptr<BasicCPU8085> fork() const;
+
+    // Writes made directly to `memory` and changes to its memory map bypass
+    // self-modifying code detection; call this afterwards when using the
+    // Predecoded or JIT engine
+    void invalidateCode();
+    
+    // One bit per 256-byte page stored to since the last call, for viewers
+    // that refresh only what changed. reset() and loads mark every page;
+    // direct writes to `memory` are not tracked.
+    std::bitset<256> takeWrittenPages();
     
 private:
-    void executeInstruction(uint8_t opcode);
-    void updateFlags(uint8_t result);
+    template <class Cpu> friend class BasicBlockCache;
+    friend class JitCompiler;
+    friend class LoopSkipper;
+    friend class UndoLog;
+    friend class Breakpoints;
+    
+    using Handler = int (BasicCPU8085::*)();
+    using RunEngine = uint64_t (BasicCPU8085::*)(uint64_t);
+    using MicroOpFn = int (*)(BasicCPU8085&, uint16_t operand);
+    
+    Engine engine;
+    RunEngine runEngine;
+    
+    // Predecoded and JIT engine state, created on first use
+    std::unique_ptr<BasicBlockCache<BasicCPU8085>> blockCache;
+    std::unique_ptr<JitCompiler> jit;
+    std::unique_ptr<LoopSkipper> loopSkipper;
+    // Non-zero for 256-byte pages holding predecoded code
+    std::array<uint8_t, 256> codePages;
+    // Set when a store hit a code page or the engine must return to run();
+    // checked after each micro-op
+    bool leaveBlock;
+    // Set by HLT and by instructions after which run() has to look at the
+    // interrupts or events again; engines return before the next instruction
+    bool exitRun;
+    // EI found a request pending: take it only after the next instruction
+    bool enableDelay;
+    // cycles when run() was called: a false beforeInstruction is ignored there
+    uint64_t runStart;
+    // Non-zero for pages stored to since takeWrittenPages()
+    std::array<uint8_t, 256> writtenPages;
+    
+    uint8_t readByte(uint16_t address) {
+        uint8_t value = memory.read(address);
+        if constexpr (kLoadHooks) (static_cast<Policies&>(*this).onLoad(*this, address, value), ...);
+        return value;
+    }
+    void writeByte(uint16_t address, uint8_t value) {
+        if constexpr (kStoreHooks) (static_cast<Policies&>(*this).onStore(*this, address, value), ...);
+        memory.write(address, value);
+        writtenPages[address >> 8] = 1;
+        if (codePages[address >> 8]) invalidateCodePage(address >> 8);
+    }
+    void invalidateCodePage(uint8_t page);
+    // reset()'s memory part: back to the image, dropping code from changed pages
+    void resetMemory();
+    
+    // Policy hooks, compiled in only when some policy has them
+    bool beforeInstruction() {
+        // Every policy sees every instruction, whichever one stops the run
+        return (true & ... & static_cast<Policies&>(*this).beforeInstruction(*this));
+    }
+    void afterInstruction([[maybe_unused]] uint16_t pc, [[maybe_unused]] uint8_t opcode, [[maybe_unused]] int states) {
+        (static_cast<Policies&>(*this).afterInstruction(*this, pc, opcode, states), ...);
+    }
+    bool wantsInstructions([[maybe_unused]] uint16_t first, [[maybe_unused]] uint16_t last) {
+        return (false || ... || static_cast<Policies&>(*this).wantsInstructions(*this, first, last));
+    }
+    uint8_t portIn(uint8_t port) {
+        uint8_t value = io.read(port);
+        if constexpr (kPortHooks) (static_cast<Policies&>(*this).onInput(*this, port, value), ...);
+        deviceAccessed();
+        return value;
+    }
+    void portOut(uint8_t port, uint8_t value) {
+        if constexpr (kPortHooks) (static_cast<Policies&>(*this).onOutput(*this, port, value), ...);
+        io.write(port, value);
+        deviceAccessed();
+    }
+    
+    void requestExit() { exitRun = leaveBlock = true; }
+    // A device handler may have raised an interrupt or scheduled an event
+    // earlier than the end of the current slice
+    void deviceAccessed() {
+        if (interrupts.changed || events.changed) requestExit();
+    }
+    static void memoryDeviceAccessed(void* cpu) { static_cast<BasicCPU8085*>(cpu)->deviceAccessed(); }
+    void enableInterrupts() {
+        interruptEnabled = true;
+        if (interrupts.requested(true)) {
+            enableDelay = true;
+            requestExit();
+        }
+    }
+    void acceptInterrupt();
+    
+    int executeInstruction(uint8_t opcode);  // Switch engine, returns T-states
+    // Fetches and executes one instruction, counting its T-states and
+    // calling afterInstruction
+    void executeNext();
+    uint64_t runSwitch(uint64_t cycleBudget);
+    uint64_t runThreaded(uint64_t cycleBudget);
+    uint64_t runFunctionTable(uint64_t cycleBudget);
+    uint64_t runPredecoded(uint64_t cycleBudget);
+    uint64_t runJit(uint64_t cycleBudget);
+    
+    // One opcode's statements with the operand already fetched, returning T-states
+    template <uint8_t OPCODE> int execute(uint16_t operand);
+    // Function-table engine: fetch the operand, then execute<OPCODE>
+    template <uint8_t OPCODE> int handler();
+    static const Handler handlerTable[256];
+    // Predecoded engine: execute<OPCODE> as a plain function pointer
+    template <uint8_t OPCODE> static int microOp(BasicCPU8085& cpu, uint16_t operand);
+    static const MicroOpFn microOpTable[256];
+    
+    void incrementFlags(uint8_t result);
+    void decrementFlags(uint8_t result);
     void updateFlagsLogical(uint8_t result);
+    void updateFlagsAnd(uint8_t result);
     uint8_t add(uint8_t value, bool withCarry = false);
     uint8_t sub(uint8_t value, bool withBorrow = false);
     void push(uint16_t value);
@@ -64,4 +359,35 @@ private:
     void setHL(uint16_t val) { H = (val >> 8) & 0xFF; L = val & 0xFF; }
 };
 
-#endif // CPU8085_H
+// The plain core, used everywhere no policy is needed
+using CPU8085 = BasicCPU8085<>;
+// Counts instructions; the headless runner uses it for --max-instructions
+using CountingCPU8085 = BasicCPU8085<InstructionCounter>;
+// Counts and prints every instruction (--trace)
+using TracingCPU8085 = BasicCPU8085<InstructionCounter, InstructionTracer>;
+// Counts and records every instruction to a binary trace (--trace-bin)
+using BinaryTracingCPU8085 = BasicCPU8085<InstructionCounter, BinaryTracer>;
+// Counts instructions and profiles them (--profile)
+using ProfilingCPU8085 = BasicCPU8085<InstructionCounter, Profiler>;
+// Breakpoints, watchpoints and tracepoints (breakpoints.h)
+using DebugCPU8085 = BasicCPU8085<Breakpoints>;
+// Breakpoints plus an undo log for stepping back (undolog.h) and a profiler
+// that is off until switched on; the GUI's core
+using ReversibleCPU8085 = BasicCPU8085<UndoLog, Profiler, Breakpoints>;
+
+// Every specialization the library compiles, as X(policies...). Files that
+// define templates over the CPU type instantiate them for each entry.
+#define CPU8085_SPECIALIZATIONS(X) \
+    X() \
+    X(InstructionCounter) \
+    X(InstructionCounter, InstructionTracer) \
+    X(InstructionCounter, BinaryTracer) \
+    X(InstructionCounter, Profiler) \
+    X(Breakpoints) \
+    X(UndoLog, Profiler, Breakpoints)
+
+#define CPU8085_EXTERN_TEMPLATE(...) extern template class BasicCPU8085<__VA_ARGS__>;
+CPU8085_SPECIALIZATIONS(CPU8085_EXTERN_TEMPLATE)
+#undef CPU8085_EXTERN_TEMPLATE
+
+#endif // CPU8085_H
\ No newline at end of file
@@ -0,0 +1,84 @@
+#ifndef CPUPOLICY_H
+#define CPUPOLICY_H
+
+#include <cstdint>
+#include <cstdio>
+#include "opcodes.h"
+
+// Compile-time features for BasicCPU8085 (cpu8085.h). A policy is a base
+// class of the CPU: its data members become members of the CPU, and the core
+// calls its hooks at fixed points. Each group of hooks is only compiled into
+// the engines when some policy sets the matching flag, so a specialization
+// without policies (CPU8085) has no feature checks at all.
+//
+// Derive from CpuPolicy and redefine the hooks that are needed:
+//   beforeInstruction - PC is about to execute; false stops run() there.
+//                       Called on every policy for every instruction, but
+//                       false is ignored for the first one of a run() call,
+//                       so a run stopped by a policy can always resume.
+//   afterInstruction  - the instruction at pc finished after states T-states
+//   onLoad            - a program data read (not instruction fetches)
+//   onStore           - a program store (not direct writes to memory)
+//   onInput/onOutput  - IN/OUT; onInput may replace the value read
+//   wantsInstructions - with kSparseHooks: whether any instruction from first
+//                       to last needs the instruction hooks. When every
+//                       policy with instruction hooks is sparse, the
+//                       predecoded engine runs blocks nobody wants without them.
+struct CpuPolicy {
+    static constexpr bool kInstructionHooks = false;
+    static constexpr bool kLoadHooks = false;
+    static constexpr bool kStoreHooks = false;
+    static constexpr bool kPortHooks = false;
+    static constexpr bool kSparseHooks = false;
+
+    template <class Cpu> bool beforeInstruction(Cpu&) { return true; }
+    template <class Cpu> void afterInstruction(Cpu&, uint16_t, uint8_t, int) {}
+    template <class Cpu> bool wantsInstructions(Cpu&, uint16_t, uint16_t) { return false; }
+    template <class Cpu> void onLoad(Cpu&, uint16_t, uint8_t) {}
+    template <class Cpu> void onStore(Cpu&, uint16_t, uint8_t) {}
+    template <class Cpu> void onInput(Cpu&, uint8_t, uint8_t&) {}
+    template <class Cpu> void onOutput(Cpu&, uint8_t, uint8_t) {}
+};
+
+// Counts executed instructions and optionally stops run() after a limit
+struct InstructionCounter : CpuPolicy {
+    static constexpr bool kInstructionHooks = true;
+
+    uint64_t instructions = 0;  // Not cleared by reset()
+    uint64_t instructionLimit = UINT64_MAX;
+
+    template <class Cpu> bool beforeInstruction(Cpu&) { return instructions < instructionLimit; }
+    template <class Cpu> void afterInstruction(Cpu&, uint16_t, uint8_t, int) { instructions++; }
+};
+
+// Writes one text line per instruction (address, bytes, disassembly,
+// registers after it, T-states so far) and one per port access to traceFile, when it is set
+struct InstructionTracer : CpuPolicy {
+    static constexpr bool kInstructionHooks = true;
+    static constexpr bool kPortHooks = true;
+
+    std::FILE* traceFile = nullptr;
+
+    template <class Cpu> void afterInstruction(Cpu& cpu, uint16_t pc, uint8_t opcode, int) {
+        if (!traceFile) return;
+        uint8_t code[3] = {opcode, cpu.getMemory(static_cast<uint16_t>(pc + 1)),
+                           cpu.getMemory(static_cast<uint16_t>(pc + 2))};
+        char text[kDisassemblySize];
+        int length = disassemble(code, text);
+        char bytes[12];
+        std::snprintf(bytes, sizeof(bytes), "%02X %02X %02X", code[0], code[1], code[2]);
+        bytes[length * 3 - 1] = '\0';
+        std::fprintf(traceFile,
+                     "%04X  %-8s  %-14s  A=%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%04X F=%02X T=%llu\n",
+                     pc, bytes, text, cpu.A, cpu.B, cpu.C, cpu.D, cpu.E, cpu.H, cpu.L, cpu.SP,
+                     cpu.flags.psw, static_cast<unsigned long long>(cpu.cycles));
+    }
+    template <class Cpu> void onInput(Cpu&, uint8_t port, uint8_t& value) {
+        if (traceFile) std::fprintf(traceFile, "      IN  %02X -> %02X\n", port, value);
+    }
+    template <class Cpu> void onOutput(Cpu&, uint8_t port, uint8_t value) {
+        if (traceFile) std::fprintf(traceFile, "      OUT %02X <- %02X\n", port, value);
+    }
+};
+
+#endif // CPUPOLICY_H
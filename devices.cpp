@@ -0,0 +1,199 @@
+#include "devices.h"
+#include <cmath>
+
+namespace {
+
+bool edgeTriggered(InterruptUnit::Line line) {
+    return line == InterruptUnit::Trap || line == InterruptUnit::Rst75;
+}
+
+} // namespace
+
+// IntervalTimer
+
+IntervalTimer::IntervalTimer(InterruptUnit::Line line)
+    : expiries(0), line(line), interrupts(nullptr), events(nullptr), base(0) {
+    powerOn();
+}
+
+void IntervalTimer::attach(IoBus& io, InterruptUnit& irq, EventScheduler& scheduler, uint8_t port) {
+    interrupts = &irq;
+    events = &scheduler;
+    base = port;
+    for (int i = 0; i < 3; i++) io.mapOutput(static_cast<uint8_t>(port + i), write, this);
+    io.mapInput(static_cast<uint8_t>(port + 2), readStatus, this, statusQuiet);
+    io.addResetHook(reset, this);
+}
+
+void IntervalTimer::powerOn() {
+    reload = 0;
+    control = 0;
+    expired = false;
+    pending = 0;
+}
+
+void IntervalTimer::start() {
+    stop();
+    pending = events->scheduleIn(period(), expire, this);
+}
+
+void IntervalTimer::stop() {
+    if (pending) events->cancel(pending);
+    pending = 0;
+}
+
+uint8_t IntervalTimer::readStatus(void* context, uint8_t) {
+    IntervalTimer& t = *static_cast<IntervalTimer*>(context);
+    uint8_t status = (t.expired ? 0x01 : 0) | (t.pending ? 0x02 : 0);
+    t.expired = false;
+    if (!edgeTriggered(t.line) && t.interrupts->line(t.line)) t.interrupts->setLine(t.line, false);
+    return status;
+}
+
+// Nothing to clear: the status stays as it is until the next expiry
+bool IntervalTimer::statusQuiet(void* context, uint8_t) {
+    IntervalTimer& t = *static_cast<IntervalTimer*>(context);
+    return !t.expired && (edgeTriggered(t.line) || !t.interrupts->line(t.line));
+}
+
+void IntervalTimer::write(void* context, uint8_t port, uint8_t value) {
+    IntervalTimer& t = *static_cast<IntervalTimer*>(context);
+    switch (static_cast<uint8_t>(port - t.base)) {
+        case 0: t.reload = static_cast<uint16_t>((t.reload & 0xFF00) | value); break;
+        case 1: t.reload = static_cast<uint16_t>((t.reload & 0x00FF) | (value << 8)); break;
+        case 2:
+            t.control = value;
+            if (value & 0x01) {
+                t.start();
+            } else {
+                t.stop();
+            }
+            break;
+    }
+}
+
+void IntervalTimer::expire(void* context, uint64_t due) {
+    IntervalTimer& t = *static_cast<IntervalTimer*>(context);
+    // Next period counts from when this one was due, so late handling never drifts
+    t.pending = t.events->schedule(due + t.period(), expire, context);
+    t.expired = true;
+    t.expiries++;
+    if (!(t.control & 0x02)) return;
+    if (edgeTriggered(t.line)) {
+        t.interrupts->pulse(t.line);
+    } else {
+        t.interrupts->setLine(t.line, true);
+    }
+}
+
+void IntervalTimer::reset(void* context) {
+    static_cast<IntervalTimer*>(context)->powerOn();
+}
+
+// Uart
+
+Uart::Uart(double clockHz, uint32_t baud, InterruptUnit::Line rxLine)
+    : frame(static_cast<uint64_t>(std::llround(clockHz * 10.0 / baud))),
+      rxLine(rxLine), interrupts(nullptr), events(nullptr) {
+    if (frame == 0) frame = 1;
+    powerOn();
+}
+
+void Uart::attach(IoBus& io, InterruptUnit& irq, EventScheduler& scheduler, uint8_t port) {
+    interrupts = &irq;
+    events = &scheduler;
+    io.mapInput(port, readData, this, dataQuiet);
+    io.mapOutput(port, writeData, this);
+    io.mapInput(static_cast<uint8_t>(port + 1), readStatus, this, statusQuiet);
+    io.addResetHook(reset, this);
+    scheduleReceive(events->now());
+}
+
+void Uart::powerOn() {
+    rxData = 0;
+    rxReady = false;
+    overrun = false;
+    rxPending = 0;
+    txShift = 0;
+    txHolding = 0;
+    txBusy = false;
+    txHeld = false;
+}
+
+void Uart::receive(const uint8_t* data, size_t size) {
+    inbox.insert(inbox.end(), data, data + size);
+    if (events) scheduleReceive(events->now());
+}
+
+void Uart::scheduleReceive(uint64_t from) {
+    if (rxPending || inbox.empty()) return;
+    rxPending = events->schedule(from + frame, received, this);
+}
+
+uint8_t Uart::readData(void* context, uint8_t) {
+    Uart& u = *static_cast<Uart*>(context);
+    if (u.rxReady) {
+        u.rxReady = false;
+        u.interrupts->setLine(u.rxLine, false);
+    }
+    return u.rxData;
+}
+
+uint8_t Uart::readStatus(void* context, uint8_t) {
+    Uart& u = *static_cast<Uart*>(context);
+    uint8_t status = (u.rxReady ? 0x01 : 0) | (u.txHeld ? 0 : 0x02) | (u.overrun ? 0x04 : 0);
+    u.overrun = false;
+    return status;
+}
+
+// Reads that would not clear rx ready or overrun
+bool Uart::dataQuiet(void* context, uint8_t) {
+    return !static_cast<Uart*>(context)->rxReady;
+}
+
+bool Uart::statusQuiet(void* context, uint8_t) {
+    return !static_cast<Uart*>(context)->overrun;
+}
+
+void Uart::writeData(void* context, uint8_t, uint8_t value) {
+    Uart& u = *static_cast<Uart*>(context);
+    if (!u.txBusy) {
+        u.txShift = value;
+        u.txBusy = true;
+        u.events->scheduleIn(u.frame, transmitted, context);
+    } else if (!u.txHeld) {
+        u.txHolding = value;
+        u.txHeld = true;
+    }
+    // Otherwise the byte is lost, as on real hardware
+}
+
+void Uart::received(void* context, uint64_t due) {
+    Uart& u = *static_cast<Uart*>(context);
+    u.rxPending = 0;
+    if (u.rxReady) u.overrun = true;
+    u.rxData = u.inbox.front();
+    u.inbox.pop_front();
+    u.rxReady = true;
+    u.interrupts->setLine(u.rxLine, true);
+    u.scheduleReceive(due);
+}
+
+void Uart::transmitted(void* context, uint64_t due) {
+    Uart& u = *static_cast<Uart*>(context);
+    if (u.output) u.output(u.txShift);
+    if (u.txHeld) {
+        u.txShift = u.txHolding;
+        u.txHeld = false;
+        u.events->schedule(due + u.frame, transmitted, context);
+    } else {
+        u.txBusy = false;
+    }
+}
+
+void Uart::reset(void* context) {
+    Uart& u = *static_cast<Uart*>(context);
+    u.powerOn();
+    // Host input still waiting starts arriving again from the reset
+    u.scheduleReceive(u.events->now());
+}
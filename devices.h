@@ -0,0 +1,114 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include "interrupts.h"
+#include "iobus.h"
+#include "scheduler.h"
+
+// Peripherals built on the I/O bus, interrupt unit and event scheduler.
+// attach() maps a device onto a CPU's ports; the device must outlive the CPU
+// or be detached by io.clear(). All timing is in CPU T-states, so devices run
+// at the same emulated speed on every engine and at any pacing.
+
+// Interval timer at three ports:
+//   base+0 OUT  reload value, low byte
+//   base+1 OUT  reload value, high byte (T-states per period, 0 = 65536)
+//   base+2 OUT  control: bit 0 runs the timer (restarting the period),
+//               bit 1 raises the interrupt line at each expiry
+//   base+2 IN   status: bit 0 expired since the last status read (cleared by
+//               the read, which also drops a level-triggered line), bit 1 running
+// Edge inputs (RST 7.5, TRAP) get a pulse per expiry; level inputs stay high
+// until the status is read.
+class IntervalTimer {
+public:
+    explicit IntervalTimer(InterruptUnit::Line line = InterruptUnit::Rst75);
+
+    void attach(IoBus& io, InterruptUnit& interrupts, EventScheduler& events, uint8_t port);
+    template <class Cpu> void attach(Cpu& cpu, uint8_t port) {
+        attach(cpu.io, cpu.interrupts, cpu.events, port);
+    }
+
+    uint64_t expiries;  // Since attach(), for tests and statistics
+
+private:
+    InterruptUnit::Line line;
+    InterruptUnit* interrupts;
+    EventScheduler* events;
+    uint8_t base;
+    uint16_t reload;
+    uint8_t control;
+    bool expired;
+    EventScheduler::EventId pending;  // 0 when stopped
+
+    uint64_t period() const { return reload ? reload : 65536; }
+    void start();
+    void stop();
+    void powerOn();
+
+    static uint8_t readStatus(void* context, uint8_t port);
+    static bool statusQuiet(void* context, uint8_t port);
+    static void write(void* context, uint8_t port, uint8_t value);
+    static void expire(void* context, uint64_t due);
+    static void reset(void* context);
+};
+
+// Serial port at two ports, one frame (start, 8 data, stop = 10 bits) taking
+// clockHz * 10 / baud T-states in each direction:
+//   base+0 OUT  transmit; the byte reaches `output` when its frame is done.
+//               One more byte is held while a frame is being sent.
+//   base+0 IN   received byte; clears rx ready and drops the rx line
+//   base+1 IN   status: bit 0 rx ready, bit 1 tx ready (holding register
+//               empty), bit 2 overrun (a received byte was lost; cleared by
+//               the status read)
+// Host input queued with receive() arrives one frame apart. While a byte is
+// waiting the rx interrupt line is held high.
+class Uart {
+public:
+    Uart(double clockHz, uint32_t baud, InterruptUnit::Line rxLine = InterruptUnit::Rst65);
+
+    void attach(IoBus& io, InterruptUnit& interrupts, EventScheduler& events, uint8_t port);
+    template <class Cpu> void attach(Cpu& cpu, uint8_t port) {
+        attach(cpu.io, cpu.interrupts, cpu.events, port);
+    }
+
+    // Queues host bytes for the guest to receive
+    void receive(const uint8_t* data, size_t size);
+    // Called with each transmitted byte
+    std::function<void(uint8_t)> output;
+
+    uint64_t frameCycles() const { return frame; }
+
+private:
+    uint64_t frame;
+    InterruptUnit::Line rxLine;
+    InterruptUnit* interrupts;
+    EventScheduler* events;
+
+    std::deque<uint8_t> inbox;  // Not yet arrived
+    uint8_t rxData;
+    bool rxReady;
+    bool overrun;
+    EventScheduler::EventId rxPending;
+
+    uint8_t txShift;    // Frame being sent
+    uint8_t txHolding;  // Next byte, when txHeld
+    bool txBusy;
+    bool txHeld;
+
+    void scheduleReceive(uint64_t from);
+    void powerOn();
+
+    static uint8_t readData(void* context, uint8_t port);
+    static uint8_t readStatus(void* context, uint8_t port);
+    static bool dataQuiet(void* context, uint8_t port);
+    static bool statusQuiet(void* context, uint8_t port);
+    static void writeData(void* context, uint8_t port, uint8_t value);
+    static void received(void* context, uint64_t due);
+    static void transmitted(void* context, uint64_t due);
+    static void reset(void* context);
+};
+
+#endif // DEVICES_H
@@ -0,0 +1,279 @@
+#include "emulationthread.h"
+#include "opcodes.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+// T-states per unpaced slice: about a millisecond on the interpreters, so
+// queued commands are seen promptly
+const uint64_t kUnpacedSlice = 1000000;
+// Snapshots are published at most this often while running; a UI refreshing
+// at 30-60 Hz always finds a recent one
+const std::chrono::milliseconds kPublishInterval(5);
+// Hot spots take a pass over the 64K profile, so they are refreshed less often
+const std::chrono::milliseconds kHotSpotInterval(200);
+const size_t kHotSpots = 16;
+// Hits kept for the snapshots; tracepoints in a loop would otherwise pile up
+const size_t kRecentHits = 64;
+
+} // namespace
+
+EmulationThread::EmulationThread(CPU8085::Engine engine)
+    : cpu(new Cpu(engine)), queued(0), completed(0), quit(false),
+      publishedMemory(0x10000), running(false), clockHz(0.0), profiledCycles(0), hitTotal(0),
+      breakStop(false), stepOverId(0), stepOverReturned(false) {
+    cpu->hitHandler = [this](const DebugHit& hit) {
+        if (hit.id == stepOverId) {
+            stepOverReturned = true;
+            return;
+        }
+        if (hits.size() == kRecentHits) hits.pop_front();
+        hits.push_back(hit);
+        hitTotal++;
+    };
+    publish();
+    thread = std::thread(&EmulationThread::loop, this);
+}
+
+EmulationThread::~EmulationThread() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    wake.notify_all();
+    thread.join();
+}
+
+void EmulationThread::post(std::function<void(Cpu&)> fn) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        commands.push_back(std::move(fn));
+        queued++;
+    }
+    wake.notify_one();
+}
+
+void EmulationThread::sync() {
+    std::unique_lock<std::mutex> guard(lock);
+    uint64_t ticket = queued;
+    drained.wait(guard, [&] { return completed >= ticket; });
+}
+
+void EmulationThread::snapshot(CpuSnapshot& out) const {
+    std::lock_guard<std::mutex> guard(snapshotLock);
+    out = latest;
+}
+
+std::bitset<256> EmulationThread::takeMemory(std::array<uint8_t, 65536>& out) {
+    std::lock_guard<std::mutex> guard(snapshotLock);
+    std::bitset<256> pages = unreadPages;
+    for (int page = 0; page < 256; page++) {
+        if (!pages[page]) continue;
+        std::copy_n(&publishedMemory[page * 256], 256, &out[page * 256]);
+    }
+    unreadPages.reset();
+    return pages;
+}
+
+void EmulationThread::reset() {
+    post([this](Cpu& c) {
+        running = false;
+        c.reset();
+        c.clearUndo();
+    });
+}
+
+void EmulationThread::step() {
+    post([this](Cpu& c) {
+        running = false;
+        c.step();
+    });
+}
+
+void EmulationThread::stepOver() {
+    post([this](Cpu& c) {
+        running = false;
+        endStepOver();
+        const OpcodeInfo& info = kOpcodes[c.getMemory(c.PC)];
+        if (c.stopped() || (info.flow != ControlFlow::Call && info.flow != ControlFlow::Restart)) {
+            c.step();
+            return;
+        }
+        // Back at the next instruction with the frame popped, so a
+        // recursive call passing through there does not count
+        Breakpoint back;
+        back.first = back.last = static_cast<uint16_t>(c.PC + info.length);
+        char condition[24];
+        std::snprintf(condition, sizeof(condition), "SP >= 0x%04X", c.SP);
+        std::string error;
+        back.condition.parse(condition, error);
+        stepOverId = c.addBreakpoint(back);
+        running = true;
+        breakStop = false;
+        c.breakRequested = false;
+        pacer.start(c.cycles);
+    });
+}
+
+void EmulationThread::run() {
+    post([this](Cpu& c) {
+        if (c.stopped()) return;
+        running = true;
+        breakStop = false;
+        c.breakRequested = false;
+        pacer.start(c.cycles);
+    });
+}
+
+void EmulationThread::stop() {
+    post([this](Cpu&) { running = false; });
+}
+
+void EmulationThread::stepBack() {
+    post([this](Cpu& c) {
+        running = false;
+        ::stepBack(c);
+    });
+}
+
+void EmulationThread::runBack() {
+    post([this](Cpu& c) {
+        running = false;
+        ::runBack(c);
+    });
+}
+
+void EmulationThread::setClock(double hz) {
+    post([this, hz](Cpu& c) {
+        clockHz = hz;
+        if (hz > 0.0) {
+            pacer = ClockPacer(hz);
+            pacer.start(c.cycles);
+        }
+    });
+}
+
+void EmulationThread::setProfiling(bool on) {
+    post([this, on](Cpu& c) {
+        if (on && !c.profiling) c.clearProfile();
+        c.profiling = on;
+        lastHotSpots = ClockPacer::Clock::time_point();
+    });
+}
+
+void EmulationThread::addBreakpoint(Breakpoint breakpoint) {
+    post([breakpoint = std::move(breakpoint)](Cpu& c) { c.addBreakpoint(breakpoint); });
+}
+
+void EmulationThread::clearBreakpoints() {
+    post([](Cpu& c) { c.clearBreakpoints(); });
+}
+
+void EmulationThread::load(std::vector<uint8_t> program, uint16_t address) {
+    load(std::move(program), address, address);
+}
+
+void EmulationThread::load(std::vector<uint8_t> program, uint16_t address, uint16_t start) {
+    post([this, program = std::move(program), address, start](Cpu& c) {
+        running = false;
+        c.reset();
+        c.loadProgram(program.data(), program.size(), address);
+        c.PC = start;
+        c.clearUndo();
+    });
+}
+
+void EmulationThread::loop() {
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        wake.wait(guard, [this] { return quit || running || !commands.empty(); });
+        if (quit) return;
+
+        while (!commands.empty()) {
+            std::function<void(Cpu&)> command = std::move(commands.front());
+            commands.pop_front();
+            guard.unlock();
+            command(*cpu);
+            if (!running) endStepOver();
+            publish();
+            guard.lock();
+            completed++;
+            drained.notify_all();
+        }
+        if (running) runSlice(guard);
+    }
+}
+
+void EmulationThread::runSlice(std::unique_lock<std::mutex>& guard) {
+    bool paced = clockHz > 0.0;
+    guard.unlock();
+    cpu->run(paced ? pacer.batchCycles() : kUnpacedSlice);
+    if (cpu->stopped()) running = false;
+    if (cpu->breakRequested) {
+        cpu->breakRequested = false;
+        breakStop = !stepOverReturned;
+        running = false;
+    }
+    if (!running) endStepOver();
+    if (!running || ClockPacer::Clock::now() - lastPublish >= kPublishInterval) publish();
+    guard.lock();
+
+    // Sleep until the next batch is due, waking early for commands
+    if (running && paced) {
+        ClockPacer::Clock::time_point due = pacer.deadline(cpu->cycles);
+        wake.wait_until(guard, due, [this] { return quit || !commands.empty(); });
+    }
+}
+
+void EmulationThread::endStepOver() {
+    if (!stepOverId) return;
+    cpu->removeBreakpoint(stepOverId);
+    stepOverId = 0;
+    stepOverReturned = false;
+}
+
+void EmulationThread::publish() {
+    CpuSnapshot s;
+    s.A = cpu->A;
+    s.B = cpu->B;
+    s.C = cpu->C;
+    s.D = cpu->D;
+    s.E = cpu->E;
+    s.H = cpu->H;
+    s.L = cpu->L;
+    s.psw = cpu->flags.psw;
+    s.SP = cpu->SP;
+    s.PC = cpu->PC;
+    s.cycles = cpu->cycles;
+    s.halted = cpu->halted;
+    s.running = running;
+    s.undoDepth = cpu->undoDepth();
+    s.profiling = cpu->profiling;
+    if (cpu->profiling && (!running || ClockPacer::Clock::now() - lastHotSpots >= kHotSpotInterval)) {
+        hotSpots = cpu->hotSpots(kHotSpots);
+        profiledCycles = cpu->profiledCycles();
+        lastHotSpots = ClockPacer::Clock::now();
+    }
+    s.profiledCycles = profiledCycles;
+    s.hotSpots = hotSpots;
+    s.breakpoints = cpu->breakpointList();
+    s.breakpoints.erase(std::remove_if(s.breakpoints.begin(), s.breakpoints.end(),
+                                       [this](const Breakpoint& b) { return b.id == stepOverId; }),
+                        s.breakpoints.end());
+    s.hits.assign(hits.begin(), hits.end());
+    s.hitTotal = hitTotal;
+    s.breakStop = breakStop;
+    std::bitset<256> written = cpu->takeWrittenPages();
+    lastPublish = ClockPacer::Clock::now();
+
+    std::lock_guard<std::mutex> guard(snapshotLock);
+    s.serial = latest.serial + 1;
+    latest = s;
+    for (int page = 0; page < 256; page++) {
+        if (!written[page]) continue;
+        const uint8_t* source = cpu->memory.page(static_cast<uint8_t>(page));
+        std::copy_n(source, 256, &publishedMemory[page * 256]);
+    }
+    unreadPages |= written;
+}
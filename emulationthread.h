@@ -0,0 +1,127 @@
+#ifndef EMULATIONTHREAD_H
+#define EMULATIONTHREAD_H
+
+#include <cstdint>
+#include <array>
+#include <bitset>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "cpu8085.h"
+#include "pacer.h"
+
+// CPU state copied out by the emulation thread between run() slices, so the
+// registers and flags always belong to the same instant
+struct CpuSnapshot {
+    uint8_t A = 0, B = 0, C = 0, D = 0, E = 0, H = 0, L = 0;
+    uint8_t psw = CPU8085::Flags::ALWAYS_ONE;
+    uint16_t SP = 0xFFFF;
+    uint16_t PC = 0x0000;
+    uint64_t cycles = 0;
+    bool halted = false;
+    bool running = false;
+    uint64_t undoDepth = 0;  // Instructions that can be stepped back
+    bool profiling = false;
+    uint64_t profiledCycles = 0;
+    std::vector<Profiler::HotSpot> hotSpots;  // Busiest addresses, refreshed a few times a second
+    std::vector<Breakpoint> breakpoints;  // With their hit counts
+    std::vector<DebugHit> hits;  // The latest hits, oldest first
+    uint64_t hitTotal = 0;       // Hits since the thread started
+    bool breakStop = false;      // The last run was stopped by a breakpoint
+    uint64_t serial = 0;  // Incremented for every published snapshot
+};
+
+// Owns a CPU and runs it on a dedicated thread, flat out or paced to a
+// clock. Methods are meant for a single controlling (UI) thread: commands are
+// queued and carried out between run() slices of at most a few milliseconds,
+// so Stop lands almost at once even at full speed. The UI polls snapshot() at
+// its own frame rate and never holds up emulation.
+class EmulationThread {
+public:
+    // Core specialization the thread runs (cpu8085.h). It records an undo
+    // log, so the UI can step back.
+    using Cpu = ReversibleCPU8085;
+
+    explicit EmulationThread(CPU8085::Engine engine = CPU8085::defaultEngine);
+    ~EmulationThread();
+    EmulationThread(const EmulationThread&) = delete;
+    EmulationThread& operator=(const EmulationThread&) = delete;
+
+    void reset();
+    void step();  // Stops a run first
+    // Steps, but runs a CALL, taken Ccc or RST until it returns to the next
+    // instruction (or something else stops the run)
+    void stepOver();
+    void run();   // Until stop() or HLT
+    void stop();
+    // Undo the last instruction, or go back to the previous breakpoint hit
+    // (or as far as the undo log reaches); both stop a run first
+    void stepBack();
+    void runBack();
+    void setClock(double clockHz);  // 0 = unpaced
+    // Starts a fresh profile, or stops profiling and keeps the last one
+    void setProfiling(bool on);
+    // Breakpoints, watchpoints and tracepoints (breakpoints.h); a run stops
+    // at a hit and every hit is listed in the snapshots
+    void addBreakpoint(Breakpoint breakpoint);
+    void clearBreakpoints();
+    // Reset, then copy program to address and point PC at it (or at start)
+    void load(std::vector<uint8_t> program, uint16_t address);
+    void load(std::vector<uint8_t> program, uint16_t address, uint16_t start);
+    // Runs fn on the emulation thread between slices, for anything the
+    // commands above do not cover
+    void post(std::function<void(Cpu&)> fn);
+
+    // Blocks until every command queued so far has been carried out
+    void sync();
+    // Latest published state; waits at most for another snapshot copy
+    void snapshot(CpuSnapshot& out) const;
+    // Copies the memory pages written since the last call (as of the latest
+    // snapshot) into out and returns which pages those were. The first call
+    // returns every page.
+    std::bitset<256> takeMemory(std::array<uint8_t, 65536>& out);
+
+private:
+    std::unique_ptr<Cpu> cpu;
+
+    // Shared with the controlling thread, guarded by lock
+    std::mutex lock;
+    std::condition_variable wake;     // Commands queued or quitting
+    std::condition_variable drained;  // A command finished
+    std::deque<std::function<void(Cpu&)>> commands;
+    uint64_t queued;
+    uint64_t completed;
+    bool quit;
+
+    mutable std::mutex snapshotLock;
+    CpuSnapshot latest;
+    std::vector<uint8_t> publishedMemory;  // Up to date for every written page
+    std::bitset<256> unreadPages;          // Not yet taken by takeMemory()
+
+    // Emulation thread only
+    bool running;
+    double clockHz;
+    ClockPacer pacer;
+    ClockPacer::Clock::time_point lastPublish;
+    ClockPacer::Clock::time_point lastHotSpots;
+    std::vector<Profiler::HotSpot> hotSpots;  // As of lastHotSpots
+    uint64_t profiledCycles;
+    std::deque<DebugHit> hits;  // From the CPU's hit handler
+    uint64_t hitTotal;
+    bool breakStop;
+    int stepOverId;         // Breakpoint on the return address, 0 if none
+    bool stepOverReturned;  // It was hit
+
+    std::thread thread;
+
+    void loop();
+    void runSlice(std::unique_lock<std::mutex>& guard);
+    void endStepOver();
+    void publish();
+};
+
+#endif // EMULATIONTHREAD_H
@@ -0,0 +1,284 @@
+#include "guestmemory.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Shared by every paged memory for pages nobody has written
+const uint8_t zeroPage[GuestMemory::kPageSize] = {};
+
+bool allZero(const uint8_t* data, size_t size) {
+    return std::all_of(data, data + size, [](uint8_t byte) { return byte == 0; });
+}
+
+} // namespace
+
+MemoryImage::MemoryImage(const uint8_t* data, size_t size, uint16_t origin) {
+    size = std::min<size_t>(size, 0x10000);
+    std::vector<uint8_t> full(0x10000, 0);
+    for (size_t i = 0; i < size; i++) full[static_cast<uint16_t>(origin + i)] = data[i];
+
+    // Store only the non-zero pages; pointers are set once storage stops growing
+    std::vector<int> stored;
+    for (int index = 0; index < 256; index++) {
+        const uint8_t* source = &full[index * 256];
+        if (allZero(source, 256)) continue;
+        storage.insert(storage.end(), source, source + 256);
+        stored.push_back(index);
+    }
+    pages.fill(nullptr);
+    for (size_t i = 0; i < stored.size(); i++) pages[stored[i]] = &storage[i * 256];
+}
+
+MemoryImage::MemoryImage(const std::array<const uint8_t*, 256>& pages, std::shared_ptr<const void> owner)
+    : pages(pages), owner(std::move(owner)) {
+}
+
+size_t MemoryImage::storedPages() const {
+    return std::count_if(pages.begin(), pages.end(), [](const uint8_t* page) { return page != nullptr; });
+}
+
+GuestMemory::GuestMemory(Mode mode)
+    : flat(nullptr), specialPages(0), deviceHook(nullptr), deviceHookContext(nullptr) {
+    contents.fill(zeroPage);
+    privatePages.fill(nullptr);
+    readPages.fill(zeroPage);
+    writePages.fill(nullptr);
+    kinds.fill(PageKind::Ram);
+    devices.fill(Device{nullptr, nullptr, nullptr});
+    setMode(mode);
+}
+
+GuestMemory::~GuestMemory() = default;
+
+const uint8_t* GuestMemory::imagePage(uint8_t index) const {
+    const uint8_t* page = image ? image->page(index) : nullptr;
+    return page ? page : zeroPage;
+}
+
+void GuestMemory::updatePage(uint8_t index) {
+    readPages[index] = kinds[index] == PageKind::Device ? nullptr : contents[index];
+    writePages[index] = kinds[index] == PageKind::Ram ? privatePages[index] : nullptr;
+}
+
+uint8_t* GuestMemory::copyOnWrite(uint8_t index) {
+    if (freePages.empty()) {
+        pagePool.emplace_back(new uint8_t[kPageSize]);
+        freePages.push_back(pagePool.back().get());
+    }
+    uint8_t* page = freePages.back();
+    freePages.pop_back();
+    std::memcpy(page, contents[index], kPageSize);
+    contents[index] = page;
+    privatePages[index] = page;
+    updatePage(index);
+    dirty.push_back(index);
+    return page;
+}
+
+void GuestMemory::unmapPrivatePages() {
+    for (uint8_t index : dirty) {
+        freePages.push_back(privatePages[index]);
+        privatePages[index] = nullptr;
+        contents[index] = imagePage(index);
+        updatePage(index);
+    }
+    dirty.clear();
+}
+
+void GuestMemory::reset() {
+    if (flat) {
+        for (int index = 0; index < kPageCount; index++) {
+            std::memcpy(flat + index * kPageSize, imagePage(index), kPageSize);
+        }
+    } else {
+        unmapPrivatePages();
+    }
+}
+
+void GuestMemory::setImage(std::shared_ptr<const MemoryImage> newImage) {
+    if (!flat) {
+        // Remap every page, not just the dirty ones, since the image changed
+        unmapPrivatePages();
+        image = std::move(newImage);
+        for (int index = 0; index < kPageCount; index++) {
+            contents[index] = imagePage(index);
+            updatePage(index);
+        }
+        return;
+    }
+    image = std::move(newImage);
+    reset();
+}
+
+void GuestMemory::setMode(Mode mode) {
+    if (mode == getMode()) return;
+
+    if (mode == Mode::Flat) {
+        if (!allRam()) return;
+        if (!flatStorage) flatStorage.reset(new uint8_t[0x10000]);
+        for (int index = 0; index < kPageCount; index++) {
+            std::memcpy(&flatStorage[index * kPageSize], contents[index], kPageSize);
+        }
+        unmapPrivatePages();
+        flat = flatStorage.get();
+        return;
+    }
+
+    // Flat to paged: pages that differ from the image get private copies
+    uint8_t* source = flat;
+    flat = nullptr;
+    for (int index = 0; index < kPageCount; index++) {
+        contents[index] = imagePage(index);
+        updatePage(index);
+        const uint8_t* page = source + index * kPageSize;
+        if (std::memcmp(page, contents[index], kPageSize) != 0) {
+            std::memcpy(copyOnWrite(static_cast<uint8_t>(index)), page, kPageSize);
+        }
+    }
+    flatStorage.reset();
+}
+
+std::shared_ptr<const MemoryImage> GuestMemory::snapshot() const {
+    struct Pages {
+        std::shared_ptr<const MemoryImage> image;
+        std::vector<uint8_t> storage;
+    };
+    auto owner = std::make_shared<Pages>();
+    owner->image = image;
+
+    std::array<const uint8_t*, kPageCount> pages;
+    std::vector<int> changed;
+    for (int index = 0; index < kPageCount; index++) {
+        const uint8_t* current = page(static_cast<uint8_t>(index));
+        const uint8_t* base = imagePage(static_cast<uint8_t>(index));
+        if (current == base || std::memcmp(current, base, kPageSize) == 0) {
+            pages[index] = base == zeroPage ? nullptr : base;
+        } else if (allZero(current, kPageSize)) {
+            pages[index] = nullptr;
+        } else {
+            changed.push_back(index);
+        }
+    }
+    // Pointers are set once storage stops growing
+    owner->storage.resize(changed.size() * kPageSize);
+    for (size_t i = 0; i < changed.size(); i++) {
+        uint8_t* copy = &owner->storage[i * kPageSize];
+        std::memcpy(copy, page(static_cast<uint8_t>(changed[i])), kPageSize);
+        pages[changed[i]] = copy;
+    }
+    return std::make_shared<MemoryImage>(pages, std::move(owner));
+}
+
+void GuestMemory::mapRam(uint8_t firstPage, int pageCount) {
+    mapPages(firstPage, pageCount, PageKind::Ram, Device{nullptr, nullptr, nullptr});
+}
+
+void GuestMemory::mapRom(uint8_t firstPage, int pageCount) {
+    mapPages(firstPage, pageCount, PageKind::Rom, Device{nullptr, nullptr, nullptr});
+}
+
+void GuestMemory::mapDevice(uint8_t firstPage, int pageCount, DeviceReadFn read, DeviceWriteFn write,
+                            void* context) {
+    mapPages(firstPage, pageCount, PageKind::Device, Device{read, write, context});
+}
+
+void GuestMemory::mapPages(uint8_t firstPage, int pageCount, PageKind kind, const Device& device) {
+    int end = std::min(firstPage + std::max(pageCount, 0), kPageCount);
+    for (int index = firstPage; index < end; index++) {
+        specialPages += (kind != PageKind::Ram) - (kinds[index] != PageKind::Ram);
+        kinds[index] = kind;
+        devices[index] = device;
+    }
+    // The flat buffer has no way to route an access elsewhere
+    if (!allRam()) setMode(Mode::Paged);
+    if (flat) return;
+    for (int index = firstPage; index < end; index++) updatePage(static_cast<uint8_t>(index));
+}
+
+void GuestMemory::setDeviceHook(void (*hook)(void*), void* context) {
+    deviceHook = hook;
+    deviceHookContext = context;
+}
+
+uint8_t GuestMemory::readDevice(uint16_t address) const {
+    const Device& device = devices[address >> 8];
+    uint8_t value = device.read ? device.read(device.context, address) : 0xFF;
+    if (deviceHook) deviceHook(deviceHookContext);
+    return value;
+}
+
+void GuestMemory::writeSlow(uint16_t address, uint8_t value) {
+    uint8_t index = address >> 8;
+    switch (kinds[index]) {
+        case PageKind::Ram:
+            copyOnWrite(index)[address & 0xFF] = value;
+            break;
+        case PageKind::Rom:
+            break;
+        case PageKind::Device: {
+            const Device& device = devices[index];
+            if (device.write) device.write(device.context, address, value);
+            if (deviceHook) deviceHook(deviceHookContext);
+            break;
+        }
+    }
+}
+
+void GuestMemory::poke(uint16_t address, uint8_t value) {
+    if (flat) {
+        flat[address] = value;
+        return;
+    }
+    uint8_t* page = privatePages[address >> 8];
+    if (!page) page = copyOnWrite(address >> 8);
+    page[address & 0xFF] = value;
+}
+
+void GuestMemory::write(uint16_t address, const uint8_t* data, size_t size) {
+    if (flat && size <= 0x10000u - address) {
+        std::memcpy(flat + address, data, size);
+        return;
+    }
+    for (size_t i = 0; i < size; i++) poke(static_cast<uint16_t>(address + i), data[i]);
+}
+
+void GuestMemory::read(uint16_t address, uint8_t* out, size_t size) const {
+    if (flat && size <= 0x10000u - address) {
+        std::memcpy(out, flat + address, size);
+        return;
+    }
+    for (size_t i = 0; i < size; i++) out[i] = peek(static_cast<uint16_t>(address + i));
+}
+
+void GuestMemory::copyFrom(const GuestMemory& other) {
+    if (this == &other) return;
+    if (flat) {
+        // Assigned, not setImage(): that would reset before the copy
+        image = other.image;
+        for (int index = 0; index < kPageCount; index++) {
+            std::memcpy(flat + index * kPageSize, other.page(static_cast<uint8_t>(index)), kPageSize);
+        }
+        return;
+    }
+    // Share the other memory's image and copy only the pages that differ from it
+    setImage(other.image);
+    for (int index = 0; index < kPageCount; index++) {
+        const uint8_t* source = other.page(static_cast<uint8_t>(index));
+        if (source != contents[index] && std::memcmp(source, contents[index], kPageSize) != 0) {
+            std::memcpy(copyOnWrite(static_cast<uint8_t>(index)), source, kPageSize);
+        }
+    }
+}
+
+int32_t GuestMemory::firstDifference(const GuestMemory& other) const {
+    for (int index = 0; index < kPageCount; index++) {
+        const uint8_t* mine = page(static_cast<uint8_t>(index));
+        const uint8_t* theirs = other.page(static_cast<uint8_t>(index));
+        if (mine == theirs || std::memcmp(mine, theirs, kPageSize) == 0) continue;
+        for (int offset = 0; offset < kPageSize; offset++) {
+            if (mine[offset] != theirs[offset]) return index * kPageSize + offset;
+        }
+    }
+    return -1;
+}
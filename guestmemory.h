@@ -0,0 +1,184 @@
+#ifndef GUESTMEMORY_H
+#define GUESTMEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <memory>
+#include <vector>
+
+// Read-only 64KB memory contents that many CPUs can start from, such as a
+// program image shared by every job of a batch. All-zero pages are not stored.
+class MemoryImage {
+public:
+    MemoryImage(const uint8_t* data, size_t size, uint16_t origin);
+    // Pages held elsewhere (null for all-zero pages), kept alive by owner;
+    // used for snapshots and mapped save state files
+    MemoryImage(const std::array<const uint8_t*, 256>& pages, std::shared_ptr<const void> owner);
+    MemoryImage(const MemoryImage&) = delete;
+    MemoryImage& operator=(const MemoryImage&) = delete;
+
+    // 256-byte page, or null when the page is all zero
+    const uint8_t* page(uint8_t index) const { return pages[index]; }
+    size_t storedPages() const;
+
+private:
+    std::vector<uint8_t> storage;
+    std::array<const uint8_t*, 256> pages;
+    std::shared_ptr<const void> owner;
+};
+
+// 64KB of guest memory in one of two layouts:
+//   Flat   - one contiguous buffer. Reads and writes index it directly; this is
+//            the fast path for a standalone CPU and what the JIT requires.
+//   Paged  - a table of 256-byte pages. Pages map the shared image (or a
+//            common zero page) read-only, and the first write to a page copies
+//            it into a private page. reset() only has to unmap private pages,
+//            so it costs O(dirty pages) instead of O(64KB).
+//
+// Each page is also RAM, ROM or a device in the memory map (all RAM by
+// default). Any ROM or device page puts the memory in paged mode, where RAM
+// and ROM reads still go straight through the page table; only device
+// accesses and writes that RAM cannot take directly leave the inline path.
+class GuestMemory {
+public:
+    static const int kPageSize = 256;
+    static const int kPageCount = 256;
+
+    enum class Mode {
+        Flat,
+        Paged,
+    };
+
+    // What guest reads and writes of a page reach:
+    //   Ram     - the contents
+    //   Rom     - reads see the contents, writes are ignored
+    //   Device  - the device's handlers; the contents are only seen by the host
+    enum class PageKind : uint8_t {
+        Ram,
+        Rom,
+        Device,
+    };
+    using DeviceReadFn = uint8_t (*)(void* context, uint16_t address);
+    using DeviceWriteFn = void (*)(void* context, uint16_t address, uint8_t value);
+
+    explicit GuestMemory(Mode mode = Mode::Flat);
+    ~GuestMemory();
+    GuestMemory(const GuestMemory&) = delete;
+    GuestMemory& operator=(const GuestMemory&) = delete;
+
+    // Guest accesses, following the memory map
+    uint8_t read(uint16_t address) const {
+        if (flat) return flat[address];
+        const uint8_t* page = readPages[address >> 8];
+        if (page) return page[address & 0xFF];
+        return readDevice(address);
+    }
+    void write(uint16_t address, uint8_t value) {
+        if (flat) {
+            flat[address] = value;
+            return;
+        }
+        uint8_t* page = writePages[address >> 8];
+        if (page) {
+            page[address & 0xFF] = value;
+            return;
+        }
+        writeSlow(address, value);
+    }
+
+    // Host accesses to the contents, ignoring the memory map: loaders can
+    // fill ROM, and viewers never trigger device side effects
+    uint8_t peek(uint16_t address) const {
+        return flat ? flat[address] : contents[address >> 8][address & 0xFF];
+    }
+    void poke(uint16_t address, uint8_t value);
+    uint8_t operator[](uint16_t address) const { return peek(address); }
+
+    // Host copies of size bytes starting at address, wrapping at 64KB
+    void write(uint16_t address, const uint8_t* data, size_t size);
+    void read(uint16_t address, uint8_t* out, size_t size) const;
+
+    // Contents of one 256-byte page
+    const uint8_t* page(uint8_t index) const {
+        return flat ? flat + index * kPageSize : contents[index];
+    }
+
+    // Restores the image, or all zeros without one. The memory map is kept.
+    void reset();
+    // Maps image (null for none) and resets
+    void setImage(std::shared_ptr<const MemoryImage> image);
+    const std::shared_ptr<const MemoryImage>& getImage() const { return image; }
+
+    // The current contents as an image: unchanged pages are shared with this
+    // memory's image, so only the pages written since it was set are copied
+    std::shared_ptr<const MemoryImage> snapshot() const;
+
+    // Switching layouts keeps the contents. Flat is refused while any page
+    // is ROM or a device.
+    void setMode(Mode mode);
+    Mode getMode() const { return flat ? Mode::Flat : Mode::Paged; }
+
+    // Memory map, by pages (pageCount is clipped at the top of memory).
+    // Remapping pages that hold cached code needs CPU8085::invalidateCode().
+    void mapRam(uint8_t firstPage, int pageCount);
+    void mapRom(uint8_t firstPage, int pageCount);
+    void mapDevice(uint8_t firstPage, int pageCount, DeviceReadFn read, DeviceWriteFn write, void* context);
+    PageKind pageKind(uint8_t index) const { return kinds[index]; }
+    bool allRam() const { return specialPages == 0; }
+    // Called after every device read or write (the CPU checks whether the
+    // device raised an interrupt or scheduled an event)
+    void setDeviceHook(void (*hook)(void* context), void* context);
+
+    // Pages written since the last reset(); in flat mode every page counts
+    size_t dirtyPageCount() const { return flat ? kPageCount : dirty.size(); }
+    const std::vector<uint8_t>& dirtyPages() const { return dirty; }
+
+    // Takes the other memory's image as well as its contents, in either
+    // layout, so a reset() afterwards goes back to that image
+    void copyFrom(const GuestMemory& other);
+    // Lowest address whose contents differ, or -1 when identical
+    int32_t firstDifference(const GuestMemory& other) const;
+    bool operator==(const GuestMemory& other) const { return firstDifference(other) < 0; }
+    bool operator!=(const GuestMemory& other) const { return !(*this == other); }
+
+private:
+    friend class JitCompiler;
+
+    uint8_t* flat;  // Whole address space in flat mode, null when paged
+    std::unique_ptr<uint8_t[]> flatStorage;
+    std::shared_ptr<const MemoryImage> image;
+
+    // Paged mode: contents has every page; privatePages is null until the
+    // page has a private copy. readPages and writePages are the guest's view
+    // through the memory map, null where an access takes the slow path.
+    std::array<const uint8_t*, kPageCount> contents;
+    std::array<uint8_t*, kPageCount> privatePages;
+    std::array<const uint8_t*, kPageCount> readPages;
+    std::array<uint8_t*, kPageCount> writePages;
+    std::vector<uint8_t> dirty;
+    // Private pages are kept across resets and reused
+    std::vector<std::unique_ptr<uint8_t[]>> pagePool;
+    std::vector<uint8_t*> freePages;
+
+    struct Device {
+        DeviceReadFn read;
+        DeviceWriteFn write;
+        void* context;
+    };
+    std::array<PageKind, kPageCount> kinds;
+    std::array<Device, kPageCount> devices;
+    int specialPages;  // ROM and device pages
+    void (*deviceHook)(void* context);
+    void* deviceHookContext;
+
+    const uint8_t* imagePage(uint8_t index) const;
+    uint8_t* copyOnWrite(uint8_t index);
+    void unmapPrivatePages();
+    void updatePage(uint8_t index);
+    void mapPages(uint8_t firstPage, int pageCount, PageKind kind, const Device& device);
+    uint8_t readDevice(uint16_t address) const;
+    void writeSlow(uint16_t address, uint8_t value);
+};
+
+#endif // GUESTMEMORY_H
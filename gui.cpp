@@ -4,14 +4,163 @@
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QTextEdit>
+#include <QPlainTextEdit>
+#include <QFileDialog>
 #include <QPushButton>
 #include <QLabel>
-#include <QTableWidget>
+#include <QLineEdit>
+#include <QCheckBox>
+#include <QTableView>
+#include <QAbstractTableModel>
 #include <QHeaderView>
 #include <QGroupBox>
 #include <QTimer>
+#include <QComboBox>
+#include <QSpinBox>
 #include <QFont>
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cctype>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include "assembler.h"
 #include "cpu8085.h"
+#include "emulationthread.h"
+#include "loader.h"
+#include "opcodes.h"
+
+// In the editor at startup
+static const char kSampleSource[] =
+    "; Add two numbers, result in A and C\n"
+    "        ORG 0000h\n"
+    "START:  MVI A, 05h      ; Load 5 into A\n"
+    "        MVI B, 03h      ; Load 3 into B\n"
+    "        ADD B           ; A = A + B\n"
+    "        MOV C, A        ; Copy the result to C\n"
+    "        HLT\n"
+    "        END START\n";
+
+// All 64KB of guest memory as 4096 rows of 16 bytes. Views only ask for the
+// rows on screen; refresh() turns the pages written since the last frame into
+// dataChanged() for just the rows whose bytes changed.
+class MemoryModel : public QAbstractTableModel {
+public:
+    static constexpr int kColumns = 16;
+    static constexpr int kRows = 0x10000 / kColumns;
+    static constexpr uint32_t kRecentFrames = 30;  // Write highlight lasts ~0.5 s
+    
+    explicit MemoryModel(QObject *parent = nullptr) : QAbstractTableModel(parent) {
+        shown.fill(0);
+        incoming.fill(0);
+        writtenFrame.fill(0);
+        rowFrame.fill(0);
+    }
+    
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override {
+        return parent.isValid() ? 0 : kRows;
+    }
+    
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override {
+        return parent.isValid() ? 0 : kColumns;
+    }
+    
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override {
+        if (!index.isValid()) return QVariant();
+        uint16_t addr = static_cast<uint16_t>(index.row() * kColumns + index.column());
+        switch (role) {
+            case Qt::DisplayRole:
+                return QString("%1").arg(shown[addr], 2, 16, QChar('0')).toUpper();
+            case Qt::TextAlignmentRole:
+                return static_cast<int>(Qt::AlignCenter);
+            case Qt::BackgroundRole:
+                if (addr == pc) return QBrush(Qt::yellow);
+                if (addr == sp) return QBrush(QColor(170, 210, 255));
+                if (writtenFrame[addr] && frame - writtenFrame[addr] < kRecentFrames) {
+                    return QBrush(QColor(255, 190, 190));
+                }
+                return QVariant();
+        }
+        return QVariant();
+    }
+    
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override {
+        if (role != Qt::DisplayRole) return QVariant();
+        if (orientation == Qt::Horizontal) return QString::number(section, 16).toUpper();
+        return QString("%1").arg(section * kColumns, 4, 16, QChar('0')).toUpper();
+    }
+    
+    // Memory as of the last refresh()
+    const std::array<uint8_t, 0x10000> &bytes() const { return shown; }
+    
+    // Called once per display frame with the latest snapshot
+    void refresh(EmulationThread &emulator, const CpuSnapshot &snapshot) {
+        frame++;
+        std::bitset<256> pages = emulator.takeMemory(incoming);
+        for (int page = 0; page < 256; page++) {
+            if (!pages[page]) continue;
+            int runStart = -1;
+            for (int row = page * 16; row < page * 16 + 16; row++) {
+                bool changed = false;
+                for (int addr = row * kColumns; addr < (row + 1) * kColumns; addr++) {
+                    if (incoming[addr] == shown[addr]) continue;
+                    shown[addr] = incoming[addr];
+                    writtenFrame[addr] = frame;
+                    changed = true;
+                }
+                if (changed) {
+                    rowFrame[row] = frame;
+                    fading.push_back({frame, row});
+                    if (runStart < 0) runStart = row;
+                } else if (runStart >= 0) {
+                    rowsChanged(runStart, row - 1);
+                    runStart = -1;
+                }
+            }
+            if (runStart >= 0) rowsChanged(runStart, page * 16 + 15);
+        }
+        
+        // PC and SP highlights
+        if (snapshot.PC != pc) {
+            uint16_t old = pc;
+            pc = snapshot.PC;
+            rowsChanged(old / kColumns, old / kColumns);
+            rowsChanged(pc / kColumns, pc / kColumns);
+        }
+        if (snapshot.SP != sp) {
+            uint16_t old = sp;
+            sp = snapshot.SP;
+            rowsChanged(old / kColumns, old / kColumns);
+            rowsChanged(sp / kColumns, sp / kColumns);
+        }
+        
+        // Write highlights that ran out this frame; rows written again since
+        // are handled by their later entry
+        while (!fading.empty() && fading.front().first + kRecentFrames <= frame) {
+            int row = fading.front().second;
+            if (rowFrame[row] == fading.front().first) rowsChanged(row, row);
+            fading.pop_front();
+        }
+    }
+    
+private:
+    std::array<uint8_t, 0x10000> shown;     // What the view displays
+    std::array<uint8_t, 0x10000> incoming;  // Pages from EmulationThread::takeMemory()
+    std::array<uint32_t, 0x10000> writtenFrame;  // Frame of the last change, 0 = never
+    std::array<uint32_t, kRows> rowFrame;   // Frame of the last change in the row
+    std::deque<std::pair<uint32_t, int>> fading;  // (frame, row) of highlights, oldest first
+    uint32_t frame = 0;
+    uint16_t pc = 0x0000;
+    uint16_t sp = 0xFFFF;
+    
+    void rowsChanged(int first, int last) {
+        emit dataChanged(index(first, 0), index(last, kColumns - 1),
+                         {Qt::DisplayRole, Qt::BackgroundRole});
+    }
+};
 
 class Emulator8085Window : public QMainWindow {
     Q_OBJECT
@@ -19,9 +168,7 @@ class Emulator8085Window : public QMainWindow {
 public:
     Emulator8085Window(QWidget *parent = nullptr) : QMainWindow(parent) {
         setWindowTitle("8085 Microprocessor Emulator");
-        setMinimumSize(1000, 700);
-        
-        cpu = new CPU8085();
+        setMinimumSize(1300, 700);
         
         // Central widget
         QWidget *centralWidget = new QWidget(this);
@@ -78,28 +225,49 @@ public:
         
         QPushButton *resetBtn = new QPushButton("Reset");
         QPushButton *stepBtn = new QPushButton("Step");
+        QPushButton *stepOverBtn = new QPushButton("Step Over");
         QPushButton *runBtn = new QPushButton("Run");
+        QPushButton *stepBackBtn = new QPushButton("Step Back");
+        QPushButton *runBackBtn = new QPushButton("Run Back");
         QPushButton *stopBtn = new QPushButton("Stop");
-        QPushButton *loadBtn = new QPushButton("Load Program");
+        
+        // Clock speed used by Run; 0 runs as fast as the host allows
+        clockSelect = new QComboBox();
+        clockSelect->addItem("3.072 MHz", 3072000.0);
+        clockSelect->addItem("1 MHz", 1000000.0);
+        clockSelect->addItem("100 kHz", 100000.0);
+        clockSelect->addItem("1 kHz", 1000.0);
+        clockSelect->addItem("10 Hz", 10.0);
+        clockSelect->addItem("Unlimited", 0.0);
+        connect(clockSelect, QOverload<int>::of(&QComboBox::currentIndexChanged),
+                this, &Emulator8085Window::onClockChanged);
         
         connect(resetBtn, &QPushButton::clicked, this, &Emulator8085Window::onReset);
         connect(stepBtn, &QPushButton::clicked, this, &Emulator8085Window::onStep);
+        connect(stepOverBtn, &QPushButton::clicked, this, &Emulator8085Window::onStepOver);
         connect(runBtn, &QPushButton::clicked, this, &Emulator8085Window::onRun);
+        connect(stepBackBtn, &QPushButton::clicked, this, &Emulator8085Window::onStepBack);
+        connect(runBackBtn, &QPushButton::clicked, this, &Emulator8085Window::onRunBack);
         connect(stopBtn, &QPushButton::clicked, this, &Emulator8085Window::onStop);
-        connect(loadBtn, &QPushButton::clicked, this, &Emulator8085Window::onLoadProgram);
         
         // Set minimum button heights for better visibility
         resetBtn->setMinimumHeight(35);
         stepBtn->setMinimumHeight(35);
+        stepOverBtn->setMinimumHeight(35);
         runBtn->setMinimumHeight(35);
+        stepBackBtn->setMinimumHeight(35);
+        runBackBtn->setMinimumHeight(35);
         stopBtn->setMinimumHeight(35);
-        loadBtn->setMinimumHeight(35);
         
         controlLayout->addWidget(resetBtn);
         controlLayout->addWidget(stepBtn);
+        controlLayout->addWidget(stepOverBtn);
         controlLayout->addWidget(runBtn);
+        controlLayout->addWidget(stepBackBtn);
+        controlLayout->addWidget(runBackBtn);
         controlLayout->addWidget(stopBtn);
-        controlLayout->addWidget(loadBtn);
+        controlLayout->addWidget(new QLabel("Clock:"));
+        controlLayout->addWidget(clockSelect);
         controlLayout->addStretch();
         
         controlGroup->setLayout(controlLayout);
@@ -108,33 +276,140 @@ public:
         
         mainLayout->addLayout(leftLayout, 1);
         
+        // Middle panel - Program source, assembled and loaded on request
+        QGroupBox *sourceGroup = new QGroupBox("Program");
+        QVBoxLayout *sourceLayout = new QVBoxLayout();
+        sourceEdit = new QPlainTextEdit();
+        sourceEdit->setFont(QFont("Monospace", 10));
+        sourceEdit->setLineWrapMode(QPlainTextEdit::NoWrap);
+        sourceEdit->setPlainText(kSampleSource);
+        QHBoxLayout *sourceButtonLayout = new QHBoxLayout();
+        QPushButton *assembleBtn = new QPushButton("Assemble && Load");
+        QPushButton *openBtn = new QPushButton("Open...");
+        assembleBtn->setMinimumHeight(35);
+        openBtn->setMinimumHeight(35);
+        connect(assembleBtn, &QPushButton::clicked, this, &Emulator8085Window::onAssemble);
+        connect(openBtn, &QPushButton::clicked, this, &Emulator8085Window::onOpen);
+        sourceButtonLayout->addWidget(assembleBtn);
+        sourceButtonLayout->addWidget(openBtn);
+        sourceButtonLayout->addStretch();
+        assemblyLog = new QTextEdit();
+        assemblyLog->setReadOnly(true);
+        assemblyLog->setMaximumHeight(100);
+        assemblyLog->setFont(QFont("Monospace", 10));
+        assemblyLog->setLineWrapMode(QTextEdit::NoWrap);
+        assemblyLog->setPlaceholderText("Assembler messages appear here");
+        sourceLayout->addWidget(sourceEdit, 1);
+        sourceLayout->addLayout(sourceButtonLayout);
+        sourceLayout->addWidget(assemblyLog);
+        sourceGroup->setLayout(sourceLayout);
+        QVBoxLayout *middleLayout = new QVBoxLayout();
+        middleLayout->addWidget(sourceGroup, 3);
+        
+        // Disassembly from PC, following it
+        QGroupBox *disassemblyGroup = new QGroupBox("Disassembly");
+        QVBoxLayout *disassemblyLayout = new QVBoxLayout();
+        disassemblyDisplay = new QTextEdit();
+        disassemblyDisplay->setReadOnly(true);
+        disassemblyDisplay->setFont(QFont("Monospace", 10));
+        disassemblyDisplay->setLineWrapMode(QTextEdit::NoWrap);
+        disassemblyLayout->addWidget(disassemblyDisplay);
+        disassemblyGroup->setLayout(disassemblyLayout);
+        middleLayout->addWidget(disassemblyGroup, 2);
+        mainLayout->addLayout(middleLayout, 2);
+        
         // Right panel - Memory view
         QVBoxLayout *rightLayout = new QVBoxLayout();
         
-        QGroupBox *memoryGroup = new QGroupBox("Memory (First 256 bytes)");
+        QGroupBox *memoryGroup = new QGroupBox("Memory");
         QVBoxLayout *memoryLayout = new QVBoxLayout();
         
-        memoryTable = new QTableWidget(16, 17);
-        memoryTable->setFont(QFont("Monospace", 10));
-        memoryTable->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
-        memoryTable->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
-        memoryTable->verticalHeader()->setSectionResizeMode(QHeaderView::Stretch);
-        memoryTable->setVerticalScrollBarPolicy(Qt::ScrollBarAsNeeded);
-        memoryTable->setHorizontalScrollBarPolicy(Qt::ScrollBarAsNeeded);
-        
-        // Set headers
-        QStringList headers;
-        headers << "Addr";
-        for (int i = 0; i < 16; i++) {
-            headers << QString("%1").arg(i, 1, 16).toUpper();
-        }
-        memoryTable->setHorizontalHeaderLabels(headers);
-        memoryTable->verticalHeader()->setVisible(false);
+        QHBoxLayout *navigationLayout = new QHBoxLayout();
+        gotoEdit = new QLineEdit();
+        gotoEdit->setPlaceholderText("Go to address (hex)");
+        gotoEdit->setMaxLength(6);
+        followPc = new QCheckBox("Follow PC");
+        followSp = new QCheckBox("Follow SP");
+        connect(gotoEdit, &QLineEdit::returnPressed, this, &Emulator8085Window::onGoto);
+        navigationLayout->addWidget(gotoEdit);
+        navigationLayout->addWidget(followPc);
+        navigationLayout->addWidget(followSp);
+        navigationLayout->addStretch();
+        memoryLayout->addLayout(navigationLayout);
+        
+        // Fixed row heights keep scrolling through 4096 rows cheap
+        memoryModel = new MemoryModel(this);
+        memoryView = new QTableView();
+        memoryView->setModel(memoryModel);
+        memoryView->setFont(QFont("Monospace", 10));
+        memoryView->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
+        memoryView->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+        memoryView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+        memoryView->verticalHeader()->setDefaultSectionSize(20);
+        memoryView->setVerticalScrollBarPolicy(Qt::ScrollBarAsNeeded);
+        memoryView->setHorizontalScrollBarPolicy(Qt::ScrollBarAsNeeded);
         
-        memoryLayout->addWidget(memoryTable);
+        memoryLayout->addWidget(memoryView);
         memoryGroup->setLayout(memoryLayout);
         memoryGroup->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
-        rightLayout->addWidget(memoryGroup);
+        rightLayout->addWidget(memoryGroup, 3);
+        
+        // Live profile: the addresses taking the most T-states
+        QGroupBox *hotSpotGroup = new QGroupBox("Hot Spots");
+        QVBoxLayout *hotSpotLayout = new QVBoxLayout();
+        profileCheck = new QCheckBox("Profile");
+        connect(profileCheck, &QCheckBox::toggled, this, &Emulator8085Window::onProfileToggled);
+        hotSpotDisplay = new QTextEdit();
+        hotSpotDisplay->setReadOnly(true);
+        hotSpotDisplay->setFont(QFont("Monospace", 10));
+        hotSpotDisplay->setLineWrapMode(QTextEdit::NoWrap);
+        hotSpotDisplay->setPlaceholderText("Check Profile to see where the program spends its time");
+        hotSpotLayout->addWidget(profileCheck);
+        hotSpotLayout->addWidget(hotSpotDisplay);
+        hotSpotGroup->setLayout(hotSpotLayout);
+        rightLayout->addWidget(hotSpotGroup, 1);
+        
+        // Breakpoints, watchpoints and tracepoints, with their hits
+        QGroupBox *breakGroup = new QGroupBox("Breakpoints");
+        QVBoxLayout *breakLayout = new QVBoxLayout();
+        QHBoxLayout *breakEntryLayout = new QHBoxLayout();
+        breakKind = new QComboBox();
+        breakKind->addItem("Execute", static_cast<int>(BreakKind::Execute));
+        breakKind->addItem("Read", static_cast<int>(BreakKind::Read));
+        breakKind->addItem("Write", static_cast<int>(BreakKind::Write));
+        breakKind->addItem("Port In", static_cast<int>(BreakKind::Input));
+        breakKind->addItem("Port Out", static_cast<int>(BreakKind::Output));
+        breakAddress = new QLineEdit();
+        breakAddress->setPlaceholderText("Address or range (hex)");
+        breakAddress->setMaxLength(11);
+        breakCondition = new QLineEdit();
+        breakCondition->setPlaceholderText("Condition, e.g. B == 0 && CY");
+        breakCount = new QSpinBox();
+        breakCount->setRange(1, 1000000);
+        breakCount->setPrefix("Hit ");
+        breakLogOnly = new QCheckBox("Log only");
+        QPushButton *addBreakBtn = new QPushButton("Add");
+        QPushButton *clearBreakBtn = new QPushButton("Clear");
+        connect(breakAddress, &QLineEdit::returnPressed, this, &Emulator8085Window::onAddBreakpoint);
+        connect(breakCondition, &QLineEdit::returnPressed, this, &Emulator8085Window::onAddBreakpoint);
+        connect(addBreakBtn, &QPushButton::clicked, this, &Emulator8085Window::onAddBreakpoint);
+        connect(clearBreakBtn, &QPushButton::clicked, this, &Emulator8085Window::onClearBreakpoints);
+        breakEntryLayout->addWidget(breakKind);
+        breakEntryLayout->addWidget(breakAddress);
+        breakEntryLayout->addWidget(breakCondition, 1);
+        breakEntryLayout->addWidget(breakCount);
+        breakEntryLayout->addWidget(breakLogOnly);
+        breakEntryLayout->addWidget(addBreakBtn);
+        breakEntryLayout->addWidget(clearBreakBtn);
+        breakDisplay = new QTextEdit();
+        breakDisplay->setReadOnly(true);
+        breakDisplay->setFont(QFont("Monospace", 10));
+        breakDisplay->setLineWrapMode(QTextEdit::NoWrap);
+        breakDisplay->setPlaceholderText("Breakpoints and their latest hits appear here");
+        breakLayout->addLayout(breakEntryLayout);
+        breakLayout->addWidget(breakDisplay);
+        breakGroup->setLayout(breakLayout);
+        rightLayout->addWidget(breakGroup, 1);
         
         // Status bar
         statusLabel = new QLabel("Status: Ready");
@@ -142,150 +417,350 @@ public:
         
         mainLayout->addLayout(rightLayout, 2);
         
-        // Timer for run mode
-        runTimer = new QTimer(this);
-        connect(runTimer, &QTimer::timeout, this, &Emulator8085Window::onTimerStep);
+        // The CPU runs on the emulation thread; the display polls its
+        // snapshots at a fixed frame rate whether or not it is running
+        emulator.setClock(clockSelect->currentData().toDouble());
+        frameTimer = new QTimer(this);
+        connect(frameTimer, &QTimer::timeout, this, &Emulator8085Window::updateDisplay);
+        frameTimer->start(kFrameMs);
         
         // Initial update
         updateDisplay();
     }
-    
-    ~Emulator8085Window() {
-        delete cpu;
-    }
 
 private slots:
     void onReset() {
-        cpu->reset();
-        updateDisplay();
+        emulator.reset();
         statusLabel->setText("Status: Reset");
     }
     
     void onStep() {
-        if (!cpu->halted) {
-            cpu->step();
-            updateDisplay();
+        if (!shown.halted) {
+            emulator.step();
             statusLabel->setText("Status: Stepped");
         } else {
             statusLabel->setText("Status: CPU Halted");
         }
     }
     
+    void onStepOver() {
+        if (!shown.halted) {
+            emulator.stepOver();
+            statusLabel->setText("Status: Stepped over");
+        } else {
+            statusLabel->setText("Status: CPU Halted");
+        }
+    }
+    
     void onRun() {
-        if (!cpu->halted) {
-            runTimer->start(100); // Execute step every 100ms
+        if (!shown.halted) {
+            emulator.run();
             statusLabel->setText("Status: Running...");
         }
     }
     
+    void onStepBack() {
+        if (shown.undoDepth > 0) {
+            emulator.stepBack();
+            statusLabel->setText("Status: Stepped back");
+        } else {
+            statusLabel->setText("Status: Nothing to step back over");
+        }
+    }
+    
+    void onRunBack() {
+        emulator.runBack();
+        statusLabel->setText("Status: Ran back");
+    }
+    
+    void onProfileToggled(bool on) {
+        emulator.setProfiling(on);
+        statusLabel->setText(on ? "Status: Profiling" : "Status: Profiling stopped");
+    }
+    
+    void onAddBreakpoint() {
+        // ADDR or ADDR-END in hex; ports stop at FF
+        Breakpoint breakpoint;
+        breakpoint.kind = static_cast<BreakKind>(breakKind->currentData().toInt());
+        bool port = breakpoint.kind == BreakKind::Input || breakpoint.kind == BreakKind::Output;
+        QStringList range = breakAddress->text().trimmed().split("-");
+        uint first = 0, last = 0;
+        bool ok = range.size() <= 2 && parseHex(range.front(), first) && parseHex(range.back(), last) &&
+                  first <= last && last <= (port ? 0xFFu : 0xFFFFu);
+        if (!ok) {
+            statusLabel->setText("Status: Not an address or range: " + breakAddress->text());
+            return;
+        }
+        breakpoint.first = static_cast<uint16_t>(first);
+        breakpoint.last = static_cast<uint16_t>(last);
+        std::string error;
+        if (!breakpoint.condition.parse(breakCondition->text().toStdString(), error)) {
+            statusLabel->setText("Status: Condition: " + QString::fromStdString(error));
+            return;
+        }
+        breakpoint.hitCount = static_cast<uint64_t>(breakCount->value());
+        breakpoint.logOnly = breakLogOnly->isChecked();
+        statusLabel->setText(breakpoint.logOnly ? "Status: Tracepoint added" : "Status: Breakpoint added");
+        emulator.addBreakpoint(std::move(breakpoint));
+    }
+    
+    void onClearBreakpoints() {
+        emulator.clearBreakpoints();
+        statusLabel->setText("Status: Breakpoints cleared");
+    }
+    
+    void onClockChanged() {
+        // Paced runs re-anchor so the new speed applies from now on
+        emulator.setClock(clockSelect->currentData().toDouble());
+    }
+    
     void onStop() {
-        runTimer->stop();
+        emulator.stop();
         statusLabel->setText("Status: Stopped");
     }
     
-    void onTimerStep() {
-        if (!cpu->halted) {
-            cpu->step();
-            updateDisplay();
-        } else {
-            runTimer->stop();
-            statusLabel->setText("Status: CPU Halted");
+    void onAssemble() {
+        Assembler assembler;
+        AssembledProgram program;
+        assembler.assemble(sourceEdit->toPlainText().toStdString(), program);
+        if (!program.ok()) {
+            QString errors;
+            for (const AssemblyError &e : program.errors) {
+                errors += QString("Line %1: %2\n").arg(e.line).arg(QString::fromStdString(e.message));
+            }
+            assemblyLog->setPlainText(errors);
+            statusLabel->setText(QString("Status: Assembly failed with %1 errors").arg(static_cast<int>(program.errors.size())));
+            return;
+        }
+        if (program.bytes.empty()) {
+            assemblyLog->setPlainText("Nothing to load");
+            return;
         }
+        assemblyLog->setPlainText(QString("Assembled %1 lines: %2 bytes at %3h-%4h, start %5h")
+            .arg(program.lines).arg(static_cast<int>(program.bytes.size()))
+            .arg(hex(program.lowAddress(), 4)).arg(hex(program.highAddress(), 4)).arg(hex(program.entryPoint(), 4)));
+        emulator.load(program.flatImage(), program.lowAddress(), program.entryPoint());
+        statusLabel->setText("Status: Program assembled and loaded");
     }
     
-    void onLoadProgram() {
-        // Sample program: Add two numbers and store in C
-        // MVI A, 05h  ; Load 5 into A
-        // MVI B, 03h  ; Load 3 into B
-        // ADD B       ; Add B to A (result: A = 8)
-        // MOV C, A    ; Copy result to C
-        // HLT         ; Halt
-        uint8_t program[] = {
-            0x3E, 0x05,  // MVI A, 05h
-            0x06, 0x03,  // MVI B, 03h
-            0x80,        // ADD B
-            0x4F,        // MOV C, A
-            0x76         // HLT
-        };
-        
-        cpu->reset();
-        cpu->loadProgram(program, sizeof(program), 0x0000);
-        updateDisplay();
-        statusLabel->setText("Status: Sample program loaded (Add 5 + 3, result in A and C)");
+    void onOpen() {
+        QString name = QFileDialog::getOpenFileName(this, "Open Program", QString(),
+            "Programs (*.asm *.s *.a85 *.hex *.ihx *.bin);;All files (*)");
+        if (name.isEmpty()) return;
+        std::string path = name.toStdString();
+        std::string ext = path.substr(path.find_last_of('.') + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+        
+        // Sources go into the editor; images load as they are
+        if (ext == "asm" || ext == "s" || ext == "a85") {
+            std::ifstream in(path, std::ios::binary);
+            std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            if (!in.eof()) {
+                statusLabel->setText("Status: Cannot read " + name);
+                return;
+            }
+            sourceEdit->setPlainText(QString::fromStdString(text));
+            onAssemble();
+            return;
+        }
+        std::unique_ptr<CPU8085> scratch(new CPU8085(CPU8085::Engine::Switch));
+        LoadResult loaded = loadImageFile(*scratch, path);
+        if (!loaded.ok || !loaded.bytesLoaded) {
+            statusLabel->setText("Status: " + QString::fromStdString(loaded.ok ? path + " is empty" : loaded.error));
+            return;
+        }
+        std::vector<uint8_t> image(loaded.highAddress - loaded.lowAddress + 1u);
+        scratch->memory.read(loaded.lowAddress, image.data(), image.size());
+        emulator.load(std::move(image), loaded.lowAddress,
+                      loaded.hasStartAddress ? loaded.startAddress : loaded.lowAddress);
+        statusLabel->setText(QString("Status: Loaded %1 bytes from ").arg(static_cast<int>(loaded.bytesLoaded)) + name);
+    }
+    
+    void onGoto() {
+        uint addr = 0;
+        if (!parseHex(gotoEdit->text(), addr) || addr > 0xFFFF) {
+            statusLabel->setText("Status: Not an address: " + gotoEdit->text());
+            return;
+        }
+        showAddress(static_cast<uint16_t>(addr), QAbstractItemView::PositionAtTop);
     }
     
     void updateDisplay() {
+        CpuSnapshot frame;
+        emulator.snapshot(frame);
+        // Every frame, so write highlights fade out while stopped too
+        memoryModel->refresh(emulator, frame);
+        if (frame.serial == shown.serial) return;
+        
+        if (shown.running && !frame.running && frame.halted) {
+            statusLabel->setText("Status: CPU Halted");
+        } else if (shown.running && !frame.running && frame.breakStop && !frame.hits.empty()) {
+            const DebugHit &hit = frame.hits.back();
+            statusLabel->setText(QString("Status: Stopped by breakpoint #%1 (%2 %3h)")
+                .arg(hit.id).arg(breakKindName(hit.kind)).arg(hex(hit.address, 4)));
+        }
+        
         // Update registers
-        registerDisplay->setText(QString::fromStdString(cpu->getRegisterState()));
+        registerDisplay->setText(QString("A:%1 B:%2 C:%3 D:%4 E:%5 H:%6 L:%7\nSP:%8 PC:%9")
+            .arg(hex(frame.A, 2)).arg(hex(frame.B, 2)).arg(hex(frame.C, 2))
+            .arg(hex(frame.D, 2)).arg(hex(frame.E, 2)).arg(hex(frame.H, 2))
+            .arg(hex(frame.L, 2)).arg(hex(frame.SP, 4)).arg(hex(frame.PC, 4)));
         
         // Update flags
-        flagsDisplay->setText(QString::fromStdString(cpu->getFlagsState()));
+        CPU8085::Flags flags;
+        flags.psw = frame.psw;
+        flagsDisplay->setText(QString("S:%1 Z:%2 AC:%3 P:%4 CY:%5")
+            .arg(flags.S()).arg(flags.Z()).arg(flags.AC()).arg(flags.P()).arg(flags.CY()));
         
         // Update output display with result information
         QString output;
         output += QString("Accumulator (A): %1 (0x%2, %3d)\n")
-            .arg(QString::number(cpu->A, 2).rightJustified(8, '0'))
-            .arg(cpu->A, 2, 16, QChar('0')).toUpper()
-            .arg(cpu->A);
+            .arg(QString::number(frame.A, 2).rightJustified(8, '0'))
+            .arg(hex(frame.A, 2))
+            .arg(frame.A);
         output += QString("B Register: %1 (0x%2, %3d)\n")
-            .arg(QString::number(cpu->B, 2).rightJustified(8, '0'))
-            .arg(cpu->B, 2, 16, QChar('0')).toUpper()
-            .arg(cpu->B);
+            .arg(QString::number(frame.B, 2).rightJustified(8, '0'))
+            .arg(hex(frame.B, 2))
+            .arg(frame.B);
         output += QString("C Register: %1 (0x%2, %3d)\n")
-            .arg(QString::number(cpu->C, 2).rightJustified(8, '0'))
-            .arg(cpu->C, 2, 16, QChar('0')).toUpper()
-            .arg(cpu->C);
+            .arg(QString::number(frame.C, 2).rightJustified(8, '0'))
+            .arg(hex(frame.C, 2))
+            .arg(frame.C);
         output += QString("\nProgram Counter: 0x%1\n")
-            .arg(cpu->PC, 4, 16, QChar('0')).toUpper();
+            .arg(hex(frame.PC, 4));
         output += QString("Stack Pointer: 0x%1\n")
-            .arg(cpu->SP, 4, 16, QChar('0')).toUpper();
+            .arg(hex(frame.SP, 4));
+        output += QString("T-states: %1\n")
+            .arg(static_cast<qulonglong>(frame.cycles));
+        output += QString("Undo history: %1 instructions\n")
+            .arg(static_cast<qulonglong>(frame.undoDepth));
         output += QString("Status: %1")
-            .arg(cpu->halted ? "HALTED" : "RUNNING");
+            .arg(frame.halted ? "HALTED" : "RUNNING");
         
         outputDisplay->setText(output);
         
-        // Update memory table (first 256 bytes)
-        for (int row = 0; row < 16; row++) {
-            // Address column
-            uint16_t baseAddr = row * 16;
-            QTableWidgetItem *addrItem = new QTableWidgetItem(
-                QString("%1").arg(baseAddr, 4, 16, QChar('0')).toUpper()
-            );
-            addrItem->setForeground(Qt::black);
-            addrItem->setBackground(QColor(230, 230, 230));
-            memoryTable->setItem(row, 0, addrItem);
-            
-            // Memory values
-            for (int col = 0; col < 16; col++) {
-                uint16_t addr = baseAddr + col;
-                uint8_t value = cpu->getMemory(addr);
-                QTableWidgetItem *item = new QTableWidgetItem(
-                    QString("%1").arg(value, 2, 16, QChar('0')).toUpper()
-                );
-                
-                // Set text color to black for visibility
-                item->setForeground(Qt::black);
-                
-                // Highlight current PC location
-                if (addr == cpu->PC) {
-                    item->setBackground(Qt::yellow);
-                } else {
-                    item->setBackground(Qt::white);
-                }
-                
-                memoryTable->setItem(row, col + 1, item);
+        if (frame.hotSpots.size() != shown.hotSpots.size() || frame.profiledCycles != shown.profiledCycles) {
+            QString spots = "Address   T-states         %\n";
+            for (const Profiler::HotSpot& spot : frame.hotSpots) {
+                double share = frame.profiledCycles ? 100.0 * spot.cycles / frame.profiledCycles : 0.0;
+                spots += QString("%1h  %2  %3\n")
+                    .arg(hex(spot.address, 4))
+                    .arg(static_cast<qulonglong>(spot.cycles), 14)
+                    .arg(share, 7, 'f', 2);
             }
+            hotSpotDisplay->setText(spots);
         }
+        
+        bool listChanged = frame.breakpoints.size() != shown.breakpoints.size();
+        for (size_t i = 0; !listChanged && i < frame.breakpoints.size(); i++) {
+            listChanged = frame.breakpoints[i].id != shown.breakpoints[i].id;
+        }
+        if (listChanged || frame.hitTotal != shown.hitTotal) {
+            QString text;
+            for (const Breakpoint &b : frame.breakpoints) {
+                text += QString("#%1 %2 %3").arg(b.id).arg(breakKindName(b.kind), -5).arg(hex(b.first, 4));
+                if (b.last != b.first) text += "-" + hex(b.last, 4);
+                if (!b.condition.empty()) text += " if " + QString::fromStdString(b.condition.text());
+                if (b.hitCount > 1) text += QString(" from hit %1").arg(static_cast<qulonglong>(b.hitCount));
+                if (b.logOnly) text += " (log)";
+                text += QString(", %1 hits\n").arg(static_cast<qulonglong>(b.hits));
+            }
+            if (!frame.hits.empty()) text += "\nLatest hits:\n";
+            for (const DebugHit &hit : frame.hits) text += QString::fromStdString(formatDebugHit(hit)) + "\n";
+            breakDisplay->setText(text);
+            breakDisplay->moveCursor(QTextCursor::End);
+        }
+        
+        updateDisassembly(frame);
+        
+        if (followPc->isChecked() && frame.PC != shown.PC) showAddress(frame.PC);
+        if (followSp->isChecked() && frame.SP != shown.SP) showAddress(frame.SP);
+        
+        shown = frame;
     }
 
 private:
-    CPU8085 *cpu;
+    static constexpr int kFrameMs = 16;  // ~60 Hz display refresh
+    static constexpr int kDisassemblyLines = 24;
+    
+    static QString hex(unsigned value, int digits) {
+        return QString("%1").arg(value, digits, 16, QChar('0')).toUpper();
+    }
+    
+    // Hex with an optional 0x prefix or h suffix
+    static bool parseHex(QString text, uint &value) {
+        text = text.trimmed();
+        if (text.startsWith("0x") || text.startsWith("0X")) text = text.mid(2);
+        if (text.endsWith('h') || text.endsWith('H')) text.chop(1);
+        bool ok = false;
+        value = text.toUInt(&ok, 16);
+        return ok;
+    }
+    
+    // Keeps the lines on screen while PC stays in their upper part, else
+    // starts again at PC
+    void updateDisassembly(const CpuSnapshot &frame) {
+        const std::array<uint8_t, 0x10000> &memory = memoryModel->bytes();
+        auto shownAt = std::find(disassemblyLines.begin(), disassemblyLines.end(), frame.PC);
+        bool keep = shownAt != disassemblyLines.end() && shownAt - disassemblyLines.begin() < kDisassemblyLines - 4;
+        uint16_t address = keep ? disassemblyLines.front() : frame.PC;
+        disassemblyLines.clear();
+        QString text;
+        for (int line = 0; line < kDisassemblyLines; line++) {
+            uint8_t bytes[3] = {memory[address], memory[static_cast<uint16_t>(address + 1)],
+                                memory[static_cast<uint16_t>(address + 2)]};
+            char instruction[kDisassemblySize];
+            int length = disassemble(bytes, instruction);
+            bool breakpoint = false;
+            for (const Breakpoint &b : frame.breakpoints) {
+                if (b.kind == BreakKind::Execute && !b.logOnly && address >= b.first && address <= b.last) breakpoint = true;
+            }
+            QString code;
+            for (int i = 0; i < 3; i++) code += i < length ? hex(bytes[i], 2) + " " : "   ";
+            text += QString("%1%2%3  %4 %5\n")
+                .arg(address == frame.PC ? ">" : " ").arg(breakpoint ? "*" : " ")
+                .arg(hex(address, 4)).arg(code).arg(instruction);
+            disassemblyLines.push_back(address);
+            address = static_cast<uint16_t>(address + length);
+        }
+        if (text != disassemblyText) {
+            disassemblyDisplay->setPlainText(text);
+            disassemblyText = text;
+        }
+    }
+    
+    void showAddress(uint16_t addr, QAbstractItemView::ScrollHint hint = QAbstractItemView::EnsureVisible) {
+        QModelIndex index = memoryModel->index(addr / MemoryModel::kColumns, addr % MemoryModel::kColumns);
+        memoryView->scrollTo(index, hint);
+        memoryView->setCurrentIndex(index);
+    }
+    
+    EmulationThread emulator;
+    CpuSnapshot shown;  // What the widgets currently display
     QTextEdit *registerDisplay;
+    QPlainTextEdit *sourceEdit;
+    QTextEdit *assemblyLog;
     QTextEdit *flagsDisplay;
     QTextEdit *outputDisplay;
-    QTableWidget *memoryTable;
+    MemoryModel *memoryModel;
+    QTableView *memoryView;
+    QLineEdit *gotoEdit;
+    QCheckBox *followPc;
+    QCheckBox *followSp;
+    QCheckBox *profileCheck;
+    QTextEdit *hotSpotDisplay;
+    QTextEdit *disassemblyDisplay;
+    std::vector<uint16_t> disassemblyLines;  // Address of each line shown
+    QString disassemblyText;
+    QComboBox *breakKind;
+    QLineEdit *breakAddress;
+    QLineEdit *breakCondition;
+    QSpinBox *breakCount;
+    QCheckBox *breakLogOnly;
+    QTextEdit *breakDisplay;
     QLabel *statusLabel;
-    QTimer *runTimer;
+    QTimer *frameTimer;
+    QComboBox *clockSelect;
 };
 
 int main(int argc, char *argv[]) {
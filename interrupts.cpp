@@ -0,0 +1,99 @@
+#include "interrupts.h"
+
+namespace {
+
+const uint16_t kTrapVector = 0x0024;
+const uint16_t kRst75Vector = 0x003C;
+const uint16_t kRst65Vector = 0x0034;
+const uint16_t kRst55Vector = 0x002C;
+
+// Bits of unmasked()
+const uint8_t kPending75 = 0x04;
+const uint8_t kPending65 = 0x02;
+const uint8_t kPending55 = 0x01;
+
+} // namespace
+
+InterruptUnit::InterruptUnit() {
+    reset();
+}
+
+void InterruptUnit::reset() {
+    masks = 0x07;
+    rst75Latch = false;
+    trapArmed = false;
+    serialIn = false;
+    serialOut = false;
+    changed = true;
+    levels = 0;
+    intrVector = 0x0038;
+    enabledBeforeTrap = false;
+    trapTaken = false;
+}
+
+void InterruptUnit::setLine(Line l, bool level, uint16_t vector) {
+    if (l == Intr) intrVector = vector;
+    uint8_t bit = static_cast<uint8_t>(1u << l);
+    bool rising = level && !(levels & bit);
+    if (level) {
+        levels |= bit;
+    } else {
+        levels &= static_cast<uint8_t>(~bit);
+    }
+    if (rising && l == Rst75) rst75Latch = true;
+    if (rising && l == Trap) trapArmed = true;
+    changed = true;
+}
+
+void InterruptUnit::pulse(Line l) {
+    setLine(l, true);
+    setLine(l, false);
+}
+
+uint8_t InterruptUnit::unmasked() const {
+    uint8_t pending = 0;
+    if (rst75Latch && !(masks & 0x04)) pending |= kPending75;
+    if (line(Rst65) && !(masks & 0x02)) pending |= kPending65;
+    if (line(Rst55) && !(masks & 0x01)) pending |= kPending55;
+    return pending;
+}
+
+InterruptUnit::Request InterruptUnit::next(bool enabled) const {
+    if (trapArmed && line(Trap)) return {Trap, kTrapVector};
+    uint8_t pending = enabled ? unmasked() : 0;
+    if (pending & kPending75) return {Rst75, kRst75Vector};
+    if (pending & kPending65) return {Rst65, kRst65Vector};
+    if (pending & kPending55) return {Rst55, kRst55Vector};
+    return {Intr, intrVector};
+}
+
+void InterruptUnit::acknowledge(Line l, bool enabled) {
+    if (l == Trap) {
+        trapArmed = false;
+        trapTaken = true;
+        enabledBeforeTrap = enabled;
+    } else if (l == Rst75) {
+        rst75Latch = false;
+    }
+}
+
+void InterruptUnit::sim(uint8_t a) {
+    if (a & 0x08) masks = a & 0x07;    // MSE: load the masks
+    if (a & 0x10) rst75Latch = false;  // R7.5: reset the RST 7.5 latch
+    if (a & 0x40) serialOut = (a & 0x80) != 0;  // SOE: latch SOD
+    changed = true;
+}
+
+uint8_t InterruptUnit::rim(bool enabled) {
+    if (trapTaken) {
+        enabled = enabledBeforeTrap;
+        trapTaken = false;
+    }
+    uint8_t value = masks;
+    if (enabled) value |= 0x08;
+    if (line(Rst55)) value |= 0x10;
+    if (line(Rst65)) value |= 0x20;
+    if (rst75Latch) value |= 0x40;
+    if (serialIn) value |= 0x80;
+    return value;
+}
@@ -0,0 +1,75 @@
+#ifndef INTERRUPTS_H
+#define INTERRUPTS_H
+
+#include <cstdint>
+
+// The 8085 interrupt inputs, masks and the RIM/SIM serial pins. Devices drive
+// the lines; the CPU asks for the highest-priority request between
+// instructions and acknowledges it.
+//
+// Priority, highest first: TRAP, RST 7.5, RST 6.5, RST 5.5, INTR.
+//   TRAP     - edge and level: a rising edge arms it, it is taken while the
+//              line is still high; not maskable, ignores IE
+//   RST 7.5  - rising edge sets a latch that stays set until acknowledged or
+//              cleared by SIM (bit 4); masked by SIM bit 2
+//   RST 6.5  - level, masked by SIM bit 1
+//   RST 5.5  - level, masked by SIM bit 0
+//   INTR     - level; the device supplies an RST opcode (RST 0-7)
+class InterruptUnit {
+public:
+    enum Line : uint8_t { Trap, Rst75, Rst65, Rst55, Intr };
+
+    // Pending request, as returned by next()
+    struct Request {
+        Line line;
+        uint16_t vector;
+    };
+
+    InterruptUnit();
+
+    // Power-on state: lines low, latches clear, all three RST masks set
+    void reset();
+
+    // Drive an input line. For INTR, vector is the restart address the
+    // interrupting device puts on the bus (a multiple of 8 below 0x40).
+    void setLine(Line line, bool level, uint16_t vector = 0x0038);
+    // A rising then falling edge, for RST 7.5 and TRAP sources that pulse
+    void pulse(Line line);
+    bool line(Line l) const { return (levels >> l) & 1; }
+
+    // True when some request would be taken with interrupts enabled as given
+    bool requested(bool enabled) const {
+        if (trapArmed && line(Trap)) return true;
+        return enabled && (unmasked() || line(Intr));
+    }
+    // Highest-priority request; call only when requested() is true
+    Request next(bool enabled) const;
+    // The CPU took a request: clears the edge latch that raised it
+    void acknowledge(Line line, bool enabled);
+
+    // SIM and RIM, with the accumulator value and interrupt enable flag
+    void sim(uint8_t a);
+    uint8_t rim(bool enabled);
+
+    uint8_t masks;     // SIM bits 2-0: RST 7.5, 6.5, 5.5 (1 = masked)
+    bool rst75Latch;   // Edge seen on RST 7.5
+    bool trapArmed;    // Edge seen on TRAP, not yet taken
+    bool serialIn;     // SID pin, read by RIM bit 7
+    bool serialOut;    // SOD latch, written by SIM bits 7/6
+
+    // Set whenever a line, latch or mask changes. The CPU clears it between
+    // run() slices and ends a slice early when an IN or OUT handler sets it.
+    bool changed;
+
+private:
+    friend class SaveState;
+
+    uint8_t levels;      // Bit per Line
+    uint16_t intrVector;
+    bool enabledBeforeTrap;
+    bool trapTaken;      // RIM after TRAP reports the IE flag from before it
+
+    uint8_t unmasked() const;
+};
+
+#endif // INTERRUPTS_H
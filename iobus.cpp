@@ -0,0 +1,50 @@
+#include "iobus.h"
+
+namespace {
+
+uint8_t floatingInput(void*, uint8_t) {
+    return 0xFF;
+}
+
+bool alwaysQuiet(void*, uint8_t) {
+    return true;
+}
+
+void ignoredOutput(void*, uint8_t, uint8_t) {
+}
+
+} // namespace
+
+IoBus::IoBus() {
+    clear();
+}
+
+void IoBus::mapInput(uint8_t port, InputFn fn, void* context, QuietFn quiet) {
+    inputs[port] = {fn, context, quiet};
+}
+
+void IoBus::mapOutput(uint8_t port, OutputFn fn, void* context) {
+    outputs[port] = {fn, context};
+}
+
+void IoBus::unmapInput(uint8_t port) {
+    inputs[port] = {floatingInput, nullptr, alwaysQuiet};
+}
+
+void IoBus::unmapOutput(uint8_t port) {
+    outputs[port] = {ignoredOutput, nullptr};
+}
+
+void IoBus::clear() {
+    inputs.fill({floatingInput, nullptr, alwaysQuiet});
+    outputs.fill({ignoredOutput, nullptr});
+    resetHooks.clear();
+}
+
+void IoBus::addResetHook(ResetFn fn, void* context) {
+    resetHooks.push_back({fn, context});
+}
+
+void IoBus::reset() const {
+    for (const ResetHook& hook : resetHooks) hook.fn(hook.context);
+}
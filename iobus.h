@@ -0,0 +1,71 @@
+#ifndef IOBUS_H
+#define IOBUS_H
+
+#include <cstdint>
+#include <array>
+#include <vector>
+
+// The 8085 I/O address space: 256 input and 256 output ports. Devices map
+// plain function pointers (plus a context pointer) onto ports, so IN and OUT
+// cost one table lookup and an indirect call. Unmapped ports read 0xFF, like
+// an undriven data bus, and ignore writes.
+class IoBus {
+public:
+    using InputFn = uint8_t (*)(void* context, uint8_t port);
+    // Whether a read of port now would leave its device unchanged
+    using QuietFn = bool (*)(void* context, uint8_t port);
+    using OutputFn = void (*)(void* context, uint8_t port, uint8_t value);
+    using ResetFn = void (*)(void* context);
+
+    IoBus();
+
+    void mapInput(uint8_t port, InputFn fn, void* context, QuietFn quiet = nullptr);
+    void mapOutput(uint8_t port, OutputFn fn, void* context);
+    void unmapInput(uint8_t port);
+    void unmapOutput(uint8_t port);
+    // Drops every mapping and reset hook
+    void clear();
+
+    uint8_t read(uint8_t port) const {
+        const Input& in = inputs[port];
+        return in.fn(in.context, port);
+    }
+    // Reading port now changes nothing, so it keeps returning the same value
+    // until an event fires, a port is written or the host changes the device.
+    // Always true for unmapped ports; for mapped ones, what their QuietFn says
+    // (false without one).
+    bool quiet(uint8_t port) const {
+        const Input& in = inputs[port];
+        return in.quiet && in.quiet(in.context, port);
+    }
+    void write(uint8_t port, uint8_t value) const {
+        const Output& out = outputs[port];
+        out.fn(out.context, port, value);
+    }
+
+    // Called by CPU reset(), after scheduled events have been dropped, so
+    // devices can return to their power-on state
+    void addResetHook(ResetFn fn, void* context);
+    void reset() const;
+
+private:
+    struct Input {
+        InputFn fn;
+        void* context;
+        QuietFn quiet;
+    };
+    struct Output {
+        OutputFn fn;
+        void* context;
+    };
+    struct ResetHook {
+        ResetFn fn;
+        void* context;
+    };
+
+    std::array<Input, 256> inputs;
+    std::array<Output, 256> outputs;
+    std::vector<ResetHook> resetHooks;
+};
+
+#endif // IOBUS_H
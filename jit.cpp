@@ -0,0 +1,950 @@
+#include "jit.h"
+
+#if CPU8085_JIT
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <iomanip>
+#include <sstream>
+#include <sys/mman.h>
+
+namespace {
+
+// x86-64 register numbers
+enum : int { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+// Byte registers encodable without a REX prefix
+enum : int { AL, CL, DL, BL, AH, CH, DH, BH };
+const int SIL = 6;  // Needs REX8
+
+// Condition codes for jcc
+enum : uint8_t { CC_E = 0x4, CC_NE = 0x5 };
+
+// Prefix flags for Emitter
+enum : unsigned { W = 1, P66 = 2, REX8 = 4 };
+
+const int kNoIndex = -1;
+
+// 8085 register field (B C D E H L M A) to host byte register; M has none
+const int kHostReg8[8] = {CH, CL, DH, DL, BH, BL, -1, AL};
+// Register pair field (BC DE HL SP) to host register holding it
+const int kHostPair[4] = {RCX, RDX, RBX, R13};
+
+// Minimal x86-64 encoder. CPU fields are [rbp + disp32] and guest memory is
+// [r15 + index + disp], r15 holding the flat memory buffer.
+class Emitter {
+public:
+    uint8_t* p;
+
+    explicit Emitter(uint8_t* at) : p(at) {}
+
+    void byte(uint8_t value) { *p++ = value; }
+    void bytes(std::initializer_list<uint8_t> list) { for (uint8_t b : list) *p++ = b; }
+    void u16(uint16_t value) { std::memcpy(p, &value, 2); p += 2; }
+    void u32(uint32_t value) { std::memcpy(p, &value, 4); p += 4; }
+    void u64(uint64_t value) { std::memcpy(p, &value, 8); p += 8; }
+
+    // opcode /reg with a register operand
+    void rr(std::initializer_list<uint8_t> opcode, int reg, int rm, unsigned flags = 0) {
+        prefix(flags, reg, kNoIndex, rm);
+        bytes(opcode);
+        byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+    }
+
+    // opcode /reg with memory operand [rbp + index + disp]
+    void rm(std::initializer_list<uint8_t> opcode, int reg, int index, int32_t disp, unsigned flags = 0) {
+        address(opcode, reg, RBP, index, disp, flags);
+    }
+
+    // opcode /reg with guest memory operand [r15 + index + disp]
+    void mem(std::initializer_list<uint8_t> opcode, int reg, int index, int32_t disp = 0, unsigned flags = 0) {
+        address(opcode, reg, R15, index, disp, flags);
+    }
+
+    // Returns the rel32 field to patch
+    uint8_t* jcc(uint8_t cc) { bytes({0x0F, static_cast<uint8_t>(0x80 | cc)}); return rel32(); }
+    uint8_t* jmp() { byte(0xE9); return rel32(); }
+    void jcc(uint8_t cc, const uint8_t* target) { patch(jcc(cc), target); }
+    void jmp(const uint8_t* target) { patch(jmp(), target); }
+
+    static void patch(uint8_t* site, const uint8_t* target) {
+        int32_t rel = static_cast<int32_t>(target - (site + 4));
+        std::memcpy(site, &rel, 4);
+    }
+
+private:
+    void address(std::initializer_list<uint8_t> opcode, int reg, int base, int index, int32_t disp,
+                 unsigned flags) {
+        prefix(flags, reg, index, base);
+        bytes(opcode);
+        // rbp/r13 as base always need a displacement
+        uint8_t mod = (disp == 0 && (base & 7) != 5) ? 0x00 : 0x80;
+        if (index == kNoIndex) {
+            byte(mod | (reg & 7) << 3 | (base & 7));
+        } else {
+            byte(mod | (reg & 7) << 3 | 4);
+            byte((index & 7) << 3 | (base & 7));
+        }
+        if (mod) u32(static_cast<uint32_t>(disp));
+    }
+
+    void prefix(unsigned flags, int reg, int index, int base) {
+        if (flags & P66) byte(0x66);
+        uint8_t rex = 0x40 | (flags & W ? 8 : 0) | (reg >= 8 ? 4 : 0) |
+                      (index >= 8 ? 2 : 0) | (base >= 8 ? 1 : 0);
+        if (rex != 0x40 || (flags & REX8)) byte(rex);
+    }
+
+    uint8_t* rel32() { uint8_t* site = p; u32(0); return site; }
+};
+
+int32_t fieldOffset(const CPU8085& cpu, const void* field) {
+    return static_cast<int32_t>(reinterpret_cast<const uint8_t*>(field) -
+                                reinterpret_cast<const uint8_t*>(&cpu));
+}
+
+} // namespace
+
+// Emits the code for one block
+struct JitCompiler::Translator {
+    JitCompiler& jit;
+    const Layout& L;
+    Emitter e;
+    int32_t block;
+    int pending;  // Static T-states not yet added to r12
+
+    Translator(JitCompiler& jit, uint8_t* at, int32_t block)
+        : jit(jit), L(jit.layout), e(at), block(block), pending(0) {}
+
+    void spill() {
+        e.rm({0x88}, AL, kNoIndex, L.a);
+        e.rm({0x88}, AH, kNoIndex, L.psw);
+        e.rm({0x88}, CH, kNoIndex, L.b);
+        e.rm({0x88}, CL, kNoIndex, L.c);
+        e.rm({0x88}, DH, kNoIndex, L.d);
+        e.rm({0x88}, DL, kNoIndex, L.e);
+        e.rm({0x88}, BH, kNoIndex, L.h);
+        e.rm({0x88}, BL, kNoIndex, L.l);
+        e.rm({0x89}, R13, kNoIndex, L.sp, P66);
+    }
+
+    void reload() {
+        e.rm({0x0F, 0xB6}, RAX, kNoIndex, L.psw);
+        e.bytes({0xC1, 0xE0, 0x08});                    // shl eax, 8
+        e.rm({0x8A}, AL, kNoIndex, L.a);
+        e.rm({0x0F, 0xB6}, RCX, kNoIndex, L.b);
+        e.bytes({0xC1, 0xE1, 0x08});                    // shl ecx, 8
+        e.rm({0x8A}, CL, kNoIndex, L.c);
+        e.rm({0x0F, 0xB6}, RDX, kNoIndex, L.d);
+        e.bytes({0xC1, 0xE2, 0x08});                    // shl edx, 8
+        e.rm({0x8A}, DL, kNoIndex, L.e);
+        e.rm({0x0F, 0xB6}, RBX, kNoIndex, L.h);
+        e.bytes({0xC1, 0xE3, 0x08});                    // shl ebx, 8
+        e.rm({0x8A}, BL, kNoIndex, L.l);
+        e.rm({0x0F, 0xB7}, R13, kNoIndex, L.sp);        // movzx r13d, word
+    }
+
+    void addCycles(int extra) {
+        int total = pending + extra;
+        if (total) {
+            e.bytes({0x49, 0x81, 0xC4});                // add r12, imm32
+            e.u32(static_cast<uint32_t>(total));
+        }
+    }
+
+    // Guest memory byte to or from a kHostReg8 register. The REX prefix r15
+    // needs turns ch/dh/bh into bpl/sil/dil, so high halves go through esi.
+    void loadByte(int reg, int index, int32_t disp = 0) {
+        if (reg < CH) {
+            e.mem({0x8A}, reg, index, disp);
+            return;
+        }
+        int pair = reg - 4;                             // CH -> RCX, DH -> RDX, BH -> RBX
+        e.mem({0x0F, 0xB6}, RSI, index, disp);          // movzx esi, byte
+        e.bytes({0xC1, 0xE6, 0x08});                    // shl esi, 8
+        e.rr({0x81}, 4, pair);                          // and pair, 0xFFFF00FF
+        e.u32(0xFFFF00FF);
+        e.rr({0x09}, RSI, pair);                        // or pair, esi
+    }
+
+    void storeByte(int reg, int index, int32_t disp = 0) {
+        if (reg < CH) {
+            e.mem({0x88}, reg, index, disp);
+            return;
+        }
+        e.rr({0x0F, 0xB6}, RSI, reg);                   // movzx esi, ch/dh/bh
+        e.mem({0x88}, SIL, index, disp, REX8);
+    }
+
+    // Leaves the block for a known address through a patchable jump
+    void staticExit(uint16_t target, int extra = 0) {
+        addCycles(extra);
+        e.byte(0xBF);                                   // mov edi, imm32
+        e.u32(target);
+        uint8_t* site = e.jmp();
+        Emitter::patch(site, jit.exitLookup);
+        jit.exits.push_back({site, target, block});
+    }
+
+    // Leaves the block for the address in edi
+    void dynamicExit(int extra = 0) {
+        addCycles(extra);
+        e.jmp(jit.exitLookup);
+    }
+
+    // After a store: leave for smcExit when any of the pages holds code.
+    // loadAddress puts the first stored address in esi.
+    template <typename PageChecks, typename LoadAddress>
+    void storeCheck(PageChecks pageChecks, LoadAddress loadAddress, int count, uint16_t nextPC, int extra = 0) {
+        std::vector<uint8_t*> hits;
+        pageChecks(hits);
+        uint8_t* skip = e.jmp();
+        uint8_t* slow = e.p;
+        for (uint8_t* site : hits) Emitter::patch(site, slow);
+        addCycles(extra);
+        e.byte(0xBF);                                   // mov edi, nextPC
+        e.u32(nextPC);
+        loadAddress();
+        e.bytes({0x41, 0xB8});                          // mov r8d, count
+        e.u32(static_cast<uint32_t>(count));
+        e.jmp(jit.smcExit);
+        Emitter::patch(skip, e.p);
+    }
+
+    // Marks the page of esi written, then checks it for code:
+    // cmp byte [rbp + rsi + codePages], 0; jne
+    void checkPageInEsi(std::vector<uint8_t*>& hits) {
+        e.rm({0xC6}, 0, RSI, L.writtenPages);
+        e.byte(0x01);
+        e.rm({0x80}, 7, RSI, L.codePages);
+        e.byte(0x00);
+        hits.push_back(e.jcc(CC_NE));
+    }
+
+    // Store through a register pair (HL, BC or DE)
+    void checkPairStore(int pair, uint16_t nextPC) {
+        storeCheck([&](std::vector<uint8_t*>& hits) {
+            e.rr({0x0F, 0xB6}, RSI, pair + 4);          // movzx esi, high byte
+            checkPageInEsi(hits);
+        }, [&] {
+            e.rr({0x0F, 0xB7}, RSI, pair);              // movzx esi, pair
+        }, 1, nextPC);
+    }
+
+    // Store of count bytes at a constant address
+    void checkConstStore(uint16_t address, int count, uint16_t nextPC) {
+        storeCheck([&](std::vector<uint8_t*>& hits) {
+            int lastPage = -1;
+            for (int i = 0; i < count; i++) {
+                int page = static_cast<uint16_t>(address + i) >> 8;
+                if (page == lastPage) continue;
+                e.rm({0xC6}, 0, kNoIndex, L.writtenPages + page);
+                e.byte(0x01);
+                e.rm({0x80}, 7, kNoIndex, L.codePages + page);
+                e.byte(0x00);
+                hits.push_back(e.jcc(CC_NE));
+                lastPage = page;
+            }
+        }, [&] {
+            e.byte(0xBE);                               // mov esi, imm32
+            e.u32(address);
+        }, count, nextPC);
+    }
+
+    // Two bytes just pushed at SP and SP+1
+    void checkStackStore(uint16_t nextPC, int extra) {
+        storeCheck([&](std::vector<uint8_t*>& hits) {
+            e.bytes({0x44, 0x89, 0xEE});                // mov esi, r13d
+            e.bytes({0xC1, 0xEE, 0x08});                // shr esi, 8
+            checkPageInEsi(hits);
+            e.bytes({0x44, 0x89, 0xEE});                // mov esi, r13d
+            e.bytes({0xFF, 0xC6});                      // inc esi
+            e.bytes({0x0F, 0xB7, 0xF6});                // movzx esi, si
+            e.bytes({0xC1, 0xEE, 0x08});                // shr esi, 8
+            checkPageInEsi(hits);
+        }, [&] {
+            e.bytes({0x44, 0x89, 0xEE});                // mov esi, r13d
+        }, 2, nextPC, extra);
+    }
+
+    void decSP() { e.bytes({0x66, 0x41, 0xFF, 0xCD}); }
+    void incSP() { e.bytes({0x66, 0x41, 0xFF, 0xC5}); }
+
+    void pushConstant(uint16_t value) {
+        decSP();
+        e.mem({0xC6}, 0, R13);
+        e.byte(value >> 8);
+        decSP();
+        e.mem({0xC6}, 0, R13);
+        e.byte(value & 0xFF);
+    }
+
+    // Pops into edi
+    void popToEdi() {
+        e.mem({0x0F, 0xB6}, RDI, R13);
+        incSP();
+        e.mem({0x0F, 0xB6}, RSI, R13);
+        incSP();
+        e.bytes({0xC1, 0xE6, 0x08});                    // shl esi, 8
+        e.bytes({0x09, 0xF7});                          // or edi, esi
+    }
+
+    // Copies the host carry flag into the guest CY bit
+    void captureCarry() {
+        e.bytes({0x19, 0xF6});                          // sbb esi, esi
+        e.bytes({0x81, 0xE6, 0x00, 0x01, 0x00, 0x00});  // and esi, 0x100
+        e.bytes({0x25, 0xFF, 0xFE, 0xFF, 0xFF});        // and eax, ~0x100
+        e.bytes({0x09, 0xF0});                          // or eax, esi
+    }
+
+    // INR/DCR: S, Z, AC and P from the result, CY kept from before. x86 AF
+    // after DEC is the nibble borrow, the inverse of the 8085's AC.
+    void incDec(int digit, int r, uint16_t nextPC) {
+        e.bytes({0x89, 0xC6});                          // mov esi, eax
+        if (r == 6) {
+            e.mem({0xFE}, digit, RBX);
+        } else {
+            e.rr({0xFE}, digit, kHostReg8[r]);
+        }
+        e.byte(0x9F);                                   // lahf
+        e.bytes({0x81, 0xE6, 0x00, 0x01, 0x00, 0x00});  // and esi, 0x100
+        e.bytes({0x25, 0xFF, 0xFE, 0xFF, 0xFF});        // and eax, ~0x100
+        e.bytes({0x09, 0xF0});                          // or eax, esi
+        if (digit == 1) e.bytes({0x80, 0xF4, 0x10});    // xor ah, AC
+        if (r == 6) checkPairStore(RBX, nextPC);
+    }
+
+    // ADD, SUB, ANA, XRA, ORA, CMP: x86 flags after the same operation are
+    // the 8085 flags, except AC. x86 AF after SUB and CMP is the nibble
+    // borrow, the inverse of the 8085's; ANA sets AC, XRA and ORA clear it,
+    // and x86 leaves it undefined after all three.
+    void alu(int group, int r, bool immediate, uint8_t operand) {
+        static const uint8_t x86Base[8] = {0x00, 0, 0x28, 0, 0x20, 0x30, 0x08, 0x38};
+        uint8_t base = x86Base[group];
+        if (immediate) {
+            e.bytes({static_cast<uint8_t>(base + 4), operand});
+        } else if (r == 6) {
+            e.mem({static_cast<uint8_t>(base + 2)}, AL, RBX);
+        } else {
+            e.rr({base}, kHostReg8[r], AL);
+        }
+        e.byte(0x9F);                                   // lahf
+        if (group == 2 || group == 7) e.bytes({0x80, 0xF4, 0x10});  // xor ah, AC
+        if (group == 4) e.bytes({0x80, 0xCC, 0x10});                 // or ah, AC
+        if (group == 5 || group == 6) e.bytes({0x80, 0xE4, 0xEF});  // and ah, ~AC
+    }
+
+    // Interpreter micro-op called from compiled code
+    void helper(uint8_t opcode, uint16_t operand, uint16_t nextPC) {
+        spill();
+        if (opcode == 0xD3 || opcode == 0xDB) {
+            // Port devices read the cycle counter: bring it up to date
+            addCycles(0);
+            pending = 0;
+            e.rm({0x89}, R12, kNoIndex, L.cycles, W);   // mov [cycles], r12
+        }
+        e.rm({0xC7}, 0, kNoIndex, L.pc, P66);           // mov word [pc], nextPC
+        e.u16(nextPC);
+        e.bytes({0x48, 0x89, 0xEF});                    // mov rdi, rbp
+        e.byte(0xBE);                                   // mov esi, operand
+        e.u32(operand);
+        e.bytes({0x48, 0xB8});                          // mov rax, fn
+        e.u64(reinterpret_cast<uint64_t>(CPU8085::microOpTable[opcode]));
+        e.bytes({0xFF, 0xD0});                          // call rax
+        e.bytes({0x89, 0xC0});                          // mov eax, eax
+        e.bytes({0x49, 0x01, 0xC4});                    // add r12, rax
+        reload();
+        // Leave if the micro-op stored into compiled code or needs run() back
+        e.rm({0x80}, 7, kNoIndex, L.leaveBlock);
+        e.byte(0x00);
+        uint8_t* skip = e.jcc(CC_E);
+        addCycles(0);
+        e.byte(0xBF);                                   // mov edi, nextPC
+        e.u32(nextPC);
+        e.jmp(jit.exitSpill);
+        Emitter::patch(skip, e.p);
+    }
+
+    // Conditional: test the flag, returns the jcc taken when the condition holds
+    uint8_t* branchIfTaken(uint8_t opcode) {
+        static const uint8_t masks[4] = {CPU8085::Flags::ZERO, CPU8085::Flags::CARRY,
+                                         CPU8085::Flags::PARITY, CPU8085::Flags::SIGN};
+        int condition = (opcode >> 3) & 7;
+        e.bytes({0xF6, 0xC4, masks[condition >> 1]});  // test ah, mask
+        return e.jcc((condition & 1) ? CC_NE : CC_E);
+    }
+
+    // Returns false when the instruction ended the block
+    bool translate(uint8_t opcode, uint16_t operand, uint16_t nextPC) {
+        int states = CPU8085::baseCycles(opcode);
+        int r = (opcode >> 3) & 7;
+        int s = opcode & 7;
+        int pair = (opcode >> 4) & 3;
+
+        if (opcode >= 0x40 && opcode <= 0x7F && opcode != 0x76) {  // MOV
+            pending += states;
+            if (r == 6) {
+                storeByte(kHostReg8[s], RBX);
+                checkPairStore(RBX, nextPC);
+            } else if (s == 6) {
+                loadByte(kHostReg8[r], RBX);
+            } else {
+                e.rr({0x88}, kHostReg8[s], kHostReg8[r]);
+            }
+            return true;
+        }
+        if (opcode >= 0x80 && opcode <= 0xBF && r != 1 && r != 3) {  // ALU, not ADC/SBB
+            pending += states;
+            alu(r, s, false, 0);
+            return true;
+        }
+
+        switch (opcode) {
+            case 0x00:  // NOP
+                pending += states;
+                return true;
+            case 0x01: case 0x11: case 0x21: case 0x31:  // LXI
+                pending += states;
+                if (pair == 3) e.bytes({0x41, 0xBD});   // mov r13d, imm32
+                else e.byte(0xB8 + kHostPair[pair]);     // mov r32, imm32
+                e.u32(operand);
+                return true;
+            case 0x02: case 0x12:  // STAX
+                pending += states;
+                e.mem({0x88}, AL, kHostPair[pair]);
+                checkPairStore(kHostPair[pair], nextPC);
+                return true;
+            case 0x0A: case 0x1A:  // LDAX
+                pending += states;
+                e.mem({0x8A}, AL, kHostPair[pair]);
+                return true;
+            case 0x03: case 0x13: case 0x23: case 0x33:  // INX
+                pending += states;
+                e.rr({0xFF}, 0, kHostPair[pair], P66);
+                return true;
+            case 0x0B: case 0x1B: case 0x2B: case 0x3B:  // DCX
+                pending += states;
+                e.rr({0xFF}, 1, kHostPair[pair], P66);
+                return true;
+            case 0x04: case 0x0C: case 0x14: case 0x1C:
+            case 0x24: case 0x2C: case 0x34: case 0x3C:  // INR
+                pending += states;
+                incDec(0, r, nextPC);
+                return true;
+            case 0x05: case 0x0D: case 0x15: case 0x1D:
+            case 0x25: case 0x2D: case 0x35: case 0x3D:  // DCR
+                pending += states;
+                incDec(1, r, nextPC);
+                return true;
+            case 0x06: case 0x0E: case 0x16: case 0x1E:
+            case 0x26: case 0x2E: case 0x36: case 0x3E:  // MVI
+                pending += states;
+                if (r == 6) {
+                    e.mem({0xC6}, 0, RBX);
+                    e.byte(operand);
+                    checkPairStore(RBX, nextPC);
+                } else {
+                    e.bytes({static_cast<uint8_t>(0xB0 + kHostReg8[r]), static_cast<uint8_t>(operand)});
+                }
+                return true;
+            case 0x07:  // RLC
+                pending += states;
+                e.bytes({0xD0, 0xC0});                  // rol al, 1
+                captureCarry();
+                return true;
+            case 0x0F:  // RRC
+                pending += states;
+                e.bytes({0xD0, 0xC8});                  // ror al, 1
+                captureCarry();
+                return true;
+            case 0x17:  // RAL
+                pending += states;
+                e.bytes({0x0F, 0xBA, 0xE0, 0x08});      // bt eax, 8
+                e.bytes({0xD0, 0xD0});                  // rcl al, 1
+                captureCarry();
+                return true;
+            case 0x1F:  // RAR
+                pending += states;
+                e.bytes({0x0F, 0xBA, 0xE0, 0x08});      // bt eax, 8
+                e.bytes({0xD0, 0xD8});                  // rcr al, 1
+                captureCarry();
+                return true;
+            case 0x09: case 0x19: case 0x29: case 0x39:  // DAD
+                pending += states;
+                e.rr({0x01}, kHostPair[pair], RBX, P66);  // add bx, rp
+                captureCarry();
+                return true;
+            case 0x22:  // SHLD
+                pending += states;
+                storeByte(BL, kNoIndex, operand);
+                storeByte(BH, kNoIndex, static_cast<uint16_t>(operand + 1));
+                checkConstStore(operand, 2, nextPC);
+                return true;
+            case 0x2A:  // LHLD
+                pending += states;
+                loadByte(BL, kNoIndex, operand);
+                loadByte(BH, kNoIndex, static_cast<uint16_t>(operand + 1));
+                return true;
+            case 0x32:  // STA
+                pending += states;
+                e.mem({0x88}, AL, kNoIndex, operand);
+                checkConstStore(operand, 1, nextPC);
+                return true;
+            case 0x3A:  // LDA
+                pending += states;
+                e.mem({0x8A}, AL, kNoIndex, operand);
+                return true;
+            case 0x2F:  // CMA
+                pending += states;
+                e.bytes({0xF6, 0xD0});                  // not al
+                return true;
+            case 0x37:  // STC
+                pending += states;
+                e.bytes({0x80, 0xCC, 0x01});            // or ah, CY
+                return true;
+            case 0x3F:  // CMC
+                pending += states;
+                e.bytes({0x80, 0xF4, 0x01});            // xor ah, CY
+                return true;
+            case 0xC6: case 0xD6: case 0xE6: case 0xEE: case 0xF6: case 0xFE:  // ADI..CPI
+                pending += states;
+                alu(r, 0, true, static_cast<uint8_t>(operand));
+                return true;
+            case 0xEB:  // XCHG
+                pending += states;
+                e.bytes({0x87, 0xDA});                  // xchg ebx, edx
+                return true;
+            case 0xF9:  // SPHL
+                pending += states;
+                e.bytes({0x44, 0x0F, 0xB7, 0xEB});      // movzx r13d, bx
+                return true;
+            case 0xC5: case 0xD5: case 0xE5:  // PUSH rp
+                pending += states;
+                e.rr({0x89}, kHostPair[pair], RSI);     // mov esi, pair
+                e.bytes({0xC1, 0xEE, 0x08});            // shr esi, 8
+                decSP();
+                e.mem({0x88}, SIL, R13, 0, REX8);
+                decSP();
+                e.mem({0x88}, kHostPair[pair], R13);  // low byte register
+                checkStackStore(nextPC, 0);
+                return true;
+            case 0xF5:  // PUSH PSW
+                pending += states;
+                decSP();
+                e.mem({0x88}, AL, R13);
+                e.bytes({0x89, 0xC6});                  // mov esi, eax
+                e.bytes({0xC1, 0xEE, 0x08});            // shr esi, 8
+                decSP();
+                e.mem({0x88}, SIL, R13, 0, REX8);
+                checkStackStore(nextPC, 0);
+                return true;
+            case 0xC1: case 0xD1: case 0xE1: {  // POP rp
+                pending += states;
+                int host = kHostPair[pair];
+                e.mem({0x0F, 0xB6}, host, R13);
+                incSP();
+                e.mem({0x0F, 0xB6}, RSI, R13);
+                incSP();
+                e.bytes({0xC1, 0xE6, 0x08});            // shl esi, 8
+                e.rr({0x09}, RSI, host);                // or pair, esi
+                return true;
+            }
+            case 0xF1:  // POP PSW
+                pending += states;
+                e.mem({0x0F, 0xB6}, RSI, R13);
+                e.bytes({0x81, 0xE6, CPU8085::Flags::ALL, 0x00, 0x00, 0x00});  // and esi, ALL
+                e.bytes({0x83, 0xCE, CPU8085::Flags::ALWAYS_ONE});             // or esi, 1
+                e.bytes({0xC1, 0xE6, 0x08});            // shl esi, 8
+                incSP();
+                e.mem({0x0F, 0xB6}, RAX, R13);
+                incSP();
+                e.bytes({0x09, 0xF0});                  // or eax, esi
+                return true;
+            case 0xC3:  // JMP
+                pending += states;
+                staticExit(operand);
+                return false;
+            case 0xCD:  // CALL
+                pending += states;
+                pushConstant(nextPC);
+                checkStackStore(operand, 0);
+                staticExit(operand);
+                return false;
+            case 0xC9:  // RET
+                pending += states;
+                popToEdi();
+                dynamicExit();
+                return false;
+            case 0xE9:  // PCHL
+                pending += states;
+                e.bytes({0x0F, 0xB7, 0xFB});            // movzx edi, bx
+                dynamicExit();
+                return false;
+        }
+
+        switch (opcode & 0xC7) {
+            case 0xC2: {  // Jcc
+                pending += states;
+                uint8_t* taken = branchIfTaken(opcode);
+                staticExit(nextPC);
+                Emitter::patch(taken, e.p);
+                staticExit(operand, CPU8085::takenExtraCycles(opcode));
+                return false;
+            }
+            case 0xC4: {  // Ccc
+                pending += states;
+                int extra = CPU8085::takenExtraCycles(opcode);
+                uint8_t* taken = branchIfTaken(opcode);
+                staticExit(nextPC);
+                Emitter::patch(taken, e.p);
+                pushConstant(nextPC);
+                checkStackStore(operand, extra);
+                staticExit(operand, extra);
+                return false;
+            }
+            case 0xC0: {  // Rcc
+                pending += states;
+                uint8_t* taken = branchIfTaken(opcode);
+                staticExit(nextPC);
+                Emitter::patch(taken, e.p);
+                popToEdi();
+                dynamicExit(CPU8085::takenExtraCycles(opcode));
+                return false;
+            }
+            case 0xC7: {  // RST n
+                pending += states;
+                uint16_t vector = opcode & 0x38;
+                pushConstant(nextPC);
+                checkStackStore(vector, 0);
+                staticExit(vector);
+                return false;
+            }
+        }
+
+        // Everything else (ADC/SBB, DAA, XTHL, I/O, interrupt control, HLT)
+        helper(opcode, operand, nextPC);
+        if (opcode == 0x76) {  // HLT: back to the dispatcher, which sees exitRun
+            addCycles(0);
+            e.byte(0xBF);
+            e.u32(nextPC);
+            e.jmp(jit.exitSpill);
+            return false;
+        }
+        return !CPU8085::endsBlock(opcode);
+    }
+};
+
+JitCompiler::JitCompiler(const CPU8085& cpu)
+    : code(nullptr), codeEnd(nullptr), cursor(nullptr), exitSpill(nullptr),
+      exitLookup(nullptr), smcExit(nullptr), enter(nullptr),
+      blockAt(65536, -1), entries(65536, nullptr), heat(65536, 0), verify(false) {
+    layout.a = fieldOffset(cpu, &cpu.A);
+    layout.b = fieldOffset(cpu, &cpu.B);
+    layout.c = fieldOffset(cpu, &cpu.C);
+    layout.d = fieldOffset(cpu, &cpu.D);
+    layout.e = fieldOffset(cpu, &cpu.E);
+    layout.h = fieldOffset(cpu, &cpu.H);
+    layout.l = fieldOffset(cpu, &cpu.L);
+    layout.sp = fieldOffset(cpu, &cpu.SP);
+    layout.pc = fieldOffset(cpu, &cpu.PC);
+    layout.psw = fieldOffset(cpu, &cpu.flags.psw);
+    layout.cycles = fieldOffset(cpu, &cpu.cycles);
+    layout.flatMemory = fieldOffset(cpu, &cpu.memory.flat);
+    layout.codePages = fieldOffset(cpu, cpu.codePages.data());
+    layout.leaveBlock = fieldOffset(cpu, &cpu.leaveBlock);
+    layout.writtenPages = fieldOffset(cpu, cpu.writtenPages.data());
+
+    void* mapping = mmap(nullptr, kCodeSize, PROT_READ | PROT_WRITE | PROT_EXEC,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) return;
+    code = static_cast<uint8_t*>(mapping);
+    codeEnd = code + kCodeSize;
+    emitStubs();
+}
+
+JitCompiler::~JitCompiler() {
+    if (code) munmap(code, kCodeSize);
+}
+
+void JitCompiler::emitStubs() {
+    Translator t(*this, code, -1);
+    Emitter& e = t.e;
+
+    // void enter(CPU8085* cpu, uint64_t target, const uint8_t* entry)
+    enter = reinterpret_cast<EnterFn>(e.p);
+    e.bytes({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});  // push rbx..r15
+    e.bytes({0x48, 0x83, 0xEC, 0x08});              // sub rsp, 8
+    e.bytes({0x48, 0x89, 0xFD});                    // mov rbp, rdi
+    e.rm({0x8B}, R15, kNoIndex, layout.flatMemory, W);  // mov r15, [memory.flat]
+    e.bytes({0x49, 0x89, 0xF6});                    // mov r14, rsi
+    e.bytes({0x49, 0x89, 0xD3});                    // mov r11, rdx
+    e.rm({0x8B}, R12, kNoIndex, layout.cycles, W);  // mov r12, [cycles]
+    t.reload();
+    e.bytes({0x41, 0xFF, 0xE3});                    // jmp r11
+
+    exitSpill = e.p;
+    t.spill();
+    e.rm({0x89}, RDI, kNoIndex, layout.pc, P66);    // mov [pc], di
+    e.rm({0x89}, R12, kNoIndex, layout.cycles, W);  // mov [cycles], r12
+    uint8_t* epilogue = e.p;
+    e.bytes({0x48, 0x83, 0xC4, 0x08});              // add rsp, 8
+    e.bytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3});  // pop, ret
+
+    // esi = first stored address, r8d = byte count, edi = next PC
+    smcExit = e.p;
+    t.spill();
+    e.rm({0x89}, RDI, kNoIndex, layout.pc, P66);
+    e.rm({0x89}, R12, kNoIndex, layout.cycles, W);
+    e.bytes({0x48, 0x89, 0xEF});                    // mov rdi, rbp
+    e.bytes({0x44, 0x89, 0xC2});                    // mov edx, r8d
+    e.bytes({0x48, 0xB8});                          // mov rax, storeHit
+    e.u64(reinterpret_cast<uint64_t>(&JitCompiler::storeHit));
+    e.bytes({0xFF, 0xD0});                          // call rax
+    e.jmp(epilogue);
+
+    if (verify) {
+        // One block per entry, so every block is compared
+        exitLookup = exitSpill;
+    } else {
+        exitLookup = e.p;
+        e.bytes({0x48, 0xBE});                      // mov rsi, entries
+        e.u64(reinterpret_cast<uint64_t>(entries.data()));
+        e.bytes({0x48, 0x8B, 0x34, 0xFE});          // mov rsi, [rsi + rdi*8]
+        e.bytes({0x48, 0x85, 0xF6});                // test rsi, rsi
+        e.jcc(CC_E, exitSpill);
+        e.bytes({0xFF, 0xE6});                      // jmp rsi
+    }
+    cursor = e.p;
+}
+
+void JitCompiler::flush() {
+    blocks.clear();
+    exits.clear();
+    exitsTo.clear();
+    std::fill(blockAt.begin(), blockAt.end(), -1);
+    std::fill(entries.begin(), entries.end(), nullptr);
+    std::fill(heat.begin(), heat.end(), 0);
+    for (auto& list : pageBlocks) list.clear();
+    if (code) emitStubs();
+}
+
+void JitCompiler::invalidatePage(uint8_t page) {
+    for (int32_t index : pageBlocks[page]) {
+        Block& block = blocks[index];
+        if (!block.valid) continue;
+        block.valid = false;
+        blockAt[block.start] = -1;
+        entries[block.start] = nullptr;
+        auto incoming = exitsTo.find(block.start);
+        if (incoming == exitsTo.end()) continue;
+        for (uint32_t exitIndex : incoming->second) {
+            Emitter::patch(exits[exitIndex].site, exitLookup);
+        }
+    }
+    pageBlocks[page].clear();
+}
+
+void JitCompiler::link(uint32_t exitIndex) {
+    const Exit& exit = exits[exitIndex];
+    if (verify || !blocks[exit.block].valid) return;
+    int32_t target = blockAt[exit.target];
+    if (target >= 0) Emitter::patch(exit.site, blocks[target].entry);
+}
+
+void JitCompiler::storeHit(CPU8085& cpu, uint16_t address, int count) {
+    for (int i = 0; i < count; i++) {
+        uint8_t page = static_cast<uint16_t>(address + i) >> 8;
+        if (cpu.codePages[page]) cpu.invalidateCodePage(page);
+    }
+}
+
+int32_t JitCompiler::compile(CPU8085& cpu, uint16_t address) {
+    if (static_cast<size_t>(codeEnd - cursor) < kMaxBlockBytes) {
+        flush();
+        cpu.codePages.fill(0);
+    }
+
+    struct Instruction {
+        uint8_t opcode;
+        uint16_t operand;
+        uint16_t nextPC;
+    };
+    Instruction list[kMaxBlockOps];
+    int count = 0;
+    int maxCycles = 0;
+    uint16_t pc = address;
+    int32_t index = static_cast<int32_t>(blocks.size());
+    int lastPage = -1;
+    while (count < kMaxBlockOps) {
+        Instruction& in = list[count++];
+        in.opcode = cpu.memory[pc];
+        int length = CPU8085::instructionLength(in.opcode);
+        in.operand = 0;
+        if (length == 2) {
+            in.operand = cpu.memory[static_cast<uint16_t>(pc + 1)];
+        } else if (length == 3) {
+            in.operand = cpu.memory[static_cast<uint16_t>(pc + 1)] |
+                         (cpu.memory[static_cast<uint16_t>(pc + 2)] << 8);
+        }
+        in.nextPC = static_cast<uint16_t>(pc + length);
+        maxCycles += CPU8085::baseCycles(in.opcode) + CPU8085::takenExtraCycles(in.opcode);
+
+        for (int i = 0; i < length; i++) {
+            int page = static_cast<uint16_t>(pc + i) >> 8;
+            if (page != lastPage) {
+                if (pageBlocks[page].empty() || pageBlocks[page].back() != index) {
+                    pageBlocks[page].push_back(index);
+                }
+                cpu.codePages[page] = 1;
+                lastPage = page;
+            }
+        }
+        pc = in.nextPC;
+        if (CPU8085::endsBlock(in.opcode)) break;
+    }
+
+    Translator t(*this, cursor, index);
+    Emitter& e = t.e;
+    uint8_t* entry = e.p;
+    // Leave unless the whole block fits in the budget: r12 + maxCycles <= r14
+    e.bytes({0x49, 0x8D, 0xB4, 0x24});              // lea rsi, [r12 + maxCycles]
+    e.u32(static_cast<uint32_t>(maxCycles));
+    e.bytes({0x4C, 0x39, 0xF6});                    // cmp rsi, r14
+    e.bytes({0x76, 0x0A});                          // jbe body
+    e.byte(0xBF);                                   // mov edi, start
+    e.u32(address);
+    e.jmp(exitSpill);
+
+    size_t firstExit = exits.size();
+    bool open = true;
+    for (int i = 0; i < count && open; i++) {
+        open = t.translate(list[i].opcode, list[i].operand, list[i].nextPC);
+    }
+    if (open) t.staticExit(pc);
+    cursor = e.p;
+
+    blocks.push_back({address, static_cast<uint16_t>(maxCycles), entry, true});
+    blockAt[address] = index;
+    entries[address] = entry;
+
+    auto incoming = exitsTo.find(address);
+    if (incoming != exitsTo.end()) {
+        for (uint32_t exitIndex : incoming->second) link(exitIndex);
+    }
+    for (size_t i = firstExit; i < exits.size(); i++) {
+        exitsTo[exits[i].target].push_back(static_cast<uint32_t>(i));
+        link(static_cast<uint32_t>(i));
+    }
+    return index;
+}
+
+uint64_t JitCompiler::run(CPU8085& cpu, uint64_t cycleBudget) {
+    uint64_t start = cpu.cycles;
+    uint64_t target = cycleBudget > UINT64_MAX - start ? UINT64_MAX : start + cycleBudget;
+    if (verify) {
+        if (!verifyMessage.empty()) return 0;
+        syncShadow(cpu);
+    }
+    int threshold = verify ? 1 : kHotThreshold;
+
+    while (!cpu.exitRun && cpu.cycles < target) {
+        uint16_t pc = cpu.PC;
+        int32_t index = blockAt[pc];
+        if (index < 0 && ++heat[pc] >= threshold) {
+            heat[pc] = 0;
+            index = compile(cpu, pc);
+        }
+
+        if (index >= 0 && target - cpu.cycles >= blocks[index].maxCycles) {
+            cpu.leaveBlock = false;
+            enter(&cpu, target, blocks[index].entry);
+        } else {
+            // Cold code runs in the interpreter up to the end of its block;
+            // a compiled block that does not fit the budget runs one instruction
+            uint8_t opcode;
+            do {
+                opcode = cpu.fetchByte();
+                cpu.cycles += cpu.executeInstruction(opcode);
+            } while (index < 0 && !CPU8085::endsBlock(opcode) && !cpu.exitRun && cpu.cycles < target);
+        }
+
+        if (verify && !checkShadow(cpu, pc)) break;
+    }
+    return cpu.cycles - start;
+}
+
+void JitCompiler::setVerify(bool enabled) {
+    if (verify == enabled) return;
+    verify = enabled;
+    verifyMessage.clear();
+    if (!verify) shadow.reset();
+    flush();
+}
+
+void JitCompiler::syncShadow(const CPU8085& cpu) {
+    if (!shadow) shadow.reset(new CPU8085(CPU8085::Engine::Switch));
+    CPU8085& s = *shadow;
+    s.A = cpu.A; s.B = cpu.B; s.C = cpu.C; s.D = cpu.D;
+    s.E = cpu.E; s.H = cpu.H; s.L = cpu.L;
+    s.SP = cpu.SP; s.PC = cpu.PC;
+    s.flags.psw = cpu.flags.psw;
+    s.memory.copyFrom(cpu.memory);
+    s.halted = cpu.halted;
+    s.interruptEnabled = cpu.interruptEnabled;
+    s.interrupts = cpu.interrupts;
+    s.cycles = cpu.cycles;
+}
+
+bool JitCompiler::checkShadow(const CPU8085& cpu, uint16_t blockStart) {
+    CPU8085& s = *shadow;
+    // The engine alone: interrupts and events are run()'s business
+    if (cpu.cycles > s.cycles) {
+        s.exitRun = false;
+        s.runStart = s.cycles;
+        s.runSwitch(cpu.cycles - s.cycles);
+    }
+
+    bool same = cpu.A == s.A && cpu.B == s.B && cpu.C == s.C && cpu.D == s.D &&
+                cpu.E == s.E && cpu.H == s.H && cpu.L == s.L &&
+                cpu.SP == s.SP && cpu.PC == s.PC && cpu.flags.psw == s.flags.psw &&
+                cpu.cycles == s.cycles && cpu.halted == s.halted &&
+                cpu.interruptEnabled == s.interruptEnabled;
+    int32_t diff = cpu.memory.firstDifference(s.memory);
+    if (same && diff < 0) return true;
+
+    auto state = [](const CPU8085& c) {
+        std::string text = c.getRegisterState();
+        std::replace(text.begin(), text.end(), '\n', ' ');
+        return text;
+    };
+    std::ostringstream oss;
+    oss << std::hex << std::uppercase << std::setfill('0')
+        << "JIT block at " << std::setw(4) << blockStart << "h diverged from the interpreter\n"
+        << "  jit:         " << state(cpu) << " PSW:" << std::setw(2) << (int)cpu.flags.psw
+        << std::dec << " T:" << cpu.cycles << "\n" << std::hex
+        << "  interpreter: " << state(s) << " PSW:" << std::setw(2) << (int)s.flags.psw
+        << std::dec << " T:" << s.cycles;
+    if (diff >= 0) {
+        uint16_t address = static_cast<uint16_t>(diff);
+        oss << std::hex << "\n  memory " << std::setw(4) << address << "h: jit "
+            << std::setw(2) << (int)cpu.memory[address] << ", interpreter "
+            << std::setw(2) << (int)s.memory[address];
+    }
+    verifyMessage = oss.str();
+    return false;
+}
+
+#else // !CPU8085_JIT
+
+// No JIT on this platform: CPU8085 falls back to the predecoded engine and
+// never calls run()
+JitCompiler::JitCompiler(const CPU8085&)
+    : code(nullptr), codeEnd(nullptr), cursor(nullptr), exitSpill(nullptr),
+      exitLookup(nullptr), smcExit(nullptr), enter(nullptr), verify(false) {}
+JitCompiler::~JitCompiler() {}
+uint64_t JitCompiler::run(CPU8085&, uint64_t) { return 0; }
+void JitCompiler::invalidatePage(uint8_t) {}
+void JitCompiler::flush() {}
+void JitCompiler::setVerify(bool enabled) { verify = enabled; }
+
+#endif // CPU8085_JIT
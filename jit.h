@@ -0,0 +1,114 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstdint>
+#include <array>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "cpu8085.h"
+
+// JIT engine: basic blocks that run often are compiled to x86-64 machine code.
+//
+// Guest state lives in host registers while compiled code runs:
+//   al = A, ah = PSW (the 8085 flag layout matches x86 LAHF bit for bit),
+//   ch/cl = B/C, dh/dl = D/E, bh/bl = H/L, r13w = SP, edi = PC at block exits,
+//   r12 = cycles, r14 = cycle target, rbp = the CPU8085 object,
+//   r15 = guest memory (the JIT switches memory to flat mode).
+// Blocks jump straight into each other ("chaining"): static exits are patched
+// to the target block once it exists, and dynamic exits (RET, PCHL) look the
+// target up in a table without leaving compiled code. Every block entry checks
+// that the whole block fits in the remaining cycle budget, so run() stops on
+// the same instruction as the interpreters.
+//
+// Instructions without a native translation call the interpreter's micro-op
+// from compiled code. Code that has not run kHotThreshold times yet is
+// interpreted. Stores to pages holding compiled code drop the blocks on that
+// page and leave compiled code before the next instruction.
+//
+// Verification mode replays every block on a Switch-engine copy of the CPU
+// and compares registers, flags, cycles and memory afterwards. run() stops at
+// the first difference and verifyError() describes it. The copy has no port
+// devices, so programs that read mapped ports will show differences.
+class JitCompiler {
+public:
+    explicit JitCompiler(const CPU8085& cpu);
+    ~JitCompiler();
+
+    // False when executable memory could not be mapped
+    bool available() const { return code != nullptr; }
+
+    // Same contract as CPU8085::run()
+    uint64_t run(CPU8085& cpu, uint64_t cycleBudget);
+
+    void invalidatePage(uint8_t page);
+    void flush();
+
+    void setVerify(bool enabled);
+    bool verifying() const { return verify; }
+    const std::string& verifyError() const { return verifyMessage; }
+
+    size_t blockCount() const { return blocks.size(); }
+
+private:
+    static const int kMaxBlockOps = 32;
+    static const int kHotThreshold = 8;
+    static const size_t kCodeSize = 8 << 20;
+    static const size_t kMaxBlockBytes = 64 << 10;  // Flush when less is left
+
+    using EnterFn = void (*)(CPU8085* cpu, uint64_t target, const uint8_t* entry);
+
+    struct Block {
+        uint16_t start;
+        uint16_t maxCycles;  // T-states if every conditional is taken
+        uint8_t* entry;
+        bool valid;
+    };
+
+    // A patchable jmp rel32 leaving a block for a known address
+    struct Exit {
+        uint8_t* site;  // The rel32 field
+        uint16_t target;
+        int32_t block;
+    };
+
+    // Field offsets from the CPU8085 object, which compiled code reaches via rbp
+    struct Layout {
+        int32_t a, b, c, d, e, h, l, sp, pc, psw, cycles, flatMemory, codePages, leaveBlock, writtenPages;
+    };
+
+    uint8_t* code;
+    uint8_t* codeEnd;
+    uint8_t* cursor;
+    uint8_t* exitSpill;   // Stores host registers into the CPU and returns
+    uint8_t* exitLookup;  // Jumps to the block at edi, else exitSpill
+    uint8_t* smcExit;     // Invalidates esi..esi+r8d, then exitSpill
+    EnterFn enter;
+    Layout layout;
+
+    std::vector<Block> blocks;
+    std::vector<Exit> exits;
+    std::vector<int32_t> blockAt;     // Start address -> block index, -1 if none
+    std::vector<uint8_t*> entries;    // Start address -> native entry, read by exitLookup
+    std::vector<uint8_t> heat;
+    std::unordered_map<uint16_t, std::vector<uint32_t>> exitsTo;
+    std::array<std::vector<int32_t>, 256> pageBlocks;
+
+    bool verify;
+    std::unique_ptr<CPU8085> shadow;
+    std::string verifyMessage;
+
+    struct Translator;
+    friend struct Translator;
+
+    void emitStubs();
+    int32_t compile(CPU8085& cpu, uint16_t address);
+    void link(uint32_t exitIndex);
+    void syncShadow(const CPU8085& cpu);
+    bool checkShadow(const CPU8085& cpu, uint16_t blockStart);
+
+    static void storeHit(CPU8085& cpu, uint16_t address, int count);
+};
+
+#endif // JIT_H
@@ -0,0 +1,198 @@
+#include "loader.h"
+#include "assembler.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+LoadResult fail(const std::string& message) {
+    LoadResult result;
+    result.error = message;
+    return result;
+}
+
+int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+bool parseHexByte(const char* line, size_t size, size_t pos, uint8_t& out) {
+    if (pos + 1 >= size) return false;
+    int hi = hexDigit(line[pos]);
+    int lo = hexDigit(line[pos + 1]);
+    if (hi < 0 || lo < 0) return false;
+    out = static_cast<uint8_t>((hi << 4) | lo);
+    return true;
+}
+
+void noteWrite(LoadResult& result, uint16_t address) {
+    if (result.bytesLoaded == 0) {
+        result.lowAddress = result.highAddress = address;
+    } else {
+        result.lowAddress = std::min(result.lowAddress, address);
+        result.highAddress = std::max(result.highAddress, address);
+    }
+    result.bytesLoaded++;
+}
+
+// Closes the file when the loader returns
+struct InputFile {
+    std::FILE* file;
+    explicit InputFile(const std::string& path, const char* mode) : file(std::fopen(path.c_str(), mode)) {}
+    ~InputFile() {
+        if (file) std::fclose(file);
+    }
+};
+
+} // namespace
+
+// Both loaders stream the file through a fixed buffer, so an image costs no
+// more memory than the block being copied
+template <class Cpu>
+LoadResult loadBinaryFile(Cpu& cpu, const std::string& path, uint16_t origin) {
+    InputFile in(path, "rb");
+    if (!in.file) return fail("cannot open " + path);
+
+    LoadResult result;
+    uint8_t chunk[4096];
+    size_t count;
+    uint32_t address = origin;
+    while ((count = std::fread(chunk, 1, sizeof(chunk), in.file)) > 0) {
+        if (address + count > 0x10000u) return fail(path + ": image does not fit in memory at origin");
+        for (size_t i = 0; i < count; i++, address++) {
+            cpu.setMemory(static_cast<uint16_t>(address), chunk[i]);
+            noteWrite(result, static_cast<uint16_t>(address));
+        }
+    }
+    if (std::ferror(in.file)) return fail("cannot read " + path);
+    result.ok = true;
+    return result;
+}
+
+template <class Cpu>
+LoadResult loadIntelHexFile(Cpu& cpu, const std::string& path) {
+    InputFile in(path, "rb");
+    if (!in.file) return fail("cannot open " + path);
+
+    LoadResult result;
+    uint32_t segmentBase = 0;
+    // The longest record is 521 characters; anything longer is an error
+    char line[600];
+    size_t lineNumber = 0;
+    bool sawEnd = false;
+
+    while (std::fgets(line, sizeof(line), in.file)) {
+        lineNumber++;
+        size_t size = std::strlen(line);
+        auto bad = [&](const char* what) { return fail(path + ":" + std::to_string(lineNumber) + ": " + what); };
+        if (size == sizeof(line) - 1 && line[size - 1] != '\n') return bad("record too long");
+        // Tolerate CRLF files and blank lines
+        while (size > 0 && std::isspace(static_cast<unsigned char>(line[size - 1]))) size--;
+        if (size == 0) continue;
+
+        if (line[0] != ':') return bad("record does not start with ':'");
+
+        uint8_t count, addrHi, addrLo, type;
+        if (!parseHexByte(line, size, 1, count) || !parseHexByte(line, size, 3, addrHi) ||
+            !parseHexByte(line, size, 5, addrLo) || !parseHexByte(line, size, 7, type)) {
+            return bad("malformed record header");
+        }
+        if (size != 11u + count * 2u) return bad("record length mismatch");
+
+        uint8_t sum = count + addrHi + addrLo + type;
+        uint8_t data[255];
+        for (int i = 0; i < count; i++) {
+            if (!parseHexByte(line, size, 9 + i * 2, data[i])) return bad("bad data byte");
+            sum += data[i];
+        }
+        uint8_t checksum;
+        if (!parseHexByte(line, size, 9 + count * 2, checksum)) return bad("bad checksum field");
+        if (static_cast<uint8_t>(sum + checksum) != 0) return bad("checksum mismatch");
+
+        uint16_t offset = static_cast<uint16_t>((addrHi << 8) | addrLo);
+        switch (type) {
+            case 0x00: // Data
+                for (int i = 0; i < count; i++) {
+                    uint32_t address = segmentBase + offset + i;
+                    if (address > 0xFFFF) return bad("data beyond 64KB address space");
+                    cpu.setMemory(static_cast<uint16_t>(address), data[i]);
+                    noteWrite(result, static_cast<uint16_t>(address));
+                }
+                break;
+            case 0x01: // End of file
+                sawEnd = true;
+                break;
+            case 0x02: // Extended segment address
+                if (count != 2) return bad("bad extended segment record");
+                segmentBase = ((data[0] << 8) | data[1]) << 4;
+                break;
+            case 0x04: // Extended linear address
+                if (count != 2) return bad("bad extended linear record");
+                segmentBase = static_cast<uint32_t>((data[0] << 8) | data[1]) << 16;
+                break;
+            case 0x03: // Start segment address (CS:IP)
+            case 0x05: // Start linear address
+                if (count != 4) return bad("bad start address record");
+                result.hasStartAddress = true;
+                result.startAddress = static_cast<uint16_t>((data[2] << 8) | data[3]);
+                break;
+            default:
+                return bad("unknown record type");
+        }
+        if (sawEnd) break;
+    }
+
+    if (!sawEnd) return fail(path + ": missing end-of-file record");
+    result.ok = true;
+    return result;
+}
+
+template <class Cpu>
+LoadResult loadAssemblyFile(Cpu& cpu, const std::string& path, uint16_t origin) {
+    Assembler assembler;
+    assembler.origin = origin;
+    AssembledProgram program;
+    if (!assembler.assembleFile(path, program)) {
+        std::string errors = program.errorText(path);
+        errors.pop_back();  // The caller ends the message
+        return fail(errors);
+    }
+    program.loadInto(cpu);
+    LoadResult result;
+    result.ok = true;
+    result.lowAddress = program.lowAddress();
+    result.highAddress = program.highAddress();
+    result.bytesLoaded = program.bytes.size();
+    result.hasStartAddress = program.hasStart;
+    result.startAddress = program.start;
+    return result;
+}
+
+template <class Cpu>
+LoadResult loadImageFile(Cpu& cpu, const std::string& path, uint16_t origin) {
+    std::string ext;
+    size_t dot = path.find_last_of('.');
+    if (dot != std::string::npos) {
+        ext = path.substr(dot + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    }
+    if (ext == "hex" || ext == "ihx" || ext == "ihex") {
+        return loadIntelHexFile(cpu, path);
+    }
+    if (ext == "asm" || ext == "s" || ext == "a85") {
+        return loadAssemblyFile(cpu, path, origin);
+    }
+    return loadBinaryFile(cpu, path, origin);
+}
+
+#define LOADER_INSTANTIATE(...) \
+    template LoadResult loadBinaryFile(BasicCPU8085<__VA_ARGS__>&, const std::string&, uint16_t); \
+    template LoadResult loadIntelHexFile(BasicCPU8085<__VA_ARGS__>&, const std::string&); \
+    template LoadResult loadAssemblyFile(BasicCPU8085<__VA_ARGS__>&, const std::string&, uint16_t); \
+    template LoadResult loadImageFile(BasicCPU8085<__VA_ARGS__>&, const std::string&, uint16_t);
+CPU8085_SPECIALIZATIONS(LOADER_INSTANTIATE)
+#undef LOADER_INSTANTIATE
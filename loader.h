@@ -0,0 +1,39 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <cstdint>
+#include <string>
+#include "cpu8085.h"
+
+// Result of loading an image into CPU memory
+struct LoadResult {
+    bool ok = false;
+    std::string error;      // Set when ok is false
+    uint16_t lowAddress = 0;  // Lowest address written
+    uint16_t highAddress = 0; // Highest address written
+    size_t bytesLoaded = 0;
+    bool hasStartAddress = false; // Intel HEX type 03/05 record, or END's operand
+    uint16_t startAddress = 0;
+};
+
+// Loaders are instantiated for every entry of CPU8085_SPECIALIZATIONS
+
+// Raw binary image, copied to memory starting at origin
+template <class Cpu>
+LoadResult loadBinaryFile(Cpu& cpu, const std::string& path, uint16_t origin = 0x0000);
+
+// Intel HEX image (record types 00-05, checksums verified)
+template <class Cpu>
+LoadResult loadIntelHexFile(Cpu& cpu, const std::string& path);
+
+// 8085 assembly source (assembler.h), assembled from origin up to its first
+// ORG; every error is in the message, one per line
+template <class Cpu>
+LoadResult loadAssemblyFile(Cpu& cpu, const std::string& path, uint16_t origin = 0x0000);
+
+// Picks the loader from the file extension (.hex/.ihx/.ihex are Intel HEX,
+// .asm/.s/.a85 assembly)
+template <class Cpu>
+LoadResult loadImageFile(Cpu& cpu, const std::string& path, uint16_t origin = 0x0000);
+
+#endif // LOADER_H
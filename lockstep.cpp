@@ -0,0 +1,471 @@
+#include "lockstep.h"
+#include "cpu8085.h"
+#include "opcodes.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <type_traits>
+
+namespace {
+
+// Steps per kernel call; between calls run() flushes the 16-bit T-state
+// countdowns, checks the clock and regroups. At 18 T-states a step a
+// countdown started at kMaxBudget stays positive.
+const uint64_t kStepsPerCall = 1024;
+const uint16_t kMaxBudget = 0x7FFF;
+
+const uint8_t zeroPage[256] = {};
+
+// Kernel calls a running lane may go without executing anything before the
+// next call runs only such lanes. Lowest PC first would otherwise leave lanes
+// that branched ahead of one stuck in a loop waiting until the time limit.
+const uint8_t kStarvedCalls = 64;
+
+// Opcodes that touch memory, the stack or the interrupt unit, done one lane
+// at a time (Rcc and Ccc work out their own lanes)
+constexpr bool byLane(uint8_t opcode) {
+    if (opcode >= 0x40 && opcode < 0xC0) return opcode != 0x76 && ((opcode & 7) == 6 || (opcode & 0xF8) == 0x70);
+    switch (opcode) {
+        case 0x02: case 0x0A: case 0x12: case 0x1A:  // STAX, LDAX
+        case 0x20: case 0x30:                        // RIM, SIM
+        case 0x22: case 0x2A: case 0x32: case 0x3A:  // SHLD, LHLD, STA, LDA
+        case 0x34: case 0x35: case 0x36:             // INR M, DCR M, MVI M
+        case 0xC1: case 0xD1: case 0xE1: case 0xF1:  // POP
+        case 0xC5: case 0xD5: case 0xE5: case 0xF5:  // PUSH
+        case 0xC9: case 0xCD: case 0xE3:             // RET, CALL, XTHL
+            return true;
+        default:
+            return (opcode & 0xC7) == 0xC7;  // RST
+    }
+}
+
+#if !CPU8085_LOCKSTEP_SIMD
+// kWidth lanes of T, for compilers without vector extensions. Comparisons
+// give masks of the signed type, all ones where true.
+template <class T>
+struct Pack {
+    T lane[LockstepCPU8085::kWidth];
+};
+
+template <class T> using MaskOf = Pack<typename std::make_signed<T>::type>;
+
+template <class To, class From> To packConvert(From v) {
+    To result;
+    for (size_t k = 0; k < LockstepCPU8085::kWidth; k++) {
+        result.lane[k] = static_cast<typename std::remove_reference<decltype(result.lane[0])>::type>(v.lane[k]);
+    }
+    return result;
+}
+
+template <class T> Pack<T> packSplat(T x) {
+    Pack<T> result;
+    for (T& lane : result.lane) lane = x;
+    return result;
+}
+
+#define PACK_OPERATOR(op) \
+    template <class T> Pack<T> operator op(Pack<T> a, Pack<T> b) { \
+        for (size_t k = 0; k < LockstepCPU8085::kWidth; k++) a.lane[k] = static_cast<T>(a.lane[k] op b.lane[k]); \
+        return a; \
+    } \
+    template <class T, class S, class = typename std::enable_if<std::is_arithmetic<S>::value>::type> \
+    Pack<T> operator op(Pack<T> a, S b) { return a op packSplat<T>(static_cast<T>(b)); } \
+    template <class T, class S> Pack<T>& operator op##=(Pack<T>& a, S b) { return a = a op b; }
+PACK_OPERATOR(+)
+PACK_OPERATOR(-)
+PACK_OPERATOR(&)
+PACK_OPERATOR(|)
+PACK_OPERATOR(^)
+PACK_OPERATOR(<<)
+PACK_OPERATOR(>>)
+#undef PACK_OPERATOR
+
+#define PACK_COMPARE(op) \
+    template <class T> MaskOf<T> operator op(Pack<T> a, Pack<T> b) { \
+        MaskOf<T> result; \
+        for (size_t k = 0; k < LockstepCPU8085::kWidth; k++) result.lane[k] = a.lane[k] op b.lane[k] ? -1 : 0; \
+        return result; \
+    } \
+    template <class T, class S, class = typename std::enable_if<std::is_arithmetic<S>::value>::type> \
+    MaskOf<T> operator op(Pack<T> a, S b) { return a op packSplat<T>(static_cast<T>(b)); }
+PACK_COMPARE(==)
+PACK_COMPARE(!=)
+PACK_COMPARE(<)
+PACK_COMPARE(<=)
+PACK_COMPARE(>)
+PACK_COMPARE(>=)
+#undef PACK_COMPARE
+
+template <class T> Pack<T> operator~(Pack<T> a) {
+    for (T& lane : a.lane) lane = static_cast<T>(~lane);
+    return a;
+}
+#endif
+
+} // namespace
+
+// The slots of a LockstepCPU8085 as the kernels see them
+struct LaneArrays {
+    // The instruction a step runs, read from the leader's memory
+    struct Group {
+        uint16_t pc;
+        uint8_t bytes[3];
+        int length;
+        uint16_t operand;
+        bool byLane;
+        // Some lane has its own copy of a page holding the instruction, so
+        // lanes whose page is not the leader's compare the bytes
+        bool checkCode;
+        uint8_t pages[2];
+        const uint8_t* code[2];
+    };
+
+    uint8_t* reg[8];
+    uint8_t* psw;
+    uint16_t* sp;
+    uint8_t* pcLow;
+    uint8_t* pcHigh;
+    uint16_t* left;
+    uint8_t* running;
+    uint8_t* exits;
+    uint8_t* ie;
+    InterruptUnit* interrupts;
+    LaneMemory* memory;
+    uint32_t* chunkMin;
+    size_t chunks;
+    uint64_t laneInstructions;
+
+    explicit LaneArrays(LockstepCPU8085& cpu)
+        : psw(cpu.psw.data()), sp(cpu.SP.data()), pcLow(cpu.pcLow.data()), pcHigh(cpu.pcHigh.data()),
+          left(cpu.left.data()), running(cpu.running.data()), exits(cpu.exits.data()),
+          ie(cpu.interruptEnabled.data()), interrupts(cpu.interrupts.data()), memory(&cpu.memory),
+          chunkMin(cpu.chunkMin.data()), chunks(cpu.width / LockstepCPU8085::kWidth), laneInstructions(0) {
+        for (int r = 0; r < 8; r++) reg[r] = cpu.registers[r].data();
+    }
+
+    uint16_t pcAt(size_t s) const { return static_cast<uint16_t>(pcHigh[s] << 8 | pcLow[s]); }
+    void setPc(size_t s, uint16_t value) {
+        pcLow[s] = static_cast<uint8_t>(value);
+        pcHigh[s] = static_cast<uint8_t>(value >> 8);
+    }
+    // BC, DE or HL by pair field
+    uint16_t pairAt(int field, size_t s) const {
+        return static_cast<uint16_t>(reg[field * 2][s] << 8 | reg[field * 2 + 1][s]);
+    }
+};
+
+namespace {
+
+// Baseline vectors are 16 bytes wide (SSE2 on x86-64, NEON on ARM64)
+#if CPU8085_LOCKSTEP_SIMD
+#define LOCKSTEP_VECTOR_BYTES 16
+#else
+#define LOCKSTEP_VECTOR_BYTES 0
+#endif
+namespace generic {
+#include "lockstep_kernels.inc"
+} // namespace generic
+#undef LOCKSTEP_VECTOR_BYTES
+
+#if CPU8085_LOCKSTEP_AVX2
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define LOCKSTEP_VECTOR_BYTES 32
+namespace avx2 {
+#include "lockstep_kernels.inc"
+} // namespace avx2
+#undef LOCKSTEP_VECTOR_BYTES
+#pragma GCC pop_options
+#endif
+
+using Kernel = uint64_t (*)(LaneArrays&, uint64_t);
+
+bool hasAvx2() {
+#if CPU8085_LOCKSTEP_AVX2
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+Kernel kernel() {
+#if CPU8085_LOCKSTEP_AVX2
+    static const Kernel chosen = hasAvx2() ? avx2::runSteps : generic::runSteps;
+    return chosen;
+#else
+    return generic::runSteps;
+#endif
+}
+
+} // namespace
+
+LaneMemory::LaneMemory() : imagePages(kPages, zeroPage), laneCount(0), used(0), privateCount(kPages, 0) {
+}
+
+void LaneMemory::setLanes(size_t lanes) {
+    laneCount = lanes;
+    pages.assign(lanes * kPages, nullptr);
+    reset();
+}
+
+void LaneMemory::setImage(std::shared_ptr<const MemoryImage> newImage) {
+    image = std::move(newImage);
+    for (int index = 0; index < kPages; index++) {
+        const uint8_t* page = image ? image->page(static_cast<uint8_t>(index)) : nullptr;
+        imagePages[index] = page ? page : zeroPage;
+    }
+    reset();
+}
+
+void LaneMemory::reset() {
+    for (int index = 0; index < kPages; index++) {
+        std::fill(pages.begin() + index * laneCount, pages.begin() + (index + 1) * laneCount, imagePages[index]);
+    }
+    used = 0;
+    std::fill(privateCount.begin(), privateCount.end(), 0);
+}
+
+const uint8_t* LaneMemory::copyOnWrite(uint8_t index) {
+    if (used == pool.size()) pool.emplace_back(new uint8_t[kPages]);
+    uint8_t* page = pool[used++].get();
+    std::memcpy(page, imagePages[index], kPages);
+    privateCount[index]++;
+    return page;
+}
+
+void LaneMemory::swapLanes(size_t a, size_t b) {
+    for (int index = 0; index < kPages; index++) std::swap(pages[index * laneCount + a], pages[index * laneCount + b]);
+}
+
+LockstepCPU8085::LockstepCPU8085(size_t lanes) : laneCount(0), width(0), start(0x0000) {
+    setLanes(lanes);
+}
+
+LockstepCPU8085::~LockstepCPU8085() = default;
+
+void LockstepCPU8085::setLanes(size_t lanes) {
+    laneCount = lanes;
+    size_t slots = (lanes + kWidth - 1) / kWidth * kWidth;
+    for (std::vector<uint8_t>& r : registers) r.assign(slots, 0);
+    psw.assign(slots, 0);
+    SP.assign(slots, 0);
+    pcLow.assign(slots, 0);
+    pcHigh.assign(slots, 0);
+    cycles.assign(slots, 0);
+    limit.assign(slots, 0);
+    budget.assign(slots, 0);
+    left.assign(slots, 0);
+    running.assign(slots, 0);
+    waited.assign(slots, 0);
+    parked.assign(slots, 0);
+    exits.assign(slots, 0);
+    interruptEnabled.assign(slots, 0);
+    interrupts.assign(slots, InterruptUnit());
+    slotLane.assign(slots, 0);
+    laneSlot.assign(lanes, 0);
+    chunkMin.assign(slots / kWidth, 0x10000);
+    memory.setLanes(slots);
+    reset();
+}
+
+void LockstepCPU8085::setImage(std::shared_ptr<const MemoryImage> image, uint16_t startAddress) {
+    memory.setImage(std::move(image));
+    start = startAddress;
+    reset();
+}
+
+void LockstepCPU8085::reset() {
+    width = SP.size();
+    for (size_t slot = 0; slot < width; slot++) {
+        for (std::vector<uint8_t>& r : registers) r[slot] = 0;
+        psw[slot] = CPU8085Base::Flags::ALWAYS_ONE;
+        SP[slot] = 0xFFFF;
+        pcLow[slot] = static_cast<uint8_t>(start);
+        pcHigh[slot] = static_cast<uint8_t>(start >> 8);
+        cycles[slot] = 0;
+        limit[slot] = UINT64_MAX;
+        budget[slot] = 0;
+        left[slot] = 0;
+        // Padding slots past the last lane never run
+        running[slot] = slot < laneCount ? 0xFF : 0x00;
+        waited[slot] = 0;
+        parked[slot] = 0;
+        exits[slot] = static_cast<uint8_t>(slot < laneCount ? Exit::Running : Exit::Halted);
+        interruptEnabled[slot] = 0;
+        interrupts[slot].reset();
+        slotLane[slot] = static_cast<uint32_t>(slot);
+        if (slot < laneCount) laneSlot[slot] = static_cast<uint32_t>(slot);
+    }
+    memory.reset();
+    statistics = Stats();
+}
+
+void LockstepCPU8085::setMemory(size_t lane, uint16_t address, uint8_t value) {
+    memory.write(laneSlot[lane], address, value);
+}
+
+uint8_t LockstepCPU8085::getMemory(size_t lane, uint16_t address) const {
+    return memory.read(laneSlot[lane], address);
+}
+
+void LockstepCPU8085::readMemory(size_t lane, uint16_t address, uint8_t* out, size_t size) const {
+    for (size_t i = 0; i < size; i++) out[i] = memory.read(laneSlot[lane], static_cast<uint16_t>(address + i));
+}
+
+void LockstepCPU8085::setCycleLimit(size_t lane, uint64_t maxCycles) {
+    limit[laneSlot[lane]] = maxCycles;
+}
+
+void LockstepCPU8085::run(double maxSeconds) {
+    using Clock = std::chrono::steady_clock;
+    auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(maxSeconds));
+
+    flush();
+    findChunkMins();
+    Kernel runSteps = kernel();
+    for (;;) {
+        LaneArrays arrays(*this);
+        uint64_t steps = runSteps(arrays, kStepsPerCall);
+        statistics.steps += steps;
+        statistics.laneInstructions += arrays.laneInstructions;
+        age();
+        bool resumed = unpark();
+        flush();
+        // Out of running lanes, unless the call only had the starved ones
+        if (steps < kStepsPerCall && !resumed) break;
+        if (maxSeconds > 0.0 && Clock::now() >= deadline) {
+            for (size_t slot = 0; slot < width; slot++) {
+                if (!running[slot]) continue;
+                running[slot] = 0;
+                exits[slot] = static_cast<uint8_t>(Exit::TimeLimit);
+            }
+            break;
+        }
+        regroup();
+        if (parkAllButStarved() || resumed) findChunkMins();
+    }
+}
+
+// Counts the kernel calls each running lane went without executing; before
+// flush(), which clears what the call spent
+void LockstepCPU8085::age() {
+    for (size_t slot = 0; slot < width; slot++) {
+        if (!running[slot]) continue;
+        if (budget[slot] != left[slot]) {
+            waited[slot] = 0;
+        } else if (waited[slot] < kStarvedCalls) {
+            waited[slot]++;
+        }
+    }
+}
+
+// Once some running lane has starved, holds back the others for one call
+bool LockstepCPU8085::parkAllButStarved() {
+    bool starved = false;
+    for (size_t slot = 0; slot < width && !starved; slot++) starved = running[slot] && waited[slot] >= kStarvedCalls;
+    if (!starved) return false;
+    for (size_t slot = 0; slot < width; slot++) {
+        if (!running[slot] || waited[slot] >= kStarvedCalls) continue;
+        running[slot] = 0;
+        parked[slot] = 1;
+    }
+    return true;
+}
+
+bool LockstepCPU8085::unpark() {
+    bool any = false;
+    for (size_t slot = 0; slot < width; slot++) {
+        if (!parked[slot]) continue;
+        parked[slot] = 0;
+        running[slot] = 0xFF;
+        any = true;
+    }
+    return any;
+}
+
+// Adds the kernels' T-states to cycles and works out the next budgets;
+// lanes already at their limit stop here
+void LockstepCPU8085::flush() {
+    for (size_t slot = 0; slot < width; slot++) {
+        cycles[slot] += static_cast<uint16_t>(budget[slot] - left[slot]);
+        budget[slot] = left[slot] = 0;
+        if (!running[slot]) continue;
+        if (cycles[slot] >= limit[slot]) {
+            running[slot] = 0;
+            exits[slot] = static_cast<uint8_t>(Exit::CycleLimit);
+        } else {
+            budget[slot] = left[slot] = static_cast<uint16_t>(std::min<uint64_t>(limit[slot] - cycles[slot], kMaxBudget));
+        }
+    }
+}
+
+void LockstepCPU8085::findChunkMins() {
+    for (size_t chunk = 0; chunk < width / kWidth; chunk++) {
+        uint32_t lowest = 0x10000;
+        for (size_t slot = chunk * kWidth; slot < (chunk + 1) * kWidth; slot++) {
+            if (running[slot]) lowest = std::min<uint32_t>(lowest, static_cast<uint32_t>(pcHigh[slot] << 8 | pcLow[slot]));
+        }
+        chunkMin[chunk] = lowest;
+    }
+}
+
+// Once no more than half the slots in use are running, moves the running
+// lanes to the front (keeping their order) and shrinks the slots in use
+void LockstepCPU8085::regroup() {
+    size_t count = static_cast<size_t>(std::count_if(running.begin(), running.begin() + width, [](uint8_t r) { return r; }));
+    if (width <= kWidth || count * 2 > width) return;
+    size_t next = 0;
+    for (size_t slot = 0; slot < width; slot++) {
+        if (running[slot]) swapSlots(next++, slot);
+    }
+    width = count ? (count + kWidth - 1) / kWidth * kWidth : kWidth;
+    findChunkMins();
+    statistics.regroups++;
+}
+
+void LockstepCPU8085::swapSlots(size_t a, size_t b) {
+    if (a == b) return;
+    for (std::vector<uint8_t>& r : registers) std::swap(r[a], r[b]);
+    std::swap(psw[a], psw[b]);
+    std::swap(SP[a], SP[b]);
+    std::swap(pcLow[a], pcLow[b]);
+    std::swap(pcHigh[a], pcHigh[b]);
+    std::swap(cycles[a], cycles[b]);
+    std::swap(limit[a], limit[b]);
+    std::swap(budget[a], budget[b]);
+    std::swap(left[a], left[b]);
+    std::swap(running[a], running[b]);
+    std::swap(waited[a], waited[b]);
+    std::swap(parked[a], parked[b]);
+    std::swap(exits[a], exits[b]);
+    std::swap(interruptEnabled[a], interruptEnabled[b]);
+    std::swap(interrupts[a], interrupts[b]);
+    memory.swapLanes(a, b);
+    std::swap(slotLane[a], slotLane[b]);
+    if (slotLane[a] < laneCount) laneSlot[slotLane[a]] = static_cast<uint32_t>(a);
+    if (slotLane[b] < laneCount) laneSlot[slotLane[b]] = static_cast<uint32_t>(b);
+}
+
+LockstepCPU8085::Lane LockstepCPU8085::lane(size_t index) const {
+    size_t slot = laneSlot[index];
+    Lane result;
+    result.A = registers[7][slot];
+    result.B = registers[0][slot];
+    result.C = registers[1][slot];
+    result.D = registers[2][slot];
+    result.E = registers[3][slot];
+    result.H = registers[4][slot];
+    result.L = registers[5][slot];
+    result.psw = psw[slot];
+    result.SP = SP[slot];
+    result.PC = static_cast<uint16_t>(pcHigh[slot] << 8 | pcLow[slot]);
+    result.cycles = cycles[slot] + static_cast<uint16_t>(budget[slot] - left[slot]);
+    result.interruptEnabled = interruptEnabled[slot] != 0;
+    result.exit = static_cast<Exit>(exits[slot]);
+    return result;
+}
+
+const char* LockstepCPU8085::kernelName() {
+    if (hasAvx2()) return "avx2";
+    return CPU8085_LOCKSTEP_SIMD ? "vector" : "scalar";
+}
@@ -0,0 +1,189 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "guestmemory.h"
+#include "interrupts.h"
+
+// Lane kernels use GCC/Clang vector extensions; elsewhere they fall back to
+// plain loops over the lanes of a group
+#ifndef CPU8085_LOCKSTEP_SIMD
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU8085_LOCKSTEP_SIMD 1
+#else
+#define CPU8085_LOCKSTEP_SIMD 0
+#endif
+#endif
+
+// A second copy of the kernels built for AVX2, picked at run time on CPUs
+// that have it (needs GCC's target pragma)
+#ifndef CPU8085_LOCKSTEP_AVX2
+#if CPU8085_LOCKSTEP_SIMD && defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define CPU8085_LOCKSTEP_AVX2 1
+#else
+#define CPU8085_LOCKSTEP_AVX2 0
+#endif
+#endif
+
+// Guest memory of many lanes over one shared image. A lane's page table
+// points into the image until the lane first writes a page, which then gets
+// a private copy from a pool kept across resets; a lane costs 2KB plus the
+// pages it wrote. All pages are RAM. The tables are stored page by page, so
+// lanes reading the same page at once look at neighbouring entries.
+class LaneMemory {
+public:
+    LaneMemory();
+    LaneMemory(const LaneMemory&) = delete;
+    LaneMemory& operator=(const LaneMemory&) = delete;
+
+    // Both drop every private page
+    void setLanes(size_t lanes);
+    void setImage(std::shared_ptr<const MemoryImage> image);
+    // Every lane back to the image
+    void reset();
+
+    uint8_t read(size_t lane, uint16_t address) const {
+        return pages[(address >> 8) * laneCount + lane][address & 0xFF];
+    }
+    void write(size_t lane, uint16_t address, uint8_t value) {
+        const uint8_t*& page = pages[(address >> 8) * laneCount + lane];
+        if (page == imagePages[address >> 8]) page = copyOnWrite(address >> 8);
+        const_cast<uint8_t*>(page)[address & 0xFF] = value;
+    }
+    const uint8_t* page(size_t lane, uint8_t index) const { return pages[index * laneCount + lane]; }
+    // Lanes holding a private copy of the page
+    uint32_t privateLanes(uint8_t index) const { return privateCount[index]; }
+    size_t privatePages() const { return used; }
+
+    void swapLanes(size_t a, size_t b);
+
+private:
+    static const int kPages = 256;
+
+    std::shared_ptr<const MemoryImage> image;
+    std::vector<const uint8_t*> imagePages;  // The image's pages, zeros where it has none
+    size_t laneCount;
+    std::vector<const uint8_t*> pages;       // laneCount per page
+    std::vector<std::unique_ptr<uint8_t[]>> pool;
+    size_t used;
+    std::vector<uint32_t> privateCount;
+
+    const uint8_t* copyOnWrite(uint8_t index);
+};
+
+// Many copies of one program run side by side, such as a grader's test
+// vectors. Registers and flags of all lanes are kept as arrays (structure of
+// arrays), and each step executes one instruction for every lane at the same
+// PC with vector kernels 32 lanes wide. Lanes elsewhere are masked off: the
+// lowest PC among running lanes goes first, so lanes that branched ahead
+// wait for the others to catch up. Lanes kept waiting for some 64K steps get
+// a turn to themselves, so one lane looping below the rest cannot hold them
+// until a time limit. Once half the lanes have stopped, the running ones are
+// moved together so steps stop paying for finished lanes.
+//
+// Every lane ends exactly as CPU8085 would running the same program with
+// the same memory and cycle limit. There are no devices: IN reads FFh, OUT
+// is ignored, no interrupt is ever requested and a lane stops at HLT.
+// A lane whose copy of the code at PC differs from the group's (self-
+// modifying code) is left for a step of its own.
+class LockstepCPU8085 {
+public:
+    static const size_t kWidth = 32;  // Lanes per vector operation
+
+    enum class Exit : uint8_t {
+        Running,
+        Halted,
+        CycleLimit,
+        TimeLimit,
+    };
+
+    struct Lane {
+        uint8_t A, B, C, D, E, H, L;
+        uint8_t psw;
+        uint16_t SP, PC;
+        uint64_t cycles;
+        bool interruptEnabled;
+        Exit exit;
+    };
+
+    struct Stats {
+        uint64_t steps = 0;             // Instructions issued to a group
+        uint64_t laneInstructions = 0;  // Instructions executed by all lanes
+        uint64_t regroups = 0;          // Running lanes moved together
+        // Average lanes per step
+        double lanesPerStep() const { return steps ? double(laneInstructions) / steps : 0.0; }
+    };
+
+    explicit LockstepCPU8085(size_t lanes = 0);
+    ~LockstepCPU8085();
+    LockstepCPU8085(const LockstepCPU8085&) = delete;
+    LockstepCPU8085& operator=(const LockstepCPU8085&) = delete;
+
+    // Changing the lane count or image resets every lane
+    void setLanes(size_t lanes);
+    size_t lanes() const { return laneCount; }
+    void setImage(std::shared_ptr<const MemoryImage> image, uint16_t start = 0x0000);
+
+    // Every lane to CPU8085::reset() state with PC at the start address,
+    // memory back to the image and no cycle limit
+    void reset();
+    void setMemory(size_t lane, uint16_t address, uint8_t value);
+    uint8_t getMemory(size_t lane, uint16_t address) const;
+    void readMemory(size_t lane, uint16_t address, uint8_t* out, size_t size) const;
+    // The lane stops once it has run this many T-states (may overrun by up
+    // to one instruction, like CPU8085::run)
+    void setCycleLimit(size_t lane, uint64_t maxCycles);
+
+    // Runs until every lane has halted or reached its cycle limit, or until
+    // maxSeconds of wall-clock time have passed (0 = no limit)
+    void run(double maxSeconds = 0.0);
+
+    Lane lane(size_t index) const;
+    const Stats& stats() const { return statistics; }
+
+    // "avx2", "vector" or "scalar": the kernels run() uses on this machine
+    static const char* kernelName();
+
+private:
+    friend struct LaneArrays;
+
+    size_t laneCount;
+    size_t width;  // Slots in use, a multiple of kWidth
+    uint16_t start;
+    LaneMemory memory;
+    Stats statistics;
+
+    // Per slot; slots are lanes until run() moves the running ones together
+    std::vector<uint8_t> registers[8];  // By opcode register field: B C D E H L - A
+    std::vector<uint8_t> psw;
+    std::vector<uint16_t> SP;
+    std::vector<uint8_t> pcLow, pcHigh;  // Byte planes, like the registers
+    std::vector<uint64_t> cycles;
+    std::vector<uint64_t> limit;
+    // T-states the kernels may run before the next flush into cycles (what
+    // is left of the limit, at most 7FFFh) and their countdown of it, so
+    // they count in 16 bits
+    std::vector<uint16_t> budget, left;
+    std::vector<uint8_t> running;  // FFh while running
+    std::vector<uint8_t> waited;   // Kernel calls since the lane last executed
+    std::vector<uint8_t> parked;   // Running but held back for one call
+    std::vector<uint8_t> exits;  // Exit values
+    std::vector<uint8_t> interruptEnabled;
+    std::vector<InterruptUnit> interrupts;
+    std::vector<uint32_t> slotLane, laneSlot;
+    // Lowest PC of each kWidth-slot chunk's running lanes, 10000h for none
+    std::vector<uint32_t> chunkMin;
+
+    void flush();
+    void findChunkMins();
+    void regroup();
+    void age();
+    bool parkAllButStarved();
+    bool unpark();
+    void swapSlots(size_t a, size_t b);
+};
+
+#endif // LOCKSTEP_H
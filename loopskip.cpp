@@ -0,0 +1,223 @@
+#include "loopskip.h"
+#include "opcodes.h"
+#include <algorithm>
+
+namespace {
+
+// Opcodes a loop body may hold besides its jumps: they change registers and
+// flags and read memory, nothing else. IN is further checked for quiet ports.
+struct BodyTable {
+    bool allowed[256];
+};
+
+constexpr BodyTable makeBodyTable() {
+    BodyTable t{};
+    for (int opcode = 0; opcode < 256; opcode++) t.allowed[opcode] = kOpcodes[opcode].flow == ControlFlow::Next;
+    // STAX, SHLD, STA, INR/DCR/MVI M, XTHL, OUT, RIM, SIM, DI, EI
+    const uint8_t excluded[] = {0x02, 0x12, 0x22, 0x32, 0x34, 0x35, 0x36, 0xE3, 0xD3, 0x20, 0x30, 0xF3, 0xFB};
+    for (uint8_t opcode : excluded) t.allowed[opcode] = false;
+    for (int opcode = 0x70; opcode < 0x78; opcode++) t.allowed[opcode] = false;  // MOV M,r
+    for (int pair = 0; pair < 4; pair++) {
+        t.allowed[0xC1 | pair << 4] = false;  // POP
+        t.allowed[0xC5 | pair << 4] = false;  // PUSH
+    }
+    return t;
+}
+
+constexpr BodyTable kBody = makeBodyTable();
+
+bool isJump(uint8_t opcode) {
+    return opcode == 0xC3 || (opcode & 0xC7) == 0xC2;
+}
+
+bool isNop(uint8_t opcode) {
+    return opcode == 0x00 || !kOpcodes[opcode].documented;
+}
+
+// Register field (B C D E H L - A) to the register
+uint8_t& registerAt(CPU8085& cpu, int field) {
+    uint8_t* registers[8] = {&cpu.B, &cpu.C, &cpu.D, &cpu.E, &cpu.H, &cpu.L, nullptr, &cpu.A};
+    return *registers[field];
+}
+
+struct Registers {
+    uint8_t a, b, c, d, e, h, l, psw;
+    uint16_t sp;
+
+    explicit Registers(const CPU8085& cpu)
+        : a(cpu.A), b(cpu.B), c(cpu.C), d(cpu.D), e(cpu.E), h(cpu.H), l(cpu.L),
+          psw(cpu.flags.psw), sp(cpu.SP) {}
+
+    bool operator==(const Registers& o) const {
+        return a == o.a && b == o.b && c == o.c && d == o.d && e == o.e && h == o.h &&
+               l == o.l && psw == o.psw && sp == o.sp;
+    }
+};
+
+} // namespace
+
+uint64_t LoopSkipper::skip(CPU8085& cpu, uint64_t end) {
+    Loop loop;
+    if (!find(cpu, loop)) {
+        interval = std::min(interval * 2, kMaxInterval);
+        return interval;
+    }
+    // Even when this one cannot be skipped (a poll that has just seen its
+    // event, say), it will likely run again soon
+    interval = kMinInterval;
+    if (cpu.PC == loop.head || iterate(cpu, loop, end)) {
+        classify(loop);
+        if (loop.kind == Loop::Kind::FixedPoint) {
+            skipFixedPoint(cpu, loop, end);
+        } else {
+            skipCounter(cpu, loop, end);
+        }
+    }
+    return interval;
+}
+
+bool LoopSkipper::find(const CPU8085& cpu, Loop& loop) {
+    const GuestMemory& memory = cpu.memory;
+    auto target = [&memory](uint32_t address) {
+        return static_cast<uint16_t>(memory.peek(static_cast<uint16_t>(address + 1)) |
+                                     memory.peek(static_cast<uint16_t>(address + 2)) << 8);
+    };
+
+    // Forward from PC to a jump back to PC or before it
+    uint32_t pc = cpu.PC;
+    uint32_t address = pc;
+    bool closed = false;
+    for (int i = 0; i < kMaxInstructions && !closed; i++) {
+        if (address > 0xFFFD) return false;  // Loops do not wrap around
+        uint8_t opcode = memory.peek(static_cast<uint16_t>(address));
+        if (isJump(opcode)) {
+            closed = target(address) <= pc;
+            if (closed) break;
+            if (opcode == 0xC3) return false;
+        } else if (!kBody.allowed[opcode]) {
+            return false;
+        }
+        address += kOpcodes[opcode].length;
+    }
+    if (!closed) return false;
+    loop.head = target(address);
+    loop.end = static_cast<uint16_t>(address);
+
+    // From the head: whole instructions through PC to the end, and only
+    // conditional jumps out of the loop
+    loop.count = 0;
+    loop.portCount = 0;
+    bool passedPc = false;
+    for (address = loop.head; address != loop.end; address += kOpcodes[loop.opcodes[loop.count - 1]].length) {
+        if (address > loop.end || loop.count == kMaxInstructions - 1) return false;
+        passedPc = passedPc || address == pc;
+        uint8_t opcode = memory.peek(static_cast<uint16_t>(address));
+        loop.opcodes[loop.count++] = opcode;
+        if (isJump(opcode)) {
+            uint16_t to = target(address);
+            if (opcode == 0xC3 || (to >= loop.head && to <= loop.end)) return false;
+        } else if (!kBody.allowed[opcode]) {
+            return false;
+        } else if (opcode == 0xDB) {
+            loop.ports[loop.portCount++] = memory.peek(static_cast<uint16_t>(address + 1));
+        }
+    }
+    loop.opcodes[loop.count++] = memory.peek(loop.end);
+    return passedPc || pc == loop.end;
+}
+
+void LoopSkipper::classify(Loop& loop) {
+    loop.kind = Loop::Kind::FixedPoint;
+    uint8_t closing = loop.opcodes[loop.count - 1];
+    if (closing != 0xC2) return;  // JNZ
+
+    uint8_t ops[3];
+    int n = 0;
+    int period = kOpcodes[closing].cycles + kOpcodes[closing].takenCycles;
+    for (int i = 0; i < loop.count - 1; i++) {
+        uint8_t opcode = loop.opcodes[i];
+        period += kOpcodes[opcode].cycles;
+        if (isNop(opcode)) continue;
+        if (n == 3) return;
+        ops[n++] = opcode;
+    }
+    loop.period = period;
+
+    if (n == 1 && (ops[0] & 0xC7) == 0x05 && ops[0] != 0x35) {  // DCR r
+        loop.kind = Loop::Kind::Counter8;
+        loop.counter = (ops[0] >> 3) & 7;
+    } else if (n == 3 && (ops[0] & 0xCF) == 0x0B && ops[0] != 0x3B) {  // DCX B/D/H
+        int pair = (ops[0] >> 4) & 3;
+        int high = pair * 2, low = pair * 2 + 1;
+        bool tested = (ops[1] == (0x78 | high) && ops[2] == (0xB0 | low)) ||  // MOV A,hi; ORA lo
+                      (ops[1] == (0x78 | low) && ops[2] == (0xB0 | high));
+        if (tested) {
+            loop.kind = Loop::Kind::Counter16;
+            loop.counter = pair;
+        }
+    }
+}
+
+bool LoopSkipper::iterate(CPU8085& cpu, const Loop& loop, uint64_t end) {
+    do {
+        if (cpu.cycles >= end || cpu.exitRun) return false;
+        cpu.executeNext();
+        if (cpu.PC == loop.head) return true;
+    } while (cpu.PC > loop.head && cpu.PC <= loop.end);
+    return false;
+}
+
+void LoopSkipper::skipCounter(CPU8085& cpu, const Loop& loop, uint64_t end) {
+    // Iterations left, the one that falls through included
+    uint32_t left;
+    if (loop.kind == Loop::Kind::Counter8) {
+        uint8_t value = registerAt(cpu, loop.counter);
+        left = value ? value : 0x100;
+    } else {
+        uint16_t value = static_cast<uint16_t>(registerAt(cpu, loop.counter * 2) << 8 |
+                                               registerAt(cpu, loop.counter * 2 + 1));
+        left = value ? value : 0x10000;
+    }
+    uint64_t fit = (end - cpu.cycles) / static_cast<uint64_t>(loop.period);
+    uint64_t count = std::min<uint64_t>(left, fit);
+    if (count < 2) return;
+
+    // Only the counter changes from one iteration to the next; the last
+    // iteration runs on the interpreter and leaves A and the flags
+    uint32_t skipped = static_cast<uint32_t>(count - 1);
+    if (loop.kind == Loop::Kind::Counter8) {
+        uint8_t& counter = registerAt(cpu, loop.counter);
+        counter = static_cast<uint8_t>(counter - skipped);
+    } else {
+        uint8_t& high = registerAt(cpu, loop.counter * 2);
+        uint8_t& low = registerAt(cpu, loop.counter * 2 + 1);
+        uint16_t value = static_cast<uint16_t>((high << 8 | low) - skipped);
+        high = static_cast<uint8_t>(value >> 8);
+        low = static_cast<uint8_t>(value);
+    }
+    cpu.cycles += skipped * static_cast<uint64_t>(loop.period);
+    skippedCycles += skipped * static_cast<uint64_t>(loop.period);
+    skips++;
+    iterate(cpu, loop, end);
+}
+
+void LoopSkipper::skipFixedPoint(CPU8085& cpu, const Loop& loop, uint64_t end) {
+    for (int i = 0; i < loop.portCount; i++) {
+        if (!cpu.io.quiet(loop.ports[i])) return;
+    }
+    // An iteration may first have to settle the registers it tests
+    for (int probe = 0; probe < 2; probe++) {
+        Registers before(cpu);
+        uint64_t start = cpu.cycles;
+        if (!iterate(cpu, loop, end)) return;
+        if (Registers(cpu) == before) {
+            uint64_t period = cpu.cycles - start;
+            uint64_t count = (end - cpu.cycles) / period;
+            if (!count) return;
+            cpu.cycles += count * period;
+            skippedCycles += count * period;
+            skips++;
+            return;
+        }
+    }
+}
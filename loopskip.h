@@ -0,0 +1,71 @@
+#ifndef LOOPSKIP_H
+#define LOOPSKIP_H
+
+#include <cstdint>
+#include "cpu8085.h"
+
+// Loop skipping: delay and polling loops are fast-forwarded instead of
+// executed, with the same final registers, flags, memory and cycle count as
+// stepping through them.
+//
+// run() asks skip() about the code at PC between engine slices. A loop is a
+// straight run of instructions from a head to a JMP or Jcc back to it, with
+// no stores, stack operations, OUT, interrupt control or HLT; conditional
+// jumps out of it are allowed, and IN only from quiet ports (IoBus::quiet).
+// Two kinds are skipped:
+//   counter loops - DCR r; JNZ and DCX rp; MOV A,hi; ORA lo; JNZ (either
+//                   half first), NOPs anywhere. Every iteration but the last
+//                   that fits before the slice ends is skipped by computing
+//                   the counter and cycles; the last runs on the interpreter
+//                   and sets A and the flags.
+//   fixed points  - any other loop whose registers and flags come out of an
+//                   iteration as they went in. Nothing it reads can change
+//                   before the next device event, so it is skipped in whole
+//                   iterations up to that event (or the end of the run).
+// Both need all-RAM memory, since loads from device pages may have effects.
+//
+// The checks cost a few decodes, so run() gives the engine kMinInterval
+// T-states after a skip and doubles that up to kMaxInterval while nothing
+// is found.
+class LoopSkipper {
+public:
+    static const uint64_t kMinInterval = 256;
+    static const uint64_t kMaxInterval = 16384;
+
+    LoopSkipper() : interval(kMaxInterval), skippedCycles(0), skips(0) {}
+
+    // Runs or skips the loop at PC without passing cycle end (run()'s slice
+    // end); returns the T-states to give the engine before the next call
+    uint64_t skip(CPU8085& cpu, uint64_t end);
+
+    uint64_t interval;
+    uint64_t skippedCycles;  // Fast-forwarded, not executed
+    uint64_t skips;
+
+private:
+    static const int kMaxInstructions = 16;
+
+    struct Loop {
+        enum class Kind : uint8_t { Counter8, Counter16, FixedPoint };
+
+        uint16_t head;
+        uint16_t end;  // Address of the jump back to head
+        Kind kind;
+        int counter;   // Register field (Counter8) or pair field (Counter16)
+        int period;    // T-states of a counter loop's iterations but the last
+        int count;
+        uint8_t opcodes[kMaxInstructions];
+        uint8_t ports[kMaxInstructions];  // Of the IN instructions
+        int portCount;
+    };
+
+    static bool find(const CPU8085& cpu, Loop& loop);
+    static void classify(Loop& loop);
+    // Executes instructions until PC is back at the head, the loop is left
+    // or the slice ends; returns whether PC is at the head
+    static bool iterate(CPU8085& cpu, const Loop& loop, uint64_t end);
+    void skipCounter(CPU8085& cpu, const Loop& loop, uint64_t end);
+    void skipFixedPoint(CPU8085& cpu, const Loop& loop, uint64_t end);
+};
+
+#endif // LOOPSKIP_H
@@ -0,0 +1,320 @@
+#include "multicpu.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Waiters spin this many times before sleeping, since the others are
+// usually only a few microseconds behind
+const int kSpins = 4000;
+
+// Every worker calls arrive() at the end of a quantum. The last to arrive
+// runs the exchange while the others wait, and all of them get its result.
+class QuantumBarrier {
+public:
+    explicit QuantumBarrier(unsigned count) : count(count), waiting(0), generation(0), result(false) {}
+
+    template <class Fn> bool arrive(Fn exchange) {
+        uint64_t current = generation.load(std::memory_order_acquire);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (++waiting == count) {
+                waiting = 0;
+                result = exchange();
+                generation.store(current + 1, std::memory_order_release);
+                wake.notify_all();
+                return result;
+            }
+        }
+        for (int i = 0; i < kSpins; i++) {
+            if (generation.load(std::memory_order_acquire) != current) return result;
+        }
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [&] { return generation.load(std::memory_order_acquire) != current; });
+        return result;
+    }
+
+private:
+    const unsigned count;
+    unsigned waiting;
+    std::atomic<uint64_t> generation;
+    bool result;
+    std::mutex lock;
+    std::condition_variable wake;
+};
+
+} // namespace
+
+struct MultiCpuSystem::Mailbox {
+    CPU8085* receiver;
+    bool hasLine;
+    InterruptUnit::Line line;
+    std::deque<uint8_t> inbox;   // Arrived, touched by the receiver only
+    std::vector<uint8_t> outbox; // Sent this quantum, touched by the sender only
+    size_t room;                 // Sender's view: free slots at the last barrier, less the outbox
+
+    void clear() {
+        inbox.clear();
+        outbox.clear();
+        room = kMailboxDepth;
+    }
+
+    static void send(void* context, uint8_t, uint8_t value) {
+        Mailbox& box = *static_cast<Mailbox*>(context);
+        if (!box.room) return;
+        box.outbox.push_back(value);
+        box.room--;
+    }
+    static uint8_t sendStatus(void* context, uint8_t) {
+        return static_cast<Mailbox*>(context)->room ? 0x02 : 0x00;
+    }
+    static uint8_t receive(void* context, uint8_t) {
+        Mailbox& box = *static_cast<Mailbox*>(context);
+        if (box.inbox.empty()) return 0xFF;
+        uint8_t value = box.inbox.front();
+        box.inbox.pop_front();
+        if (box.hasLine && box.inbox.empty()) box.receiver->interrupts.setLine(box.line, false);
+        return value;
+    }
+    static uint8_t receiveStatus(void* context, uint8_t) {
+        return static_cast<Mailbox*>(context)->inbox.empty() ? 0x00 : 0x01;
+    }
+    // Both statuses only change at a barrier or through the reader's own
+    // accesses
+    static bool quiet(void*, uint8_t) { return true; }
+};
+
+MultiCpuSystem::MultiCpuSystem(size_t cpuCount, CPU8085::Engine engine)
+    : shared(0x10000, 0), quantum(kDefaultQuantum), threads(0), now(0), end(0), target(0), quantumCount(0) {
+    for (size_t i = 0; i < cpuCount; i++) {
+        cpus.emplace_back(new Node());
+        cpus.back()->cpu.reset(new CPU8085(engine));
+    }
+}
+
+MultiCpuSystem::~MultiCpuSystem() = default;
+
+void MultiCpuSystem::setStart(size_t index, uint16_t address) {
+    cpus[index]->start = address;
+}
+
+unsigned MultiCpuSystem::threadCount() const {
+    unsigned count = threads ? threads : std::thread::hardware_concurrency();
+    count = std::min<unsigned>(std::max(count, 1u), static_cast<unsigned>(cpus.size()));
+    return std::max(count, 1u);
+}
+
+bool MultiCpuSystem::addSharedWindow(uint8_t firstPage, int pageCount, std::string& error) {
+    if (pageCount <= 0 || firstPage + pageCount > GuestMemory::kPageCount) {
+        error = "shared window outside the address space";
+        return false;
+    }
+    for (int page = firstPage; page < firstPage + pageCount; page++) {
+        if (std::binary_search(windowPages.begin(), windowPages.end(), static_cast<uint8_t>(page))) {
+            error = "shared windows overlap";
+            return false;
+        }
+    }
+    for (int page = firstPage; page < firstPage + pageCount; page++) windowPages.push_back(static_cast<uint8_t>(page));
+    std::sort(windowPages.begin(), windowPages.end());
+
+    // The window starts out as CPU 0 has it
+    for (int page = firstPage; page < firstPage + pageCount && !cpus.empty(); page++) {
+        std::memcpy(&shared[page * GuestMemory::kPageSize], cpus[0]->cpu->memory.page(static_cast<uint8_t>(page)),
+                    GuestMemory::kPageSize);
+        copyToCpus(static_cast<uint8_t>(page));
+    }
+    return true;
+}
+
+bool MultiCpuSystem::addMailbox(size_t from, uint8_t sendPort, size_t to, uint8_t receivePort, std::string& error) {
+    return connect(from, sendPort, to, receivePort, false, InterruptUnit::Intr, error);
+}
+
+bool MultiCpuSystem::addMailbox(size_t from, uint8_t sendPort, size_t to, uint8_t receivePort,
+                                InterruptUnit::Line line, std::string& error) {
+    return connect(from, sendPort, to, receivePort, true, line, error);
+}
+
+bool MultiCpuSystem::connect(size_t from, uint8_t sendPort, size_t to, uint8_t receivePort, bool hasLine,
+                             InterruptUnit::Line line, std::string& error) {
+    if (from >= cpus.size() || to >= cpus.size()) {
+        error = "no such CPU";
+        return false;
+    }
+    if (receivePort == 0xFF) {
+        error = "the receive port needs a status port after it";
+        return false;
+    }
+    Node& sender = *cpus[from];
+    Node& receiver = *cpus[to];
+    bool taken = sender.inputs[sendPort] || sender.outputs[sendPort] || receiver.inputs[receivePort] ||
+                 receiver.inputs[receivePort + 1] || (from == to && (sendPort == receivePort || sendPort == receivePort + 1));
+    if (taken) {
+        error = "mailbox port already in use";
+        return false;
+    }
+    sender.inputs[sendPort] = sender.outputs[sendPort] = true;
+    receiver.inputs[receivePort] = receiver.inputs[receivePort + 1] = true;
+
+    mailboxes.emplace_back(new Mailbox());
+    Mailbox* box = mailboxes.back().get();
+    box->receiver = receiver.cpu.get();
+    box->hasLine = hasLine;
+    box->line = line;
+    box->clear();
+    sender.cpu->io.mapOutput(sendPort, &Mailbox::send, box);
+    sender.cpu->io.mapInput(sendPort, &Mailbox::sendStatus, box, &Mailbox::quiet);
+    receiver.cpu->io.mapInput(receivePort, &Mailbox::receive, box);
+    receiver.cpu->io.mapInput(static_cast<uint8_t>(receivePort + 1), &Mailbox::receiveStatus, box, &Mailbox::quiet);
+    return true;
+}
+
+void MultiCpuSystem::reset() {
+    for (std::unique_ptr<Node>& node : cpus) {
+        node->cpu->reset();
+        node->cpu->PC = node->start;
+        node->stalled = false;
+    }
+    for (std::unique_ptr<Mailbox>& box : mailboxes) box->clear();
+    for (uint8_t page : windowPages) {
+        std::memcpy(&shared[page * GuestMemory::kPageSize], cpus[0]->cpu->memory.page(page), GuestMemory::kPageSize);
+        copyToCpus(page);
+    }
+    now = 0;
+    quantumCount = 0;
+}
+
+void MultiCpuSystem::setShared(uint16_t address, uint8_t value) {
+    if (!std::binary_search(windowPages.begin(), windowPages.end(), static_cast<uint8_t>(address >> 8))) return;
+    shared[address] = value;
+    for (std::unique_ptr<Node>& node : cpus) node->cpu->setMemory(address, value);
+}
+
+bool MultiCpuSystem::stopped() const {
+    // Mailboxes are empty at a barrier, and what a halted CPU stored last
+    // has been shared
+    if (now % quantum) return false;
+    for (const std::unique_ptr<Node>& node : cpus) {
+        if (!node->cpu->stopped()) return false;
+    }
+    return true;
+}
+
+int MultiCpuSystem::stalledCpu() const {
+    for (size_t i = 0; i < cpus.size(); i++) {
+        if (cpus[i]->stalled) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+uint64_t MultiCpuSystem::run(uint64_t cycles) {
+    uint64_t start = now;
+    end = now + std::min(cycles, UINT64_MAX - now);
+    if (!nextQuantum()) return 0;
+
+    unsigned workers = threadCount();
+    if (workers == 1) {
+        do {
+            runShare(0, 1);
+        } while (exchange());
+        return now - start;
+    }
+
+    QuantumBarrier barrier(workers);
+    auto work = [this, &barrier, workers](unsigned worker) {
+        do {
+            runShare(worker, workers);
+        } while (barrier.arrive([this] { return exchange(); }));
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < workers; i++) pool.emplace_back(work, i);
+    work(0);
+    for (std::thread& thread : pool) thread.join();
+    return now - start;
+}
+
+void MultiCpuSystem::runShare(unsigned worker, unsigned workers) {
+    for (size_t i = worker; i < cpus.size(); i += workers) runCpu(*cpus[i]);
+}
+
+void MultiCpuSystem::runCpu(Node& node) {
+    CPU8085& cpu = *node.cpu;
+    while (cpu.cycles < target) {
+        uint64_t ran = cpu.run(target - cpu.cycles);
+        // Halted with nothing to wake it before the barrier: the time passes
+        if (cpu.cycles < target && cpu.stopped()) {
+            cpu.cycles = target;
+        } else if (ran == 0) {
+            break;
+        }
+    }
+    node.stalled = cpu.cycles < target;
+}
+
+bool MultiCpuSystem::nextQuantum() {
+    if (now >= end || stopped()) return false;
+    uint64_t boundary = now - now % quantum;
+    target = quantum <= UINT64_MAX - boundary ? std::min(boundary + quantum, end) : end;
+    return true;
+}
+
+bool MultiCpuSystem::exchange() {
+    // A stalled CPU has not reached target, so neither has the board: the
+    // run ends here, before the barrier, and the others wait there for it
+    if (stalledCpu() >= 0) return false;
+    // A run() ending between barriers only pauses the quantum
+    if (target % quantum == 0) {
+        exchangeShared();
+        for (std::unique_ptr<Mailbox>& box : mailboxes) {
+            box->inbox.insert(box->inbox.end(), box->outbox.begin(), box->outbox.end());
+            box->outbox.clear();
+            box->room = kMailboxDepth - box->inbox.size();
+            if (box->hasLine && !box->inbox.empty()) box->receiver->interrupts.setLine(box->line, true);
+        }
+        quantumCount++;
+    }
+    now = target;
+    return nextQuantum();
+}
+
+void MultiCpuSystem::exchangeShared() {
+    uint8_t next[GuestMemory::kPageSize];
+    for (uint8_t page : windowPages) {
+        // shared still holds the window as of the last barrier; what each
+        // CPU changed since then goes in, in CPU order
+        uint8_t* base = &shared[page * GuestMemory::kPageSize];
+        std::memcpy(next, base, sizeof next);
+        bool changed = false;
+        for (std::unique_ptr<Node>& node : cpus) {
+            const uint8_t* mine = node->cpu->memory.page(page);
+            if (std::memcmp(mine, base, sizeof next) == 0) continue;
+            changed = true;
+            for (int b = 0; b < GuestMemory::kPageSize; b++) {
+                if (mine[b] != base[b]) next[b] = mine[b];
+            }
+        }
+        if (!changed) continue;
+
+        std::memcpy(base, next, sizeof next);
+        copyToCpus(page);
+    }
+}
+
+void MultiCpuSystem::copyToCpus(uint8_t page) {
+    const uint8_t* window = &shared[page * GuestMemory::kPageSize];
+    for (std::unique_ptr<Node>& node : cpus) {
+        CPU8085& cpu = *node->cpu;
+        const uint8_t* mine = cpu.memory.page(page);
+        if (std::memcmp(mine, window, GuestMemory::kPageSize) == 0) continue;
+        // setMemory() drops code cached from the page
+        for (int b = 0; b < GuestMemory::kPageSize; b++) {
+            if (mine[b] != window[b]) cpu.setMemory(static_cast<uint16_t>(page << 8 | b), window[b]);
+        }
+    }
+}
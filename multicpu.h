@@ -0,0 +1,125 @@
+#ifndef MULTICPU_H
+#define MULTICPU_H
+
+#include <cstddef>
+#include <cstdint>
+#include <bitset>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cpu8085.h"
+
+// A board of several 8085s, each with its own memory and devices, that talk
+// through shared RAM windows and port mailboxes.
+//
+// The CPUs run in quanta of T-states on host threads of their own and meet
+// at a barrier after each quantum, where whatever they wrote for the others
+// is exchanged. Within a quantum a CPU only touches its own state:
+//   shared RAM - every CPU has a copy of each window in its own memory and
+//                sees its own stores at once and the others' from the next
+//                quantum. A byte several CPUs changed in the same quantum
+//                takes the value of the highest-numbered one.
+//   mailboxes  - bytes sent during a quantum reach the receiver at its end.
+// So results never depend on the thread count or the host's scheduling, and
+// threads = 1, which runs every CPU on the calling thread, gives the same
+// result as any other setting. Smaller quanta shorten the latency between
+// CPUs; larger ones spend less time at the barrier. Barriers fall on
+// multiples of the quantum in board time, so how the host splits the time
+// into run() calls does not matter either.
+//
+// Every port status the CPUs can poll only changes at a barrier or by their
+// own accesses, so loop skipping (CPU8085::setLoopSkipping) may be on.
+class MultiCpuSystem {
+public:
+    static const uint64_t kDefaultQuantum = 10000;
+    static const size_t kMailboxDepth = 16;
+
+    explicit MultiCpuSystem(size_t cpuCount, CPU8085::Engine engine = CPU8085::defaultEngine);
+    ~MultiCpuSystem();
+    MultiCpuSystem(const MultiCpuSystem&) = delete;
+    MultiCpuSystem& operator=(const MultiCpuSystem&) = delete;
+
+    size_t cpuCount() const { return cpus.size(); }
+    // Load each CPU's program and map its devices here; call reset()
+    // afterwards. Shared windows and mailbox ports must be left alone.
+    CPU8085& cpu(size_t index) { return *cpus[index]->cpu; }
+    const CPU8085& cpu(size_t index) const { return *cpus[index]->cpu; }
+    // PC the CPU starts from at reset()
+    void setStart(size_t index, uint16_t address);
+
+    // Pages every CPU sees as one RAM window. It starts out, and comes back
+    // on reset(), as CPU 0's memory has it.
+    bool addSharedWindow(uint8_t firstPage, int pageCount, std::string& error);
+    // A FIFO of kMailboxDepth bytes from one CPU to another:
+    //   sender   sendPort OUT        queue a byte (dropped when full)
+    //   sender   sendPort IN         status: bit 1 room for another byte
+    //   receiver receivePort IN      next byte (FFh when empty)
+    //   receiver receivePort+1 IN    status: bit 0 a byte is waiting
+    // With interrupt, the receiver's line is high while bytes are waiting.
+    bool addMailbox(size_t from, uint8_t sendPort, size_t to, uint8_t receivePort, std::string& error);
+    bool addMailbox(size_t from, uint8_t sendPort, size_t to, uint8_t receivePort, InterruptUnit::Line line,
+                    std::string& error);
+
+    void setQuantum(uint64_t cycles) { quantum = cycles ? cycles : 1; }
+    uint64_t getQuantum() const { return quantum; }
+    // Host threads for run(), 0 = one per CPU up to the hardware threads
+    void setThreads(unsigned count) { threads = count; }
+    unsigned threadCount() const;
+
+    // Every CPU reset (to its start address), shared windows back to CPU
+    // 0's memory and mailboxes emptied
+    void reset();
+    // Runs every CPU for up to cycles T-states of board time, or until all
+    // are stopped (CPU8085::stopped()) at a barrier with nothing in flight
+    // between them.
+    // A stopped CPU's clock keeps up with the board's. Returns the T-states
+    // of board time that passed.
+    // A CPU that makes no progress short of the barrier without being
+    // stopped (a JIT verification mismatch) ends the run before it, and
+    // stalledCpu() tells which. The next run() retries that quantum.
+    uint64_t run(uint64_t cycles);
+    // Board time: every CPU's cycles are at least this
+    uint64_t cycles() const { return now; }
+    uint64_t quanta() const { return quantumCount; }  // Barriers passed since reset()
+    bool stopped() const;
+    // First CPU the last run() left short of the barrier, or -1
+    int stalledCpu() const;
+
+    // Host access to the shared windows, as of the last barrier
+    uint8_t getShared(uint16_t address) const { return shared[address]; }
+    void setShared(uint16_t address, uint8_t value);
+
+private:
+    struct Mailbox;
+    struct Node {
+        std::unique_ptr<CPU8085> cpu;
+        uint16_t start = 0x0000;
+        std::bitset<256> inputs, outputs;  // Ports taken by mailboxes
+        bool stalled = false;               // Short of the last target
+    };
+
+    std::vector<std::unique_ptr<Node>> cpus;
+    std::vector<std::unique_ptr<Mailbox>> mailboxes;
+    std::vector<uint8_t> windowPages;  // Sorted
+    std::vector<uint8_t> shared;       // 64KB, only window pages are used
+    uint64_t quantum;
+    unsigned threads;
+    uint64_t now;
+    uint64_t end;     // Of the current run()
+    uint64_t target;  // Of the current quantum
+    uint64_t quantumCount;
+
+    bool connect(size_t from, uint8_t sendPort, size_t to, uint8_t receivePort, bool hasLine,
+                 InterruptUnit::Line line, std::string& error);
+    void runCpu(Node& node);
+    void runShare(unsigned worker, unsigned workers);
+    // After the CPUs reach target: exchanges shared RAM and mailboxes at a
+    // quantum boundary and picks the next target; false when run() is done
+    bool exchange();
+    bool nextQuantum();
+    void exchangeShared();
+    // Every CPU's copy of the window page to what shared holds
+    void copyToCpus(uint8_t page);
+};
+
+#endif // MULTICPU_H
@@ -0,0 +1,90 @@
+#include "opcodes.h"
+
+namespace {
+
+const char kRegisters[] = "BCDEHLMA";
+const char* const kPairs[] = {"B", "D", "H", "SP"};
+
+// Appends to a fixed buffer, which every caller sizes for the longest line
+struct Writer {
+    char* p;
+
+    void text(const char* s) {
+        while (*s) *p++ = *s++;
+    }
+    void character(char c) { *p++ = c; }
+    // As the assembler reads it: 0FFh, 1234h
+    void hex(unsigned value, int digits) {
+        static const char kDigits[] = "0123456789ABCDEF";
+        if ((value >> (digits * 4 - 4)) >= 10) *p++ = '0';
+        for (int shift = digits * 4 - 4; shift >= 0; shift -= 4) *p++ = kDigits[(value >> shift) & 0xF];
+        *p++ = 'h';
+    }
+};
+
+// Mnemonic and the operands encoded in the opcode; returns whether the
+// immediate follows a comma
+bool writeFields(Writer& w, uint8_t opcode, const OpcodeInfo& info) {
+    w.text(info.mnemonic);
+    int low = opcode & 7, high = (opcode >> 3) & 7, pair = (opcode >> 4) & 3;
+    switch (info.form) {
+        case OperandForm::None: return false;
+        case OperandForm::Reg: w.character(' '); w.character(kRegisters[low]); return false;
+        case OperandForm::RegHigh: w.character(' '); w.character(kRegisters[high]); return false;
+        case OperandForm::RegReg:
+            w.character(' ');
+            w.character(kRegisters[high]);
+            w.text(", ");
+            w.character(kRegisters[low]);
+            return false;
+        case OperandForm::RegImm8: w.character(' '); w.character(kRegisters[high]); return true;
+        case OperandForm::Imm8:
+        case OperandForm::Imm16: return false;
+        case OperandForm::Pair:
+        case OperandForm::PairBD: w.character(' '); w.text(kPairs[pair]); return false;
+        case OperandForm::PairImm16: w.character(' '); w.text(kPairs[pair]); return true;
+        case OperandForm::PairPsw: w.character(' '); w.text(pair == 3 ? "PSW" : kPairs[pair]); return false;
+        case OperandForm::Rst: w.character(' '); w.character(static_cast<char>('0' + high)); return false;
+    }
+    return false;
+}
+
+} // namespace
+
+int disassemble(uint8_t opcode, uint16_t operand, char (&out)[kDisassemblySize]) {
+    const OpcodeInfo& info = kOpcodes[opcode];
+    Writer w{out};
+    if (!info.documented) {
+        w.text("DB ");
+        w.hex(opcode, 2);
+    } else {
+        bool comma = writeFields(w, opcode, info);
+        if (info.length > 1) {
+            w.text(comma ? ", " : " ");
+            w.hex(info.length == 2 ? operand & 0xFF : operand, info.length == 2 ? 2 : 4);
+        }
+    }
+    w.character('\0');
+    return info.length;
+}
+
+int disassemble(const uint8_t* bytes, char (&out)[kDisassemblySize]) {
+    int length = kOpcodes[bytes[0]].length;
+    uint16_t operand = length == 1 ? 0 : length == 2 ? bytes[1] : static_cast<uint16_t>(bytes[1] | bytes[2] << 8);
+    return disassemble(bytes[0], operand, out);
+}
+
+void describeOpcode(uint8_t opcode, char (&out)[kDisassemblySize]) {
+    const OpcodeInfo& info = kOpcodes[opcode];
+    Writer w{out};
+    if (!info.documented) {
+        w.text("*NOP");
+    } else {
+        bool comma = writeFields(w, opcode, info);
+        if (info.length > 1) {
+            w.text(comma ? ", " : " ");
+            w.text(info.length == 2 ? "d8" : info.form == OperandForm::PairImm16 ? "d16" : "a16");
+        }
+    }
+    w.character('\0');
+}
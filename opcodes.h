@@ -0,0 +1,173 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Operand syntax of an instruction. Register, pair and RST fields are bits
+// of the opcode, so one form covers a whole row or column of the opcode map.
+enum class OperandForm : uint8_t {
+    None,       // NOP
+    Reg,        // ADD r: r in bits 0-2
+    RegHigh,    // INR r: r in bits 3-5
+    RegReg,     // MOV d,s
+    RegImm8,    // MVI r,d8
+    Imm8,       // ADI d8, IN/OUT port
+    Imm16,      // JMP a16, LDA a16
+    Pair,       // INX rp: rp in bits 4-5, with SP
+    PairImm16,  // LXI rp,d16
+    PairPsw,    // PUSH rp, with PSW for SP
+    PairBD,     // LDAX/STAX, B or D only
+    Rst         // RST n: n in bits 3-5
+};
+
+// Bytes of an instruction with the given form, opcode included
+constexpr int formLength(OperandForm form) {
+    switch (form) {
+        case OperandForm::RegImm8:
+        case OperandForm::Imm8: return 2;
+        case OperandForm::Imm16:
+        case OperandForm::PairImm16: return 3;
+        default: return 1;
+    }
+}
+
+// Where an instruction may send control
+enum class ControlFlow : uint8_t {
+    Next,      // Always the next instruction
+    Jump,      // JMP, Jcc
+    Call,      // CALL, Ccc
+    Return,    // RET, Rcc
+    Restart,   // RST n, a one-byte call to n * 8
+    Indirect,  // PCHL
+    Halt       // HLT
+};
+
+struct OpcodeInfo {
+    const char* mnemonic;  // Upper case; NOP for the undocumented opcodes
+    OperandForm form;
+    uint8_t length;        // Bytes, opcode included
+    uint8_t cycles;        // T-states; for conditionals, when not taken
+    uint8_t takenCycles;   // Added to cycles when a conditional is taken
+    uint8_t flags;         // PSW bits it may change (CPU8085Base::Flags masks)
+    ControlFlow flow;
+    bool conditional;      // Jcc, Ccc and Rcc
+    bool documented;       // false for the ten opcodes executed as NOP
+};
+
+// Everything known about each opcode, built at compile time. The core's
+// length and cycle tables, block ends, the assembler's mnemonics and the
+// disassembler all come from here.
+struct OpcodeTable {
+    OpcodeInfo entries[256];
+
+    constexpr const OpcodeInfo& operator[](uint8_t opcode) const { return entries[opcode]; }
+};
+
+constexpr OpcodeTable makeOpcodeTable() {
+    // PSW bits: S Z 0 AC 0 P 1 CY
+    constexpr uint8_t kCY = 0x01, kSZAP = 0xD4, kSZAPC = 0xD5;
+    const char* const alu[] = {"ADD", "ADC", "SUB", "SBB", "ANA", "XRA", "ORA", "CMP"};
+    const char* const aluImmediate[] = {"ADI", "ACI", "SUI", "SBI", "ANI", "XRI", "ORI", "CPI"};
+    const char* const returns[] = {"RNZ", "RZ", "RNC", "RC", "RPO", "RPE", "RP", "RM"};
+    const char* const jumps[] = {"JNZ", "JZ", "JNC", "JC", "JPO", "JPE", "JP", "JM"};
+    const char* const calls[] = {"CNZ", "CZ", "CNC", "CC", "CPO", "CPE", "CP", "CM"};
+
+    OpcodeTable t{};
+    auto set = [&t](int opcode, const char* mnemonic, OperandForm form, int cycles, uint8_t flags = 0,
+                    ControlFlow flow = ControlFlow::Next, int takenCycles = 0) {
+        t.entries[opcode] = {mnemonic, form, static_cast<uint8_t>(formLength(form)),
+                             static_cast<uint8_t>(cycles), static_cast<uint8_t>(takenCycles), flags,
+                             flow, takenCycles != 0, true};
+    };
+    for (int opcode = 0; opcode < 256; opcode++) {
+        t.entries[opcode] = {"NOP", OperandForm::None, 1, 4, 0, 0, ControlFlow::Next, false, false};
+    }
+
+    // 00-3F
+    set(0x00, "NOP", OperandForm::None, 4);
+    for (int p = 0; p < 4; p++) {
+        set(0x01 | p << 4, "LXI", OperandForm::PairImm16, 10);
+        set(0x03 | p << 4, "INX", OperandForm::Pair, 6);
+        set(0x09 | p << 4, "DAD", OperandForm::Pair, 10, kCY);
+        set(0x0B | p << 4, "DCX", OperandForm::Pair, 6);
+    }
+    for (int p = 0; p < 2; p++) {
+        set(0x02 | p << 4, "STAX", OperandForm::PairBD, 7);
+        set(0x0A | p << 4, "LDAX", OperandForm::PairBD, 7);
+    }
+    set(0x22, "SHLD", OperandForm::Imm16, 16);
+    set(0x2A, "LHLD", OperandForm::Imm16, 16);
+    set(0x32, "STA", OperandForm::Imm16, 13);
+    set(0x3A, "LDA", OperandForm::Imm16, 13);
+    for (int r = 0; r < 8; r++) {
+        bool m = r == 6;
+        set(0x04 | r << 3, "INR", OperandForm::RegHigh, m ? 10 : 4, kSZAP);
+        set(0x05 | r << 3, "DCR", OperandForm::RegHigh, m ? 10 : 4, kSZAP);
+        set(0x06 | r << 3, "MVI", OperandForm::RegImm8, m ? 10 : 7);
+    }
+    set(0x07, "RLC", OperandForm::None, 4, kCY);
+    set(0x0F, "RRC", OperandForm::None, 4, kCY);
+    set(0x17, "RAL", OperandForm::None, 4, kCY);
+    set(0x1F, "RAR", OperandForm::None, 4, kCY);
+    set(0x20, "RIM", OperandForm::None, 4);
+    set(0x27, "DAA", OperandForm::None, 4, kSZAPC);
+    set(0x2F, "CMA", OperandForm::None, 4);
+    set(0x30, "SIM", OperandForm::None, 4);
+    set(0x37, "STC", OperandForm::None, 4, kCY);
+    set(0x3F, "CMC", OperandForm::None, 4, kCY);
+
+    // 40-BF
+    for (int opcode = 0x40; opcode < 0x80; opcode++) {
+        bool m = (opcode & 7) == 6 || (opcode & 0x38) == 0x30;
+        set(opcode, "MOV", OperandForm::RegReg, m ? 7 : 4);
+    }
+    set(0x76, "HLT", OperandForm::None, 5, 0, ControlFlow::Halt);
+    for (int opcode = 0x80; opcode < 0xC0; opcode++) {
+        set(opcode, alu[(opcode >> 3) & 7], OperandForm::Reg, (opcode & 7) == 6 ? 7 : 4, kSZAPC);
+    }
+
+    // C0-FF
+    for (int c = 0; c < 8; c++) {
+        set(0xC0 | c << 3, returns[c], OperandForm::None, 6, 0, ControlFlow::Return, 6);
+        set(0xC2 | c << 3, jumps[c], OperandForm::Imm16, 7, 0, ControlFlow::Jump, 3);
+        set(0xC4 | c << 3, calls[c], OperandForm::Imm16, 9, 0, ControlFlow::Call, 9);
+        set(0xC6 | c << 3, aluImmediate[c], OperandForm::Imm8, 7, kSZAPC);
+        set(0xC7 | c << 3, "RST", OperandForm::Rst, 12, 0, ControlFlow::Restart);
+    }
+    for (int p = 0; p < 4; p++) {
+        set(0xC1 | p << 4, "POP", OperandForm::PairPsw, 10, p == 3 ? kSZAPC : 0);
+        set(0xC5 | p << 4, "PUSH", OperandForm::PairPsw, 12);
+    }
+    set(0xC3, "JMP", OperandForm::Imm16, 10, 0, ControlFlow::Jump);
+    set(0xC9, "RET", OperandForm::None, 10, 0, ControlFlow::Return);
+    set(0xCD, "CALL", OperandForm::Imm16, 18, 0, ControlFlow::Call);
+    set(0xD3, "OUT", OperandForm::Imm8, 10);
+    set(0xDB, "IN", OperandForm::Imm8, 10);
+    set(0xE3, "XTHL", OperandForm::None, 16);
+    set(0xE9, "PCHL", OperandForm::None, 6, 0, ControlFlow::Indirect);
+    set(0xEB, "XCHG", OperandForm::None, 4);
+    set(0xF3, "DI", OperandForm::None, 4);
+    set(0xF9, "SPHL", OperandForm::None, 6);
+    set(0xFB, "EI", OperandForm::None, 4);
+    return t;
+}
+
+inline constexpr OpcodeTable kOpcodes = makeOpcodeTable();
+
+// Longest text the disassembler writes, with its terminating NUL
+constexpr size_t kDisassemblySize = 16;
+
+// Writes the instruction opcode, operand in assembler syntax ("MVI B, 05h",
+// "JNZ 0102h") and returns its length. operand is the byte or little-endian
+// word after the opcode; instructions without one ignore it. Undocumented
+// opcodes come out as "DB 08h", so the text always assembles back to the
+// same bytes. Nothing is allocated.
+int disassemble(uint8_t opcode, uint16_t operand, char (&out)[kDisassemblySize]);
+// Same, for the instruction at bytes, which must hold all of it
+int disassemble(const uint8_t* bytes, char (&out)[kDisassemblySize]);
+// The opcode alone, with the operand as d8, d16 or a16: "MVI B, d8"; the
+// undocumented ones are "*NOP"
+void describeOpcode(uint8_t opcode, char (&out)[kDisassemblySize]);
+
+#endif // OPCODES_H
@@ -0,0 +1,45 @@
+#include "pacer.h"
+#include <thread>
+
+namespace {
+
+// Sleep granularity on desktop kernels is ~50-100us; spin the remainder
+const std::chrono::microseconds kSpinWindow(200);
+// Falling further behind than this re-anchors instead of bursting
+const std::chrono::milliseconds kMaxLag(50);
+
+} // namespace
+
+ClockPacer::ClockPacer(double clockHz, double batchSeconds)
+    : hz(clockHz),
+      batch(static_cast<uint64_t>(clockHz * batchSeconds)),
+      anchorTime(Clock::now()),
+      anchorCycles(0) {
+    if (batch == 0) batch = 1;
+}
+
+void ClockPacer::start(uint64_t cycleCount) {
+    anchorTime = Clock::now();
+    anchorCycles = cycleCount;
+}
+
+ClockPacer::Clock::time_point ClockPacer::deadline(uint64_t cycleCount) {
+    std::chrono::duration<double> emulated((cycleCount - anchorCycles) / hz);
+    Clock::time_point due = anchorTime + std::chrono::duration_cast<Clock::duration>(emulated);
+    Clock::time_point now = Clock::now();
+    if (now > due + kMaxLag) {
+        start(cycleCount);
+        return now;
+    }
+    return due;
+}
+
+void ClockPacer::pace(uint64_t cycleCount) {
+    Clock::time_point due = deadline(cycleCount);
+    if (due - Clock::now() > kSpinWindow) {
+        std::this_thread::sleep_until(due - kSpinWindow);
+    }
+    while (Clock::now() < due) {
+        std::this_thread::yield();
+    }
+}
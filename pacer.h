@@ -0,0 +1,39 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <cstdint>
+#include <chrono>
+
+// Holds emulation to a fixed clock speed by sleeping between batches of
+// CPU8085::run(). Deadlines are measured from a fixed anchor, so sleep
+// overshoot in one batch is made up in the next instead of accumulating.
+class ClockPacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr double kDefaultClockHz = 3072000.0;  // 6.144 MHz crystal / 2
+
+    explicit ClockPacer(double clockHz = kDefaultClockHz, double batchSeconds = 0.001);
+
+    double clockHz() const { return hz; }
+    // T-states to execute between pace() calls
+    uint64_t batchCycles() const { return batch; }
+
+    // Anchor wall-clock time to the given cycle count
+    void start(uint64_t cycleCount);
+    // Block until wall-clock time catches up with cycleCount. If the host fell
+    // far behind (debugger pause, overloaded machine) the anchor is reset
+    // instead of running flat out to catch up.
+    void pace(uint64_t cycleCount);
+    // Wall-clock time at which cycleCount is due, re-anchoring like pace()
+    // does when the host fell far behind. For callers that wait themselves.
+    Clock::time_point deadline(uint64_t cycleCount);
+
+private:
+    double hz;
+    uint64_t batch;
+    Clock::time_point anchorTime;
+    uint64_t anchorCycles;
+};
+
+#endif // PACER_H
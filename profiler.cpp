@@ -0,0 +1,162 @@
+#include "profiler.h"
+#include "opcodes.h"
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+#include <string>
+
+void Profiler::clearProfile() {
+    opcodeCounts.fill(0);
+    addressCycles.clear();
+    nodes.clear();
+    children.clear();
+    callStack.clear();
+    current = 0;
+    expecting = false;
+}
+
+uint64_t Profiler::profiledInstructions() const {
+    return std::accumulate(opcodeCounts.begin(), opcodeCounts.end(), uint64_t(0));
+}
+
+uint64_t Profiler::profiledCycles() const {
+    uint64_t total = 0;
+    for (const Context& node : nodes) total += node.cycles;
+    return total;
+}
+
+std::vector<Profiler::Routine> Profiler::routines() const {
+    // Callers come first, so one backward pass sums each subtree
+    std::vector<uint64_t> inclusive(nodes.size());
+    for (size_t i = nodes.size(); i-- > 0;) {
+        inclusive[i] += nodes[i].cycles;
+        if (i > 0) inclusive[nodes[i].parent] += inclusive[i];
+    }
+    std::unordered_map<uint16_t, Routine> byAddress;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const Context& node = nodes[i];
+        Routine& routine = byAddress.emplace(node.routine, Routine{node.routine, 0, 0, 0}).first->second;
+        routine.calls += i == 0 ? 1 : node.calls;
+        routine.exclusive += node.cycles;
+        // Recursive activations are already inside the outermost one
+        bool nested = false;
+        for (size_t up = i; up != 0 && !nested;) {
+            up = nodes[up].parent;
+            nested = nodes[up].routine == node.routine;
+        }
+        if (!nested) routine.inclusive += inclusive[i];
+    }
+    std::vector<Routine> result;
+    for (const auto& entry : byAddress) result.push_back(entry.second);
+    std::sort(result.begin(), result.end(), [](const Routine& a, const Routine& b) {
+        return a.inclusive != b.inclusive ? a.inclusive > b.inclusive : a.address < b.address;
+    });
+    return result;
+}
+
+std::vector<Profiler::HotSpot> Profiler::hotSpots(size_t count) const {
+    std::vector<HotSpot> spots;
+    for (size_t address = 0; address < addressCycles.size(); address++) {
+        if (addressCycles[address]) spots.push_back({static_cast<uint16_t>(address), addressCycles[address]});
+    }
+    count = std::min(count, spots.size());
+    std::partial_sort(spots.begin(), spots.begin() + count, spots.end(), [](const HotSpot& a, const HotSpot& b) {
+        return a.cycles != b.cycles ? a.cycles > b.cycles : a.address < b.address;
+    });
+    spots.resize(count);
+    return spots;
+}
+
+void Profiler::start(uint16_t pc) {
+    addressCycles.assign(0x10000, 0);
+    nodes.push_back({0, pc, 1, 0});
+    current = 0;
+}
+
+void Profiler::enter(uint16_t routine, uint16_t slot) {
+    if (nodes.empty()) start(routine);
+    if (callStack.size() >= kMaxDepth) return;
+    uint64_t key = (static_cast<uint64_t>(current) << 16) | routine;
+    auto found = children.find(key);
+    uint32_t node;
+    if (found != children.end()) {
+        node = found->second;
+    } else {
+        node = static_cast<uint32_t>(nodes.size());
+        nodes.push_back({current, routine, 0, 0});
+        children.emplace(key, node);
+    }
+    nodes[node].calls++;
+    callStack.push_back({current, slot});
+    current = node;
+}
+
+void Profiler::leave(uint16_t slot) {
+    // Frames whose return address was at or below the popped slot are gone
+    while (!callStack.empty() && callStack.back().slot <= slot) {
+        current = callStack.back().caller;
+        callStack.pop_back();
+    }
+}
+
+namespace {
+
+std::string hex4(unsigned value) {
+    static const char digits[] = "0123456789ABCDEF";
+    std::string text(4, '0');
+    for (int i = 3; i >= 0; i--, value >>= 4) text[i] = digits[value & 0xF];
+    return text;
+}
+
+double percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * part / total : 0.0;
+}
+
+} // namespace
+
+void writeProfileReport(std::ostream& out, const Profiler& profile, size_t top) {
+    uint64_t instructions = profile.profiledInstructions();
+    uint64_t cycles = profile.profiledCycles();
+    out << "Profile: " << instructions << " instructions, " << cycles << " T-states\n";
+    out << std::fixed << std::setprecision(2);
+
+    std::vector<int> opcodes(256);
+    std::iota(opcodes.begin(), opcodes.end(), 0);
+    std::stable_sort(opcodes.begin(), opcodes.end(), [&](int a, int b) {
+        return profile.opcodeCounts[a] > profile.opcodeCounts[b];
+    });
+    out << "\nOpcodes                          count        %\n";
+    for (size_t i = 0; i < std::min<size_t>(top, 256) && profile.opcodeCounts[opcodes[i]]; i++) {
+        uint64_t count = profile.opcodeCounts[opcodes[i]];
+        char name[kDisassemblySize];
+        describeOpcode(static_cast<uint8_t>(opcodes[i]), name);
+        out << "  " << hex4(opcodes[i]).substr(2) << "h  " << std::left << std::setw(15) << name << std::right
+            << std::setw(14) << count << std::setw(9) << percent(count, instructions) << "\n";
+    }
+
+    out << "\nAddresses      T-states        %\n";
+    for (const Profiler::HotSpot& spot : profile.hotSpots(top)) {
+        out << "  " << hex4(spot.address) << "  " << std::setw(14) << spot.cycles << std::setw(9)
+            << percent(spot.cycles, cycles) << "\n";
+    }
+
+    out << "\nRoutines          calls      inclusive        %      exclusive        %\n";
+    std::vector<Profiler::Routine> routines = profile.routines();
+    for (size_t i = 0; i < std::min(top, routines.size()); i++) {
+        const Profiler::Routine& r = routines[i];
+        out << "  " << hex4(r.address) << "  " << std::setw(11) << r.calls << std::setw(15) << r.inclusive
+            << std::setw(9) << percent(r.inclusive, cycles) << std::setw(15) << r.exclusive << std::setw(9)
+            << percent(r.exclusive, cycles) << "\n";
+    }
+    out << std::defaultfloat;
+}
+
+void writeFoldedStacks(std::ostream& out, const Profiler& profile) {
+    const std::vector<Profiler::Context>& nodes = profile.contexts();
+    // Each node's stack is its caller's plus itself, and callers come first
+    std::vector<std::string> stacks(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        stacks[i] = i == 0 ? hex4(nodes[i].routine) : stacks[nodes[i].parent] + ";" + hex4(nodes[i].routine);
+        if (nodes[i].cycles) out << stacks[i] << " " << nodes[i].cycles << "\n";
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+#include "cpupolicy.h"
+
+// Guest-code profiler, as a core policy: per-opcode execution counts, T-states
+// per instruction address (a flat 64K counter array) and a calling-context
+// tree built by following CALL, RST, RET and interrupt entries. Each tree
+// node is one routine reached through one chain of callers and collects the
+// T-states spent in it directly, which gives exclusive and inclusive time per
+// routine and flame graph stacks.
+//
+// A call opens a frame keyed by the stack slot of its return address; a RET
+// that pops that slot closes it, along with any frames below it the program
+// abandoned. A RET popping something else (a computed jump) closes nothing.
+//
+// Cores without the policy pay nothing. With it, profiling is a runtime
+// switch that costs one test per instruction while off.
+class Profiler : public CpuPolicy {
+public:
+    static constexpr bool kInstructionHooks = true;
+    static const size_t kMaxDepth = 4096;  // Deeper calls count as the caller
+
+    struct Routine {
+        uint16_t address;
+        uint64_t calls;
+        uint64_t inclusive;  // T-states in it and everything it called
+        uint64_t exclusive;  // T-states in its own instructions
+    };
+    struct HotSpot {
+        uint16_t address;
+        uint64_t cycles;
+    };
+    struct Context {
+        uint32_t parent;  // Index of the caller's node; the root is its own parent
+        uint16_t routine;  // Entry address
+        uint64_t calls;
+        uint64_t cycles;  // Spent in the routine itself in this context
+    };
+
+    bool profiling = false;
+    std::array<uint64_t, 256> opcodeCounts = {};
+    std::vector<uint64_t> addressCycles;  // 65536 entries once profiling starts
+
+    void clearProfile();
+    uint64_t profiledInstructions() const;
+    uint64_t profiledCycles() const;
+    // Node 0 is the root, the routine profiling started in; callers come
+    // before the routines they call
+    const std::vector<Context>& contexts() const { return nodes; }
+    // Every routine, by inclusive T-states, highest first
+    std::vector<Routine> routines() const;
+    // The count addresses with the most T-states, highest first
+    std::vector<HotSpot> hotSpots(size_t count) const;
+
+    template <class Cpu> bool beforeInstruction(Cpu& cpu) {
+        if (!profiling) return true;
+        // Anything other than the expected next instruction with a return
+        // address pushed is an interrupt being taken
+        if (expecting && cpu.PC != expectedPC && cpu.SP == static_cast<uint16_t>(expectedSP - 2)) {
+            enter(cpu.PC, cpu.SP);
+        }
+        spBefore = cpu.SP;
+        return true;
+    }
+
+    template <class Cpu> void afterInstruction(Cpu& cpu, uint16_t pc, uint8_t opcode, int states) {
+        if (!profiling) return;
+        if (nodes.empty()) start(pc);
+        opcodeCounts[opcode]++;
+        addressCycles[pc] += states;
+        nodes[current].cycles += states;
+        if (opcode == 0xCD || (opcode & 0xC7) == 0xC4) {
+            // CALL, or a conditional call that was taken
+            if (cpu.SP == static_cast<uint16_t>(spBefore - 2)) enter(cpu.PC, cpu.SP);
+        } else if ((opcode & 0xC7) == 0xC7) {
+            enter(cpu.PC, cpu.SP);  // RST
+        } else if (opcode == 0xC9 || (opcode & 0xC7) == 0xC0) {
+            if (cpu.SP == static_cast<uint16_t>(spBefore + 2)) leave(spBefore);
+        }
+        expectedPC = cpu.PC;
+        expectedSP = cpu.SP;
+        expecting = true;
+    }
+
+private:
+    struct Frame {
+        uint32_t caller;  // Node to return to
+        uint16_t slot;    // Address of the return address on the stack
+    };
+
+    std::vector<Context> nodes;
+    std::unordered_map<uint64_t, uint32_t> children;  // (parent << 16 | routine) -> node
+    std::vector<Frame> callStack;
+    uint32_t current = 0;
+    uint16_t spBefore = 0;
+    uint16_t expectedPC = 0, expectedSP = 0;
+    bool expecting = false;
+
+    void start(uint16_t pc);
+    void enter(uint16_t routine, uint16_t slot);
+    void leave(uint16_t slot);
+};
+
+// Text report: totals, the top opcodes, addresses and routines
+void writeProfileReport(std::ostream& out, const Profiler& profile, size_t top = 20);
+// One line per calling context, "0000;0100;0140 T-states", for flamegraph.pl
+// and compatible viewers
+void writeFoldedStacks(std::ostream& out, const Profiler& profile);
+
+#endif // PROFILER_H
@@ -0,0 +1,240 @@
+#include "savestate.h"
+#include "cpu8085.h"
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SAVESTATE_MMAP 1
+#else
+#define SAVESTATE_MMAP 0
+#endif
+
+namespace {
+
+const char kMagic[8] = {'8', '0', '8', '5', 'S', 'A', 'V', '\0'};
+const size_t kHeaderSize = 256;
+const size_t kPageSize = GuestMemory::kPageSize;
+
+const uint8_t* pageOf(const MemoryImage* image, int index) {
+    static const uint8_t zeros[kPageSize] = {};
+    const uint8_t* page = image ? image->page(static_cast<uint8_t>(index)) : nullptr;
+    return page ? page : zeros;
+}
+
+// Identifies the base contents a file is a delta against
+uint64_t contentHash(const MemoryImage* image) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int index = 0; index < 256; index++) {
+        const uint8_t* page = pageOf(image, index);
+        for (size_t i = 0; i < kPageSize; i++) {
+            hash = (hash ^ page[i]) * 0x100000001B3ULL;
+        }
+    }
+    return hash;
+}
+
+void put16(uint8_t* out, uint16_t value) {
+    out[0] = static_cast<uint8_t>(value);
+    out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+void put32(uint8_t* out, uint32_t value) {
+    put16(out, static_cast<uint16_t>(value));
+    put16(out + 2, static_cast<uint16_t>(value >> 16));
+}
+
+void put64(uint8_t* out, uint64_t value) {
+    put32(out, static_cast<uint32_t>(value));
+    put32(out + 4, static_cast<uint32_t>(value >> 32));
+}
+
+uint16_t get16(const uint8_t* in) {
+    return static_cast<uint16_t>(in[0] | (in[1] << 8));
+}
+
+uint32_t get32(const uint8_t* in) {
+    return get16(in) | (static_cast<uint32_t>(get16(in + 2)) << 16);
+}
+
+uint64_t get64(const uint8_t* in) {
+    return get32(in) | (static_cast<uint64_t>(get32(in + 4)) << 32);
+}
+
+// File contents, mapped or read, kept alive by the images pointing into them
+class FileContents {
+public:
+    ~FileContents() {
+#if SAVESTATE_MMAP
+        if (mapped) munmap(mapped, size);
+#endif
+    }
+
+    bool open(const std::string& path) {
+#if SAVESTATE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        bool ok = fstat(fd, &info) == 0;
+        if (ok && info.st_size > 0) {
+            size = static_cast<size_t>(info.st_size);
+            void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ok = address != MAP_FAILED;
+            if (ok) mapped = address;
+        }
+        ::close(fd);
+        return ok;
+#else
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) return false;
+        char buffer[65536];
+        size_t count;
+        while ((count = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            storage.insert(storage.end(), buffer, buffer + count);
+        }
+        std::fclose(file);
+        size = storage.size();
+        return true;
+#endif
+    }
+
+    const uint8_t* data() const {
+#if SAVESTATE_MMAP
+        return static_cast<const uint8_t*>(mapped);
+#else
+        return storage.data();
+#endif
+    }
+    size_t length() const { return size; }
+
+    std::shared_ptr<const MemoryImage> base;  // The pages not in the file
+
+private:
+    size_t size = 0;
+#if SAVESTATE_MMAP
+    void* mapped = nullptr;
+#else
+    std::vector<uint8_t> storage;
+#endif
+};
+
+} // namespace
+
+bool SaveState::save(const std::string& path, std::string& error) const {
+    uint8_t header[kHeaderSize] = {};
+    std::memcpy(header, kMagic, sizeof(kMagic));
+    put32(header + 8, kVersion);
+    put64(header + 16, contentHash(base.get()));
+    const uint8_t registers[] = {A, B, C, D, E, H, L, psw};
+    std::memcpy(header + 24, registers, sizeof(registers));
+    put16(header + 32, SP);
+    put16(header + 34, PC);
+    header[36] = halted;
+    header[37] = interruptEnabled;
+    header[38] = enableDelay;
+    put64(header + 40, cycles);
+    header[48] = interrupts.masks;
+    header[49] = interrupts.rst75Latch;
+    header[50] = interrupts.trapArmed;
+    header[51] = interrupts.serialIn;
+    header[52] = interrupts.serialOut;
+    header[53] = interrupts.levels;
+    header[54] = interrupts.enabledBeforeTrap;
+    header[55] = interrupts.trapTaken;
+    put16(header + 56, interrupts.intrVector);
+
+    std::vector<const uint8_t*> stored;
+    for (int index = 0; index < 256; index++) {
+        const uint8_t* page = pageOf(memory.get(), index);
+        const uint8_t* original = pageOf(base.get(), index);
+        if (page == original || std::memcmp(page, original, kPageSize) == 0) continue;
+        stored.push_back(page);
+        header[64 + index / 8] |= static_cast<uint8_t>(1u << (index % 8));
+    }
+    put32(header + 12, static_cast<uint32_t>(stored.size()));
+
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        error = "cannot write " + path;
+        return false;
+    }
+    bool ok = std::fwrite(header, 1, kHeaderSize, file) == kHeaderSize;
+    for (const uint8_t* page : stored) {
+        ok = ok && std::fwrite(page, 1, kPageSize, file) == kPageSize;
+    }
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok) error = "error writing " + path;
+    return ok;
+}
+
+bool SaveState::load(const std::string& path, std::shared_ptr<const MemoryImage> baseImage, std::string& error) {
+    auto file = std::make_shared<FileContents>();
+    if (!file->open(path)) {
+        error = "cannot read " + path;
+        return false;
+    }
+    const uint8_t* header = file->data();
+    if (file->length() < kHeaderSize || std::memcmp(header, kMagic, sizeof(kMagic)) != 0) {
+        error = path + " is not a save state";
+        return false;
+    }
+    uint32_t version = get32(header + 8);
+    if (version != kVersion) {
+        error = path + " is save state version " + std::to_string(version) + ", expected " +
+                std::to_string(kVersion);
+        return false;
+    }
+    uint32_t storedPages = get32(header + 12);
+    size_t bitmapPages = 0;
+    for (int index = 0; index < 256; index++) bitmapPages += (header[64 + index / 8] >> (index % 8)) & 1;
+    if (storedPages != bitmapPages || file->length() != kHeaderSize + storedPages * kPageSize) {
+        error = path + " is truncated or corrupt";
+        return false;
+    }
+    if (get64(header + 16) != contentHash(baseImage.get())) {
+        error = path + " was saved against a different base image";
+        return false;
+    }
+
+    std::array<const uint8_t*, 256> pages;
+    const uint8_t* next = header + kHeaderSize;
+    for (int index = 0; index < 256; index++) {
+        if ((header[64 + index / 8] >> (index % 8)) & 1) {
+            pages[index] = next;
+            next += kPageSize;
+        } else {
+            pages[index] = baseImage ? baseImage->page(static_cast<uint8_t>(index)) : nullptr;
+        }
+    }
+
+    A = header[24]; B = header[25]; C = header[26]; D = header[27];
+    E = header[28]; H = header[29]; L = header[30];
+    // Normalised as POP PSW does, so a hand-edited file cannot set bits 3 and 5
+    psw = (header[31] & CPU8085::Flags::ALL) | CPU8085::Flags::ALWAYS_ONE;
+    SP = get16(header + 32);
+    PC = get16(header + 34);
+    halted = header[36] != 0;
+    interruptEnabled = header[37] != 0;
+    enableDelay = header[38] != 0;
+    cycles = get64(header + 40);
+    interrupts.reset();
+    interrupts.masks = header[48] & 0x07;
+    interrupts.rst75Latch = header[49] != 0;
+    interrupts.trapArmed = header[50] != 0;
+    interrupts.serialIn = header[51] != 0;
+    interrupts.serialOut = header[52] != 0;
+    interrupts.levels = header[53] & 0x1F;
+    interrupts.enabledBeforeTrap = header[54] != 0;
+    interrupts.trapTaken = header[55] != 0;
+    interrupts.intrVector = get16(header + 56);
+
+    file->base = baseImage;
+    base = std::move(baseImage);
+    memory = std::make_shared<MemoryImage>(pages, std::move(file));
+    return true;
+}
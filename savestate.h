@@ -0,0 +1,60 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "guestmemory.h"
+#include "interrupts.h"
+
+// A machine frozen at an instruction boundary: registers, flags, halt and
+// interrupt state, T-state count, the interrupt unit and all 64KB of memory.
+// Taken with CPU8085::saveState() and applied with restoreState().
+//
+// Memory is a MemoryImage that shares every unchanged page with `base`, the
+// image the CPU had when the state was taken (null for all zeros). Taking a
+// state copies only the changed pages, and restoring one into paged memory
+// maps it copy-on-write, so it costs O(pages written) either way. Restoring
+// also makes it the CPU's image, which reset() then returns to.
+//
+// The memory map, I/O bus, devices and pending events are the host's wiring
+// of the board. They are not saved, and restoring leaves them as they are.
+//
+// File format, little-endian, version 1:
+//   0    8  magic "8085SAV\0"
+//   8    4  version
+//   12   4  number of stored pages
+//   16   8  FNV-1a hash of the 64KB base contents
+//   24   8  A B C D E H L PSW
+//   32   4  SP PC
+//   36   4  halted, interrupt enable, EI delay, 0
+//   40   8  T-states
+//   48  10  interrupt unit: masks, RST 7.5 latch, TRAP armed, SID, SOD, line
+//           levels, IE before TRAP, TRAP taken, INTR vector (16 bits)
+//   64  32  bitmap of stored pages (bit n of byte n/8)
+//   256     the stored pages, 256 bytes each in page order: those that differ
+//           from the base
+// load() maps the file with mmap where available; the memory image points
+// into the mapping, so pages are only read from disk when they are touched.
+class SaveState {
+public:
+    static const uint32_t kVersion = 1;
+
+    uint8_t A = 0, B = 0, C = 0, D = 0, E = 0, H = 0, L = 0;
+    uint8_t psw = 0;
+    uint16_t SP = 0, PC = 0;
+    bool halted = false;
+    bool interruptEnabled = false;
+    bool enableDelay = false;  // EI just ran with a request pending
+    uint64_t cycles = 0;
+    InterruptUnit interrupts;
+    std::shared_ptr<const MemoryImage> memory;
+    std::shared_ptr<const MemoryImage> base;
+
+    // Stores the pages of memory that differ from base
+    bool save(const std::string& path, std::string& error) const;
+    // base has to have the contents the file was saved against
+    bool load(const std::string& path, std::shared_ptr<const MemoryImage> base, std::string& error);
+};
+
+#endif // SAVESTATE_H
@@ -0,0 +1,36 @@
+#include "scheduler.h"
+#include <algorithm>
+
+EventScheduler::EventScheduler()
+    : changed(false), nextId(1), clock(&noClock), noClock(0) {
+}
+
+EventScheduler::EventId EventScheduler::schedule(uint64_t due, EventFn fn, void* context) {
+    if (due < nextDue()) changed = true;
+    EventId id = nextId++;
+    queue.push_back({due, id, fn, context});
+    std::push_heap(queue.begin(), queue.end(), later);
+    return id;
+}
+
+bool EventScheduler::cancel(EventId id) {
+    auto it = std::find_if(queue.begin(), queue.end(), [id](const Event& e) { return e.id == id; });
+    if (it == queue.end()) return false;
+    queue.erase(it);
+    std::make_heap(queue.begin(), queue.end(), later);
+    return true;
+}
+
+void EventScheduler::clear() {
+    queue.clear();
+    changed = true;
+}
+
+void EventScheduler::fireDue(uint64_t cycle) {
+    while (!queue.empty() && queue.front().due <= cycle) {
+        std::pop_heap(queue.begin(), queue.end(), later);
+        Event event = queue.back();
+        queue.pop_back();
+        event.fn(event.context, event.due);
+    }
+}
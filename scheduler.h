@@ -0,0 +1,61 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+#include <vector>
+
+// Device events ordered by the CPU cycle they are due at. The CPU runs up to
+// the earliest one, so an event fires at the first instruction boundary at or
+// after its cycle rather than whenever a batch happens to end; a halted CPU
+// skips straight to it. Events due at the same cycle fire in the order they
+// were scheduled.
+class EventScheduler {
+public:
+    using EventFn = void (*)(void* context, uint64_t due);
+    using EventId = uint64_t;
+
+    EventScheduler();
+
+    // The CPU's cycle counter, read by now()
+    void setClock(const uint64_t* cycles) { clock = cycles; }
+    uint64_t now() const { return *clock; }
+
+    // fn(context, due) runs once at cycle due; returns an id for cancel()
+    EventId schedule(uint64_t due, EventFn fn, void* context);
+    EventId scheduleIn(uint64_t delay, EventFn fn, void* context) {
+        return schedule(now() + delay, fn, context);
+    }
+    // False if the event already fired or was cancelled
+    bool cancel(EventId id);
+    void clear();
+
+    bool empty() const { return queue.empty(); }
+    // Cycle of the earliest event, UINT64_MAX when there is none
+    uint64_t nextDue() const { return queue.empty() ? UINT64_MAX : queue.front().due; }
+    // Fires every event due at or before cycle, including ones scheduled by
+    // the handlers themselves
+    void fireDue(uint64_t cycle);
+
+    // Set when an event is scheduled ahead of all others, which may be
+    // earlier than where the CPU planned to stop
+    bool changed;
+
+private:
+    struct Event {
+        uint64_t due;
+        EventId id;  // Also the scheduling order
+        EventFn fn;
+        void* context;
+    };
+    // Min-heap on (due, id)
+    static bool later(const Event& a, const Event& b) {
+        return a.due != b.due ? a.due > b.due : a.id > b.id;
+    }
+
+    std::vector<Event> queue;
+    EventId nextId;
+    const uint64_t* clock;
+    uint64_t noClock;
+};
+
+#endif // SCHEDULER_H
@@ -0,0 +1,3368 @@
+#include "selftest.h"
+#include "assembler.h"
+#include "cpu8085.h"
+#include "benchmark.h"
+#include "batch.h"
+#include "devices.h"
+#include "emulationthread.h"
+#include "loader.h"
+#include "lockstep.h"
+#include "multicpu.h"
+#include "opcodes.h"
+#include "savestate.h"
+#include "superopt.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kMaxReportedMismatches = 10;
+
+// Patches the operand of an ADI inside the block that is running, so a
+// stale predecoded copy would add 0 every time. C ends up as 1+2+...+16.
+const uint8_t selfModifyingProgram[] = {
+    0x06, 0x10,        // 0000: MVI B, 10h
+    0x21, 0x0A, 0x00,  // 0002: LXI H, 000Ah    ; ADI operand
+    0x0E, 0x00,        // 0005: MVI C, 00h
+    0x34,              // 0007: LOOP: INR M
+    0x79,              // 0008: MOV A, C
+    0xC6, 0x00,        // 0009: ADI 00h
+    0x4F,              // 000B: MOV C, A
+    0x05,              // 000C: DCR B
+    0xC2, 0x07, 0x00,  // 000D: JNZ LOOP
+    0x76               // 0010: HLT
+};
+const uint8_t kSelfModifyingResult = 0x88;
+
+// MOV M,r and MOV r,M for every register, SHLD and LHLD, sixteen times so
+// the JIT compiles them. B, D and H live in the high halves of host
+// registers, which guest memory moves must not encode as bpl/sil/dil.
+const uint8_t memoryMoveProgram[] = {
+    0x06, 0x11,        // 0000: MVI B, 11h
+    0x0E, 0x22,        // 0002: MVI C, 22h
+    0x16, 0x33,        // 0004: MVI D, 33h
+    0x1E, 0x44,        // 0006: MVI E, 44h
+    0x3E, 0x55,        // 0008: MVI A, 55h
+    0x21, 0x00, 0x30,  // 000A: LXI H, 3000h
+    0x36, 0x10,        // 000D: MVI M, 10h      ; passes
+    0x21, 0x00, 0x20,  // 000F: LOOP: LXI H, 2000h
+    0x70, 0x23,        // 0012: MOV M, B / INX H
+    0x71, 0x23,        // 0014: MOV M, C / INX H
+    0x72, 0x23,        // 0016: MOV M, D / INX H
+    0x73, 0x23,        // 0018: MOV M, E / INX H
+    0x74, 0x23,        // 001A: MOV M, H / INX H
+    0x75, 0x23,        // 001C: MOV M, L / INX H
+    0x77,              // 001E: MOV M, A
+    0x21, 0x01, 0x20,  // 001F: LXI H, 2001h
+    0x46, 0x23,        // 0022: MOV B, M / INX H
+    0x4E, 0x23,        // 0024: MOV C, M / INX H
+    0x56, 0x23,        // 0026: MOV D, M / INX H
+    0x5E,              // 0028: MOV E, M
+    0x04, 0x0C,        // 0029: INR B / INR C
+    0x14, 0x1C,        // 002B: INR D / INR E
+    0x22, 0x00, 0x22,  // 002D: SHLD 2200h
+    0x2A, 0x02, 0x20,  // 0030: LHLD 2002h
+    0x22, 0x02, 0x22,  // 0033: SHLD 2202h
+    0x2A, 0x00, 0x22,  // 0036: LHLD 2200h
+    0x6E,              // 0039: MOV L, M
+    0x66,              // 003A: MOV H, M
+    0x22, 0x04, 0x22,  // 003B: SHLD 2204h
+    0x21, 0x06, 0x20,  // 003E: LXI H, 2006h
+    0x7E,              // 0041: MOV A, M
+    0x80,              // 0042: ADD B
+    0x21, 0x00, 0x30,  // 0043: LXI H, 3000h
+    0x35,              // 0046: DCR M
+    0xC2, 0x0F, 0x00,  // 0047: JNZ LOOP
+    0x76               // 004A: HLT
+};
+// Some twenty times what the program needs
+const uint64_t kMemoryMoveCycles = 100000;
+
+// Patches its first instruction and jumps back to it, so the patched copy is
+// what gets cached. After a reset the original must run again; a stale copy
+// would go straight to HLT.
+const uint8_t patchOnceProgram[] = {
+    0x3E, 0x00,        // 0000: MVI A, 00h       ; operand patched to 01h
+    0xB7,              // 0002: ORA A
+    0xC2, 0x0E, 0x00,  // 0003: JNZ DONE
+    0x3E, 0x01,        // 0006: MVI A, 01h
+    0x32, 0x01, 0x00,  // 0008: STA 0001h
+    0xC3, 0x00, 0x00,  // 000B: JMP 0000h
+    0x76               // 000E: DONE: HLT
+};
+
+// Lockstep verification compares all of memory after every block, so the
+// workloads only run for a while
+const uint64_t kJitVerifyCycles = 200000;
+
+// Writes and reads a port, for the I/O hooks
+const uint8_t portProgram[] = {
+    0x3E, 0x34,        // 0000: MVI A, 34h
+    0xD3, 0x12,        // 0002: OUT 12h
+    0xDB, 0x13,        // 0004: IN 13h
+    0x76               // 0006: HLT
+};
+
+// Sleeps in HLT between RST 7.5 interrupts from an interval timer at port
+// 40h (period 1000 T-states) until the handler at 003Ch has counted five
+const uint8_t timerProgram[] = {
+    0x31, 0x00, 0x10,  // 0000: LXI SP, 1000h
+    0x3E, 0x0B,        // 0003: MVI A, 0Bh      ; unmask RST 7.5 only
+    0x30,              // 0005: SIM
+    0x3E, 0xE8,        // 0006: MVI A, E8h
+    0xD3, 0x40,        // 0008: OUT 40h         ; reload 03E8h
+    0x3E, 0x03,        // 000A: MVI A, 03h
+    0xD3, 0x41,        // 000C: OUT 41h
+    0xD3, 0x42,        // 000E: OUT 42h         ; run, interrupt
+    0xFB,              // 0010: WAIT: EI
+    0x76,              // 0011: HLT
+    0x78,              // 0012: MOV A, B
+    0xFE, 0x05,        // 0013: CPI 05h
+    0xC2, 0x10, 0x00,  // 0015: JNZ WAIT
+    0xAF,              // 0018: XRA A
+    0xD3, 0x42,        // 0019: OUT 42h         ; stop
+    0x76,              // 001B: HLT
+};
+const uint16_t kTimerHandler = 0x003C;
+const uint8_t timerHandler[] = {
+    0x04,              // 003C: INR B
+    0xC9,              // 003D: RET
+};
+// Timer started at T=55, fifth expiry at 5055, then handler and exit path
+const uint64_t kTimerEndCycles = 5055 + 12 + 4 + 10 + 4 + 7 + 7 + 4 + 10 + 5;
+
+// Every interrupt source is raised before the run; each handler reports its
+// number to port F0h (which drops that source) and returns. TRAP comes first
+// and its EI lets INTR in; SIM then unmasks RST 7.5 and 6.5 but not 5.5,
+// which RIM shows as pending until a second SIM unmasks it too.
+const uint16_t kPriorityStart = 0x0050;
+const uint8_t priorityProgram[] = {
+    0x3E, 0x09,        // 0050: MVI A, 09h      ; mask RST 5.5 only
+    0x30,              // 0052: SIM
+    0x00,              // 0053: NOP
+    0x20,              // 0054: RIM
+    0x32, 0x00, 0x01,  // 0055: STA 0100h
+    0x3E, 0x08,        // 0058: MVI A, 08h      ; unmask all
+    0x30,              // 005A: SIM
+    0x00,              // 005B: NOP
+    0xF3,              // 005C: DI
+    0x76,              // 005D: HLT
+};
+const uint8_t kPriorityOrder[] = {1, 5, 2, 3, 4};
+// I5.5 and M5.5; IE reads clear, as it was before the TRAP, since this is
+// the first RIM after it
+const uint8_t kPriorityRim = 0x11;
+
+// Echoes one received byte plus one from a UART at ports 50h/51h, then
+// sends '!', which waits in the holding register
+const uint8_t uartProgram[] = {
+    0xDB, 0x51,        // 0000: POLL: IN 51h
+    0xE6, 0x01,        // 0002: ANI 01h
+    0xCA, 0x00, 0x00,  // 0004: JZ POLL
+    0xDB, 0x50,        // 0007: IN 50h
+    0x3C,              // 0009: INR A
+    0xD3, 0x50,        // 000A: OUT 50h
+    0x3E, 0x21,        // 000C: MVI A, '!'
+    0xD3, 0x50,        // 000E: OUT 50h
+    0x76,              // 0010: HLT
+};
+
+// Registers, flags and T-states of any core specialization
+template <class Cpu>
+std::string stateOf(const Cpu& cpu) {
+    return cpu.getRegisterState() + " " + cpu.getFlagsState() + " T:" + std::to_string(cpu.cycles);
+}
+
+// Contents of a tmpfile() from the start
+std::string readAll(std::FILE* file) {
+    std::string text;
+    std::rewind(file);
+    char buffer[4096];
+    size_t count;
+    while ((count = std::fread(buffer, 1, sizeof(buffer), file)) > 0) text.append(buffer, count);
+    return text;
+}
+
+} // namespace
+
+namespace {
+
+// Reference model of the documented 8085 ALU, written from the manual rather
+// than from the core. The ALU only adds: subtraction adds the complement of
+// the operand with the carry in inverted, and CY is the inverted carry out.
+// AC is the carry out of bit 3 of that addition, so INR adds 01h and DCR
+// FFh. ANA sets AC, XRA and ORA clear it, and all three clear CY; INR and
+// DCR keep CY. Each operation is tabulated once, an entry holding the result
+// in its high byte and the PSW in its low byte.
+struct ReferenceALU {
+    uint16_t group[8][0x20000];  // ADD ADC SUB SBB ANA XRA ORA CMP; by CY << 16 | A << 8 | operand
+    uint16_t step[2][256];       // INR, DCR; PSW less CY
+    uint16_t daa[0x400];         // By AC << 9 | CY << 8 | A
+    uint16_t rotate[4][0x200];   // RLC RRC RAL RAR; by CY << 8 | A, PSW is CY alone
+
+    ReferenceALU();
+};
+
+struct Sum {
+    uint8_t value;
+    bool carry, half;  // Out of bits 7 and 3
+};
+
+Sum adder(uint8_t a, uint8_t b, bool carryIn) {
+    int sum = a + b + carryIn;
+    return {static_cast<uint8_t>(sum), sum > 0xFF, (a & 0x0F) + (b & 0x0F) + carryIn > 0x0F};
+}
+
+uint8_t signZeroParity(uint8_t value) {
+    int ones = 0;
+    for (int bit = 0; bit < 8; bit++) ones += (value >> bit) & 1;
+    return (value & 0x80 ? CPU8085::Flags::SIGN : 0) | (value == 0 ? CPU8085::Flags::ZERO : 0) |
+           (ones % 2 == 0 ? CPU8085::Flags::PARITY : 0) | CPU8085::Flags::ALWAYS_ONE;
+}
+
+uint16_t tableEntry(int result, int psw) {
+    return static_cast<uint16_t>((result & 0xFF) << 8 | psw);
+}
+
+ReferenceALU::ReferenceALU() {
+    typedef CPU8085::Flags F;
+    for (int index = 0; index < 0x20000; index++) {
+        bool cy = index >> 16;
+        uint8_t a = static_cast<uint8_t>(index >> 8), v = static_cast<uint8_t>(index);
+        for (int op = 0; op < 8; op++) {
+            uint8_t result, psw;
+            if (op <= 1) {
+                Sum sum = adder(a, v, op == 1 && cy);
+                result = sum.value;
+                psw = signZeroParity(result) | (sum.half ? F::AUX_CARRY : 0) | (sum.carry ? F::CARRY : 0);
+            } else if (op <= 3 || op == 7) {
+                Sum sum = adder(a, static_cast<uint8_t>(~v), !(op == 3 && cy));
+                result = op == 7 ? a : sum.value;
+                psw = signZeroParity(sum.value) | (sum.half ? F::AUX_CARRY : 0) | (sum.carry ? 0 : F::CARRY);
+            } else if (op == 4) {
+                result = a & v;
+                psw = signZeroParity(result) | F::AUX_CARRY;
+            } else {
+                result = op == 5 ? a ^ v : a | v;
+                psw = signZeroParity(result);
+            }
+            group[op][index] = tableEntry(result, psw);
+        }
+    }
+
+    for (int v = 0; v < 256; v++) {
+        Sum up = adder(static_cast<uint8_t>(v), 0x01, false);
+        Sum down = adder(static_cast<uint8_t>(v), 0xFF, false);
+        step[0][v] = tableEntry(up.value, signZeroParity(up.value) | (up.half ? F::AUX_CARRY : 0));
+        step[1][v] = tableEntry(down.value, signZeroParity(down.value) | (down.half ? F::AUX_CARRY : 0));
+    }
+
+    // The manual's two steps. The first can carry out of bit 7, which the
+    // second sees as a high digit over 9.
+    for (int index = 0; index < 0x400; index++) {
+        bool ac = (index >> 9) & 1, cy = (index >> 8) & 1, half = false;
+        int value = index & 0xFF;
+        if ((value & 0x0F) > 9 || ac) {
+            half = (value & 0x0F) + 0x06 > 0x0F;
+            value += 0x06;
+        }
+        if ((value >> 4) > 9 || cy) {
+            value += 0x60;
+            cy = cy || value > 0xFF;  // Otherwise unaffected
+        }
+        daa[index] = tableEntry(value, signZeroParity(static_cast<uint8_t>(value)) |
+                                           (half ? F::AUX_CARRY : 0) | (cy ? F::CARRY : 0));
+    }
+
+    for (int index = 0; index < 0x200; index++) {
+        int cy = index >> 8, a = index & 0xFF;
+        rotate[0][index] = tableEntry(a << 1 | a >> 7, a >> 7);
+        rotate[1][index] = tableEntry(a >> 1 | a << 7, a & 1);
+        rotate[2][index] = tableEntry(a << 1 | cy, a >> 7);
+        rotate[3][index] = tableEntry(a >> 1 | cy << 7, a & 1);
+    }
+}
+
+const ReferenceALU& referenceALU() {
+    static const ReferenceALU tables;
+    return tables;
+}
+
+// Inputs and outputs of one ALU instruction: the operand is the register, M
+// or immediate it reads, or the register INR/DCR changes
+struct AluCase {
+    uint8_t a, operand, psw;
+};
+
+AluCase expectedAlu(uint8_t opcode, AluCase in) {
+    typedef CPU8085::Flags F;
+    const ReferenceALU& alu = referenceALU();
+    int cy = in.psw & F::CARRY;
+    int field = (opcode >> 3) & 7;
+    AluCase out = in;
+    if ((opcode & 0xC0) == 0x80 || (opcode & 0xC7) == 0xC6) {
+        uint16_t entry = alu.group[field][cy << 16 | in.a << 8 | in.operand];
+        out.a = entry >> 8;
+        out.psw = entry & 0xFF;
+        if ((opcode & 0xC7) == 0x87) out.operand = out.a;  // The source is A
+    } else if ((opcode & 0xC6) == 0x04) {
+        uint16_t entry = alu.step[opcode & 1][in.operand];
+        out.operand = entry >> 8;
+        out.psw = (entry & 0xFF) | cy;
+        if (field == 7) out.a = out.operand;
+    } else if (field < 4) {
+        uint16_t entry = alu.rotate[field][cy << 8 | in.a];
+        out.a = entry >> 8;
+        out.psw = (in.psw & ~F::CARRY) | (entry & 0xFF);
+    } else if (field == 4) {
+        uint16_t entry = alu.daa[((in.psw & F::AUX_CARRY) ? 0x200 : 0) | cy << 8 | in.a];
+        out.a = entry >> 8;
+        out.psw = entry & 0xFF;
+    } else if (field == 5) {
+        out.a = ~in.a;  // CMA
+    } else {
+        out.psw = field == 6 ? in.psw | F::CARRY : in.psw ^ F::CARRY;  // STC, CMC
+    }
+    return out;
+}
+
+// Every ALU instruction that works on 8-bit values: the ALU group on each
+// register, M and immediates, INR and DCR on each, the rotates, DAA, CMA,
+// STC and CMC
+std::vector<uint8_t> aluConformanceOpcodes() {
+    std::vector<uint8_t> opcodes;
+    for (int opcode = 0x80; opcode < 0xC0; opcode++) opcodes.push_back(static_cast<uint8_t>(opcode));
+    for (int field = 0; field < 8; field++) {
+        opcodes.push_back(static_cast<uint8_t>(0xC6 | field << 3));
+        opcodes.push_back(static_cast<uint8_t>(0x04 | field << 3));
+        opcodes.push_back(static_cast<uint8_t>(0x05 | field << 3));
+        opcodes.push_back(static_cast<uint8_t>(0x07 | field << 3));
+    }
+    return opcodes;
+}
+
+// The instruction under test sits at kAluCode followed by HLT. Immediates
+// get a copy per operand value, kAluStride bytes apart, so no case stores
+// into code. M is kAluOperand; the other registers start from kAluRegisters
+// (by opcode field, B C D E H L - A) and must come back unchanged.
+const uint16_t kAluCode = 0x1000;
+const uint16_t kAluStride = 4;
+const uint16_t kAluOperand = 0x8000;
+const uint8_t kAluRegisters[8] = {0x12, 0x34, 0x56, 0x78, 0x80, 0x00, 0x00, 0x9A};
+
+// Runs every case of opcode on cpu. Returns the cases; mismatches go to
+// report, which gets the engine name, opcode and case.
+template <class Report>
+uint64_t checkAluOpcode(CPU8085& cpu, uint8_t opcode, Report report) {
+    typedef CPU8085::Flags F;
+    bool immediate = (opcode & 0xC7) == 0xC6;
+    bool group = (opcode & 0xC0) == 0x80 || immediate;
+    bool step = (opcode & 0xC6) == 0x04;
+    // Register field of the operand, 8 for an immediate and 9 for none
+    int field = immediate ? 8 : group ? opcode & 7 : step ? (opcode >> 3) & 7 : 9;
+    bool readsA = !step || field == 7;
+    bool readsOperand = field != 9 && field != 7;
+
+    if (immediate) {
+        for (int v = 0; v < 256; v++) {
+            uint16_t at = static_cast<uint16_t>(kAluCode + v * kAluStride);
+            cpu.setMemory(at, opcode);
+            cpu.setMemory(static_cast<uint16_t>(at + 1), static_cast<uint8_t>(v));
+            cpu.setMemory(static_cast<uint16_t>(at + 2), 0x76);
+        }
+    } else {
+        cpu.setMemory(kAluCode, opcode);
+        cpu.setMemory(kAluCode + 1, 0x76);
+    }
+    uint8_t* const regs[8] = {&cpu.B, &cpu.C, &cpu.D, &cpu.E, &cpu.H, &cpu.L, nullptr, &cpu.A};
+
+    uint64_t cases = 0;
+    for (int flagBits = 0; flagBits < 32; flagBits++) {
+        // Spread the five flag bits over their PSW positions
+        uint8_t psw = F::ALWAYS_ONE | ((flagBits & 0x01) ? F::CARRY : 0) | ((flagBits & 0x02) ? F::PARITY : 0) |
+                      ((flagBits & 0x04) ? F::AUX_CARRY : 0) | ((flagBits & 0x08) ? F::ZERO : 0) |
+                      ((flagBits & 0x10) ? F::SIGN : 0);
+        for (int a = 0; a < (readsA ? 256 : 1); a++) {
+            for (int v = 0; v < (readsOperand ? 256 : 1); v++) {
+                AluCase in = {readsA ? static_cast<uint8_t>(a) : kAluRegisters[7], static_cast<uint8_t>(v), psw};
+                if (field == 7) in.operand = in.a;
+                else if (field < 8 && !readsOperand) in.operand = kAluRegisters[field];
+                AluCase out = expectedAlu(opcode, in);
+
+                for (int r = 0; r < 8; r++) {
+                    if (regs[r]) *regs[r] = kAluRegisters[r];
+                }
+                cpu.A = in.a;
+                if (field == 6) cpu.setMemory(kAluOperand, in.operand);
+                else if (field < 6) *regs[field] = in.operand;
+                cpu.flags.psw = psw;
+                cpu.halted = false;
+                cpu.PC = static_cast<uint16_t>(kAluCode + (immediate ? v * kAluStride : 0));
+                uint16_t end = static_cast<uint16_t>(cpu.PC + (immediate ? 3 : 2));
+                cpu.run(UINT64_MAX);
+                cases++;
+
+                bool same = cpu.A == out.a && cpu.flags.psw == out.psw && cpu.halted && cpu.PC == end;
+                for (int r = 0; r < 6; r++) {
+                    same = same && *regs[r] == (r == field ? out.operand : kAluRegisters[r]);
+                }
+                if (field == 6) same = same && cpu.getMemory(kAluOperand) == out.operand;
+                if (!same) {
+                    uint8_t operand = field == 6 ? cpu.getMemory(kAluOperand) : field < 8 ? *regs[field] : in.operand;
+                    report(in, out, AluCase{cpu.A, operand, cpu.flags.psw});
+                }
+            }
+        }
+    }
+    return cases;
+}
+
+} // namespace
+
+bool runAluConformanceCheck(std::ostream& log, unsigned threads) {
+    referenceALU();
+    std::vector<uint8_t> opcodes = aluConformanceOpcodes();
+    const std::vector<CPU8085::Engine>& engines = allEngines();
+    size_t items = opcodes.size() * engines.size();
+
+    std::atomic<size_t> next(0);
+    std::atomic<uint64_t> cases(0), mismatches(0);
+    std::mutex logLock;
+    auto work = [&] {
+        for (size_t item; (item = next++) < items;) {
+            CPU8085::Engine engine = engines[item / opcodes.size()];
+            uint8_t opcode = opcodes[item % opcodes.size()];
+            CPU8085 cpu(engine);
+            auto report = [&](AluCase in, AluCase expected, AluCase got) {
+                if (mismatches++ >= kMaxReportedMismatches) return;
+                std::lock_guard<std::mutex> guard(logLock);
+                log << std::hex << std::uppercase << std::setfill('0') << CPU8085::engineName(engine) << " "
+                    << kOpcodes[opcode].mnemonic << " (" << std::setw(2) << (int)opcode << "h) A=" << std::setw(2)
+                    << (int)in.a << " operand=" << std::setw(2) << (int)in.operand << " PSW=" << std::setw(2)
+                    << (int)in.psw << ": got A=" << std::setw(2) << (int)got.a << " operand=" << std::setw(2)
+                    << (int)got.operand << " PSW=" << std::setw(2) << (int)got.psw << ", expected A="
+                    << std::setw(2) << (int)expected.a << " operand=" << std::setw(2) << (int)expected.operand
+                    << " PSW=" << std::setw(2) << (int)expected.psw << std::dec << std::setfill(' ') << "\n";
+            };
+            cases += checkAluOpcode(cpu, opcode, report);
+        }
+    };
+
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>(items)));
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++) pool.emplace_back(work);
+    work();
+    for (std::thread& thread : pool) thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    log << "alu conformance: " << opcodes.size() << " opcodes x " << engines.size() << " engines, " << cases
+        << " cases on " << threads << (threads == 1 ? " thread in " : " threads in ") << std::fixed
+        << std::setprecision(1) << seconds << " s"
+        << std::defaultfloat << ", " << mismatches << " mismatches\n";
+    return mismatches == 0;
+}
+
+namespace {
+
+// The documented instruction set on a flat 64KB, for the exerciser, with the
+// ALU from ReferenceALU: no interrupts, ports or T-states. Registers are kept
+// by opcode field, B C D E H L - A, so reg[6] is unused.
+struct ReferenceCPU {
+    uint8_t reg[8] = {};
+    uint8_t psw = CPU8085::Flags::ALWAYS_ONE;
+    uint16_t sp = 0, pc = 0;
+    bool halted = false;
+    std::vector<uint8_t> memory = std::vector<uint8_t>(0x10000);
+
+    void setMemory(uint16_t address, uint8_t value) { memory[address] = value; }
+    // BC DE HL SP
+    uint16_t pair(int rp) const { return rp == 3 ? sp : static_cast<uint16_t>(reg[rp * 2] << 8 | reg[rp * 2 + 1]); }
+    void setPair(int rp, uint16_t value) {
+        if (rp == 3) {
+            sp = value;
+        } else {
+            reg[rp * 2] = value >> 8;
+            reg[rp * 2 + 1] = value & 0xFF;
+        }
+    }
+    // A register or M
+    uint8_t& operand(int field) { return field == 6 ? memory[pair(2)] : reg[field]; }
+    uint8_t fetch() { return memory[pc++]; }
+    uint16_t fetchWord() {
+        uint8_t low = fetch();
+        return static_cast<uint16_t>(fetch() << 8 | low);
+    }
+    void push(uint16_t value) {
+        memory[--sp] = value >> 8;
+        memory[--sp] = value & 0xFF;
+    }
+    uint16_t pop() {
+        uint8_t low = memory[sp++];
+        return static_cast<uint16_t>(memory[sp++] << 8 | low);
+    }
+    // NZ Z NC C PO PE P M
+    bool condition(int cc) const {
+        static const uint8_t flag[] = {CPU8085::Flags::ZERO, CPU8085::Flags::CARRY, CPU8085::Flags::PARITY,
+                                       CPU8085::Flags::SIGN};
+        return ((psw & flag[cc >> 1]) != 0) == (cc & 1);
+    }
+    // false, before executing anything, on an instruction outside the model
+    bool step();
+};
+
+bool ReferenceCPU::step() {
+    typedef CPU8085::Flags F;
+    const ReferenceALU& alu = referenceALU();
+    uint8_t opcode = memory[pc];
+    int field = (opcode >> 3) & 7, low = opcode & 7, rp = (opcode >> 4) & 3;
+    int cy = psw & F::CARRY;
+    uint8_t& a = reg[7];
+
+    switch (opcode) {  // The odd ones out
+        case 0x00: pc++; return true;                                   // NOP
+        case 0x76: pc++; halted = true; return true;                    // HLT
+        case 0x02: case 0x12: pc++; memory[pair(rp)] = a; return true;  // STAX
+        case 0x0A: case 0x1A: pc++; a = memory[pair(rp)]; return true;  // LDAX
+        case 0x22: {                                                    // SHLD
+            pc++;
+            uint16_t address = fetchWord();
+            memory[address] = reg[5];
+            memory[static_cast<uint16_t>(address + 1)] = reg[4];
+            return true;
+        }
+        case 0x2A: {                                                    // LHLD
+            pc++;
+            uint16_t address = fetchWord();
+            reg[5] = memory[address];
+            reg[4] = memory[static_cast<uint16_t>(address + 1)];
+            return true;
+        }
+        case 0x32: pc++; memory[fetchWord()] = a; return true;          // STA
+        case 0x3A: pc++; a = memory[fetchWord()]; return true;          // LDA
+        case 0xC3: pc++; pc = fetchWord(); return true;                 // JMP
+        case 0xC9: pc = pop(); return true;                             // RET
+        case 0xCD: {                                                    // CALL
+            pc++;
+            uint16_t target = fetchWord();
+            push(pc);
+            pc = target;
+            return true;
+        }
+        case 0xE3: {                                                    // XTHL
+            pc++;
+            uint16_t top = static_cast<uint16_t>(memory[static_cast<uint16_t>(sp + 1)] << 8 | memory[sp]);
+            memory[sp] = reg[5];
+            memory[static_cast<uint16_t>(sp + 1)] = reg[4];
+            setPair(2, top);
+            return true;
+        }
+        case 0xE9: pc = pair(2); return true;                           // PCHL
+        case 0xEB: {                                                    // XCHG
+            pc++;
+            uint16_t de = pair(1);
+            setPair(1, pair(2));
+            setPair(2, de);
+            return true;
+        }
+        case 0xF9: pc++; sp = pair(2); return true;                     // SPHL
+    }
+
+    switch (opcode >> 6) {
+        case 0:
+            if (low == 1) {
+                pc++;
+                if (opcode & 0x08) {  // DAD
+                    int sum = pair(2) + pair(rp);
+                    setPair(2, static_cast<uint16_t>(sum));
+                    psw = static_cast<uint8_t>((psw & ~F::CARRY) | (sum > 0xFFFF ? F::CARRY : 0));
+                } else {  // LXI
+                    setPair(rp, fetchWord());
+                }
+                return true;
+            }
+            if (low == 3) {  // INX, DCX
+                pc++;
+                setPair(rp, static_cast<uint16_t>(pair(rp) + (opcode & 0x08 ? -1 : 1)));
+                return true;
+            }
+            if (low == 4 || low == 5) {  // INR, DCR
+                pc++;
+                uint16_t entry = alu.step[low & 1][operand(field)];
+                operand(field) = entry >> 8;
+                psw = static_cast<uint8_t>((entry & 0xFF) | cy);
+                return true;
+            }
+            if (low == 6) {  // MVI
+                pc++;
+                uint8_t value = fetch();
+                operand(field) = value;
+                return true;
+            }
+            if (low == 7) {  // Rotates, DAA, CMA, STC, CMC
+                pc++;
+                AluCase out = expectedAlu(opcode, AluCase{a, 0, psw});
+                a = out.a;
+                psw = out.psw;
+                return true;
+            }
+            return false;  // RIM, SIM and the undocumented ones
+        case 1: {  // MOV
+            pc++;
+            uint8_t value = operand(low);
+            operand(field) = value;
+            return true;
+        }
+        case 2: {  // ALU group
+            pc++;
+            uint16_t entry = alu.group[field][cy << 16 | a << 8 | operand(low)];
+            a = entry >> 8;
+            psw = entry & 0xFF;
+            return true;
+        }
+    }
+
+    switch (low) {
+        case 0:  // Rcc
+            pc++;
+            if (condition(field)) pc = pop();
+            return true;
+        case 1:  // POP
+            if (opcode & 0x08) return false;
+            pc++;
+            if (rp == 3) {
+                uint16_t value = pop();
+                a = value >> 8;
+                psw = static_cast<uint8_t>((value & F::ALL) | F::ALWAYS_ONE);
+            } else {
+                setPair(rp, pop());
+            }
+            return true;
+        case 2: {  // Jcc
+            pc++;
+            uint16_t target = fetchWord();
+            if (condition(field)) pc = target;
+            return true;
+        }
+        case 4: {  // Ccc
+            pc++;
+            uint16_t target = fetchWord();
+            if (condition(field)) {
+                push(pc);
+                pc = target;
+            }
+            return true;
+        }
+        case 5:  // PUSH
+            if (opcode & 0x08) return false;
+            pc++;
+            push(rp == 3 ? static_cast<uint16_t>(a << 8 | psw) : pair(rp));
+            return true;
+        case 6: {  // ALU immediates
+            pc++;
+            uint16_t entry = alu.group[field][cy << 16 | a << 8 | fetch()];
+            a = entry >> 8;
+            psw = entry & 0xFF;
+            return true;
+        }
+        case 7:  // RST
+            pc++;
+            push(pc);
+            pc = static_cast<uint16_t>(field * 8);
+            return true;
+    }
+    return false;  // IN, OUT, EI, DI and the undocumented ones
+}
+
+// An instruction exerciser after the classic 8080 ones: each test sweeps a
+// group of instructions over random states and folds every register, flag,
+// the stack pointer and the memory around the test stack into a CRC-32,
+// computed by the guest. The instruction under test is stored into LOAD's
+// page before each pass, so the engines also keep dropping that page's code.
+const char kExerciserSource[] =
+    "STATE   EQU 2000h           ; F A C B E D L H, 2FFEh-3001h, instruction\n"
+    "OUTBUF  EQU 2010h           ; F A C B E D L H, SP, 2FFEh-3001h, taken\n"
+    "TAKENS  EQU OUTBUF + 14\n"
+    "CRC     EQU 2020h\n"
+    "SEED    EQU 2024h\n"
+    "DESC    EQU 2026h           ; Base bytes of the test, masks after them\n"
+    "COUNT   EQU 2028h\n"
+    "TPTR    EQU 202Ah\n"
+    "RPTR    EQU 202Ch\n"
+    "VAL     EQU 202Eh\n"
+    "TESTS   EQU 2100h           ; Iterations, 15 base and 15 mask bytes each\n"
+    "RESULTS EQU 2600h           ; CRC of each test\n"
+    "TABLE   EQU 2800h\n"
+    "TSTACK  EQU 3000h           ; Stack and memory operand of the tests\n"
+    "STACK   EQU 4000h\n"
+    "\n"
+    "        ORG 0               ; Every RST is taken to TAKEN\n"
+    "        JMP TAKEN\n"
+    "        ORG 8\n"
+    "        JMP TAKEN\n"
+    "        ORG 10h\n"
+    "        JMP TAKEN\n"
+    "        ORG 18h\n"
+    "        JMP TAKEN\n"
+    "        ORG 20h\n"
+    "        JMP TAKEN\n"
+    "        ORG 28h\n"
+    "        JMP TAKEN\n"
+    "        ORG 30h\n"
+    "        JMP TAKEN\n"
+    "        ORG 38h\n"
+    "        JMP TAKEN\n"
+    "\n"
+    "        ORG 40h             ; Jumps, calls and returns that are taken\n"
+    "TAKEN:  PUSH PSW\n"
+    "        LDA TAKENS\n"
+    "        INR A\n"
+    "        STA TAKENS\n"
+    "        POP PSW\n"
+    "        JMP SAVE\n"
+    "\n"
+    "START:  LXI SP, STACK\n"
+    "        CALL MKTABLE\n"
+    "        LXI H, TESTS\n"
+    "        SHLD TPTR\n"
+    "        LXI H, RESULTS\n"
+    "        SHLD RPTR\n"
+    "NEXT:   LHLD TPTR\n"
+    "        MOV A, M\n"
+    "        INX H\n"
+    "        ORA M\n"
+    "        JZ DONE\n"
+    "        DCX H\n"
+    "        CALL TEST\n"
+    "        LHLD TPTR\n"
+    "        LXI D, 32\n"
+    "        DAD D\n"
+    "        SHLD TPTR\n"
+    "        JMP NEXT\n"
+    "DONE:   HLT\n"
+    "\n"
+    "TEST:   MOV E, M            ; HL points to the test\n"
+    "        INX H\n"
+    "        MOV D, M\n"
+    "        INX H\n"
+    "        SHLD DESC\n"
+    "        XCHG\n"
+    "        SHLD COUNT\n"
+    "        LXI H, 0FFFFh\n"
+    "        SHLD CRC\n"
+    "        SHLD CRC + 2\n"
+    "ITER:   CALL MKSTATE\n"
+    "        LHLD STATE + 8\n"
+    "        SHLD TSTACK - 2\n"
+    "        LHLD STATE + 10\n"
+    "        SHLD TSTACK\n"
+    "        LHLD STATE + 12\n"
+    "        SHLD SLOT\n"
+    "        LDA STATE + 14\n"
+    "        STA SLOT + 2\n"
+    "        XRA A\n"
+    "        STA TAKENS\n"
+    "        JMP LOAD\n"
+    "SAVE:   SHLD OUTBUF + 6\n"
+    "        PUSH PSW\n"
+    "        POP H\n"
+    "        SHLD OUTBUF\n"
+    "        LXI H, 0\n"
+    "        DAD SP\n"
+    "        SHLD OUTBUF + 8\n"
+    "        XCHG\n"
+    "        SHLD OUTBUF + 4\n"
+    "        MOV L, C\n"
+    "        MOV H, B\n"
+    "        SHLD OUTBUF + 2\n"
+    "        LXI SP, STACK - 2   ; Back to TEST's return address\n"
+    "        LHLD TSTACK - 2\n"
+    "        SHLD OUTBUF + 10\n"
+    "        LHLD TSTACK\n"
+    "        SHLD OUTBUF + 12\n"
+    "        LXI H, OUTBUF\n"
+    "        MVI C, 15\n"
+    "        CALL CRCBLK\n"
+    "        LHLD COUNT\n"
+    "        DCX H\n"
+    "        SHLD COUNT\n"
+    "        MOV A, H\n"
+    "        ORA L\n"
+    "        JNZ ITER\n"
+    "        LHLD RPTR\n"
+    "        XCHG\n"
+    "        LXI H, CRC\n"
+    "        MVI B, 4\n"
+    "TEST1:  MOV A, M\n"
+    "        STAX D\n"
+    "        INX H\n"
+    "        INX D\n"
+    "        DCR B\n"
+    "        JNZ TEST1\n"
+    "        XCHG\n"
+    "        SHLD RPTR\n"
+    "        RET\n"
+    "\n"
+    "MKSTATE: LHLD DESC          ; STATE = base ^ (random & mask)\n"
+    "        LXI D, STATE\n"
+    "        MVI B, 15\n"
+    "MKS1:   CALL RAND\n"
+    "        MOV C, A\n"
+    "        PUSH H\n"
+    "        PUSH D\n"
+    "        LXI D, 15\n"
+    "        DAD D\n"
+    "        POP D\n"
+    "        MOV A, C\n"
+    "        ANA M\n"
+    "        POP H\n"
+    "        XRA M\n"
+    "        STAX D\n"
+    "        INX H\n"
+    "        INX D\n"
+    "        DCR B\n"
+    "        JNZ MKS1\n"
+    "        RET\n"
+    "\n"
+    "RAND:   PUSH H              ; SEED = SEED * 5 + 3619h, A = its high byte\n"
+    "        PUSH D\n"
+    "        LHLD SEED\n"
+    "        MOV D, H\n"
+    "        MOV E, L\n"
+    "        DAD H\n"
+    "        DAD H\n"
+    "        DAD D\n"
+    "        LXI D, 3619h\n"
+    "        DAD D\n"
+    "        SHLD SEED\n"
+    "        MOV A, H\n"
+    "        POP D\n"
+    "        POP H\n"
+    "        RET\n"
+    "\n"
+    "CRCBLK: MOV A, M            ; C bytes from HL into CRC\n"
+    "        CALL CRCB\n"
+    "        INX H\n"
+    "        DCR C\n"
+    "        JNZ CRCBLK\n"
+    "        RET\n"
+    "\n"
+    "CRCB:   PUSH H              ; CRC = CRC >> 8 ^ TABLE[CRC ^ A & 0FFh]\n"
+    "        PUSH D\n"
+    "        PUSH B\n"
+    "        LXI H, CRC\n"
+    "        XRA M\n"
+    "        MOV L, A\n"
+    "        MVI H, 0\n"
+    "        DAD H\n"
+    "        DAD H\n"
+    "        LXI D, TABLE\n"
+    "        DAD D\n"
+    "        XCHG\n"
+    "        LXI H, CRC\n"
+    "        MVI B, 3\n"
+    "CRCB1:  INX H\n"
+    "        MOV A, M\n"
+    "        XCHG\n"
+    "        XRA M\n"
+    "        INX H\n"
+    "        XCHG\n"
+    "        DCX H\n"
+    "        MOV M, A\n"
+    "        INX H\n"
+    "        DCR B\n"
+    "        JNZ CRCB1\n"
+    "        LDAX D\n"
+    "        MOV M, A\n"
+    "        POP B\n"
+    "        POP D\n"
+    "        POP H\n"
+    "        RET\n"
+    "\n"
+    "MKTABLE: LXI H, TABLE       ; CRC-32 of each byte, polynomial EDB88320h\n"
+    "        MVI C, 0\n"
+    "MKT1:   MOV A, C\n"
+    "        STA VAL\n"
+    "        XRA A\n"
+    "        STA VAL + 1\n"
+    "        STA VAL + 2\n"
+    "        STA VAL + 3\n"
+    "        MVI B, 8\n"
+    "MKT2:   PUSH H\n"
+    "        LXI H, VAL + 3\n"
+    "        XRA A\n"
+    "        MOV A, M\n"
+    "        RAR\n"
+    "        MOV M, A\n"
+    "        DCX H\n"
+    "        MOV A, M\n"
+    "        RAR\n"
+    "        MOV M, A\n"
+    "        DCX H\n"
+    "        MOV A, M\n"
+    "        RAR\n"
+    "        MOV M, A\n"
+    "        DCX H\n"
+    "        MOV A, M\n"
+    "        RAR\n"
+    "        MOV M, A\n"
+    "        JNC MKT3\n"
+    "        MOV A, M\n"
+    "        XRI 20h\n"
+    "        MOV M, A\n"
+    "        INX H\n"
+    "        MOV A, M\n"
+    "        XRI 83h\n"
+    "        MOV M, A\n"
+    "        INX H\n"
+    "        MOV A, M\n"
+    "        XRI 0B8h\n"
+    "        MOV M, A\n"
+    "        INX H\n"
+    "        MOV A, M\n"
+    "        XRI 0EDh\n"
+    "        MOV M, A\n"
+    "MKT3:   POP H\n"
+    "        DCR B\n"
+    "        JNZ MKT2\n"
+    "        LXI D, VAL\n"
+    "        MVI B, 4\n"
+    "MKT4:   LDAX D\n"
+    "        MOV M, A\n"
+    "        INX H\n"
+    "        INX D\n"
+    "        DCR B\n"
+    "        JNZ MKT4\n"
+    "        INR C\n"
+    "        JNZ MKT1\n"
+    "        RET\n"
+    "\n"
+    "        ORG 1000h           ; Alone in its page, since SLOT is patched\n"
+    "LOAD:   LXI SP, STATE\n"
+    "        POP PSW\n"
+    "        POP B\n"
+    "        POP D\n"
+    "        POP H\n"
+    "        LXI SP, TSTACK\n"
+    "SLOT:   DB 0, 0, 0\n"
+    "        JMP SAVE\n";
+
+const uint16_t kExerciserResults = 0x2600;
+const int kExerciserIterations = 1024;
+
+// One exerciser test. Each pass sets the 15 state bytes, F A C B E D L H,
+// 2FFEh-3001h around the test stack and the three instruction bytes, to
+// base ^ (random & mask). M is 3000h or 3001h; jumps, calls and returns
+// go to TAKEN at 0040h and RSTs reach it through their vectors.
+struct ExerciserTest {
+    const char* name;
+    uint8_t base[15];
+    uint8_t mask[15];
+};
+
+const ExerciserTest kExerciserTestList[] = {
+    //                F     A     C     B     E     D     L     H    2FFE  2FFF  3000  3001  op    i1    i2
+    {"aluop nn",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC6, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x38, 0xFF, 0x00}},
+    {"aluop <b,c,d,e,h,l,m,a>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x3F, 0x00, 0x00}},
+    {"<daa,cma,stc,cmc>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x27, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x18, 0x00, 0x00}},
+    {"<inr,dcr> <b,c,d,e,h,l,m,a>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x39, 0x00, 0x00}},
+    {"<inx,dcx> <b,d,h,sp>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x38, 0x00, 0x00}},
+    {"dad <b,d,h,sp>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x09, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x30, 0x00, 0x00}},
+    {"lxi <b,d>,nnnn",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x10, 0xFF, 0xFF}},
+    {"lxi h,nnnn",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x21, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0xFF, 0xFF}},
+    {"lxi sp,nnnn",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x31, 0x00, 0x30},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x03, 0x00}},
+    {"mvi <b,c,d,e,h,l,m,a>,nn",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0x06, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x38, 0xFF, 0x00}},
+    {"mov <b,c,d,e>,<b,c,d,e,h,l,m,a>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x1F, 0x00, 0x00}},
+    {"mov <h,l>,<b,c,d,e,h,l,m,a>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0x60, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F, 0x00, 0x00}},
+    {"mov a,<b,c,d,e,h,l,m,a>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0x78, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x07, 0x00, 0x00}},
+    {"mov m,<b,c,d,e>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0x70, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x03, 0x00, 0x00}},
+    {"mov m,<h,l>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0x74, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0x00, 0x00}},
+    {"mov m,a",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0x77, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00}},
+    {"<shld,lhld,sta,lda> nnnn",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x22, 0xFE, 0x2F},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x18, 0x01, 0x00}},
+    {"<stax,ldax> <b,d>",
+     {0x02, 0x00, 0x00, 0x30, 0xFE, 0x2F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00},
+     {0xD5, 0xFF, 0x01, 0x00, 0x01, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x18, 0x00, 0x00}},
+    {"<rlc,rrc,ral,rar>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x18, 0x00, 0x00}},
+    {"push <b,d,h,psw>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC5, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x30, 0x00, 0x00}},
+    {"pop <b,d,h,psw>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC1, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x30, 0x00, 0x00}},
+    {"<xthl,xchg>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xE3, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x08, 0x00, 0x00}},
+    {"sphl",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0xF9, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x03, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00}},
+    {"pchl",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0xE9, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00}},
+    {"jmp nnnn",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC3, 0x40, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00}},
+    {"j<cc> nnnn",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC2, 0x40, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x38, 0x00, 0x00}},
+    {"call nnnn",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xCD, 0x40, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00}},
+    {"c<cc> nnnn",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC4, 0x40, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x38, 0x00, 0x00}},
+    {"ret",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0xC9, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00}},
+    {"r<cc>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0xC0, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x38, 0x00, 0x00}},
+    {"rst <0-7>",
+     {0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC7, 0x00, 0x00},
+     {0xD5, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x38, 0x00, 0x00}},
+};
+
+// The harness followed by the test table
+std::string exerciserSource() {
+    std::ostringstream source;
+    source << kExerciserSource << "\n        ORG TESTS\n";
+    source << std::hex << std::uppercase << std::setfill('0');
+    for (const ExerciserTest& test : kExerciserTestList) {
+        source << "        DW " << std::dec << kExerciserIterations << std::hex << "      ; " << test.name << "\n";
+        for (const uint8_t* bytes : {test.base, test.mask}) {
+            source << "        DB ";
+            for (int i = 0; i < 15; i++) source << (i ? ", " : "") << "0" << std::setw(2) << (int)bytes[i] << "h";
+            source << "\n";
+        }
+    }
+    source << "        DW 0\n        END START\n";
+    return source.str();
+}
+
+// CRC of each test, from memory after the exerciser halted
+template <class Memory>
+std::vector<uint32_t> exerciserResults(Memory read) {
+    std::vector<uint32_t> crcs;
+    for (size_t test = 0; test < std::size(kExerciserTestList); test++) {
+        uint32_t crc = 0;
+        for (int i = 3; i >= 0; i--) crc = crc << 8 | read(static_cast<uint16_t>(kExerciserResults + test * 4 + i));
+        crcs.push_back(crc);
+    }
+    return crcs;
+}
+
+// Generous for the exerciser, which runs for about 400M T-states
+const uint64_t kExerciserBudget = 4000000000ull;
+
+} // namespace
+
+bool runExerciserCheck(std::ostream& log, unsigned threads) {
+    Assembler assembler;
+    AssembledProgram program;
+    if (!assembler.assemble(exerciserSource(), program)) {
+        log << "exerciser: " << program.errorText("exerciser") << "\n";
+        return false;
+    }
+
+    // The reference model, then each engine, on whichever thread is free
+    const std::vector<CPU8085::Engine>& engines = allEngines();
+    size_t runs = engines.size() + 1;
+    std::vector<std::vector<uint32_t>> results(runs);
+    std::vector<std::string> errors(runs);
+    std::atomic<size_t> next(0);
+    auto work = [&] {
+        for (size_t run; (run = next++) < runs;) {
+            if (run == 0) {
+                ReferenceCPU cpu;
+                program.loadInto(cpu);
+                cpu.pc = program.entryPoint();
+                while (!cpu.halted) {
+                    if (!cpu.step()) {
+                        std::ostringstream text;
+                        text << "reference model stopped at " << std::hex << cpu.pc << "h on opcode "
+                             << (int)cpu.memory[cpu.pc] << "h";
+                        errors[run] = text.str();
+                        break;
+                    }
+                }
+                results[run] = exerciserResults([&](uint16_t address) { return cpu.memory[address]; });
+            } else {
+                CPU8085 cpu(engines[run - 1]);
+                program.loadInto(cpu);
+                cpu.PC = program.entryPoint();
+                cpu.run(kExerciserBudget);
+                if (!cpu.halted) errors[run] = std::string(CPU8085::engineName(engines[run - 1])) + " engine did not finish";
+                results[run] = exerciserResults([&](uint16_t address) { return cpu.getMemory(address); });
+            }
+        }
+    };
+
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>(runs)));
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++) pool.emplace_back(work);
+    work();
+    for (std::thread& thread : pool) thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool ok = true;
+    for (const std::string& error : errors) {
+        if (error.empty()) continue;
+        log << "exerciser: " << error << "\n";
+        ok = false;
+    }
+    size_t failed = 0;
+    for (size_t test = 0; test < std::size(kExerciserTestList); test++) {
+        bool same = true;
+        for (size_t run = 1; run < runs; run++) same = same && results[run][test] == results[0][test];
+        if (same) continue;
+        failed++;
+        log << std::hex << std::uppercase << std::setfill('0') << "exerciser: " << kExerciserTestList[test].name
+            << ": CRC " << std::setw(8) << results[0][test] << " expected,";
+        for (size_t run = 1; run < runs; run++) {
+            log << " " << CPU8085::engineName(engines[run - 1]) << " " << std::setw(8) << results[run][test];
+        }
+        log << std::dec << std::setfill(' ') << "\n";
+    }
+    ok = ok && failed == 0;
+    log << "exerciser: " << std::size(kExerciserTestList) << " tests x " << kExerciserIterations
+        << " passes on the reference model and " << engines.size() << " engines, " << threads
+        << (threads == 1 ? " thread in " : " threads in ")
+        << std::fixed << std::setprecision(1) << seconds << " s" << std::defaultfloat << ", "
+        << (ok ? "all CRCs match" : "MISMATCH") << "\n";
+    return ok;
+}
+
+bool runEngineEquivalenceCheck(std::ostream& log) {
+    bool ok = true;
+    for (const Workload& workload : builtinWorkloads()) {
+        CPU8085 reference(CPU8085::Engine::Switch);
+        reference.loadProgram(workload.program, workload.size, 0x0000);
+        reference.run(UINT64_MAX);
+
+        for (CPU8085::Engine engine : allEngines()) {
+            CPU8085 cpu(engine);
+            cpu.loadProgram(workload.program, workload.size, 0x0000);
+            cpu.takeWrittenPages();
+            cpu.run(UINT64_MAX);
+
+            bool same = cpu.getRegisterState() == reference.getRegisterState() &&
+                        cpu.flags.psw == reference.flags.psw &&
+                        cpu.cycles == reference.cycles &&
+                        cpu.halted == reference.halted &&
+                        cpu.memory == reference.memory;
+            if (!same) {
+                log << workload.name << ": " << CPU8085::engineName(engine)
+                    << " engine disagrees with the switch engine\n";
+                ok = false;
+            }
+
+            // Every page the program changed must be marked written
+            std::bitset<256> written = cpu.takeWrittenPages();
+            CPU8085 loaded;
+            loaded.loadProgram(workload.program, workload.size, 0x0000);
+            for (int page = 0; page < 256; page++) {
+                bool changed = std::memcmp(cpu.memory.page(page), loaded.memory.page(page), 256) != 0;
+                if (changed && !written[page]) {
+                    log << workload.name << ": " << CPU8085::engineName(engine)
+                        << " engine did not mark page " << page << " written\n";
+                    ok = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (CPU8085::Engine engine : allEngines()) {
+        CPU8085 cpu(engine);
+        cpu.loadProgram(selfModifyingProgram, sizeof(selfModifyingProgram), 0x0000);
+        cpu.run(UINT64_MAX);
+        if (cpu.C != kSelfModifyingResult || !cpu.halted) {
+            log << "self-modifying code: " << CPU8085::engineName(engine)
+                << " engine ended with C=" << (int)cpu.C
+                << ", expected " << (int)kSelfModifyingResult << "\n";
+            ok = false;
+        }
+    }
+
+    CPU8085 reference(CPU8085::Engine::Switch);
+    reference.loadProgram(memoryMoveProgram, sizeof(memoryMoveProgram), 0x0000);
+    reference.run(kMemoryMoveCycles);
+    for (CPU8085::Engine engine : allEngines()) {
+        CPU8085 cpu(engine);
+        cpu.loadProgram(memoryMoveProgram, sizeof(memoryMoveProgram), 0x0000);
+        cpu.run(kMemoryMoveCycles);
+        bool same = cpu.getRegisterState() == reference.getRegisterState() &&
+                    cpu.flags.psw == reference.flags.psw &&
+                    cpu.cycles == reference.cycles &&
+                    cpu.halted == reference.halted &&
+                    cpu.memory == reference.memory;
+        if (!same) {
+            log << "memory moves: " << CPU8085::engineName(engine)
+                << " engine disagrees with the switch engine\n";
+            ok = false;
+        }
+    }
+    log << "engine equivalence: " << builtinWorkloads().size() << " workloads + self-modifying code + memory moves x "
+        << allEngines().size() << " engines, " << (ok ? "all identical" : "MISMATCH") << "\n";
+    return ok;
+}
+
+bool runJitVerifyCheck(std::ostream& log) {
+    if (!CPU8085::hasJit()) {
+        log << "jit verification: no JIT on this platform, skipped\n";
+        return true;
+    }
+    bool ok = true;
+    size_t programs = 0;
+    auto verify = [&](const char* name, const uint8_t* program, size_t size) {
+        CPU8085 cpu(CPU8085::Engine::Jit);
+        cpu.setJitVerify(true);
+        cpu.loadProgram(program, size, 0x0000);
+        cpu.run(kJitVerifyCycles);
+        programs++;
+        if (!cpu.jitVerifyError().empty()) {
+            log << name << ": " << cpu.jitVerifyError() << "\n";
+            ok = false;
+        }
+    };
+    for (const Workload& workload : builtinWorkloads()) {
+        verify(workload.name, workload.program, workload.size);
+    }
+    verify("self-modifying code", selfModifyingProgram, sizeof(selfModifyingProgram));
+    verify("memory moves", memoryMoveProgram, sizeof(memoryMoveProgram));
+    log << "jit verification: " << programs << " programs, "
+        << (ok ? "every block matched the interpreter" : "MISMATCH") << "\n";
+    return ok;
+}
+
+bool runPagedMemoryCheck(std::ostream& log) {
+    struct Program {
+        const char* name;
+        const uint8_t* bytes;
+        size_t size;
+    };
+    std::vector<Program> programs;
+    for (const Workload& workload : builtinWorkloads()) {
+        programs.push_back({workload.name, workload.program, workload.size});
+    }
+    programs.push_back({"self-modifying code", selfModifyingProgram, sizeof(selfModifyingProgram)});
+    programs.push_back({"patch once", patchOnceProgram, sizeof(patchOnceProgram)});
+
+    bool ok = true;
+    for (const Program& program : programs) {
+        CPU8085 reference(CPU8085::Engine::Switch);
+        reference.loadProgram(program.bytes, program.size, 0x0000);
+        reference.run(UINT64_MAX);
+
+        auto image = std::make_shared<MemoryImage>(program.bytes, program.size, 0x0000);
+        CPU8085 pristine(CPU8085::Engine::Switch);
+        pristine.loadProgram(program.bytes, program.size, 0x0000);
+
+        for (CPU8085::Engine engine : allEngines()) {
+            CPU8085 cpu(engine);
+            cpu.memory.setMode(GuestMemory::Mode::Paged);
+            cpu.setMemoryImage(image);
+            // The second pass starts from reset(), which must also drop code
+            // cached from pages the first pass wrote
+            for (int pass = 0; pass < 2; pass++) {
+                cpu.reset();
+                if (cpu.memory != pristine.memory) {
+                    log << program.name << ": reset did not restore the image\n";
+                    ok = false;
+                }
+                cpu.run(UINT64_MAX);
+                bool same = cpu.getRegisterState() == reference.getRegisterState() &&
+                            cpu.flags.psw == reference.flags.psw &&
+                            cpu.cycles == reference.cycles &&
+                            cpu.halted == reference.halted &&
+                            cpu.memory == reference.memory;
+                if (!same) {
+                    log << program.name << ": " << CPU8085::engineName(engine)
+                        << " engine with paged memory disagrees with flat memory (pass "
+                        << pass + 1 << ")\n";
+                    ok = false;
+                }
+            }
+        }
+
+        CPU8085 fresh(CPU8085::Engine::Switch);
+        fresh.memory.setMode(GuestMemory::Mode::Paged);
+        fresh.setMemoryImage(image);
+        if (fresh.memory != pristine.memory) {
+            log << program.name << ": a write reached the shared image\n";
+            ok = false;
+        }
+
+        // copyFrom takes the image along in both layouts, so reset() after
+        // it restores the source's image rather than the destination's
+        GuestMemory source(GuestMemory::Mode::Paged);
+        source.setImage(image);
+        source.poke(0x8000, 0x55);
+        for (GuestMemory::Mode mode : {GuestMemory::Mode::Flat, GuestMemory::Mode::Paged}) {
+            GuestMemory copy(mode);
+            copy.poke(0x0000, 0xAA);
+            copy.copyFrom(source);
+            bool copied = copy == source && copy.getImage() == image;
+            copy.reset();
+            if (!copied || copy != pristine.memory) {
+                const char* layout = mode == GuestMemory::Mode::Flat ? "flat" : "paged";
+                log << program.name << ": copyFrom then reset in " << layout
+                    << " memory did not restore the source's image\n";
+                ok = false;
+            }
+        }
+    }
+    log << "paged memory: " << programs.size() << " programs x " << allEngines().size()
+        << " engines, " << (ok ? "all match flat memory" : "MISMATCH") << "\n";
+    return ok;
+}
+
+bool runEmulationThreadCheck(std::ostream& log) {
+    using Clock = std::chrono::steady_clock;
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "emulation thread: " << what << "\n";
+        ok = false;
+    };
+    auto waitFor = [](EmulationThread& emulator, CpuSnapshot& frame, bool (*done)(const CpuSnapshot&)) {
+        Clock::time_point limit = Clock::now() + std::chrono::seconds(10);
+        do {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            emulator.snapshot(frame);
+        } while (!done(frame) && Clock::now() < limit);
+        return done(frame);
+    };
+
+    EmulationThread emulator;
+    CpuSnapshot frame;
+
+    // Full-speed run to HLT
+    const Workload& workload = builtinWorkloads().front();
+    CPU8085 reference;
+    reference.loadProgram(workload.program, workload.size, 0x0000);
+    reference.run(UINT64_MAX);
+    emulator.load(std::vector<uint8_t>(workload.program, workload.program + workload.size), 0x0000);
+    emulator.run();
+    if (!waitFor(emulator, frame, [](const CpuSnapshot& f) { return f.halted; })) {
+        fail("run did not reach HLT");
+    } else if (frame.running || frame.cycles != reference.cycles || frame.PC != reference.PC ||
+               frame.psw != reference.flags.psw || frame.B != reference.B || frame.E != reference.E) {
+        fail("run ended in a different state than a direct run");
+    }
+
+    // Memory pages reach the viewer copy as written
+    static std::array<uint8_t, 65536> viewed;
+    emulator.takeMemory(viewed);
+    const Workload& copier = builtinWorkloads()[1];
+    CPU8085 copied;
+    copied.loadProgram(copier.program, copier.size, 0x0000);
+    copied.run(UINT64_MAX);
+    emulator.load(std::vector<uint8_t>(copier.program, copier.program + copier.size), 0x0000);
+    emulator.run();
+    waitFor(emulator, frame, [](const CpuSnapshot& f) { return f.halted; });
+    emulator.takeMemory(viewed);
+    for (int page = 0; page < 256; page++) {
+        if (std::memcmp(&viewed[page * 256], copied.memory.page(page), 256) != 0) {
+            fail("memory page " + std::to_string(page) + " differs from a direct run");
+            break;
+        }
+    }
+
+    // Single step
+    emulator.load(std::vector<uint8_t>(workload.program, workload.program + workload.size), 0x0000);
+    emulator.step();
+    emulator.sync();
+    emulator.snapshot(frame);
+    if (frame.PC != 0x0002 || frame.E != workload.program[1] || frame.running) {
+        fail("step did not execute exactly one instruction");
+    }
+
+    // Stop latency on an endless loop, flat out and at 10 Hz
+    const std::vector<uint8_t> endless = {0xC3, 0x00, 0x00};  // JMP 0000h
+    for (double clockHz : {0.0, 10.0}) {
+        emulator.setClock(clockHz);
+        emulator.load(endless, 0x0000);
+        emulator.run();
+        if (!waitFor(emulator, frame, [](const CpuSnapshot& f) { return f.running; })) {
+            fail("run did not start");
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        Clock::time_point asked = Clock::now();
+        emulator.stop();
+        emulator.sync();
+        double latency = std::chrono::duration<double>(Clock::now() - asked).count();
+        emulator.snapshot(frame);
+        if (frame.running || latency > 0.25) {
+            fail("stop took " + std::to_string(latency) + " s at " + std::to_string(clockHz) + " Hz");
+        }
+        if (clockHz > 0.0 && frame.cycles > 10) {
+            fail("a 10 Hz run executed " + std::to_string(frame.cycles) + " T-states in 20 ms");
+        }
+    }
+
+    log << "emulation thread: run, step and stop " << (ok ? "behave" : "MISBEHAVE") << "\n";
+    return ok;
+}
+
+bool runBatchCheck(std::ostream& log) {
+    const std::vector<Workload>& workloads = builtinWorkloads();
+    std::vector<BatchImage> images;
+    for (const Workload& workload : workloads) {
+        BatchImage image;
+        image.name = workload.name;
+        image.memory = std::make_shared<MemoryImage>(workload.program, workload.size, 0x0000);
+        images.push_back(image);
+    }
+
+    // Per image: a full run, a run with the first operand byte patched to 1
+    // (every workload starts with MVI/LXI), and one stopped by a cycle limit.
+    // Jobs on one image run back to back, so workers reuse its mapping.
+    std::vector<BatchJob> jobs;
+    std::vector<const Workload*> sources;
+    for (size_t w = 0; w < images.size(); w++) {
+        for (int variant = 0; variant < 3; variant++) {
+            BatchJob job;
+            job.image = &images[w];
+            sources.push_back(&workloads[w]);
+            if (variant == 1) job.inputs.push_back({0x0001, {0x01}});
+            if (variant == 2) job.limits.maxCycles = 100000;
+            jobs.push_back(job);
+        }
+    }
+
+    BatchOptions options;
+    options.threads = 4;
+    options.outputAddress = 0x3000;
+    options.outputLength = 2;
+    BatchRunner runner(options);
+    runner.run(jobs);
+
+    bool ok = true;
+    CPU8085 cpu;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const BatchJob& job = jobs[i];
+        cpu.reset();
+        cpu.loadProgram(sources[i]->program, sources[i]->size, 0x0000);
+        for (const BatchInput& input : job.inputs) cpu.setMemory(input.address, input.bytes[0]);
+        cpu.run(job.limits.maxCycles);
+
+        const BatchResult& r = runner.results()[i];
+        const uint8_t* out = runner.outputOf(i);
+        bool same = r.cycles == cpu.cycles && r.PC == cpu.PC && r.SP == cpu.SP &&
+                    r.A == cpu.A && r.B == cpu.B && r.C == cpu.C && r.D == cpu.D &&
+                    r.E == cpu.E && r.H == cpu.H && r.L == cpu.L && r.psw == cpu.flags.psw &&
+                    (r.exit == BatchExit::Halted) == cpu.halted &&
+                    out[0] == cpu.memory[0x3000] && out[1] == cpu.memory[0x3001];
+        if (!same) {
+            log << "batch job " << i << " (" << job.image->name << ") differs from a sequential run\n";
+            ok = false;
+        }
+    }
+    log << "batch: " << jobs.size() << " jobs on " << runner.threadCount()
+        << (runner.threadCount() == 1 ? " thread, " : " threads, ")
+        << (ok ? "all match sequential runs" : "MISMATCH") << "\n";
+    return ok;
+}
+
+bool runPolicyCheck(std::ostream& log) {
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "policies: " << what << "\n";
+        ok = false;
+    };
+
+    for (const Workload& workload : builtinWorkloads()) {
+        // Reference instruction count and the state after kLimit instructions
+        const uint64_t kLimit = 1000;
+        CPU8085 reference(CPU8085::Engine::Switch);
+        reference.loadProgram(workload.program, workload.size, 0x0000);
+        std::string limited;
+        uint64_t steps = 0;
+        while (!reference.halted) {
+            reference.step();
+            if (++steps == kLimit) limited = stateOf(reference);
+        }
+
+        for (CPU8085::Engine engine : allEngines()) {
+            std::string where = std::string(workload.name) + " on " + CPU8085::engineName(engine);
+            CountingCPU8085 counted(engine);
+            counted.loadProgram(workload.program, workload.size, 0x0000);
+            counted.run(UINT64_MAX);
+            if (stateOf(counted) != stateOf(reference) || counted.memory != reference.memory ||
+                counted.instructions != steps) {
+                fail(where + ": counting core disagrees with the plain core");
+            }
+
+            counted.reset();
+            counted.instructions = 0;
+            counted.instructionLimit = kLimit;
+            counted.loadProgram(workload.program, workload.size, 0x0000);
+            counted.run(UINT64_MAX);
+            if (counted.instructions != kLimit || stateOf(counted) != limited) {
+                fail(where + ": instruction limit stopped at the wrong instruction");
+            }
+        }
+    }
+
+    // Breakpoint on the DCR B after each inner loop, hit twice in a row
+    const Workload& loop = builtinWorkloads()[0];
+    const uint16_t kBreakAt = 0x000A;
+    CPU8085 reference(CPU8085::Engine::Switch);
+    reference.loadProgram(loop.program, loop.size, 0x0000);
+    std::string hits[2];
+    for (std::string& hit : hits) {
+        do {
+            reference.step();
+        } while (reference.PC != kBreakAt);
+        hit = stateOf(reference);
+    }
+    for (CPU8085::Engine engine : allEngines()) {
+        DebugCPU8085 cpu(engine);
+        cpu.addBreakpoint(kBreakAt);
+        cpu.loadProgram(loop.program, loop.size, 0x0000);
+        for (const std::string& hit : hits) {
+            cpu.run(UINT64_MAX);
+            if (stateOf(cpu) != hit) {
+                fail(std::string("breakpoint on ") + CPU8085::engineName(engine) + " stopped at the wrong place");
+                break;
+            }
+        }
+    }
+
+    // Port hooks and the trace must not depend on the engine
+    std::string firstTrace;
+    for (CPU8085::Engine engine : allEngines()) {
+        TracingCPU8085 cpu(engine);
+        std::FILE* file = std::tmpfile();
+        if (!file) {
+            fail("cannot create a temporary trace file");
+            break;
+        }
+        cpu.traceFile = file;
+        cpu.loadProgram(portProgram, sizeof(portProgram), 0x0000);
+        cpu.run(UINT64_MAX);
+        std::string trace = readAll(file);
+        std::fclose(file);
+        if (firstTrace.empty()) firstTrace = trace;
+        if (cpu.instructions != 4 || trace != firstTrace ||
+            trace.find("OUT 12 <- 34") == std::string::npos ||
+            trace.find("IN  13 -> FF") == std::string::npos) {
+            fail(std::string("trace on ") + CPU8085::engineName(engine) + " is wrong:\n" + trace);
+        }
+    }
+
+    log << "policies: counting, limit, breakpoint and trace cores x " << allEngines().size()
+        << " engines, " << (ok ? "all match the plain core" : "MISMATCH") << "\n";
+    return ok;
+}
+
+namespace {
+
+// Port F0h of the priority program: logs a handler and drops its source
+struct InterruptLog {
+    InterruptUnit* interrupts;
+    std::string order;
+
+    static void write(void* context, uint8_t, uint8_t value) {
+        InterruptLog& log = *static_cast<InterruptLog*>(context);
+        log.order += static_cast<char>(value);
+        static const InterruptUnit::Line lines[] = {InterruptUnit::Trap, InterruptUnit::Rst75,
+                                                    InterruptUnit::Rst65, InterruptUnit::Rst55,
+                                                    InterruptUnit::Intr};
+        if (value >= 1 && value <= 5) log.interrupts->setLine(lines[value - 1], false);
+    }
+};
+
+} // namespace
+
+bool runDeviceCheck(std::ostream& log) {
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "devices: " << what << "\n";
+        ok = false;
+    };
+
+    std::string firstUart;
+    for (CPU8085::Engine engine : allEngines()) {
+        std::string where = std::string(" on ") + CPU8085::engineName(engine);
+
+        CPU8085 cpu(engine);
+        IntervalTimer timer;
+        timer.attach(cpu, 0x40);
+        cpu.loadProgram(timerHandler, sizeof(timerHandler), kTimerHandler);
+        cpu.loadProgram(timerProgram, sizeof(timerProgram), 0x0000);
+        cpu.run(UINT64_MAX);
+        if (cpu.B != 5 || !cpu.stopped() || timer.expiries != 5 || cpu.cycles != kTimerEndCycles) {
+            fail("timer program" + where + " ended as " + stateOf(cpu));
+        }
+
+        cpu.reset();
+        cpu.io.clear();
+        InterruptLog handlers = {&cpu.interrupts, ""};
+        cpu.io.mapOutput(0xF0, InterruptLog::write, &handlers);
+        cpu.loadProgram(priorityProgram, sizeof(priorityProgram), kPriorityStart);
+        const uint16_t vectors[] = {0x0024, 0x003C, 0x0034, 0x002C, 0x0008};
+        for (uint8_t source = 1; source <= 5; source++) {
+            const uint8_t handler[] = {0x3E, source, 0xD3, 0xF0, 0xFB, 0xC9};  // MVI A; OUT F0h; EI; RET
+            cpu.loadProgram(handler, sizeof(handler), vectors[source - 1]);
+        }
+        cpu.PC = kPriorityStart;
+        cpu.SP = 0x1000;
+        cpu.interrupts.setLine(InterruptUnit::Trap, true);
+        cpu.interrupts.pulse(InterruptUnit::Rst75);
+        cpu.interrupts.setLine(InterruptUnit::Rst65, true);
+        cpu.interrupts.setLine(InterruptUnit::Rst55, true);
+        cpu.interrupts.setLine(InterruptUnit::Intr, true, 0x0008);
+        cpu.run(UINT64_MAX);
+        std::string expected(kPriorityOrder, kPriorityOrder + sizeof(kPriorityOrder));
+        if (handlers.order != expected || cpu.memory[0x0100] != kPriorityRim || !cpu.stopped()) {
+            fail("interrupt priority" + where + " is wrong");
+        }
+
+        cpu.reset();
+        cpu.io.clear();
+        Uart uart(3.072e6, 9600);
+        std::string sent;
+        uart.output = [&sent](uint8_t byte) { sent += static_cast<char>(byte); };
+        uart.attach(cpu, 0x50);
+        const uint8_t input = 'a';
+        uart.receive(&input, 1);
+        cpu.loadProgram(uartProgram, sizeof(uartProgram), 0x0000);
+        cpu.run(UINT64_MAX);
+        std::string result = sent + " " + stateOf(cpu);
+        if (firstUart.empty()) firstUart = result;
+        if (sent != "b!" || !cpu.stopped() || cpu.cycles < 3 * uart.frameCycles() || result != firstUart) {
+            fail("uart program" + where + " ended as " + result);
+        }
+    }
+
+    log << "devices: timer, interrupt priority and uart x " << allEngines().size() << " engines, "
+        << (ok ? "all as expected" : "MISMATCH") << "\n";
+    return ok;
+}
+
+namespace {
+
+// Device page at 3000h: reads return the inverted address low byte, except a
+// RET at 3010h; writes are logged and raise TRAP
+struct MappedDevice {
+    InterruptUnit* interrupts;
+    uint16_t lastAddress;
+    uint8_t lastValue;
+    int reads;
+
+    static uint8_t read(void* context, uint16_t address) {
+        MappedDevice& device = *static_cast<MappedDevice*>(context);
+        device.reads++;
+        return address == 0x3010 ? 0xC9 : static_cast<uint8_t>(~address);
+    }
+    static void write(void* context, uint16_t address, uint8_t value) {
+        MappedDevice& device = *static_cast<MappedDevice*>(context);
+        device.lastAddress = address;
+        device.lastValue = value;
+        device.interrupts->setLine(InterruptUnit::Trap, true);
+    }
+};
+
+const uint8_t memoryMapProgram[] = {
+    0x31, 0x00, 0x20,  // LXI SP,2000h
+    0xCD, 0x10, 0x30,  // CALL 3010h      ; RET fetched from the device
+    0x21, 0x00, 0x10,  // LXI H,1000h
+    0x36, 0x55,        // MVI M,55h       ; ROM, ignored
+    0x7E,              // MOV A,M
+    0x32, 0x00, 0x20,  // STA 2000h
+    0x3A, 0x01, 0x30,  // LDA 3001h       ; device read
+    0x32, 0x01, 0x20,  // STA 2001h
+    0x3E, 0xAA,        // MVI A,AAh
+    0x32, 0x02, 0x30,  // STA 3002h       ; device write, raises TRAP
+    0x32, 0x03, 0x20,  // STA 2003h       ; must not run before the handler
+    0x76,              // HLT
+};
+const uint8_t memoryMapTrap[] = {
+    0x3E, 0x77,        // MVI A,77h
+    0x32, 0x04, 0x20,  // STA 2004h
+    0x76,              // HLT
+};
+
+} // namespace
+
+bool runMemoryMapCheck(std::ostream& log) {
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "memory map: " << what << "\n";
+        ok = false;
+    };
+
+    std::string first;
+    for (CPU8085::Engine engine : allEngines()) {
+        std::string where = std::string(" on ") + CPU8085::engineName(engine);
+        CPU8085 cpu(engine);
+        if (cpu.memory.getMode() != GuestMemory::Mode::Flat) fail("all-RAM memory is not flat" + where);
+
+        MappedDevice device = {&cpu.interrupts, 0, 0, 0};
+        cpu.memory.mapRom(0x10, 1);
+        cpu.memory.mapDevice(0x30, 1, MappedDevice::read, MappedDevice::write, &device);
+        cpu.setMemory(0x1000, 0xA5);
+        cpu.loadProgram(memoryMapTrap, sizeof(memoryMapTrap), 0x0024);
+        cpu.loadProgram(memoryMapProgram, sizeof(memoryMapProgram), 0x0000);
+        cpu.run(UINT64_MAX);
+
+        std::string result = stateOf(cpu);
+        if (first.empty()) first = result;
+        if (cpu.memory[0x1000] != 0xA5 || cpu.memory[0x2000] != 0xA5 || cpu.memory[0x2001] != 0xFE ||
+            cpu.memory[0x2003] != 0x00 || cpu.memory[0x2004] != 0x77 || device.lastAddress != 0x3002 ||
+            device.lastValue != 0xAA || device.reads != 2 || !cpu.stopped() || result != first) {
+            fail("program" + where + " ended as " + result);
+        }
+        if (cpu.memory.getMode() != GuestMemory::Mode::Paged) fail("mapped memory is not paged" + where);
+    }
+
+    log << "memory map: ROM, device reads, writes and code fetch x " << allEngines().size() << " engines, "
+        << (ok ? "all as expected" : "MISMATCH") << "\n";
+    return ok;
+}
+
+bool runSaveStateCheck(std::ostream& log) {
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "save states: " << what << "\n";
+        ok = false;
+    };
+    std::string path = (std::filesystem::temp_directory_path() / "8085_selftest.sav").string();
+
+    for (const Workload& workload : builtinWorkloads()) {
+        CPU8085 reference(CPU8085::Engine::Switch);
+        reference.loadProgram(workload.program, workload.size, 0x0000);
+        reference.run(UINT64_MAX);
+        auto matches = [&](const CPU8085& cpu) {
+            return stateOf(cpu) == stateOf(reference) && cpu.memory == reference.memory;
+        };
+
+        auto image = std::make_shared<MemoryImage>(workload.program, workload.size, 0x0000);
+        for (CPU8085::Engine engine : allEngines()) {
+            std::string where = std::string(workload.name) + " on " + CPU8085::engineName(engine);
+            CPU8085 cpu(engine);
+            cpu.memory.setMode(GuestMemory::Mode::Paged);
+            cpu.setMemoryImage(image);
+            cpu.run(reference.cycles / 2);
+            SaveState state = cpu.saveState();
+
+            std::unique_ptr<CPU8085> child = cpu.fork();
+            if (child->memory.dirtyPageCount() != 0) fail(where + ": fork copied pages");
+            child->run(UINT64_MAX);
+            cpu.run(UINT64_MAX);
+            if (!matches(*child)) fail(where + ": fork ended as " + stateOf(*child));
+            if (!matches(cpu)) fail(where + ": parent of a fork ended as " + stateOf(cpu));
+
+            // Twice, the second time over the state's own pages
+            for (int pass = 0; pass < 2; pass++) {
+                cpu.restoreState(state);
+                cpu.run(UINT64_MAX);
+                if (!matches(cpu)) fail(where + ": restored state ended as " + stateOf(cpu));
+            }
+
+            std::string error;
+            SaveState loaded;
+            if (!state.save(path, error) || !loaded.load(path, image, error)) {
+                fail(where + ": " + error);
+                continue;
+            }
+            CPU8085 fresh(engine);
+            fresh.restoreState(loaded);
+            fresh.run(UINT64_MAX);
+            if (!matches(fresh)) fail(where + ": state loaded from disk ended as " + stateOf(fresh));
+            if (loaded.load(path, nullptr, error)) fail(where + ": loaded against the wrong base");
+        }
+    }
+
+    // Other versions are refused
+    std::FILE* file = std::fopen(path.c_str(), "r+b");
+    if (file) {
+        const uint8_t version = SaveState::kVersion + 1;
+        std::fseek(file, 8, SEEK_SET);
+        std::fwrite(&version, 1, 1, file);
+        std::fclose(file);
+        SaveState loaded;
+        std::string error;
+        if (loaded.load(path, nullptr, error) || error.find("version") == std::string::npos) {
+            fail("a newer version was not refused");
+        }
+    }
+    std::remove(path.c_str());
+
+    log << "save states: " << builtinWorkloads().size() << " workloads x " << allEngines().size()
+        << " engines forked, restored and reloaded, " << (ok ? "all match" : "MISMATCH") << "\n";
+    return ok;
+}
+
+bool runReverseCheck(std::ostream& log) {
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "reverse execution: " << what << "\n";
+        ok = false;
+    };
+    uint64_t longest = 0;
+
+    for (const Workload& workload : builtinWorkloads()) {
+        CountingCPU8085 full(CPU8085::Engine::Switch);
+        full.loadProgram(workload.program, workload.size, 0x0000);
+        full.run(UINT64_MAX);
+        // Three quarters of the way through, and a span the default history
+        // holds (several checkpoints long) before it
+        uint64_t second = full.instructions * 3 / 4;
+        uint64_t first = second - std::min<uint64_t>(second / 2, 300000);
+        CountingCPU8085 early(CPU8085::Engine::Switch), late(CPU8085::Engine::Switch);
+        early.loadProgram(workload.program, workload.size, 0x0000);
+        early.instructionLimit = first;
+        early.run(UINT64_MAX);
+        late.loadProgram(workload.program, workload.size, 0x0000);
+        late.instructionLimit = second;
+        late.run(UINT64_MAX);
+        auto matches = [](const ReversibleCPU8085& cpu, const CountingCPU8085& reference) {
+            return stateOf(cpu) == stateOf(reference) && cpu.memory == reference.memory;
+        };
+        longest = std::max(longest, second - first);
+
+        for (CPU8085::Engine engine : allEngines()) {
+            std::string where = std::string(workload.name) + " on " + CPU8085::engineName(engine);
+            ReversibleCPU8085 cpu(engine);
+            cpu.loadProgram(workload.program, workload.size, 0x0000);
+            if (stepBack(cpu)) fail(where + ": stepped back before running");
+            cpu.run(late.cycles);
+            if (!matches(cpu, late)) {
+                fail(where + ": ran to " + stateOf(cpu) + " with the log on");
+                continue;
+            }
+            // Long enough to go through checkpoints
+            uint64_t undone = rewind(cpu, second - first);
+            if (undone != second - first || !matches(cpu, early)) {
+                fail(where + ": rewound " + std::to_string(undone) + " to " + stateOf(cpu));
+            }
+            cpu.run(late.cycles - cpu.cycles);
+            if (!matches(cpu, late)) fail(where + ": replayed to " + stateOf(cpu));
+
+            for (int i = 0; i < 3; i++) stepBack(cpu);
+            cpu.run(late.cycles - cpu.cycles);
+            if (!matches(cpu, late)) fail(where + ": stepped back and forward to " + stateOf(cpu));
+
+            // Back to the latest instruction at the early point's address
+            int breakpoint = cpu.addBreakpoint(early.PC);
+            runBack(cpu);
+            if (cpu.PC != early.PC || cpu.cycles < early.cycles) {
+                fail(where + ": ran back to " + stateOf(cpu));
+            }
+            cpu.removeBreakpoint(breakpoint);
+            cpu.run(late.cycles - cpu.cycles);
+            if (!matches(cpu, late)) fail(where + ": ran back and forward to " + stateOf(cpu));
+
+            // A short history wraps and reaches only so far
+            ReversibleCPU8085 brief(engine);
+            brief.undoHistory = 1000;
+            brief.loadProgram(workload.program, workload.size, 0x0000);
+            brief.run(late.cycles);
+            undone = rewind(brief, UINT64_MAX);
+            CountingCPU8085 reached(CPU8085::Engine::Switch);
+            reached.loadProgram(workload.program, workload.size, 0x0000);
+            reached.instructionLimit = second - std::min<uint64_t>(second, 1000);
+            reached.run(UINT64_MAX);
+            if (undone != std::min<uint64_t>(second, 1000) || !matches(brief, reached)) {
+                fail(where + ": short history rewound " + std::to_string(undone) + " to " + stateOf(brief));
+            }
+        }
+    }
+
+    log << "reverse execution: " << builtinWorkloads().size() << " workloads x " << allEngines().size()
+        << " engines rewound up to " << longest << " instructions and replayed, "
+        << (ok ? "all match" : "MISMATCH") << "\n";
+    return ok;
+}
+
+bool runBinaryTraceCheck(std::ostream& log) {
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "binary trace: " << what << "\n";
+        ok = false;
+    };
+    const uint64_t kInstructions = 200000;
+    std::filesystem::path directory = std::filesystem::temp_directory_path();
+    std::string reference = (directory / "8085_selftest_ref.trc").string();
+    std::string path = (directory / "8085_selftest.trc").string();
+    std::string error;
+    uint64_t records = 0;
+
+    // Runs the workload on engine for limit instructions, traced to file
+    auto record = [&](const Workload& workload, CPU8085::Engine engine, uint64_t limit, const std::string& file,
+                      BinaryTracingCPU8085& cpu) {
+        TraceWriter writer;
+        if (!writer.open(file, error)) return false;
+        cpu.setEngine(engine);
+        cpu.loadProgram(workload.program, workload.size, 0x0000);
+        cpu.traceWriter = &writer;
+        cpu.instructionLimit = limit;
+        cpu.run(UINT64_MAX);
+        cpu.flushTrace();
+        cpu.traceWriter = nullptr;
+        if (!writer.close(error)) return false;
+        error = writer.recordsWritten() == cpu.instructions ? "" : "records lost";
+        return error.empty();
+    };
+    auto diverge = [&](const std::string& a, const std::string& b) {
+        TraceReader left, right;
+        if (!left.open(a, error) || !right.open(b, error)) {
+            fail(error);
+            return TraceDivergence();
+        }
+        return findTraceDivergence(left, right);
+    };
+
+    for (const Workload& workload : builtinWorkloads()) {
+        for (CPU8085::Engine engine : allEngines()) {
+            std::string where = std::string(workload.name) + " on " + CPU8085::engineName(engine);
+            bool first = engine == allEngines().front();
+            BinaryTracingCPU8085 cpu;
+            if (!record(workload, engine, kInstructions, first ? reference : path, cpu)) {
+                fail(where + ": " + error);
+                continue;
+            }
+            records += cpu.instructions;
+            if (!first) {
+                TraceDivergence divergence = diverge(reference, path);
+                if (divergence.diverged) {
+                    fail(where + ": differs from " + CPU8085::engineName(allEngines().front()) +
+                         " at record " + std::to_string(divergence.index));
+                }
+                continue;
+            }
+
+            // Replaying the stores rebuilds memory, and the last record is
+            // the final state
+            TraceReader trace;
+            if (!trace.open(reference, error) || trace.size() != cpu.instructions) {
+                fail(where + ": cannot read the trace back " + error);
+                continue;
+            }
+            GuestMemory memory;
+            memory.write(0x0000, workload.program, workload.size);
+            std::vector<TraceRecord> chunk(4096);
+            TraceRecord last = {};
+            size_t got;
+            while ((got = trace.read(chunk.data(), chunk.size())) > 0) {
+                for (size_t i = 0; i < got; i++) {
+                    for (int k = 0; k < chunk[i].writeCount && k < 2; k++) {
+                        memory.poke(chunk[i].writeAddress[k], chunk[i].writeValue[k]);
+                    }
+                }
+                last = chunk[got - 1];
+            }
+            if (!(memory == cpu.memory)) fail(where + ": the stores in the trace do not rebuild memory");
+            if (last.cycles != cpu.cycles || last.A != cpu.A || last.H != cpu.H || last.L != cpu.L || last.SP != cpu.SP ||
+                last.psw != cpu.flags.psw) {
+                fail(where + ": the last record is not the final state");
+            }
+        }
+
+        // A shorter run is a prefix of the reference
+        BinaryTracingCPU8085 cpu;
+        if (!record(workload, CPU8085::Engine::Switch, kInstructions / 2, path, cpu)) {
+            fail(std::string(workload.name) + ": " + error);
+            continue;
+        }
+        TraceDivergence divergence = diverge(reference, path);
+        if (!divergence.lengthOnly || divergence.index != kInstructions / 2) {
+            fail(std::string(workload.name) + ": a shorter trace diverged at " + std::to_string(divergence.index));
+        }
+    }
+
+    // Inverts one byte of a record in the copy of the reference
+    auto flip = [&](uint64_t index, size_t field) {
+        std::FILE* file = std::fopen(path.c_str(), "r+b");
+        if (!file) return;
+        long offset = static_cast<long>(32 + index * sizeof(TraceRecord) + field);
+        int value = -1;
+        if (std::fseek(file, offset, SEEK_SET) == 0) value = std::fgetc(file);
+        if (value >= 0 && std::fseek(file, offset, SEEK_SET) == 0) std::fputc(value ^ 0xFF, file);
+        std::fclose(file);
+    };
+    const uint64_t patched = 12345;
+    std::filesystem::copy_file(reference, path, std::filesystem::copy_options::overwrite_existing);
+
+    // A byte after a one-byte instruction is not part of it, so changing it
+    // is no divergence
+    {
+        TraceReader trace;
+        TraceRecord r = {};
+        uint64_t index = 0;
+        if (trace.open(reference, error)) {
+            while (trace.read(&r, 1) == 1 && kOpcodes[r.opcode].length != 1) index++;
+        }
+        flip(index, offsetof(TraceRecord, operands));
+        flip(index, offsetof(TraceRecord, operands) + 1);
+        if (index >= patched || diverge(reference, path).diverged) fail("a byte past an instruction diverged");
+    }
+
+    // A changed accumulator is found at its record
+    flip(patched, offsetof(TraceRecord, A));
+    TraceDivergence divergence = diverge(reference, path);
+    TraceReader left, right;
+    TraceRecord a = {}, b = {};
+    if (left.open(reference, error) && right.open(path, error) && left.seek(patched) && right.seek(patched)) {
+        left.read(&a, 1);
+        right.read(&b, 1);
+    }
+    if (!divergence.diverged || divergence.lengthOnly || divergence.index != patched ||
+        traceDifferences(a, b) != "A") {
+        fail("a changed record was found at " + std::to_string(divergence.index) + " (" +
+             traceDifferences(a, b) + ")");
+    }
+    std::remove(path.c_str());
+    std::remove(reference.c_str());
+
+    log << "binary trace: " << builtinWorkloads().size() << " workloads x " << allEngines().size()
+        << " engines, " << records << " records written and compared, " << (ok ? "all match" : "MISMATCH") << "\n";
+    return ok;
+}
+
+namespace {
+
+// Main calls 0020 (which calls 0030 five times) and 0030, ten times over,
+// then RST 7 (a bare RET) and HLT
+std::vector<uint8_t> callGraphProgram() {
+    std::vector<uint8_t> program(0x40, 0x00);
+    const uint8_t main[] = {0x31, 0x00, 0x20,  // 0000: LXI SP, 2000h
+                            0x0E, 0x0A,        // 0003: MVI C, 10
+                            0xCD, 0x20, 0x00,  // 0005: CALL 0020h
+                            0xCD, 0x30, 0x00,  // 0008: CALL 0030h
+                            0x0D,              // 000B: DCR C
+                            0xC2, 0x05, 0x00,  // 000C: JNZ 0005h
+                            0xFF,              // 000F: RST 7
+                            0x76};             // 0010: HLT
+    const uint8_t outer[] = {0x06, 0x05,        // 0020: MVI B, 5
+                             0xCD, 0x30, 0x00,  // 0022: CALL 0030h
+                             0x05,              // 0025: DCR B
+                             0xC2, 0x22, 0x00,  // 0026: JNZ 0022h
+                             0xC9};             // 0029: RET
+    const uint8_t inner[] = {0x00, 0x00, 0xC9};  // 0030: NOP, NOP, RET
+    std::copy(std::begin(main), std::end(main), program.begin());
+    std::copy(std::begin(outer), std::end(outer), program.begin() + 0x20);
+    std::copy(std::begin(inner), std::end(inner), program.begin() + 0x30);
+    program[0x38] = 0xC9;  // RET
+    return program;
+}
+
+// EI, then an endless INR E loop; the interrupt handler at 0038 is INR D, RET
+const uint8_t kInterruptedLoop[] = {
+    0x31, 0x00, 0x20,  // 0000: LXI SP, 2000h
+    0xFB,              // 0003: EI
+    0x1C,              // 0004: INR E
+    0xC3, 0x04, 0x00,  // 0005: JMP 0004h
+};
+
+} // namespace
+
+bool runProfilerCheck(std::ostream& log) {
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "profiler: " << what << "\n";
+        ok = false;
+    };
+    const std::vector<uint8_t> program = callGraphProgram();
+    // CALL counts in the caller and RET in the routine it leaves: 0030 is
+    // 4 + 4 + 10 T-states a call, 0020 is 7 + 5 x (18 + 4 + 10) - 3 + 10
+    const std::string expectedStacks =
+        "0000 531\n"
+        "0000;0020 1740\n"
+        "0000;0020;0030 900\n"
+        "0000;0030 180\n"
+        "0000;0038 10\n";
+
+    for (CPU8085::Engine engine : allEngines()) {
+        std::string where = std::string("on ") + CPU8085::engineName(engine);
+        ProfilingCPU8085 cpu(engine);
+        cpu.profiling = true;
+        cpu.loadProgram(program.data(), program.size(), 0x0000);
+        cpu.run(UINT64_MAX);
+
+        uint64_t addressTotal = 0;
+        for (uint64_t cycles : cpu.addressCycles) addressTotal += cycles;
+        if (cpu.profiledInstructions() != cpu.instructions || cpu.profiledCycles() != cpu.cycles ||
+            addressTotal != cpu.cycles) {
+            fail(where + ": totals " + std::to_string(cpu.profiledInstructions()) + " instructions, " +
+                 std::to_string(cpu.profiledCycles()) + " T-states");
+        }
+        if (cpu.opcodeCounts[0xCD] != 70 || cpu.opcodeCounts[0xC9] != 71 || cpu.opcodeCounts[0x00] != 120) {
+            fail(where + ": wrong opcode counts");
+        }
+
+        std::ostringstream stacks;
+        writeFoldedStacks(stacks, cpu);
+        if (stacks.str() != expectedStacks) fail(where + ": folded stacks\n" + stacks.str());
+
+        std::vector<Profiler::Routine> routines = cpu.routines();
+        bool found = false;
+        for (const Profiler::Routine& r : routines) {
+            if (r.address != 0x0020) continue;
+            found = r.calls == 10 && r.inclusive == 1740 + 900 && r.exclusive == 1740;
+        }
+        if (routines.empty() || routines[0].address != 0x0000 || routines[0].inclusive != cpu.cycles || !found) {
+            fail(where + ": wrong routine totals");
+        }
+        std::vector<Profiler::HotSpot> spots = cpu.hotSpots(1);
+        if (spots.size() != 1 || spots[0].address != 0x0022) fail(where + ": wrong hottest address");
+
+        // An interrupt is a call into its handler
+        ProfilingCPU8085 interrupted(engine);
+        interrupted.profiling = true;
+        interrupted.loadProgram(kInterruptedLoop, sizeof(kInterruptedLoop), 0x0000);
+        const uint8_t handler[] = {0x14, 0xC9};  // INR D, RET
+        interrupted.loadProgram(handler, sizeof(handler), 0x0038);
+        interrupted.PC = 0x0000;
+        interrupted.run(100);
+        interrupted.interrupts.setLine(InterruptUnit::Intr, true, 0x0038);
+        interrupted.step();
+        interrupted.interrupts.setLine(InterruptUnit::Intr, false);
+        interrupted.run(100);
+        const std::vector<Profiler::Context>& contexts = interrupted.contexts();
+        if (interrupted.D != 1 || contexts.size() != 2 || contexts[1].routine != 0x0038 ||
+            contexts[1].calls != 1 || contexts[1].cycles != 14) {
+            fail(where + ": the interrupt handler was not profiled as a call");
+        }
+    }
+
+    log << "profiler: call graph, interrupts and totals x " << allEngines().size() << " engines, "
+        << (ok ? "all as expected" : "MISMATCH") << "\n";
+    return ok;
+}
+
+namespace {
+
+// Adds B (5 down to 1) into 2000h, echoing each step on port 10h, then
+// stores IN 11h at 2001h
+const uint8_t watchedLoop[] = {
+    0x21, 0x00, 0x20,  // 0000: LXI H,2000h
+    0x06, 0x05,        // 0003: MVI B,5
+    0x7E,              // 0005: MOV A,M
+    0x80,              // 0006: ADD B
+    0x77,              // 0007: MOV M,A
+    0xD3, 0x10,        // 0008: OUT 10h
+    0x05,              // 000A: DCR B
+    0xC2, 0x05, 0x00,  // 000B: JNZ 0005h
+    0xDB, 0x11,        // 000E: IN 11h
+    0x32, 0x01, 0x20,  // 0010: STA 2001h
+    0x76,              // 0013: HLT
+};
+
+Breakpoint makeBreakpoint(BreakKind kind, uint16_t first, uint16_t last, const char* condition = "") {
+    Breakpoint breakpoint;
+    breakpoint.kind = kind;
+    breakpoint.first = first;
+    breakpoint.last = last;
+    std::string error;
+    breakpoint.condition.parse(condition, error);
+    return breakpoint;
+}
+
+} // namespace
+
+bool runBreakpointCheck(std::ostream& log) {
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "breakpoints: " << what << "\n";
+        ok = false;
+    };
+
+    // Conditions, against registers A=12 BC=0203 HL=2000 with CY set
+    GuestMemory memory;
+    memory.write(0x2000, 0x0C);
+    DebugRegisters registers = {0x0C, 0x02, 0x03, 0x00, 0x00, 0x20, 0x00, 0x03, 0xFFF0, 0x0005};
+    const char* holding[] = {"", "B == 2 && [2000h] == 0Ch", "M == A", "bc == 0x203", "CY && !Z",
+                             "-1 < 0 && ~0 == -1", "A + B - 2 == 12 || 0", "(A & 0Fh) == 0Ch",
+                             "VALUE == 99", "HL - 2000h == 0 && SP >= 0FFF0h && PC != 4",
+                             "010 == 10 && 09 == 9 && 0x10 == 10h"};
+    const char* failing[] = {"B == 3", "Z", "[HL + 1] != 0", "A ^ 0Ch"};
+    const char* malformed[] = {"B ==", "Q == 1", "(A", "[HL", "1 2", "FFh", "10000h", "A = 1", "A * 2"};
+    for (const char* text : holding) {
+        DebugCondition condition;
+        std::string error;
+        if (!condition.parse(text, error) || !condition.holds(registers, 99, memory)) {
+            fail(std::string("'") + text + "' does not hold");
+        }
+    }
+    for (const char* text : failing) {
+        DebugCondition condition;
+        std::string error;
+        if (!condition.parse(text, error) || condition.holds(registers, 99, memory)) {
+            fail(std::string("'") + text + "' holds");
+        }
+    }
+    for (const char* text : malformed) {
+        DebugCondition condition;
+        std::string error;
+        if (condition.parse(text, error) || error.empty()) fail(std::string("'") + text + "' parsed");
+    }
+    // Nesting is bounded, not left to the stack: the GUI parses whatever is typed
+    for (const std::string& text : {std::string(8000, '(') + "1" + std::string(8000, ')'),
+                                    std::string(8000, '[') + "0" + std::string(8000, ']'),
+                                    std::string(8000, '-') + "1"}) {
+        DebugCondition condition;
+        std::string error;
+        if (condition.parse(text, error) || error.find("too deep") == std::string::npos) {
+            fail("deep nesting: " + (error.empty() ? std::string("parsed") : error));
+        }
+    }
+
+    CPU8085 reference(CPU8085::Engine::Switch);
+    reference.loadProgram(watchedLoop, sizeof(watchedLoop), 0x0000);
+    reference.run(UINT64_MAX);
+
+    std::string firstHits;
+    for (CPU8085::Engine engine : allEngines()) {
+        std::string where = std::string(" on ") + CPU8085::engineName(engine);
+        std::string hits;
+        DebugCPU8085 cpu(engine);
+        cpu.hitHandler = [&](const DebugHit& hit) { hits += formatDebugHit(hit) + "\n"; };
+        auto start = [&](Breakpoint breakpoint) {
+            cpu.clearBreakpoints();
+            cpu.reset();
+            cpu.loadProgram(watchedLoop, sizeof(watchedLoop), 0x0000);
+            cpu.addBreakpoint(std::move(breakpoint));
+            cpu.breakRequested = false;
+        };
+        // Runs to the next stop and checks where it is
+        auto expectStop = [&](const std::string& what, uint16_t pc, uint8_t b) {
+            cpu.breakRequested = false;
+            cpu.run(UINT64_MAX);
+            if (!cpu.breakRequested || cpu.halted || cpu.PC != pc || cpu.B != b) {
+                fail(what + where + " stopped at " + stateOf(cpu));
+            }
+        };
+
+        // Nothing watched where the program goes: no hits, same result
+        start(makeBreakpoint(BreakKind::Execute, 0x0100, 0x01FF));
+        cpu.run(UINT64_MAX);
+        if (stateOf(cpu) != stateOf(reference) || cpu.memory != reference.memory || cpu.breakRequested) {
+            fail("idle breakpoint" + where + " changed the run");
+        }
+
+        // The third and later hits stop, inside a predecoded block
+        Breakpoint counted = makeBreakpoint(BreakKind::Execute, 0x0006, 0x0006);
+        counted.hitCount = 3;
+        start(counted);
+        expectStop("hit count", 0x0006, 3);
+        expectStop("hit count", 0x0006, 2);
+        if (cpu.breakpointList()[0].hits != 4) fail("hit count" + where + " counted wrong");
+
+        start(makeBreakpoint(BreakKind::Execute, 0x0005, 0x0005, "B == 2 && [2000h] == 0Ch"));
+        expectStop("condition", 0x0005, 2);
+        cpu.run(UINT64_MAX);
+        if (!cpu.halted || cpu.breakpointList()[0].hits != 1) fail("condition" + where + " hit again");
+
+        // Watchpoints stop after the instruction making the access
+        start(makeBreakpoint(BreakKind::Write, 0x2000, 0x2000, "VALUE > 10"));
+        expectStop("write watch", 0x0008, 3);
+        start(makeBreakpoint(BreakKind::Read, 0x2000, 0x2001));
+        expectStop("read watch", 0x0006, 5);
+        // A breakpoint added now lands in a block that is already decoded
+        cpu.addBreakpoint(0x000A);
+        expectStop("added breakpoint", 0x000A, 5);
+        start(makeBreakpoint(BreakKind::Output, 0x10, 0x10, "VALUE == 9"));
+        expectStop("output watch", 0x000A, 4);
+        start(makeBreakpoint(BreakKind::Input, 0x11, 0x11));
+        expectStop("input watch", 0x0010, 0);
+
+        // Tracepoints report every pass and never stop
+        Breakpoint tracepoint = makeBreakpoint(BreakKind::Execute, 0x000A, 0x000A);
+        tracepoint.logOnly = true;
+        start(tracepoint);
+        cpu.run(UINT64_MAX);
+        if (stateOf(cpu) != stateOf(reference) || cpu.breakRequested || cpu.breakpointList()[0].hits != 5) {
+            fail("tracepoint" + where + " stopped or missed hits");
+        }
+
+        if (firstHits.empty()) firstHits = hits;
+        if (hits != firstHits) fail("hits" + where + " differ:\n" + hits);
+    }
+
+    log << "breakpoints: conditions, hit counts, watchpoints and tracepoints x " << allEngines().size()
+        << " engines, " << (ok ? "all as expected" : "MISMATCH") << "\n";
+    return ok;
+}
+
+namespace {
+
+// The memory_copy and call_ret workloads as source
+const char kMemoryCopySource[] =
+    "PASSES  EQU 3000h\n"
+    "        MVI A, 40h\n"
+    "        STA PASSES      ; pass counter\n"
+    "OUTER:  LXI H, 1000h\n"
+    "        LXI D, 2000h\n"
+    "        LXI B, 1000h\n"
+    "LOOP:   MOV A, M\n"
+    "        STAX D\n"
+    "        INX H\n"
+    "        INX D\n"
+    "        DCX B\n"
+    "        MOV A, B\n"
+    "        ORA C\n"
+    "        JNZ LOOP\n"
+    "        LDA PASSES\n"
+    "        DCR A\n"
+    "        STA PASSES\n"
+    "        JNZ OUTER\n"
+    "        HLT\n";
+
+const char kCallReturnSource[] =
+    "        mvi e, 4\n"
+    "outer:  lxi b, 0\n"
+    "loop:   call sub    ; defined below: a fixup\n"
+    "        call sub\n"
+    "        dcx b\n"
+    "        mov a, b\n"
+    "        ora c\n"
+    "        jnz loop\n"
+    "        dcr e\n"
+    "        jnz outer\n"
+    "        hlt\n"
+    "sub:    push b\n"
+    "        pop b\n"
+    "        ret\n";
+
+// Directives, expressions, forward references and macros, with the bytes
+// they must produce from 0100h (DS leaves a gap between two segments)
+const char kFeatureSource[] =
+    "        .org 100h\n"
+    "N       SET 2\n"
+    "N       SET N * 3 + 1          ; 7\n"
+    "DELAY   MACRO reg, count\n"
+    "        MVI reg, count\n"
+    "L\\@:    DCR reg\n"
+    "        JNZ L\\@\n"
+    "        ENDM\n"
+    "START:  DELAY B, N\n"
+    "        delay c, LOW(-1)\n"
+    "        MVI A, SIZE\n"
+    "        LXI H, DATA + 1\n"
+    "        DB HIGH 1234h, 'a' + 1, 1 << 4 | 0101b, 17o, (100 - 1) % 10, ~0 & 0FFh, 'x;y'\n"
+    "DATA:   DW $, 0x1F, -2\n"
+    "END_:   DS 2\n"
+    "SIZE    EQU END_ - DATA\n"
+    "        DB 10 / 3, 0Fh ^ 3\n"
+    "        END START\n";
+
+const uint8_t kFeatureBytes[] = {
+    0x06, 0x07, 0x05, 0xC2, 0x02, 0x01,  // DELAY B, N
+    0x0E, 0xFF, 0x0D, 0xC2, 0x08, 0x01,  // delay c, LOW(-1)
+    0x3E, 0x06,                          // MVI A, SIZE
+    0x21, 0x1B, 0x01,                    // LXI H, DATA + 1
+    0x12, 0x62, 0x15, 0x0F, 0x09, 0xFF, 0x78, 0x3B, 0x79,
+    0x1A, 0x01, 0x1F, 0x00, 0xFE, 0xFF,  // DATA
+    0x00, 0x00,                          // DS 2
+    0x03, 0x0C};
+
+} // namespace
+
+bool runAssemblerCheck(std::ostream& log) {
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "assembler: " << what << "\n";
+        ok = false;
+    };
+    Assembler assembler;
+    AssembledProgram program;
+
+    // Every documented opcode, written out from its bit fields
+    static const char* const registers[] = {"B", "C", "D", "E", "H", "L", "M", "A"};
+    static const char* const pairs[] = {"B", "D", "H", "SP"};
+    static const char* const alu[] = {"ADD", "ADC", "SUB", "SBB", "ANA", "XRA", "ORA", "CMP"};
+    static const char* const aluImmediate[] = {"ADI", "ACI", "SUI", "SBI", "ANI", "XRI", "ORI", "CPI"};
+    static const char* const conditions[] = {"NZ", "Z", "NC", "C", "PO", "PE", "P", "M"};
+    static const struct {
+        const char* text;
+        uint8_t opcode;
+        int operandBytes;
+    } fixed[] = {
+        {"NOP", 0x00, 0}, {"RIM", 0x20, 0}, {"SIM", 0x30, 0}, {"RLC", 0x07, 0}, {"RRC", 0x0F, 0},
+        {"RAL", 0x17, 0}, {"RAR", 0x1F, 0}, {"DAA", 0x27, 0}, {"CMA", 0x2F, 0}, {"STC", 0x37, 0},
+        {"CMC", 0x3F, 0}, {"HLT", 0x76, 0}, {"RET", 0xC9, 0}, {"XTHL", 0xE3, 0}, {"PCHL", 0xE9, 0},
+        {"XCHG", 0xEB, 0}, {"DI", 0xF3, 0}, {"SPHL", 0xF9, 0}, {"EI", 0xFB, 0}, {"SHLD 1234h", 0x22, 2},
+        {"LHLD 1234h", 0x2A, 2}, {"STA 1234h", 0x32, 2}, {"LDA 1234h", 0x3A, 2}, {"JMP 1234h", 0xC3, 2},
+        {"CALL 1234h", 0xCD, 2}, {"OUT 5Ah", 0xD3, 1}, {"IN 5Ah", 0xDB, 1}};
+    std::string source;
+    std::vector<uint8_t> expected;
+    auto add = [&](const std::string& text, uint8_t opcode, int operandBytes) {
+        source += "        " + text + "\n";
+        expected.push_back(opcode);
+        if (operandBytes == 1) expected.push_back(0x5A);
+        if (operandBytes == 2) expected.insert(expected.end(), {0x34, 0x12});
+    };
+    for (const auto& instruction : fixed) add(instruction.text, instruction.opcode, instruction.operandBytes);
+    for (int d = 0; d < 8; d++) {
+        for (int r = 0; r < 8; r++) {
+            if (d != 6 || r != 6) add(std::string("MOV ") + registers[d] + ", " + registers[r], 0x40 | d << 3 | r, 0);
+        }
+        add(std::string("MVI ") + registers[d] + ", 5Ah", 0x06 | d << 3, 1);
+        add(std::string("INR ") + registers[d], 0x04 | d << 3, 0);
+        add(std::string("DCR ") + registers[d], 0x05 | d << 3, 0);
+        for (int op = 0; op < 8; op++) add(std::string(alu[op]) + " " + registers[d], 0x80 | op << 3 | d, 0);
+        add(std::string(aluImmediate[d]) + " 5Ah", 0xC6 | d << 3, 1);
+        add(std::string("J") + conditions[d] + " 1234h", 0xC2 | d << 3, 2);
+        add(std::string("C") + conditions[d] + " 1234h", 0xC4 | d << 3, 2);
+        add(std::string("R") + conditions[d], 0xC0 | d << 3, 0);
+        add("RST " + std::to_string(d), 0xC7 | d << 3, 0);
+    }
+    for (int p = 0; p < 4; p++) {
+        add(std::string("LXI ") + pairs[p] + ", 1234h", 0x01 | p << 4, 2);
+        add(std::string("INX ") + pairs[p], 0x03 | p << 4, 0);
+        add(std::string("DCX ") + pairs[p], 0x0B | p << 4, 0);
+        add(std::string("DAD ") + pairs[p], 0x09 | p << 4, 0);
+        add(std::string("PUSH ") + (p == 3 ? "PSW" : pairs[p]), 0xC5 | p << 4, 0);
+        add(std::string("POP ") + (p == 3 ? "PSW" : pairs[p]), 0xC1 | p << 4, 0);
+        if (p < 2) {
+            add(std::string("STAX ") + pairs[p], 0x02 | p << 4, 0);
+            add(std::string("LDAX ") + pairs[p], 0x0A | p << 4, 0);
+        }
+    }
+    if (!assembler.assemble(source, program)) fail("opcodes: " + program.errorText("opcodes"));
+    else if (program.bytes != expected) fail("opcodes assembled wrong");
+    size_t opcodes = program.lines;
+
+    auto workloadBytes = [](const std::string& name) {
+        for (const Workload& workload : builtinWorkloads()) {
+            if (workload.name == name) return std::vector<uint8_t>(workload.program, workload.program + workload.size);
+        }
+        return std::vector<uint8_t>();
+    };
+    const std::pair<const char*, const char*> workloadSources[] = {
+        {"memory_copy", kMemoryCopySource}, {"call_ret", kCallReturnSource}};
+    for (const auto& entry : workloadSources) {
+        if (!assembler.assemble(entry.second, program) || program.bytes != workloadBytes(entry.first)) {
+            fail(std::string(entry.first) + " differs from the benchmark's bytes");
+        }
+    }
+
+    if (!assembler.assemble(kFeatureSource, program)) {
+        fail("features: " + program.errorText("features"));
+    } else if (program.flatImage() != std::vector<uint8_t>(std::begin(kFeatureBytes), std::end(kFeatureBytes)) ||
+               program.lowAddress() != 0x0100 || program.entryPoint() != 0x0100 || program.segments.size() != 2) {
+        fail("features assembled wrong");
+    }
+
+    // Each line has one error, reported on that line
+    const char* const malformed[] = {
+        "MOV M, M", "MVI A, 300", "JMP NOWHERE", "FOO A", "MOV A", "RST 8", "ORG LATER", "MVI X, 1",
+        "DB 'abc", "LXI PSW, 0", "ENDM", "LDA 12G", "MVI A, 1/0", "ADD B C"};
+    std::string errors = "X: NOP\nX: NOP\n";
+    for (const char* text : malformed) errors += std::string("        ") + text + "\n";
+    errors += "LATER:  NOP\n";
+    if (assembler.assemble(errors, program) || program.errors.size() != 1 + std::size(malformed)) {
+        fail("malformed source gave " + std::to_string(program.errors.size()) + " errors");
+    } else {
+        for (size_t i = 0; i < program.errors.size(); i++) {
+            if (program.errors[i].line != i + 2) fail("error on the wrong line: " + program.errorText("malformed"));
+        }
+    }
+    if (assembler.assemble("M1 MACRO\n NOP\n", program) || program.errors.size() != 1) fail("open MACRO accepted");
+    // Deep nesting is an error on its line, not a stack overflow
+    std::string deep = "        MVI A, " + std::string(20000, '(') + "1" + std::string(20000, ')') + "\n" +
+                       "        MVI A, " + std::string(200000, '-') + "1\n";
+    if (assembler.assemble(deep, program) || program.errors.size() != 2 ||
+        program.errors[0].message != "expression too deep" || program.errors[1].message != "expression too deep") {
+        fail("deep expressions: " + program.errorText("deep"));
+    }
+
+    // Through files: HEX and binary back in with the loaders, a source as an image
+    std::filesystem::path directory = std::filesystem::temp_directory_path();
+    std::string hexPath = (directory / "8085_selftest.hex").string();
+    std::string binPath = (directory / "8085_selftest.bin").string();
+    std::string asmPath = (directory / "8085_selftest.asm").string();
+    std::string error;
+    assembler.assemble(kFeatureSource, program);
+    CPU8085 direct;
+    program.loadInto(direct);
+    if (!writeProgramFile(hexPath, program, error) || !writeProgramFile(binPath, program, error)) {
+        fail(error);
+    } else {
+        CPU8085 fromHex, fromBinary;
+        LoadResult hex = loadIntelHexFile(fromHex, hexPath);
+        LoadResult binary = loadBinaryFile(fromBinary, binPath, program.lowAddress());
+        if (!hex.ok || !hex.hasStartAddress || hex.startAddress != 0x0100 || fromHex.memory != direct.memory) {
+            fail("Intel HEX round trip: " + hex.error);
+        }
+        if (!binary.ok || fromBinary.memory != direct.memory) fail("binary round trip: " + binary.error);
+    }
+    {
+        std::ofstream(asmPath) << kCallReturnSource;
+    }
+    std::vector<uint8_t> callReturn = workloadBytes("call_ret");
+    CPU8085 fromSource, reference;
+    reference.loadProgram(callReturn.data(), callReturn.size(), 0x0000);
+    LoadResult loaded = loadImageFile(fromSource, asmPath);
+    if (!loaded.ok || loaded.bytesLoaded != callReturn.size() || fromSource.memory != reference.memory) {
+        fail(".asm image: " + loaded.error);
+    }
+
+    // Parallel assembly matches one source at a time
+    std::vector<AssemblyJob> jobs;
+    const char* const sources[] = {kMemoryCopySource, kCallReturnSource, kFeatureSource, "MVI A, ?\n"};
+    for (int i = 0; i < 16; i++) {
+        std::string path = (directory / ("8085_selftest_" + std::to_string(i) + ".asm")).string();
+        std::ofstream(path) << sources[i % 4];
+        jobs.push_back({path, ""});
+    }
+    std::vector<AssemblyJobResult> results = assembleFiles(jobs, 4);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        AssembledProgram sequential;
+        bool assembled = assembler.assembleFile(jobs[i].source, sequential);
+        if (results[i].ok != assembled || results[i].bytes != sequential.bytes.size() ||
+            results[i].lines != sequential.lines || results[i].errors != sequential.errorText(jobs[i].source)) {
+            fail("parallel job " + std::to_string(i) + " differs");
+        }
+        std::filesystem::remove(jobs[i].source);
+    }
+    std::filesystem::remove(hexPath);
+    std::filesystem::remove(binPath);
+    std::filesystem::remove(asmPath);
+
+    log << "assembler: " << opcodes << " opcodes, workloads, directives, " << std::size(malformed) + 1
+        << " errors and file round trips, " << (ok ? "all as expected" : "MISMATCH") << "\n";
+    return ok;
+}
+
+bool runOpcodeTableCheck(std::ostream& log) {
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "opcode table: " << what << "\n";
+        ok = false;
+    };
+    const int kSamples = 64;
+    uint32_t seed = 0x8085;
+    auto random = [&]() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    };
+    // Addresses operands, pairs and the stack point to stay clear of the
+    // program at 1000h and of the stack at SP
+    auto address = [&]() { return static_cast<uint16_t>(0x2000 + random() % 0xC000); };
+
+    // Each opcode runs from 1000h with random registers, flags and operand,
+    // followed by HLT wherever it may go, so a run stops right after it and
+    // block engines execute it as part of a block
+    for (CPU8085::Engine engine : allEngines()) {
+        std::string where = std::string(" on ") + CPU8085::engineName(engine);
+        CPU8085 cpu(engine);
+        for (int opcode = 0; opcode < 256; opcode++) {
+            const OpcodeInfo& info = kOpcodes[static_cast<uint8_t>(opcode)];
+            for (int sample = 0; sample < kSamples; sample++) {
+                uint16_t operand = address();
+                uint16_t returnAddress = address();
+                cpu.A = random();
+                uint16_t hl = address();
+                for (uint8_t* r : {&cpu.B, &cpu.C, &cpu.D, &cpu.E}) *r = random();
+                cpu.B = static_cast<uint8_t>(0x20 + cpu.B % 0xC0);
+                cpu.D = static_cast<uint8_t>(0x20 + cpu.D % 0xC0);
+                cpu.H = hl >> 8;
+                cpu.L = hl & 0xFF;
+                cpu.SP = static_cast<uint16_t>(0xF000 + random() % 0xFF0);
+                cpu.flags.psw = (random() & CPU8085::Flags::ALL) | CPU8085::Flags::ALWAYS_ONE;
+                cpu.halted = false;
+                cpu.setMemory(cpu.SP, returnAddress & 0xFF);
+                cpu.setMemory(static_cast<uint16_t>(cpu.SP + 1), returnAddress >> 8);
+                cpu.setMemory(0x1000, static_cast<uint8_t>(opcode));
+                cpu.setMemory(0x1001, operand & 0xFF);
+                cpu.setMemory(0x1002, operand >> 8);
+                uint16_t next = static_cast<uint16_t>(0x1000 + info.length);
+                uint16_t targets[] = {next, operand, returnAddress, hl, static_cast<uint16_t>(opcode & 0x38)};
+                for (uint16_t target : targets) {
+                    if (target != 0x1000) cpu.setMemory(target, 0x76);
+                }
+
+                // Conditions in opcode order: NZ Z NC C PO PE P M
+                CPU8085::Flags before = cpu.flags;
+                int c = (opcode >> 3) & 7;
+                bool flag = c < 2 ? before.Z() : c < 4 ? before.CY() : c < 6 ? before.P() : before.S();
+                bool taken = !info.conditional || flag == ((c & 1) != 0);
+                uint16_t to = next;
+                if (taken) {
+                    switch (info.flow) {
+                        case ControlFlow::Next:
+                        case ControlFlow::Halt: break;
+                        case ControlFlow::Jump:
+                        case ControlFlow::Call: to = operand; break;
+                        case ControlFlow::Return: to = returnAddress; break;
+                        case ControlFlow::Restart: to = static_cast<uint16_t>(opcode & 0x38); break;
+                        case ControlFlow::Indirect: to = hl; break;
+                    }
+                }
+                uint64_t expected = info.cycles + (info.conditional && taken ? info.takenCycles : 0) +
+                                    (info.flow == ControlFlow::Halt ? 0 : kOpcodes[0x76].cycles);
+                uint16_t expectedPc = static_cast<uint16_t>(to + (info.flow == ControlFlow::Halt ? 0 : 1));
+
+                cpu.PC = 0x1000;
+                uint64_t start = cpu.cycles;
+                cpu.run(1000);
+                char line[160];
+                if (cpu.cycles - start != expected || cpu.PC != expectedPc || !cpu.halted ||
+                    ((before.psw ^ cpu.flags.psw) & ~info.flags)) {
+                    std::snprintf(line, sizeof(line), "%02Xh%s: %llu T-states, PC %04X, F %02X->%02X; table says "
+                                  "%llu, %04X, flags %02X", opcode, where.c_str(),
+                                  static_cast<unsigned long long>(cpu.cycles - start), cpu.PC, before.psw,
+                                  cpu.flags.psw, static_cast<unsigned long long>(expected), expectedPc, info.flags);
+                    fail(line);
+                    break;
+                }
+            }
+        }
+    }
+
+    // The disassembly of every opcode assembles back to the same bytes
+    Assembler assembler;
+    AssembledProgram program;
+    for (int opcode = 0; opcode < 256; opcode++) {
+        uint8_t bytes[3] = {static_cast<uint8_t>(opcode), static_cast<uint8_t>(random()), static_cast<uint8_t>(random())};
+        char text[kDisassemblySize];
+        int length = disassemble(bytes, text);
+        if (!assembler.assemble(text, std::strlen(text), program) ||
+            program.bytes != std::vector<uint8_t>(bytes, bytes + length)) {
+            fail(std::string("'") + text + "' does not assemble back");
+        }
+    }
+
+    log << "opcode table: lengths, T-states, control flow and flags of 256 opcodes x " << allEngines().size()
+        << " engines, disassembly round trip, " << (ok ? "all as expected" : "MISMATCH") << "\n";
+    return ok;
+}
+
+namespace {
+
+// Loop programs for runLoopSkipCheck. Each runs with a timer at 40h-42h, a
+// UART at 50h/51h receiving "8085!" and a port 60h that counts its reads.
+const char* const kLoopPrograms[] = {
+    // Counter loops of both shapes, from 0 (all the way round), 1 and others
+    "        LXI SP, 0F000h\n"
+    "        MVI L, 3\n"
+    "AGAIN:  MVI A, 0\n"
+    "DLY1:   DCR A\n"
+    "        NOP\n"
+    "        JNZ DLY1\n"
+    "        MVI H, 1\n"
+    "DLY2:   DCR H\n"
+    "        JNZ DLY2\n"
+    "        LXI D, 0\n"
+    "DLY3:   NOP\n"
+    "        DCX D\n"
+    "        MOV A, E\n"
+    "        ORA D\n"
+    "        JNZ DLY3\n"
+    "        LXI B, 1234h\n"
+    "DLY4:   DCX B\n"
+    "        MOV A, B\n"
+    "        ORA C\n"
+    "        JNZ DLY4\n"
+    "        PUSH PSW\n"
+    "        DCR L\n"
+    "        JNZ AGAIN\n"
+    "        HLT\n",
+    // Polling the timer status for ten expiries
+    "        LXI SP, 0F000h\n"
+    "        XRA A\n"
+    "        OUT 40h\n"
+    "        MVI A, 40h\n"
+    "        OUT 41h\n"
+    "        MVI A, 01h\n"
+    "        OUT 42h\n"
+    "        MVI C, 10\n"
+    "POLL:   IN 42h\n"
+    "        ANI 01h\n"
+    "        JZ POLL\n"
+    "        DCR C\n"
+    "        JNZ POLL\n"
+    "        XRA A\n"
+    "        OUT 42h\n"
+    "        HLT\n",
+    // Spinning on a flag that the RST 7.5 timer handler sets
+    "        JMP START\n"
+    "        ORG 3Ch\n"
+    "        MVI A, 1\n"
+    "        STA FLAG\n"
+    "        EI\n"
+    "        RET\n"
+    "START:  LXI SP, 0F000h\n"
+    "        MVI A, 0Bh\n"
+    "        SIM\n"
+    "        XRA A\n"
+    "        OUT 40h\n"
+    "        MVI A, 30h\n"
+    "        OUT 41h\n"
+    "        MVI A, 03h\n"
+    "        OUT 42h\n"
+    "        MVI C, 8\n"
+    "WAIT:   XRA A\n"
+    "        STA FLAG\n"
+    "        EI\n"
+    "SPIN:   LDA FLAG\n"
+    "        ORA A\n"
+    "        JZ SPIN\n"
+    "        DCR C\n"
+    "        JNZ WAIT\n"
+    "        DI\n"
+    "        XRA A\n"
+    "        OUT 42h\n"
+    "        HLT\n"
+    "FLAG:   DB 0\n",
+    // Receiving five bytes from the UART by polling its status
+    "        LXI SP, 0F000h\n"
+    "        LXI H, 2000h\n"
+    "        MVI C, 5\n"
+    "POLL:   IN 51h\n"
+    "        ANI 01h\n"
+    "        JZ POLL\n"
+    "        IN 50h\n"
+    "        MOV M, A\n"
+    "        INX H\n"
+    "        DCR C\n"
+    "        JNZ POLL\n"
+    "        HLT\n",
+    // A poll left from its middle, a port that is never quiet and a loop
+    // that is neither shape
+    "        LXI SP, 0F000h\n"
+    "        XRA A\n"
+    "        OUT 40h\n"
+    "        MVI A, 20h\n"
+    "        OUT 41h\n"
+    "        MVI A, 01h\n"
+    "        OUT 42h\n"
+    "POLL:   IN 42h\n"
+    "        RRC\n"
+    "        JC DONE\n"
+    "        JMP POLL\n"
+    "DONE:   XRA A\n"
+    "        OUT 42h\n"
+    "COUNT:  IN 60h\n"
+    "        ANI 80h\n"
+    "        JZ COUNT\n"
+    "        MVI B, 0\n"
+    "UP:     INR B\n"
+    "        INR A\n"
+    "        JNZ UP\n"
+    "        HLT\n",
+};
+
+// Port 60h: reads 80h from the 300th read on
+struct ReadCounter {
+    uint32_t reads = 0;
+
+    static uint8_t read(void* context, uint8_t) {
+        ReadCounter& counter = *static_cast<ReadCounter*>(context);
+        return ++counter.reads >= 300 ? 0x80 : 0x00;
+    }
+};
+
+// Runs a loop program to its final HLT, in one run() or in random slices
+// and steps, and describes where it ended
+std::string runLoopProgram(const AssembledProgram& program, CPU8085::Engine engine, bool sliced,
+                           bool skipLoops, uint64_t& skipped) {
+    const uint64_t kLimit = 100000000;
+    CPU8085 cpu(engine);
+    cpu.setLoopSkipping(skipLoops);
+    IntervalTimer timer;
+    timer.attach(cpu, 0x40);
+    Uart uart(3.072e6, 9600);
+    uart.attach(cpu, 0x50);
+    uart.receive(reinterpret_cast<const uint8_t*>("8085!"), 5);
+    ReadCounter counter;
+    cpu.io.mapInput(0x60, ReadCounter::read, &counter);
+    program.loadInto(cpu);
+    cpu.PC = program.entryPoint();
+
+    uint32_t seed = 0x2085;
+    while (!cpu.stopped() && cpu.cycles < kLimit) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        if (!sliced) {
+            cpu.run(kLimit - cpu.cycles);
+        } else if (seed % 8 == 0) {
+            cpu.step();
+        } else {
+            cpu.run(seed % 50000 + 1);
+        }
+    }
+    skipped = cpu.skippedCycles();
+
+    uint32_t hash = 2166136261u;
+    for (uint32_t address = 0; address < 0x10000; address++) {
+        hash = (hash ^ cpu.getMemory(static_cast<uint16_t>(address))) * 16777619u;
+    }
+    std::ostringstream oss;
+    oss << stateOf(cpu) << " memory:" << std::hex << hash << std::dec << " expiries:" << timer.expiries
+        << " reads:" << counter.reads << (cpu.stopped() ? "" : " (did not finish)");
+    return oss.str();
+}
+
+} // namespace
+
+bool runLoopSkipCheck(std::ostream& log) {
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "loop skipping: " << what << "\n";
+        ok = false;
+    };
+
+    Assembler assembler;
+    AssembledProgram program;
+    int index = 0;
+    uint64_t total = 0, executed = 0;
+    for (const char* source : kLoopPrograms) {
+        std::string name = "program " + std::to_string(++index);
+        if (!assembler.assemble(source, program)) {
+            fail(name + ": " + program.errorText("source"));
+            continue;
+        }
+        uint64_t skipped = 0;
+        std::string expected = runLoopProgram(program, CPU8085::Engine::Switch, false, false, skipped);
+        for (CPU8085::Engine engine : allEngines()) {
+            std::string where = name + " on " + CPU8085::engineName(engine);
+            for (bool sliced : {false, true}) {
+                std::string result = runLoopProgram(program, engine, sliced, true, skipped);
+                if (result != expected) {
+                    fail(where + (sliced ? " in slices" : "") + " ended as " + result + ", stepping as " + expected);
+                }
+                if (skipped == 0) fail(where + (sliced ? " in slices" : "") + " skipped nothing");
+                total += skipped;
+            }
+        }
+        executed += std::stoull(expected.substr(expected.find("T:") + 2)) * allEngines().size() * 2;
+    }
+
+    log << "loop skipping: " << index << " delay and polling programs x " << allEngines().size()
+        << " engines, whole and sliced, " << (executed ? total * 100 / executed : 0) << "% of T-states skipped, "
+        << (ok ? "all as expected" : "MISMATCH") << "\n";
+    return ok;
+}
+
+namespace {
+
+// Whether the lane ended as cpu did, memory included
+bool sameLane(const LockstepCPU8085& lanes, size_t index, const CPU8085& cpu) {
+    LockstepCPU8085::Lane r = lanes.lane(index);
+    bool same = r.A == cpu.A && r.B == cpu.B && r.C == cpu.C && r.D == cpu.D && r.E == cpu.E &&
+                r.H == cpu.H && r.L == cpu.L && r.psw == cpu.flags.psw && r.SP == cpu.SP && r.PC == cpu.PC &&
+                r.cycles == cpu.cycles && (r.exit == LockstepCPU8085::Exit::Halted) == cpu.halted &&
+                r.interruptEnabled == cpu.interruptEnabled;
+    for (uint32_t address = 0; address < 0x10000 && same; address++) {
+        same = lanes.getMemory(index, static_cast<uint16_t>(address)) == cpu.memory.peek(static_cast<uint16_t>(address));
+    }
+    return same;
+}
+
+} // namespace
+
+bool runLockstepCheck(std::ostream& log) {
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "lockstep: " << what << "\n";
+        ok = false;
+    };
+    uint32_t seed = 0x8085;
+    auto random = [&]() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    };
+
+    // The lane workloads, at a lane count that leaves a partial chunk
+    for (const LockstepBenchmarkResult& r : runLockstepBenchmarks(1, "", 100)) {
+        if (!r.matched) fail(std::string(r.workload) + " lanes differ from CPU8085");
+    }
+
+    // Random memory runs every opcode, RIM/SIM, IN/OUT and EI/DI included,
+    // with lanes splitting up at every conditional. Each lane writes a few
+    // bytes of its own, some into the code ahead, and gets its own cycle
+    // limit (some 0), so lanes stop at different times and get regrouped.
+    const int kRounds = 8;
+    uint64_t regroups = 0, laneCount = 0;
+    CPU8085 cpu(CPU8085::Engine::Switch);
+    LockstepCPU8085 lanes;
+    for (int round = 0; round < kRounds; round++) {
+        std::vector<uint8_t> contents(0x10000);
+        for (uint8_t& byte : contents) {
+            byte = static_cast<uint8_t>(random());
+            if (byte == 0x76 && random() % 4) byte = 0x00;  // Fewer HLTs, longer runs
+        }
+        std::shared_ptr<const MemoryImage> image = std::make_shared<MemoryImage>(contents.data(), contents.size(), 0x0000);
+        uint16_t start = static_cast<uint16_t>(random());
+        size_t count = 1 + random() % 200;
+        lanes.setLanes(count);
+        lanes.setImage(image, start);
+
+        struct Poke {
+            uint16_t address;
+            uint8_t value;
+        };
+        std::vector<std::vector<Poke>> pokes(count);
+        std::vector<uint64_t> limits(count);
+        for (size_t lane = 0; lane < count; lane++) {
+            for (uint32_t k = random() % 4; k > 0; k--) {
+                uint16_t address = static_cast<uint16_t>(random() % 2 ? start + random() % 64 : random());
+                pokes[lane].push_back({address, static_cast<uint8_t>(random())});
+                lanes.setMemory(lane, address, pokes[lane].back().value);
+            }
+            limits[lane] = random() % 10 == 0 ? 0 : random() % 20000;
+            lanes.setCycleLimit(lane, limits[lane]);
+        }
+        lanes.run();
+        regroups += lanes.stats().regroups;
+        laneCount += count;
+
+        cpu.setMemoryImage(image);
+        for (size_t lane = 0; lane < count; lane++) {
+            cpu.reset();
+            cpu.PC = start;
+            for (const Poke& poke : pokes[lane]) cpu.setMemory(poke.address, poke.value);
+            while (!cpu.halted && cpu.cycles < limits[lane]) cpu.run(limits[lane] - cpu.cycles);
+            if (!sameLane(lanes, lane, cpu)) {
+                fail("random round " + std::to_string(round) + " lane " + std::to_string(lane) + " differs from CPU8085");
+            }
+        }
+    }
+    if (regroups == 0) fail("random rounds never regrouped lanes");
+
+    // Lanes that branched ahead of one spinning forever below them still get
+    // to their HLT before the time limit
+    {
+        std::vector<uint8_t> code(0x41, 0x00);
+        const uint8_t spinOrHalt[] = {0x3A, 0x00, 0x01,   // LDA 0100h
+                                      0xB7,               // ORA A
+                                      0xC2, 0x40, 0x00,   // JNZ 0040h
+                                      0xC3, 0x07, 0x00};  // JMP $
+        std::copy(std::begin(spinOrHalt), std::end(spinOrHalt), code.begin());
+        code[0x40] = 0x76;
+        const size_t kSpinLanes = 40;
+        LockstepCPU8085 spin(kSpinLanes);
+        spin.setImage(std::make_shared<MemoryImage>(code.data(), code.size(), 0x0000));
+        for (size_t lane = 1; lane < kSpinLanes; lane++) spin.setMemory(lane, 0x0100, 1);
+        spin.run(0.2);
+        bool starved = spin.lane(0).exit != LockstepCPU8085::Exit::TimeLimit;
+        for (size_t lane = 1; lane < kSpinLanes; lane++) {
+            starved = starved || spin.lane(lane).exit != LockstepCPU8085::Exit::Halted || spin.lane(lane).PC != 0x0041;
+        }
+        if (starved) fail("lanes ahead of a spinning lane did not halt before the time limit");
+    }
+
+    // Batch jobs on the lockstep core, in groups of 3 lanes, against the
+    // same jobs on CPU8085
+    std::vector<BatchImage> images;
+    for (const LaneWorkload& workload : laneWorkloads()) {
+        BatchImage image;
+        image.name = workload.name;
+        image.memory = std::make_shared<MemoryImage>(workload.program, workload.size, 0x0000);
+        images.push_back(image);
+    }
+    std::vector<BatchJob> jobs;
+    for (size_t w = 0; w < images.size(); w++) {
+        const LaneWorkload& workload = laneWorkloads()[w];
+        for (int variant = 0; variant < 8; variant++) {
+            BatchJob job;
+            job.image = &images[w];
+            BatchInput input;
+            input.address = workload.inputAddress;
+            for (size_t k = 0; k < workload.inputLength; k++) input.bytes.push_back(static_cast<uint8_t>(random()));
+            job.inputs.push_back(input);
+            if (variant == 7) job.limits.maxCycles = 5000;
+            jobs.push_back(job);
+        }
+    }
+    BatchOptions options;
+    options.threads = 2;
+    options.outputAddress = 0x1000;  // Every workload's output
+    options.outputLength = 0x102;
+    BatchRunner scalar(options);
+    scalar.run(jobs);
+    options.lockstep = true;
+    options.lanes = 3;
+    BatchRunner lockstep(options);
+    lockstep.run(jobs);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const BatchResult& a = scalar.results()[i];
+        const BatchResult& b = lockstep.results()[i];
+        bool same = a.cycles == b.cycles && a.SP == b.SP && a.PC == b.PC && a.A == b.A && a.B == b.B &&
+                    a.C == b.C && a.D == b.D && a.E == b.E && a.H == b.H && a.L == b.L && a.psw == b.psw &&
+                    a.exit == b.exit;
+        if (!same || std::memcmp(scalar.outputOf(i), lockstep.outputOf(i), options.outputLength) != 0) {
+            fail("batch job " + std::to_string(i) + " (" + jobs[i].image->name + ") differs from CPU8085");
+        }
+    }
+
+    log << "lockstep: " << laneWorkloads().size() << " lane workloads, " << laneCount << " random lanes ("
+        << regroups << " regroups) and " << jobs.size() << " batch jobs on the " << LockstepCPU8085::kernelName()
+        << " kernels, " << (ok ? "all match CPU8085" : "MISMATCH") << "\n";
+    return ok;
+}
+
+namespace {
+
+// Every CPU of a ring passes the round number to the next over a mailbox
+// and adds up what it gets from the previous (1 + 2 + ... + 50 = 251 mod
+// 256), posting the sum at 8000h + its number (at 0FFFh), which also sets
+// its delay in each round
+const char* const kRingNode =
+    "        LXI SP, 0F00h\n"
+    "        MVI C, 50\n"
+    "        MVI E, 0\n"
+    "ROUND:  MOV A, C\n"
+    "        OUT 10h\n"
+    "        LDA 0FFFh\n"
+    "        INR A\n"
+    "        MOV D, A\n"
+    "WORK:   DCR D\n"
+    "        JNZ WORK\n"
+    "WAIT:   IN 21h\n"
+    "        ANI 01h\n"
+    "        JZ WAIT\n"
+    "        IN 20h\n"
+    "        ADD E\n"
+    "        MOV E, A\n"
+    "        LDA 0FFFh\n"
+    "        MOV L, A\n"
+    "        MVI H, 80h\n"
+    "        MOV M, E\n"
+    "        DCR C\n"
+    "        JNZ ROUND\n"
+    "        HLT\n";
+
+// CPU 0 stores 55h at 8000h, then later mails A5h to CPU 1
+const char* const kMailSender =
+    "        LXI SP, 0F00h\n"
+    "        MVI A, 55h\n"
+    "        STA 8000h\n"
+    "        MVI B, 0\n"
+    "DLY:    DCR B\n"
+    "        JNZ DLY\n"
+    "        MVI A, 0A5h\n"
+    "        OUT 10h\n"
+    "        HLT\n";
+
+// CPU 1 stores 66h at 8000h in the same quantum, then sleeps until the
+// mail raises RST 6.5 and posts it at 8001h
+const char* const kMailReceiver =
+    "        LXI SP, 0F00h\n"
+    "        MVI A, 66h\n"
+    "        STA 8000h\n"
+    "        MVI A, 0Dh\n"
+    "        SIM\n"
+    "        EI\n"
+    "        HLT\n"
+    "        HLT\n"
+    "        ORG 34h\n"
+    "        IN 20h\n"
+    "        STA 8001h\n"
+    "        RET\n";
+
+// The program as the CPU's image, with byte 0FFFh set to number
+bool loadNode(CPU8085& cpu, const char* source, uint8_t number, std::string& error) {
+    Assembler assembler;
+    AssembledProgram program;
+    if (!assembler.assemble(source, program)) {
+        error = program.errorText("source");
+        return false;
+    }
+    cpu.setMemoryImage(nullptr);
+    program.loadInto(cpu);
+    cpu.setMemory(0x0FFF, number);
+    cpu.setMemoryImage(cpu.memory.snapshot());
+    return true;
+}
+
+std::string boardStateOf(const MultiCpuSystem& board) {
+    std::ostringstream oss;
+    for (size_t i = 0; i < board.cpuCount(); i++) oss << stateOf(board.cpu(i)) << "\n";
+    oss << std::hex;
+    for (uint16_t address = 0x8000; address < 0x8008; address++) oss << " " << int(board.getShared(address));
+    oss << std::dec << " quanta:" << board.quanta();
+    return oss.str();
+}
+
+} // namespace
+
+bool runMultiCpuCheck(std::ostream& log) {
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "multi-cpu: " << what << "\n";
+        ok = false;
+    };
+    std::string error;
+
+    // The ring on every thread count, with and without loop skipping and
+    // with run() in slices, ends as on one thread for each quantum
+    const size_t kRing = 4;
+    int runs = 0;
+    for (uint64_t quantum : {1ull, 97ull, 2000ull}) {
+        std::string expected;
+        for (unsigned threads : {1u, 2u, 4u}) {
+            for (int variant = 0; variant < 3; variant++) {
+                MultiCpuSystem board(kRing);
+                bool built = board.addSharedWindow(0x80, 1, error);
+                for (size_t i = 0; i < kRing && built; i++) {
+                    built = loadNode(board.cpu(i), kRingNode, static_cast<uint8_t>(i), error) &&
+                            board.addMailbox(i, 0x10, (i + 1) % kRing, 0x20, error);
+                    board.cpu(i).setLoopSkipping(variant == 1);
+                }
+                if (!built) {
+                    fail("ring: " + error);
+                    return false;
+                }
+                board.setQuantum(quantum);
+                board.setThreads(threads);
+                board.reset();
+                if (variant == 2) {
+                    while (!board.stopped()) board.run(777);
+                } else {
+                    board.run(100000000);
+                }
+                runs++;
+
+                std::string state = boardStateOf(board);
+                std::string where = "ring with quantum " + std::to_string(quantum) + " on " + std::to_string(threads) +
+                                    (threads == 1 ? " thread" : " threads") +
+                                    (variant == 1 ? " skipping loops" : variant == 2 ? " in slices" : "");
+                if (expected.empty()) {
+                    expected = state;
+                    for (size_t i = 0; i < kRing; i++) {
+                        const CPU8085& cpu = board.cpu(i);
+                        if (!cpu.halted || cpu.E != 0xFB || board.getShared(static_cast<uint16_t>(0x8000 + i)) != 0xFB) {
+                            fail(where + ": CPU " + std::to_string(i) + " ended as " + stateOf(cpu));
+                        }
+                    }
+                } else if (state != expected) {
+                    fail(where + " ended as\n" + state + "\ninstead of\n" + expected);
+                }
+            }
+        }
+    }
+
+    // A mailbox interrupt wakes a halted CPU at the next barrier, and of two
+    // stores to one shared byte in a quantum the higher-numbered CPU's wins
+    for (unsigned threads : {1u, 2u}) {
+        MultiCpuSystem board(2, CPU8085::Engine::Switch);
+        if (!loadNode(board.cpu(0), kMailSender, 0, error) || !loadNode(board.cpu(1), kMailReceiver, 1, error) ||
+            !board.addMailbox(0, 0x10, 1, 0x20, InterruptUnit::Rst65, error) ||
+            !board.addSharedWindow(0x80, 1, error)) {
+            fail("mailbox: " + error);
+            return false;
+        }
+        board.setQuantum(1000);
+        board.setThreads(threads);
+        board.reset();
+        board.run(1000000);
+        const CPU8085& receiver = board.cpu(1);
+        // The mail goes out after about 3600 T-states and lands at 4000, so
+        // the board stops at the barrier after that
+        bool woke = board.stopped() && board.cycles() == 5000 && receiver.halted && receiver.PC == 0x000E;
+        if (!woke || board.getShared(0x8000) != 0x66 || board.getShared(0x8001) != 0xA5) {
+            fail("mailbox on " + std::to_string(threads) + (threads == 1 ? " thread" : " threads") + " ended as\n" +
+                 boardStateOf(board));
+        }
+    }
+
+    // Configuration errors
+    MultiCpuSystem board(2);
+    if (!board.addSharedWindow(0x80, 2, error) || board.addSharedWindow(0x81, 1, error) ||
+        board.addSharedWindow(0xFF, 2, error)) {
+        fail("overlapping or oversized shared windows were not refused");
+    }
+    if (!board.addMailbox(0, 0x10, 1, 0x20, error) || board.addMailbox(1, 0x21, 0, 0x30, error) ||
+        board.addMailbox(0, 0x10, 1, 0x40, error) || board.addMailbox(0, 0x11, 2, 0x40, error)) {
+        fail("a mailbox on a port in use or a missing CPU was not refused");
+    }
+
+    log << "multi-cpu: " << runs << " ring runs over quanta, thread counts, loop skipping and slices, "
+        << "mailbox interrupts and shared stores, " << (ok ? "all as expected" : "MISMATCH") << "\n";
+    return ok;
+}
+
+bool runSuperoptCheck(std::ostream& log) {
+    bool ok = true;
+    auto fail = [&](const std::string& what) {
+        log << "superopt: " << what << "\n";
+        ok = false;
+    };
+    Assembler assembler;
+    AssembledProgram program;
+
+    // The light path: registers back, memory kept, the same as stepping
+    {
+        const char* source = "MVI A, 12h\nMOV B, A\nADI 0F0h\nINX H\nHLT\nMVI C, 1\n";
+        CPU8085 light(CPU8085::Engine::Switch), stepped(CPU8085::Engine::Switch);
+        if (!assembler.assemble(source, program)) {
+            fail(program.errorText("light path"));
+            return false;
+        }
+        program.loadInto(light);
+        program.loadInto(stepped);
+        light.A = light.H = 0x55;
+        light.cycles = 99;
+        light.resetRegisters();
+        bool clean = light.A == 0 && light.H == 0 && light.cycles == 0 && light.PC == 0 && light.getMemory(0x0000) == 0x3E;
+        uint64_t spent = light.executeCount(10);
+        while (!stepped.halted) stepped.step();
+        if (!clean || spent != stepped.cycles || stateOf(light) != stateOf(stepped)) {
+            fail("resetRegisters() and executeCount() ended as " + stateOf(light) + " instead of " + stateOf(stepped));
+        }
+    }
+
+    struct Case {
+        const char* source;
+        const char* live;
+        SuperoptCost cost;
+        const char* expected;  // Listing, nullptr for nothing cheaper
+        bool proven;           // Few enough inputs to try them all
+    };
+    const Case cases[] = {
+        {"MVI B, 0\nMVI C, 0\n", "BC", SuperoptCost::Bytes, "LXI B, 0000h\n", true},
+        {"MVI A, 0\n", "A", SuperoptCost::Bytes, "SUB A\n", true},
+        {"MVI A, 0\n", "A,Z", SuperoptCost::Bytes, nullptr, false},  // MVI keeps the flags
+        {"STC\nCMC\n", "A,CY", SuperoptCost::Cycles, "ANA A\n", true},
+        {"INX H\nDCX H\n", "HL,F", SuperoptCost::Bytes, "", true},
+        {"MOV A, L\nADD E\nMOV L, A\nMOV A, H\nADC D\nMOV H, A\n", "HL,CY", SuperoptCost::Bytes, "DAD D\n", false},
+        {"MVI H, 0\nMVI L, 0\nMVI D, 0\nMVI E, 0\n", "HL,DE", SuperoptCost::Bytes,
+         "LXI D, 0000h\nMOV H, D\nMOV L, D\n", true},
+    };
+    uint32_t seed = 0x5EED;
+    auto random = [&]() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return static_cast<uint8_t>(seed >> 24);
+    };
+    uint64_t candidates = 0;
+    for (const Case& c : cases) {
+        if (!assembler.assemble(c.source, program)) {
+            fail(program.errorText(c.source));
+            continue;
+        }
+        std::string error;
+        SuperoptOptions options;
+        options.cost = c.cost;
+        if (!parseLiveSet(c.live, options.liveRegisters, options.liveFlags, error)) {
+            fail(error);
+            continue;
+        }
+        std::string where = std::string("live ") + c.live + " of\n" + c.source;
+        SuperoptResult first;
+        for (unsigned threads : {1u, 4u}) {
+            options.threads = threads;
+            SuperoptResult result = superoptimize(program.bytes, options);
+            candidates += result.candidates;
+            bool expected = result.ok && (c.expected ? result.found && result.proven == c.proven && result.listing == c.expected
+                                                     : !result.found);
+            if (!expected) {
+                fail(where + "gave " + (result.ok ? result.found ? "\n" + result.listing : "nothing" : result.error));
+            } else if (threads != 1 && result.code != first.code) {
+                fail(where + "differs between thread counts");
+            }
+            if (threads == 1) first = result;
+        }
+        if (!first.found) continue;
+
+        // The ordinary path agrees on the live outputs
+        CPU8085 target(CPU8085::Engine::Switch), candidate(CPU8085::Engine::Switch);
+        uint8_t CPU8085::*fields[8] = {&CPU8085::B, &CPU8085::C, &CPU8085::D, &CPU8085::E,
+                                       &CPU8085::H, &CPU8085::L, nullptr,      &CPU8085::A};
+        for (int trial = 0; trial < 1000; trial++) {
+            target.reset();
+            candidate.reset();
+            target.loadProgram(program.bytes.data(), program.bytes.size());
+            candidate.loadProgram(first.code.data(), first.code.size());
+            for (uint8_t CPU8085::*field : fields) {
+                if (field) target.*field = candidate.*field = random();
+            }
+            target.flags.psw = candidate.flags.psw = (random() & CPU8085::Flags::ALL) | CPU8085::Flags::ALWAYS_ONE;
+            target.run(first.targetCycles);
+            candidate.run(first.cycles);
+            bool same = ((target.flags.psw ^ candidate.flags.psw) & options.liveFlags) == 0;
+            for (int r = 0; r < 8; r++) {
+                if (fields[r] && (options.liveRegisters & 1 << r)) same = same && target.*fields[r] == candidate.*fields[r];
+            }
+            if (!same) {
+                fail(where + "gave\n" + first.listing + "which ends as " + stateOf(candidate) + " instead of " +
+                     stateOf(target));
+                break;
+            }
+        }
+    }
+
+    // Targets outside the subset, and bad live sets
+    SuperoptOptions options;
+    std::string error;
+    for (const char* source : {"LDA 1234h\n", "PUSH B\n", "JMP 0\n", "MOV A, M\n"}) {
+        if (!assembler.assemble(source, program)) {
+            fail(program.errorText(source));
+            continue;
+        }
+        SuperoptResult result = superoptimize(program.bytes, options);
+        if (result.ok || result.error.empty()) fail(std::string("took ") + source);
+    }
+    uint8_t registers, flags;
+    if (parseLiveSet("A,Q", registers, flags, error) || parseLiveSet("", registers, flags, error) ||
+        !parseLiveSet("a,hl,cy", registers, flags, error) || registers != 0xB0 || flags != CPU8085::Flags::CARRY) {
+        fail("live sets parsed wrongly");
+    }
+
+    log << "superopt: " << std::size(cases) << " targets on 1 and 4 threads, " << candidates
+        << " candidates, " << (ok ? "all as expected" : "MISMATCH") << "\n";
+    return ok;
+}
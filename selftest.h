@@ -0,0 +1,126 @@
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include <ostream>
+
+// Runs every 8-bit ALU instruction (the ALU group on each register, M and
+// immediates, INR/DCR, the rotates, DAA, CMA, STC and CMC) on every engine
+// for every accumulator, operand and combination of the five flags, checking
+// the result, the PSW and the untouched registers against a table-based
+// model of the documented 8085 behavior. Opcodes are dealt out to threads
+// (0 = one per core). Mismatches are reported to log; returns true when
+// everything agrees.
+bool runAluConformanceCheck(std::ostream& log, unsigned threads = 0);
+
+// Assembles an instruction exerciser after the classic 8080 ones, which
+// sweeps every documented instruction but I/O, interrupt control and HLT
+// over random states and keeps a CRC-32 of the results per test, then runs
+// it on a reference interpreter of the documented instruction set and on
+// every engine, in parallel, checking that all CRCs agree.
+bool runExerciserCheck(std::ostream& log, unsigned threads = 0);
+
+// Runs the built-in benchmark workloads on every dispatch engine and checks
+// that registers, flags, T-states and memory end up identical, then checks a
+// self-modifying program and one moving every register to and from memory
+// on each engine.
+bool runEngineEquivalenceCheck(std::ostream& log);
+
+// Runs the workloads briefly on the JIT with lockstep verification, so every
+// compiled block is compared with the interpreter. Passes trivially without
+// a JIT.
+bool runJitVerifyCheck(std::ostream& log);
+
+// Runs the workloads and the self-modifying program on every engine with
+// paged copy-on-write memory over a shared image, twice with a reset in
+// between, and checks the results match flat memory and the image is untouched.
+bool runPagedMemoryCheck(std::ostream& log);
+
+// Drives the GUI's emulation thread: full-speed runs must match a direct
+// run, and Stop must take effect quickly both unpaced and at a slow clock.
+bool runEmulationThreadCheck(std::ostream& log);
+
+// Runs the workloads as batch jobs (with inputs and cycle limits) on several
+// threads and checks every result against a plain sequential run.
+bool runBatchCheck(std::ostream& log);
+
+// Runs the workloads on the policy specializations (instruction counter and
+// limit, breakpoints, tracing with port hooks) on every engine and checks
+// they stop where, and end up as, the plain core does.
+bool runPolicyCheck(std::ostream& log);
+
+// Runs programs driven by devices on every engine: HLT woken by timer
+// interrupts, the priority and masking of all five interrupt sources with
+// RIM/SIM, and a UART whose frames take their bit times.
+bool runDeviceCheck(std::ostream& log);
+
+// Runs a program against ROM and device pages on every engine: ROM ignores
+// its stores, device reads, writes and instruction fetches reach the
+// handlers, and an interrupt a device write raises is taken straight after it.
+bool runMemoryMapCheck(std::ostream& log);
+
+// Stops the workloads halfway on every engine and finishes them from a
+// fork(), from restoreState() (twice) and from a save state file, checking
+// each against an uninterrupted run. Also checks that files are refused
+// against the wrong base image or with another format version.
+bool runSaveStateCheck(std::ostream& log);
+
+// Runs the workloads on every engine with the undo log, rewinds them across
+// checkpoints, steps and runs back to a breakpoint, and checks each point
+// and each replay against plain runs stopped at the same instruction. Also
+// checks that a short history wraps and rewinds only as far as it holds.
+bool runReverseCheck(std::ostream& log);
+
+// Records binary traces of the workloads on every engine and checks they are
+// identical, that their stores rebuild memory and that the last record is
+// the final state. Also checks that the diff finds a truncated trace and a
+// single changed register where they are.
+bool runBinaryTraceCheck(std::ostream& log);
+
+// Profiles a program with nested calls and an RST on every engine and checks
+// the opcode counts, folded stacks and routine totals to the T-state, and
+// that an interrupt shows up as a call into its handler.
+bool runProfilerCheck(std::ostream& log);
+
+// Checks the condition parser, then runs a loop on every engine with
+// execution breakpoints (hit counts, conditions, one added to a block already
+// decoded), memory and port watchpoints and a tracepoint, checking where each
+// stops and that every engine reports the same hits.
+bool runBreakpointCheck(std::ostream& log);
+
+// Assembles every documented opcode, two workloads (checked against the
+// benchmark's bytes) and a source using each directive, expression form and
+// a macro; checks malformed lines are reported on their line numbers, that
+// HEX and binary output load back, and that parallel assembly matches.
+bool runAssemblerCheck(std::ostream& log);
+
+// Runs every opcode on every engine with random registers, flags and
+// operands, checking length, T-states (taken and not), where control goes and
+// which flags change against kOpcodes (opcodes.h). Also checks that each
+// opcode's disassembly assembles back to the same bytes.
+bool runOpcodeTableCheck(std::ostream& log);
+
+// Runs delay loops, timer, UART and memory-flag polling loops and loops the
+// skipper must leave alone on every engine with loop skipping, in one run()
+// and in random slices and steps, and checks each ends exactly as the
+// Switch engine does stepping through them, having skipped something.
+bool runLoopSkipCheck(std::ostream& log);
+
+// Runs the lane workloads, random memory with per-lane stores into the code
+// and per-lane cycle limits, and batch jobs on the lockstep core, checking
+// every lane's registers, cycles and memory against CPU8085 running it alone.
+bool runLockstepCheck(std::ostream& log);
+
+// Runs a ring of CPUs passing tokens over mailboxes on several thread
+// counts, quanta and run() slicings, with loop skipping on and off, checking
+// each ends exactly as on one thread; also a mailbox interrupt waking a
+// halted CPU, two CPUs storing to one shared byte, and bad configurations.
+bool runMultiCpuCheck(std::ostream& log);
+
+// Checks resetRegisters() leaves memory alone and executeCount() matches
+// step(); then superoptimizes short sequences with known cheaper forms on one
+// and four threads, checking each answer is the expected one, the same on
+// both and equal to the target on random states through the ordinary run()
+// path, and that targets outside the instruction subset are refused.
+bool runSuperoptCheck(std::ostream& log);
+
+#endif // SELFTEST_H
@@ -0,0 +1,516 @@
+#include "superopt.h"
+#include "cpu8085.h"
+#include "opcodes.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Flags = CPU8085Base::Flags;
+
+const int kA = 7;  // Register field of A
+const uint8_t kPairs[3] = {0x03, 0x0C, 0x30};  // BC, DE, HL as register masks
+const int kMaxLength = 8;
+// The target runs from here and candidates from kCandidate
+const uint16_t kTarget = 0x0000;
+const uint16_t kCandidate = 0x0100;
+// States a survivor is checked on when its inputs are too many to try all
+const uint64_t kSampleStates = 1 << 20;
+// First instructions are dealt out in about this many chunks per worker
+const size_t kChunksPerWorker = 8;
+
+struct Instruction {
+    uint8_t bytes[3];
+    uint8_t length;
+    uint8_t cycles;
+    uint8_t reads, writes;  // Registers, as SuperoptOptions::liveRegisters
+    uint8_t flagReads;      // PSW bits
+};
+
+// Fills in what the instruction at bytes reads and writes; false when it is
+// outside the subset superoptimize() searches
+bool describe(const uint8_t* bytes, Instruction& out) {
+    uint8_t op = bytes[0];
+    int high = (op >> 3) & 7, low = op & 7, pair = (op >> 4) & 3;
+    const OpcodeInfo& info = kOpcodes[op];
+    out = {{op, 0, 0}, info.length, info.cycles, 0, 0, 0};
+    for (int i = 1; i < info.length; i++) out.bytes[i] = bytes[i];
+
+    if (op >= 0x40 && op < 0x80) {
+        if (op == 0x76 || high == 6 || low == 6) return false;
+        out.reads = 1 << low;
+        out.writes = 1 << high;
+        return true;
+    }
+    if (op >= 0x80 && op < 0xC0) {
+        if (low == 6) return false;
+        out.reads = 1 << kA | 1 << low;
+        out.writes = high == 7 ? 0 : 1 << kA;  // CMP
+        out.flagReads = high == 1 || high == 3 ? Flags::CARRY : 0;  // ADC, SBB
+        return true;
+    }
+    if ((op & 0xC7) == 0xC6) {
+        out.reads = 1 << kA;
+        out.writes = high == 7 ? 0 : 1 << kA;  // CPI
+        out.flagReads = high == 1 || high == 3 ? Flags::CARRY : 0;  // ACI, SBI
+        return true;
+    }
+    if (op < 0x40 && (low == 4 || low == 5 || low == 6)) {
+        if (high == 6) return false;
+        out.reads = low == 6 ? 0 : 1 << high;  // MVI reads nothing
+        out.writes = 1 << high;
+        return true;
+    }
+    if (op < 0x40 && (low == 1 || low == 3)) {
+        if (pair == 3) return false;
+        switch (op & 0x0F) {
+            case 0x01: out.writes = kPairs[pair]; break;                        // LXI
+            case 0x03: case 0x0B: out.reads = out.writes = kPairs[pair]; break;  // INX, DCX
+            case 0x09: out.reads = kPairs[pair] | kPairs[2]; out.writes = kPairs[2]; break;  // DAD
+            default: return false;
+        }
+        return true;
+    }
+    switch (op) {
+        case 0x00: return true;  // NOP
+        case 0x07: case 0x0F: case 0x2F: out.reads = out.writes = 1 << kA; return true;  // RLC, RRC, CMA
+        case 0x17: case 0x1F: out.reads = out.writes = 1 << kA; out.flagReads = Flags::CARRY; return true;  // RAL, RAR
+        case 0x27: out.reads = out.writes = 1 << kA; out.flagReads = Flags::CARRY | Flags::AUX_CARRY; return true;  // DAA
+        case 0x37: return true;  // STC
+        case 0x3F: out.flagReads = Flags::CARRY; return true;  // CMC
+        case 0xEB: out.reads = out.writes = kPairs[1] | kPairs[2]; return true;  // XCHG
+    }
+    return false;
+}
+
+uint32_t costKey(SuperoptCost cost, int bytes, int cycles) {
+    return cost == SuperoptCost::Bytes ? static_cast<uint32_t>(bytes << 16 | cycles)
+                                       : static_cast<uint32_t>(cycles << 16 | bytes);
+}
+
+struct State {
+    uint8_t r[8];  // By register field, r[6] unused
+    uint8_t psw;
+};
+
+uint64_t nextRandom(uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+State randomState(uint64_t& seed) {
+    State state;
+    uint64_t bits = nextRandom(seed);
+    for (int i = 0; i < 8; i++) state.r[i] = static_cast<uint8_t>(bits >> (i * 8));
+    state.psw = static_cast<uint8_t>((nextRandom(seed) & Flags::ALL) | Flags::ALWAYS_ONE);
+    return state;
+}
+
+struct Range {
+    size_t first;
+    size_t last;  // Exclusive
+};
+
+// One worker's chunks. The owner takes from the back, thieves from the front.
+struct Queue {
+    std::mutex lock;
+    std::deque<Range> ranges;
+
+    bool pop(Range& range) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (ranges.empty()) return false;
+        range = ranges.back();
+        ranges.pop_back();
+        return true;
+    }
+
+    bool steal(Range& range) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (ranges.empty()) return false;
+        range = ranges.front();
+        ranges.pop_front();
+        return true;
+    }
+};
+
+// What every worker shares
+struct Search {
+    SuperoptOptions options;
+    std::vector<Instruction> target;
+    std::vector<Instruction> alphabet;
+    std::vector<int> live;  // Live register fields
+    uint8_t liveFlags;
+    std::vector<State> tests, expected;
+
+    // Candidates dearer than this are skipped; starts just below the target
+    std::atomic<uint32_t> bound;
+    std::mutex lock;
+    bool found = false;
+    std::vector<size_t> best;  // Alphabet indices
+    uint32_t bestKey = 0;
+    bool bestProven = false;
+
+    // Of equally cheap sequences the shortest, then the first in alphabet
+    // order wins, so the thread count makes no difference
+    void offer(const std::vector<size_t>& sequence, uint32_t key, bool proven) {
+        std::lock_guard<std::mutex> guard(lock);
+        bool better = !found || key < bestKey ||
+                      (key == bestKey && (sequence.size() < best.size() ||
+                                          (sequence.size() == best.size() && sequence < best)));
+        if (!better) return;
+        found = true;
+        best = sequence;
+        bestKey = key;
+        bestProven = proven;
+        bound.store(key, std::memory_order_relaxed);
+    }
+};
+
+class Worker {
+public:
+    explicit Worker(Search& search) : search(search), cpu(new CPU8085(CPU8085::Engine::Switch)) {
+        uint8_t* fields[8] = {&cpu->B, &cpu->C, &cpu->D, &cpu->E, &cpu->H, &cpu->L, nullptr, &cpu->A};
+        std::copy(fields, fields + 8, registers);
+        uint16_t address = kTarget;
+        for (const Instruction& ins : search.target) {
+            for (int i = 0; i < ins.length; i++) cpu->setMemory(address++, ins.bytes[i]);
+        }
+    }
+
+    void run(uint16_t address, int count, const State& in, State& out) {
+        cpu->resetRegisters();
+        for (int i = 0; i < 8; i++) {
+            if (registers[i]) *registers[i] = in.r[i];
+        }
+        cpu->flags.psw = in.psw;
+        cpu->PC = address;
+        cpu->executeCount(count);
+        for (int i = 0; i < 8; i++) out.r[i] = registers[i] ? *registers[i] : 0;
+        out.psw = cpu->flags.psw;
+    }
+
+    bool matches(const State& a, const State& b) const {
+        for (int r : search.live) {
+            if (a.r[r] != b.r[r]) return false;
+        }
+        return ((a.psw ^ b.psw) & search.liveFlags) == 0;
+    }
+
+    // Every candidate of the given length starting with one of the range
+    void searchFrom(const Range& range, size_t length) {
+        sequence.assign(length, 0);
+        for (size_t i = range.first; i < range.last; i++) visit(i, 0, kCandidate, 0, 0);
+    }
+
+    // The empty candidate
+    void tryEmpty() {
+        sequence.clear();
+        evaluate(0, 0);
+    }
+
+    uint64_t candidates = 0, survivors = 0, confirmed = 0;
+
+private:
+    Search& search;
+    std::unique_ptr<CPU8085> cpu;
+    uint8_t* registers[8];
+    std::vector<size_t> sequence;
+
+    void visit(size_t index, size_t depth, uint16_t address, int bytes, int cycles) {
+        const Instruction& ins = search.alphabet[index];
+        bytes += ins.length;
+        cycles += ins.cycles;
+        // Every instruction costs at least a byte and 4 T-states
+        int left = static_cast<int>(sequence.size() - depth - 1);
+        if (costKey(search.options.cost, bytes + left, cycles + 4 * left) > search.bound.load(std::memory_order_relaxed)) {
+            return;
+        }
+        sequence[depth] = index;
+        for (int i = 0; i < ins.length; i++) cpu->setMemory(static_cast<uint16_t>(address + i), ins.bytes[i]);
+        if (depth + 1 == sequence.size()) {
+            evaluate(bytes, cycles);
+            return;
+        }
+        for (size_t next = 0; next < search.alphabet.size(); next++) {
+            visit(next, depth + 1, static_cast<uint16_t>(address + ins.length), bytes, cycles);
+        }
+    }
+
+    void evaluate(int bytes, int cycles) {
+        candidates++;
+        int count = static_cast<int>(sequence.size());
+        State out;
+        for (size_t t = 0; t < search.tests.size(); t++) {
+            run(kCandidate, count, search.tests[t], out);
+            if (!matches(out, search.expected[t])) return;
+        }
+        survivors++;
+        bool proven;
+        if (!confirm(proven)) return;
+        confirmed++;
+        search.offer(sequence, costKey(search.options.cost, bytes, cycles), proven);
+    }
+
+    // Registers read before either sequence writes them, and live ones only
+    // one of them writes, with every flag either reads or keeps live.
+    // Outputs do not depend on anything else: a live register neither
+    // writes comes out as it went in.
+    bool confirm(bool& proven) {
+        uint8_t inputs = 0, targetWrites = 0, candidateWrites = 0;
+        uint8_t flagInputs = search.liveFlags;
+        for (const Instruction& ins : search.target) {
+            inputs |= ins.reads & ~targetWrites;
+            targetWrites |= ins.writes;
+            flagInputs |= ins.flagReads;
+        }
+        for (size_t index : sequence) {
+            const Instruction& ins = search.alphabet[index];
+            inputs |= ins.reads & ~candidateWrites;
+            candidateWrites |= ins.writes;
+            flagInputs |= ins.flagReads;
+        }
+        for (int r : search.live) {
+            if ((targetWrites ^ candidateWrites) & 1 << r) inputs |= 1 << r;
+        }
+
+        std::vector<int> fields;
+        for (int r = 0; r < 8; r++) {
+            if (inputs & 1 << r) fields.push_back(r);
+        }
+        std::vector<uint8_t> flagBits;
+        for (uint8_t bit = 1; bit; bit <<= 1) {
+            if (flagInputs & bit) flagBits.push_back(bit);
+        }
+        int bits = static_cast<int>(fields.size() * 8 + flagBits.size());
+        proven = bits <= kExhaustiveBits;
+
+        int targetCount = static_cast<int>(search.target.size());
+        int count = static_cast<int>(sequence.size());
+        uint64_t seed = search.options.seed ^ 0x9E3779B97F4A7C15ULL;
+        for (size_t index : sequence) seed = seed * 31 + index + 1;
+        uint64_t states = proven ? uint64_t(1) << bits : kSampleStates;
+        State in = {}, want, got;
+        in.psw = Flags::ALWAYS_ONE;
+        for (uint64_t n = 0; n < states; n++) {
+            if (proven) {
+                uint64_t value = n;
+                for (int r : fields) {
+                    in.r[r] = static_cast<uint8_t>(value);
+                    value >>= 8;
+                }
+                in.psw = Flags::ALWAYS_ONE;
+                for (uint8_t bit : flagBits) {
+                    if (value & 1) in.psw |= bit;
+                    value >>= 1;
+                }
+            } else {
+                in = randomState(seed);
+            }
+            run(kTarget, targetCount, in, want);
+            run(kCandidate, count, in, got);
+            if (!matches(want, got)) return false;
+        }
+        return true;
+    }
+};
+
+bool describeTarget(const std::vector<uint8_t>& code, std::vector<Instruction>& out, std::string& error) {
+    for (size_t offset = 0; offset < code.size();) {
+        uint8_t op = code[offset];
+        if (offset + kOpcodes[op].length > code.size()) {
+            error = "truncated instruction at offset " + std::to_string(offset);
+            return false;
+        }
+        Instruction ins;
+        if (!describe(&code[offset], ins)) {
+            char text[kDisassemblySize];
+            disassemble(&code[offset], text);
+            error = std::string(text) + " at offset " + std::to_string(offset) +
+                    " is outside the instructions the superoptimizer knows";
+            return false;
+        }
+        out.push_back(ins);
+        offset += ins.length;
+    }
+    return true;
+}
+
+void buildAlphabet(Search& search) {
+    std::vector<uint8_t> bytes = {0x00, 0x01, 0xFF};
+    std::vector<uint16_t> words = {0x0000, 0x0001, 0xFFFF};
+    for (const Instruction& ins : search.target) {
+        if (ins.length == 2) bytes.push_back(ins.bytes[1]);
+        if (ins.length == 3) words.push_back(static_cast<uint16_t>(ins.bytes[1] | ins.bytes[2] << 8));
+    }
+    std::sort(bytes.begin(), bytes.end());
+    bytes.erase(std::unique(bytes.begin(), bytes.end()), bytes.end());
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+
+    for (int op = 0; op < 256; op++) {
+        uint8_t code[3] = {static_cast<uint8_t>(op), 0, 0};
+        Instruction ins;
+        // NOP and MOV r,r change nothing
+        if (!describe(code, ins) || op == 0x00 || (op >= 0x40 && op < 0x80 && (op >> 3 & 7) == (op & 7))) continue;
+        if (ins.length == 1) {
+            search.alphabet.push_back(ins);
+        } else if (ins.length == 2) {
+            for (uint8_t value : bytes) {
+                ins.bytes[1] = value;
+                search.alphabet.push_back(ins);
+            }
+        } else {
+            for (uint16_t value : words) {
+                ins.bytes[1] = static_cast<uint8_t>(value);
+                ins.bytes[2] = static_cast<uint8_t>(value >> 8);
+                search.alphabet.push_back(ins);
+            }
+        }
+    }
+}
+
+} // namespace
+
+SuperoptResult superoptimize(const std::vector<uint8_t>& target, const SuperoptOptions& options) {
+    SuperoptResult result;
+    auto start = Clock::now();
+    if (target.empty() || target.size() > kCandidate - kTarget) {
+        result.error = "the target must be 1 to 256 bytes";
+        return result;
+    }
+    if (options.maxLength < 0 || options.maxLength > kMaxLength || options.tests < 1) {
+        result.error = "maxLength must be 0 to " + std::to_string(kMaxLength) + " and tests at least 1";
+        return result;
+    }
+    if (!(options.liveRegisters & 0xBF) && !(options.liveFlags & Flags::ALL)) {
+        result.error = "nothing is live";
+        return result;
+    }
+
+    Search search;
+    search.options = options;
+    if (!describeTarget(target, search.target, result.error)) return result;
+    buildAlphabet(search);
+    for (int r = 0; r < 8; r++) {
+        if (r != 6 && (options.liveRegisters & 1 << r)) search.live.push_back(r);
+    }
+    search.liveFlags = options.liveFlags & Flags::ALL;
+    for (const Instruction& ins : search.target) {
+        result.targetBytes += ins.length;
+        result.targetCycles += ins.cycles;
+    }
+    uint32_t targetKey = costKey(options.cost, result.targetBytes, result.targetCycles);
+    search.bound.store(targetKey - 1);
+
+    unsigned threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, search.alphabet.size())));
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (unsigned i = 0; i < threads; i++) workers.emplace_back(new Worker(search));
+
+    // Edge values first: all clear and all set catch most near misses
+    uint64_t seed = options.seed | 1;
+    for (int t = 0; t < options.tests; t++) {
+        State state = randomState(seed);
+        if (t < 2) {
+            std::fill(state.r, state.r + 8, t ? 0xFF : 0x00);
+            state.psw = t ? Flags::ALL | Flags::ALWAYS_ONE : Flags::ALWAYS_ONE;
+        }
+        State out;
+        workers[0]->run(kTarget, static_cast<int>(search.target.size()), state, out);
+        search.tests.push_back(state);
+        search.expected.push_back(out);
+    }
+
+    workers[0]->tryEmpty();
+    for (int length = 1; length <= options.maxLength; length++) {
+        // Nothing longer can beat what has been found
+        if (costKey(options.cost, length, 4 * length) > search.bound.load()) break;
+
+        std::vector<Queue> queues(threads);
+        size_t chunk = std::max<size_t>(1, search.alphabet.size() / (threads * kChunksPerWorker));
+        unsigned owner = 0;
+        for (size_t first = 0; first < search.alphabet.size(); first += chunk) {
+            queues[owner].ranges.push_back({first, std::min(first + chunk, search.alphabet.size())});
+            owner = (owner + 1) % threads;
+        }
+        auto work = [&](unsigned index) {
+            Range range;
+            for (;;) {
+                bool found = queues[index].pop(range);
+                for (unsigned k = 1; k < threads && !found; k++) {
+                    found = queues[(index + k) % threads].steal(range);
+                }
+                if (!found) return;
+                workers[index]->searchFrom(range, static_cast<size_t>(length));
+            }
+        };
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; i++) pool.emplace_back(work, i);
+        work(0);
+        for (std::thread& thread : pool) thread.join();
+    }
+
+    for (const std::unique_ptr<Worker>& worker : workers) {
+        result.candidates += worker->candidates;
+        result.survivors += worker->survivors;
+        result.confirmed += worker->confirmed;
+    }
+    result.ok = true;
+    result.found = search.found;
+    if (search.found) {
+        result.proven = search.bestProven;
+        for (size_t index : search.best) {
+            const Instruction& ins = search.alphabet[index];
+            result.code.insert(result.code.end(), ins.bytes, ins.bytes + ins.length);
+            result.bytes += ins.length;
+            result.cycles += ins.cycles;
+            char text[kDisassemblySize];
+            disassemble(ins.bytes, text);
+            result.listing += std::string(text) + "\n";
+        }
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return result;
+}
+
+bool parseLiveSet(const std::string& text, uint8_t& registers, uint8_t& flags, std::string& error) {
+    static const struct {
+        const char* name;
+        uint8_t registers;
+        uint8_t flags;
+    } names[] = {
+        {"A", 1 << kA, 0}, {"B", 0x01, 0}, {"C", 0x02, 0}, {"D", 0x04, 0}, {"E", 0x08, 0}, {"H", 0x10, 0},
+        {"L", 0x20, 0}, {"BC", 0x03, 0}, {"DE", 0x0C, 0}, {"HL", 0x30, 0},
+        {"S", 0, Flags::SIGN}, {"Z", 0, Flags::ZERO}, {"AC", 0, Flags::AUX_CARRY}, {"P", 0, Flags::PARITY},
+        {"CY", 0, Flags::CARRY}, {"F", 0, Flags::ALL},
+    };
+    registers = flags = 0;
+    size_t begin = 0;
+    while (begin <= text.size()) {
+        size_t end = std::min(text.find(',', begin), text.size());
+        std::string name = text.substr(begin, end - begin);
+        for (char& c : name) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        bool known = false;
+        for (const auto& entry : names) {
+            if (name != entry.name) continue;
+            registers |= entry.registers;
+            flags |= entry.flags;
+            known = true;
+        }
+        if (!known) {
+            error = "unknown register or flag '" + name + "'";
+            return false;
+        }
+        begin = end + 1;
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef SUPEROPT_H
+#define SUPEROPT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Superoptimizer: searches for the cheapest instruction sequence that leaves
+// the live registers and flags as a target sequence does.
+//
+// Candidates are every sequence of up to maxLength instructions from the
+// straight-line register subset of the 8085: MOV, MVI, LXI, INR, DCR, INX,
+// DCX and DAD on B, C, D, E, H, L and A, the ALU group with registers and
+// immediates, the rotates, DAA, CMA, STC, CMC and XCHG. Immediates come from
+// the target plus 00h, 01h and FFh (0000h, 0001h and FFFFh for LXI). The
+// target must keep to the same subset.
+//
+// Each candidate first runs on a batch of random states and is dropped at
+// the first one where a live output differs from the target's. Survivors
+// are then run on every combination of the inputs either sequence reads,
+// or on a large random sample when there are more than kExhaustiveBits
+// bits of them. Both run on CPU8085 through resetRegisters() and
+// executeCount(), which touch no memory beyond the code and allocate nothing.
+//
+// The first instructions of each length are dealt out to the threads,
+// which steal from each other once their own share is done. The result
+// does not depend on the thread count.
+
+enum class SuperoptCost : uint8_t {
+    Bytes,   // Then T-states
+    Cycles,  // Then bytes
+};
+
+struct SuperoptOptions {
+    int maxLength = 3;      // Instructions in a candidate
+    SuperoptCost cost = SuperoptCost::Bytes;
+    unsigned threads = 0;   // 0 = one per core
+    // Registers by opcode field: B C D E H L - A (bit 6 unused)
+    uint8_t liveRegisters = 0x80;
+    uint8_t liveFlags = 0;  // PSW bits (CPU8085Base::Flags masks)
+    int tests = 32;         // Random states in the quick filter
+    uint64_t seed = 0x8085;
+};
+
+struct SuperoptResult {
+    bool ok = false;
+    std::string error;
+    bool found = false;          // A sequence cheaper than the target
+    std::vector<uint8_t> code;   // The cheapest one found
+    std::string listing;         // Its disassembly, one instruction per line
+    int bytes = 0, cycles = 0;
+    int targetBytes = 0, targetCycles = 0;
+    // Confirmed on every combination of its inputs, not just a sample
+    bool proven = false;
+    uint64_t candidates = 0;     // Sequences tried
+    uint64_t survivors = 0;      // Passed the quick filter
+    uint64_t confirmed = 0;      // Then passed the full check
+    double seconds = 0.0;
+};
+
+// Inputs past this many bits are checked on a random sample instead
+const int kExhaustiveBits = 24;
+
+SuperoptResult superoptimize(const std::vector<uint8_t>& target, const SuperoptOptions& options);
+
+// Live outputs from a list like "A,HL,CY": registers A B C D E H L, pairs
+// BC DE HL, flags S Z AC P CY and F for all of them
+bool parseLiveSet(const std::string& text, uint8_t& registers, uint8_t& flags, std::string& error);
+
+#endif // SUPEROPT_H
@@ -0,0 +1,140 @@
+// Reads binary traces written by 8085_cli --trace-bin: renders ranges as text
+// and finds where two traces diverge, streaming so any length works
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include "binarytrace.h"
+
+namespace {
+
+void printUsage(const char* argv0) {
+    std::cerr
+        << "Usage: " << argv0 << " show TRACE [--from N] [--count N]\n"
+        << "       " << argv0 << " diff TRACE1 TRACE2 [--context N]\n"
+        << "       " << argv0 << " info TRACE\n"
+        << "\n"
+        << "  show     print records as text (default: all of them)\n"
+        << "  diff     report the first record where the traces differ, with the\n"
+        << "           N records before it (default 5); exits 1 if they differ\n"
+        << "  info     print the number of records and the final T-state count\n";
+}
+
+bool parseCount(const std::string& text, uint64_t& value) {
+    char* end = nullptr;
+    value = std::strtoull(text.c_str(), &end, 0);
+    return !text.empty() && end && *end == '\0';
+}
+
+bool openTrace(TraceReader& reader, const std::string& path) {
+    std::string error;
+    if (reader.open(path, error)) return true;
+    std::cerr << "error: " << error << "\n";
+    return false;
+}
+
+// Prints records [from, from + count) of the trace, prefixed with prefix
+void printRange(TraceReader& reader, uint64_t from, uint64_t count, const char* prefix) {
+    const size_t kChunk = 4096;
+    std::vector<TraceRecord> records(kChunk);
+    char line[kTraceLineSize];
+    if (from >= reader.size() || !reader.seek(from)) return;
+    count = std::min(count, reader.size() - from);
+    while (count > 0) {
+        size_t got = reader.read(records.data(), static_cast<size_t>(std::min<uint64_t>(count, kChunk)));
+        if (got == 0) break;
+        for (size_t i = 0; i < got; i++) {
+            formatTraceRecord(records[i], from + i, line);
+            std::cout << prefix << line << "\n";
+        }
+        from += got;
+        count -= got;
+    }
+}
+
+int show(TraceReader& reader, uint64_t from, uint64_t count) {
+    if (from > reader.size()) {
+        std::cerr << "error: the trace has only " << reader.size() << " records\n";
+        return 2;
+    }
+    printRange(reader, from, count, "");
+    return 0;
+}
+
+int diff(TraceReader& a, TraceReader& b, const std::string& nameA, const std::string& nameB, uint64_t context) {
+    TraceDivergence divergence = findTraceDivergence(a, b);
+    if (!divergence.diverged) {
+        std::cout << "identical: " << a.size() << " records\n";
+        return 0;
+    }
+    uint64_t index = divergence.index;
+    uint64_t from = index - std::min(index, context);
+    printRange(a, from, index - from, "  ");
+    if (divergence.lengthOnly) {
+        const std::string& longer = a.size() > b.size() ? nameA : nameB;
+        const std::string& shorter = a.size() > b.size() ? nameB : nameA;
+        std::cout << shorter << " ends after " << index << " records; " << longer << " goes on:\n";
+        printRange(a.size() > b.size() ? a : b, index, 1, "+ ");
+        return 1;
+    }
+    TraceRecord left, right;
+    a.seek(index);
+    b.seek(index);
+    a.read(&left, 1);
+    b.read(&right, 1);
+    std::cout << "first divergence at record " << index << " (" << traceDifferences(left, right) << "):\n";
+    printRange(a, index, 1, "< ");
+    printRange(b, index, 1, "> ");
+    return 1;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> files;
+    uint64_t from = 0, count = UINT64_MAX, context = 5;
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return 2;
+    }
+    std::string command = argv[1];
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        uint64_t* value = arg == "--from" ? &from : arg == "--count" ? &count : arg == "--context" ? &context : nullptr;
+        if (value) {
+            if (i + 1 >= argc || !parseCount(argv[++i], *value)) {
+                std::cerr << "error: missing or invalid value for " << arg << "\n";
+                return 2;
+            }
+        } else if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "error: unknown option " << arg << "\n";
+            return 2;
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    TraceReader first, second;
+    if (command == "show" && files.size() == 1) {
+        return openTrace(first, files[0]) ? show(first, from, count) : 2;
+    } else if (command == "diff" && files.size() == 2) {
+        if (!openTrace(first, files[0]) || !openTrace(second, files[1])) return 2;
+        return diff(first, second, files[0], files[1], context);
+    } else if (command == "info" && files.size() == 1) {
+        if (!openTrace(first, files[0])) return 2;
+        std::cout << first.size() << " records";
+        TraceRecord last;
+        if (first.size() && first.seek(first.size() - 1) && first.read(&last, 1)) {
+            std::cout << ", " << last.cycles << " T-states";
+        }
+        std::cout << "\n";
+        return 0;
+    }
+    printUsage(argv[0]);
+    return 2;
+}
@@ -0,0 +1,16 @@
+#include "undolog.h"
+
+void UndoLog::clearUndo() {
+    frameHead = frameTail = 0;
+    writeHead = 0;
+    checkpoints.clear();
+}
+
+void UndoLog::dropOldest() {
+    frameTail++;
+    while (!checkpoints.empty() && checkpoints.front().index < frameTail) checkpoints.pop_front();
+}
+
+void UndoLog::dropCheckpointsAfter(uint64_t index) {
+    while (!checkpoints.empty() && checkpoints.back().index > index) checkpoints.pop_back();
+}
@@ -0,0 +1,242 @@
+#ifndef UNDOLOG_H
+#define UNDOLOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <type_traits>
+#include <vector>
+#include "breakpoints.h"
+#include "cpupolicy.h"
+#include "savestate.h"
+
+// Reverse execution, as a core policy. Before every instruction the log
+// records the registers, flags, halt and interrupt state ("frame"), and every
+// store records the byte it overwrites. Both go into bounded rings holding
+// the last undoHistory instructions. Every kCheckpointInterval instructions a
+// full SaveState is kept too, so rewind() can jump a long way back by
+// restoring the nearest later checkpoint and only undoing the instructions
+// after the target.
+//
+// Only the CPU and memory go back: devices, pending events and interrupt line
+// levels stay as they are. Host writes (setMemory(), loaders) are not logged,
+// so clear the log after making them; a reset() is noticed (the T-state count
+// goes backwards) and clears it.
+//
+// Stepping back is done with the free functions below the class.
+class UndoLog : public CpuPolicy {
+public:
+    static constexpr bool kInstructionHooks = true;
+    static constexpr bool kStoreHooks = true;
+    static const uint64_t kCheckpointInterval = 1 << 16;
+
+    bool undoRecording = true;  // When false the hooks do nothing; the log is kept
+    size_t undoHistory = 1 << 20;  // Instructions kept; a change clears the log
+
+    // Instructions that can be stepped back
+    uint64_t undoDepth() const { return frameHead - frameTail; }
+    void clearUndo();
+
+    template <class Cpu> bool beforeInstruction(Cpu& cpu);
+    template <class Cpu> void onStore(Cpu& cpu, uint16_t address, uint8_t) {
+        if (!undoRecording || frameHead == frameTail) return;
+        writes[writeHead % writes.size()] = {address, cpu.memory.peek(address)};
+        writeHead++;
+        // The oldest instructions go once their stores are overwritten
+        while (frameTail < frameHead && frame(frameTail).firstWrite + writes.size() < writeHead) dropOldest();
+    }
+
+private:
+    template <class Cpu> friend bool stepBack(Cpu& cpu);
+    template <class Cpu> friend uint64_t rewind(Cpu& cpu, uint64_t count);
+    template <class Cpu> friend uint64_t runBack(Cpu& cpu);
+
+    struct Frame {
+        uint64_t cycles;
+        uint64_t firstWrite;  // Index of this instruction's first store
+        uint16_t SP, PC;
+        uint8_t A, B, C, D, E, H, L, psw;
+        uint8_t status;  // See save()
+    };
+    struct Write {
+        uint16_t address;
+        uint8_t value;  // Before the store
+    };
+    struct Checkpoint {
+        uint64_t index;  // Frame the state was taken before
+        SaveState state;
+    };
+
+    // Monotonic indices; a ring slot is index % size
+    std::vector<Frame> frames;
+    std::vector<Write> writes;
+    uint64_t frameHead = 0, frameTail = 0;
+    uint64_t writeHead = 0;
+    std::deque<Checkpoint> checkpoints;
+
+    Frame& frame(uint64_t index) { return frames[index % frames.size()]; }
+    void dropOldest();
+    void dropCheckpointsAfter(uint64_t index);
+    // Drops a frame left by an instruction that a stop kept from running
+    template <class Cpu> void dropUnexecuted(const Cpu& cpu);
+    template <class Cpu> void save(const Cpu& cpu, Frame& f) const;
+    template <class Cpu> void load(Cpu& cpu, const Frame& f) const;
+    // Undoes the newest frame
+    template <class Cpu> void undo(Cpu& cpu);
+    template <class Cpu> void restoreCheckpoint(Cpu& cpu, const Checkpoint& checkpoint);
+};
+
+// Undoes the last instruction; false when the log is empty
+template <class Cpu> bool stepBack(Cpu& cpu);
+// Undoes up to count instructions, using a checkpoint for long jumps;
+// returns how many were undone
+template <class Cpu> uint64_t rewind(Cpu& cpu, uint64_t count);
+// Goes back to the latest earlier instruction whose address has an execution
+// breakpoint (when the core has the Breakpoints policy; conditions and hit
+// counts are not looked at), or as far as the log reaches;
+// returns the instructions undone
+template <class Cpu> uint64_t runBack(Cpu& cpu);
+
+template <class Cpu>
+bool UndoLog::beforeInstruction(Cpu& cpu) {
+    if (!undoRecording) return true;
+    if (frames.size() != std::max<size_t>(undoHistory, 1)) {
+        frames.assign(std::max<size_t>(undoHistory, 1), Frame());
+        writes.assign(std::max<size_t>(undoHistory, 16), Write());
+        clearUndo();
+    }
+    if (frameHead != frameTail && cpu.cycles < frame(frameHead - 1).cycles) clearUndo();
+    dropUnexecuted(cpu);
+
+    if (frameHead - frameTail == frames.size()) dropOldest();
+    uint64_t index = frameHead++;
+    Frame& f = frame(index);
+    save(cpu, f);
+    f.firstWrite = writeHead;
+    if (index % kCheckpointInterval == 0 && (checkpoints.empty() || checkpoints.back().index != index)) {
+        checkpoints.push_back({index, cpu.saveState()});
+    }
+    return true;
+}
+
+template <class Cpu>
+void UndoLog::dropUnexecuted(const Cpu& cpu) {
+    if (frameHead == frameTail) return;
+    const Frame& top = frame(frameHead - 1);
+    if (top.cycles == cpu.cycles && top.firstWrite == writeHead) frameHead--;
+}
+
+template <class Cpu>
+void UndoLog::save(const Cpu& cpu, Frame& f) const {
+    f.cycles = cpu.cycles;
+    f.SP = cpu.SP;
+    f.PC = cpu.PC;
+    f.A = cpu.A; f.B = cpu.B; f.C = cpu.C; f.D = cpu.D;
+    f.E = cpu.E; f.H = cpu.H; f.L = cpu.L;
+    f.psw = cpu.flags.psw;
+    // Bits: 0 halted, 1 IE, 2 EI delay, 3 RST 7.5 latch, 4 TRAP armed, 5-7 SIM masks
+    f.status = static_cast<uint8_t>(cpu.halted | (cpu.interruptEnabled << 1) | (cpu.enableDelay << 2) |
+                                    (cpu.interrupts.rst75Latch << 3) | (cpu.interrupts.trapArmed << 4) |
+                                    (cpu.interrupts.masks << 5));
+}
+
+template <class Cpu>
+void UndoLog::load(Cpu& cpu, const Frame& f) const {
+    cpu.cycles = f.cycles;
+    cpu.SP = f.SP;
+    cpu.PC = f.PC;
+    cpu.A = f.A; cpu.B = f.B; cpu.C = f.C; cpu.D = f.D;
+    cpu.E = f.E; cpu.H = f.H; cpu.L = f.L;
+    cpu.flags.psw = f.psw;
+    cpu.halted = f.status & 0x01;
+    cpu.interruptEnabled = f.status & 0x02;
+    cpu.enableDelay = f.status & 0x04;
+    cpu.interrupts.rst75Latch = f.status & 0x08;
+    cpu.interrupts.trapArmed = f.status & 0x10;
+    cpu.interrupts.masks = f.status >> 5;
+}
+
+template <class Cpu>
+void UndoLog::undo(Cpu& cpu) {
+    const Frame& f = frame(frameHead - 1);
+    while (writeHead > f.firstWrite) {
+        const Write& w = writes[--writeHead % writes.size()];
+        cpu.setMemory(w.address, w.value);
+    }
+    load(cpu, f);
+    frameHead--;
+    dropCheckpointsAfter(frameHead);
+}
+
+template <class Cpu>
+void UndoLog::restoreCheckpoint(Cpu& cpu, const Checkpoint& checkpoint) {
+    static const uint8_t zeros[GuestMemory::kPageSize] = {};
+    const SaveState& s = checkpoint.state;
+    for (int page = 0; page < GuestMemory::kPageCount; page++) {
+        const uint8_t* want = s.memory->page(static_cast<uint8_t>(page));
+        if (!want) want = zeros;
+        const uint8_t* have = cpu.memory.page(static_cast<uint8_t>(page));
+        if (std::memcmp(have, want, GuestMemory::kPageSize) == 0) continue;
+        for (int offset = 0; offset < GuestMemory::kPageSize; offset++) {
+            if (have[offset] != want[offset]) cpu.setMemory(static_cast<uint16_t>(page * 256 + offset), want[offset]);
+        }
+    }
+    Frame f;
+    f.cycles = s.cycles;
+    f.SP = s.SP;
+    f.PC = s.PC;
+    f.A = s.A; f.B = s.B; f.C = s.C; f.D = s.D;
+    f.E = s.E; f.H = s.H; f.L = s.L;
+    f.psw = s.psw;
+    f.status = static_cast<uint8_t>(s.halted | (s.interruptEnabled << 1) | (s.enableDelay << 2) |
+                                    (s.interrupts.rst75Latch << 3) | (s.interrupts.trapArmed << 4) |
+                                    (s.interrupts.masks << 5));
+    load(cpu, f);
+    writeHead = frame(checkpoint.index).firstWrite;
+    frameHead = checkpoint.index;
+    dropCheckpointsAfter(frameHead);
+}
+
+template <class Cpu>
+bool stepBack(Cpu& cpu) {
+    UndoLog& log = cpu;
+    log.dropUnexecuted(cpu);
+    if (log.frameHead == log.frameTail) return false;
+    log.undo(cpu);
+    return true;
+}
+
+template <class Cpu>
+uint64_t rewind(Cpu& cpu, uint64_t count) {
+    UndoLog& log = cpu;
+    log.dropUnexecuted(cpu);
+    uint64_t start = log.frameHead;
+    uint64_t target = start - std::min(count, log.undoDepth());
+    // The earliest checkpoint at or after the target saves undoing everything after it
+    for (const UndoLog::Checkpoint& checkpoint : log.checkpoints) {
+        if (checkpoint.index >= target && checkpoint.index < start) {
+            log.restoreCheckpoint(cpu, checkpoint);
+            break;
+        }
+    }
+    while (log.frameHead > target) log.undo(cpu);
+    return start - target;
+}
+
+template <class Cpu>
+uint64_t runBack(Cpu& cpu) {
+    UndoLog& log = cpu;
+    log.dropUnexecuted(cpu);
+    if (log.frameHead == log.frameTail) return 0;
+    uint64_t index = log.frameHead - 1;
+    if constexpr (std::is_base_of<Breakpoints, Cpu>::value) {
+        while (index > log.frameTail && !cpu.breakpointAt(log.frame(index).PC)) index--;
+    } else {
+        index = log.frameTail;
+    }
+    return rewind(cpu, log.frameHead - index);
+}
+
+#endif // UNDOLOG_H